@@ -144,6 +144,7 @@ void show_conn_flags(unsigned int f)
 	SHOW_FLAG(f, CO_FL_XPRT_WR_ENA);
 	SHOW_FLAG(f, CO_FL_CURR_RD_ENA);
 	SHOW_FLAG(f, CO_FL_XPRT_RD_ENA);
+	SHOW_FLAG(f, CO_FL_IDLE_TOREMOVE);
 
 	if (f) {
 		printf("EXTRA(0x%08x)", f);
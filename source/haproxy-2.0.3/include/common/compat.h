@@ -104,6 +104,9 @@ typedef struct { } empty_t;
 #ifndef F_SETPIPE_SZ
 #define F_SETPIPE_SZ (1024 + 7)
 #endif
+#ifndef F_GETPIPE_SZ
+#define F_GETPIPE_SZ (1024 + 8)
+#endif
 
 /* On FreeBSD we don't have SI_TKILL but SI_LWP instead */
 #if !defined(SI_TKILL) && defined(SI_LWP)
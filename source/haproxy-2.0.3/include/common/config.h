@@ -58,6 +58,17 @@
 #endif
 #endif
 
+/* With USE_POOL_SLABS, pools carve their objects from large aligned slabs
+ * instead of calling malloc() for each of them. This isn't supported with the
+ * use-after-free detector, which needs one mapping per object.
+ */
+#if defined(USE_POOL_SLABS) && !defined(DEBUG_UAF)
+#define CONFIG_HAP_POOL_SLABS
+#ifndef CONFIG_HAP_POOL_SLAB_SIZE
+#define CONFIG_HAP_POOL_SLAB_SIZE 2097152
+#endif
+#endif
+
 /* CONFIG_HAP_INLINE_FD_SET
  * This makes use of inline FD_* macros instead of calling equivalent
  * functions. Benchmarks on a Pentium-M show that using functions is
@@ -340,4 +340,15 @@
 #define DEFAULT_PAT_LRU_SIZE 10000
 #endif
 
+/* Number of shards each stick table is split into. Each shard has its own
+ * lock, so this bounds how many threads may work on a table at once.
+ */
+#ifndef STKTABLE_SHARDS
+#ifdef USE_THREAD
+#define STKTABLE_SHARDS 16
+#else
+#define STKTABLE_SHARDS 1
+#endif
+#endif
+
 #endif /* _COMMON_DEFAULTS_H */
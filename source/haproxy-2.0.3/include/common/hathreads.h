@@ -530,7 +530,6 @@ static inline unsigned long thread_isolated()
 /* WARNING!!! if you update this enum, please also keep lock_label() up to date below */
 enum lock_label {
 	FD_LOCK,
-	TASK_RQ_LOCK,
 	TASK_WQ_LOCK,
 	POOL_LOCK,
 	LISTENER_LOCK,
@@ -539,6 +538,7 @@ enum lock_label {
 	LBPRM_LOCK,
 	SIGNALS_LOCK,
 	STK_TABLE_LOCK,
+	STK_TABLE_UPDT_LOCK,
 	STK_SESS_LOCK,
 	APPLETS_LOCK,
 	PEER_LOCK,
@@ -562,6 +562,7 @@ enum lock_label {
 	AUTH_LOCK,
 	LOGSRV_LOCK,
 	DICT_LOCK,
+	URING_LOCK,
 	OTHER_LOCK,
 	LOCK_LABELS
 };
@@ -647,7 +648,6 @@ static inline const char *lock_label(enum lock_label label)
 {
 	switch (label) {
 	case FD_LOCK:              return "FD";
-	case TASK_RQ_LOCK:         return "TASK_RQ";
 	case TASK_WQ_LOCK:         return "TASK_WQ";
 	case POOL_LOCK:            return "POOL";
 	case LISTENER_LOCK:        return "LISTENER";
@@ -656,6 +656,7 @@ static inline const char *lock_label(enum lock_label label)
 	case LBPRM_LOCK:           return "LBPRM";
 	case SIGNALS_LOCK:         return "SIGNALS";
 	case STK_TABLE_LOCK:       return "STK_TABLE";
+	case STK_TABLE_UPDT_LOCK:  return "STK_TABLE_UPDT";
 	case STK_SESS_LOCK:        return "STK_SESS";
 	case APPLETS_LOCK:         return "APPLETS";
 	case PEER_LOCK:            return "PEER";
@@ -679,6 +680,7 @@ static inline const char *lock_label(enum lock_label label)
 	case AUTH_LOCK:            return "AUTH";
 	case LOGSRV_LOCK:          return "LOGSRV";
 	case DICT_LOCK:            return "DICT";
+	case URING_LOCK:           return "URING";
 	case OTHER_LOCK:           return "OTHER";
 	case LOCK_LABELS:          break; /* keep compiler happy */
 	};
@@ -40,6 +40,7 @@
 #define MEM_F_SHARED	0
 #endif
 #define MEM_F_EXACT	0x2
+#define MEM_F_SLAB	0x4	/* objects are carved from slabs (internal) */
 
 /* reserve an extra void* at the end of a pool for linking */
 #ifdef DEBUG_MEMORY_POOLS
@@ -67,6 +68,20 @@ extern struct pool_cache_head pool_cache[][MAX_BASE_POOLS];
 extern THREAD_LOCAL size_t pool_cache_bytes;   /* total cache size */
 extern THREAD_LOCAL size_t pool_cache_count;   /* #cache objects   */
 
+#ifdef CONFIG_HAP_POOL_SLABS
+/* A slab is a CONFIG_HAP_POOL_SLAB_SIZE area aligned on its size, starting
+ * with this header, followed by the objects it is carved into. The slab of
+ * an object is thus found by masking its address. Objects are carved in
+ * order, and those given back are chained through their first word.
+ */
+struct pool_slab {
+	struct list list;	/* attach point in the pool's slab lists */
+	void *free;		/* objects given back to this slab */
+	unsigned int carved;	/* objects carved so far */
+	unsigned int used;	/* objects currently owned by the pool */
+};
+#endif
+
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
 struct pool_free_list {
 	void **free_list;
@@ -91,6 +106,15 @@ struct pool_head {
 	unsigned int failed;	/* failed allocations */
 	struct list list;	/* list of all known pools */
 	char name[12];		/* name of the pool */
+#ifdef CONFIG_HAP_POOL_SLABS
+	__decl_hathreads(HA_SPINLOCK_T slab_lock); /* protects the slab lists */
+	struct list partial;	/* slabs with objects left to carve or given back */
+	struct list full;	/* slabs whose objects are all owned by the pool */
+	struct list empty;	/* slabs given back to the OS, kept for reuse */
+	unsigned int per_slab;	/* number of objects in a slab */
+	unsigned int slabs;	/* number of slabs mapped */
+	unsigned int empty_slabs; /* number of those in the empty list */
+#endif
 } __attribute__((aligned(64)));
 
 
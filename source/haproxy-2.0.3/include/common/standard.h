@@ -997,6 +997,24 @@ static inline unsigned int __full_hash(unsigned int a)
 	return a * 3221225473U;
 }
 
+/* state of the per-thread generator used by ha_random32() */
+extern THREAD_LOCAL unsigned int ha_rnd_state;
+
+/* Returns a 32-bit pseudo-random number from a per-thread xorshift generator.
+ * It is fast and lock-free but only meant for statistical uses such as load
+ * balancing, unlike random() which serializes all threads on libc's lock.
+ */
+static inline unsigned int ha_random32()
+{
+	unsigned int x = ha_rnd_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ha_rnd_state = x;
+	return x;
+}
+
 /* Return the bit position in mask <m> of the nth bit set of rank <r>, between
  * 0 and LONGBITS-1 included, starting from the left. For example ranks 0,1,2,3
  * for mask 0x55 will be 6, 4, 2 and 0 respectively. This algorithm is based on
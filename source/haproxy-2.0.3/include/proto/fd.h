@@ -204,6 +204,19 @@ static inline void fd_update_cache(int fd)
 	}
 }
 
+/* Migrates <fd>, which must only be known to a single thread, to the calling
+ * thread. The caller must guarantee that the previous thread will not process
+ * it anymore. A pending event is moved to the current thread's cache, and the
+ * previous thread's poller unregisters the FD next time it reports it.
+ */
+static inline void fd_takeover(int fd)
+{
+	fd_release_cache_entry(fd);
+	HA_ATOMIC_STORE(&fdtab[fd].thread_mask, tid_bit);
+	fd_update_cache(fd);
+	updt_fd_polling(fd);
+}
+
 /*
  * returns the FD's recv state (FD_EV_*)
  */
@@ -397,8 +410,8 @@ static inline void fd_may_recv(const int fd)
 
 /* Disable readiness when polled. This is useful to interrupt reading when it
  * is suspected that the end of data might have been reached (eg: short read).
- * This can only be done using level-triggered pollers, so if any edge-triggered
- * is ever implemented, a test will have to be added here.
+ * Edge-triggered pollers (HAP_POLL_F_ET) would not report the remaining data
+ * again, so they are asked to re-check the FD's readiness.
  */
 static inline void fd_done_recv(const int fd)
 {
@@ -414,7 +427,7 @@ static inline void fd_done_recv(const int fd)
 			new |= FD_EV_POLLED_R;
 	} while (unlikely(!_HA_ATOMIC_CAS(&fdtab[fd].state, &old, new)));
 
-	if ((old ^ new) & FD_EV_POLLED_R)
+	if (((old ^ new) & FD_EV_POLLED_R) || (cur_poller.flags & HAP_POLL_F_ET))
 		updt_fd_polling(fd);
 
 	locked = atleast2(fdtab[fd].thread_mask);
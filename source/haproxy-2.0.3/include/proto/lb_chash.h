@@ -29,6 +29,7 @@
 void chash_init_server_tree(struct proxy *p);
 struct server *chash_get_next_server(struct proxy *p, struct server *srvtoavoid);
 struct server *chash_get_server_hash(struct proxy *p, unsigned int hash, const struct server *avoid);
+void chash_deinit_rings(struct proxy *p);
 
 #endif /* _PROTO_LB_CHASH_H */
 
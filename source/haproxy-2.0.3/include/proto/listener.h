@@ -96,6 +96,14 @@ int unbind_all_listeners(struct protocol *proto);
 int create_listeners(struct bind_conf *bc, const struct sockaddr_storage *ss,
                      int portl, int porth, int fd, int inherited, char **err);
 
+/* Splits each TCP listener of bind_conf <bc> into shards sharing the same
+ * address with SO_REUSEPORT, each bound to a subset of the bind_conf's threads.
+ * The number of shards is the number of threads, possibly limited by
+ * bc->shards. Returns 0 on success, otherwise non-zero with the error message
+ * set in <err>.
+ */
+int bind_conf_shard_listeners(struct bind_conf *bc, char **err);
+
 /* Delete a listener from its protocol's list of listeners. The listener's
  * state is automatically updated from LI_ASSIGNED to LI_INIT. The protocol's
  * number of listeners is updated. Note that the listener must have previously
@@ -174,6 +182,14 @@ static inline const char *listener_state_str(const struct listener *l)
 	return states[st];
 }
 
+/* Returns the mask of threads which may handle listener <l> : those of its
+ * shard if it is sharded, otherwise those of its bind_conf.
+ */
+static inline unsigned long listener_thread_mask(const struct listener *l)
+{
+	return thread_mask(l->bind_thread ? l->bind_thread : l->bind_conf->bind_thread);
+}
+
 extern struct xfer_sock_list *xfer_sock_list;
 
 extern struct accept_queue_ring accept_queue_rings[MAX_THREADS] __attribute__((aligned(64)));
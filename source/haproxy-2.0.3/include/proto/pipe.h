@@ -44,6 +44,11 @@ void kill_pipe(struct pipe *p);
  */
 void put_pipe(struct pipe *p);
 
+/* try to double the capacity of a full pipe, up to tune.pipesize.max. Returns
+ * non-zero if the pipe was grown.
+ */
+int grow_pipe(struct pipe *p);
+
 #endif /* _PROTO_PIPE_H */
 
 /*
@@ -35,6 +35,7 @@
 #include <proto/queue.h>
 #include <proto/log.h>
 #include <proto/freq_ctr.h>
+#include <proto/obj_type.h>
 
 
 __decl_hathreads(extern HA_SPINLOCK_T idle_conn_srv_lock);
@@ -42,6 +43,7 @@ extern struct eb_root idle_conn_srv;
 extern struct task *idle_conn_task;
 extern struct task *idle_conn_cleanup[MAX_THREADS];
 extern struct list toremove_connections[MAX_THREADS];
+__decl_hathreads(extern HA_SPINLOCK_T toremove_lock[MAX_THREADS]);
 
 int srv_downtime(const struct server *s);
 int srv_lastsession(const struct server *s);
@@ -67,6 +69,7 @@ int snr_resolution_error_cb(struct dns_requester *requester, int error_code);
 struct server *snr_check_ip_callback(struct server *srv, void *ip, unsigned char *ip_family);
 struct task *srv_cleanup_idle_connections(struct task *task, void *ctx, unsigned short state);
 struct task *srv_cleanup_toremove_connections(struct task *task, void *context, unsigned short state);
+struct connection *srv_takeover_idle_conn(struct server *srv);
 
 /* increase the number of cumulated connections on the designated server */
 static inline void srv_inc_sess_ctr(struct server *s)
@@ -244,27 +247,41 @@ static inline enum srv_initaddr srv_get_next_initaddr(unsigned int *list)
 
 /* This adds an idle connection to the server's list if the connection is
  * reusable, not held by any owner anymore, but still has available streams.
+ * When the server already has as many idle connections as allowed, the least
+ * recently used one of the current thread is closed to make room for this one.
  */
 static inline int srv_add_to_idle_list(struct server *srv, struct connection *conn)
 {
-	if (srv && srv->pool_purge_delay > 0 &&
-	    (srv->max_idle_conns == -1 || srv->max_idle_conns > srv->curr_idle_conns) &&
+	if (srv && srv->pool_purge_delay > 0 && srv->max_idle_conns != 0 &&
 	    !(conn->flags & CO_FL_PRIVATE) &&
 	    ((srv->proxy->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR) &&
 	    !conn->mux->used_streams(conn) && conn->mux->avail_streams(conn) &&
 	    ha_used_fds < global.tune.pool_low_count) {
+		struct connection *oldest = NULL;
 		int retadd;
 
 		retadd = _HA_ATOMIC_ADD(&srv->curr_idle_conns, 1);
-		if (retadd > srv->max_idle_conns) {
-			_HA_ATOMIC_SUB(&srv->curr_idle_conns, 1);
-			return 0;
+		if (srv->max_idle_conns != -1 && retadd > srv->max_idle_conns) {
+			HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+			oldest = LIST_POP_LOCKED(&srv->idle_orphan_conns[tid],
+			                         struct connection *, list);
+			HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+			if (!oldest) {
+				_HA_ATOMIC_SUB(&srv->curr_idle_conns, 1);
+				return 0;
+			}
 		}
 		LIST_DEL(&conn->list);
+		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+		conn->idle_time = now_ms;
 		LIST_ADDQ_LOCKED(&srv->idle_orphan_conns[tid], &conn->list);
-		srv->curr_idle_thr[tid]++;
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+		_HA_ATOMIC_ADD(&srv->curr_idle_thr[tid], 1);
+
+		/* the evicted connection still counts as idle until it's freed */
+		if (oldest)
+			oldest->mux->destroy(oldest->ctx);
 
-		conn->idle_time = now_ms;
 		__ha_barrier_full();
 		if ((volatile void *)srv->idle_node.node.leaf_p == NULL) {
 			HA_SPIN_LOCK(OTHER_LOCK, &idle_conn_srv_lock);
@@ -286,6 +303,35 @@ static inline int srv_add_to_idle_list(struct server *srv, struct connection *co
 	return 0;
 }
 
+/* Removes idle connection <conn> from its server's idle list while the thread
+ * owning it processes an event on it, so that no other thread may take it over
+ * in the mean time. It must be called with toremove_lock[tid] held. Returns
+ * non-zero if the connection was parked in the list, in which case it must be
+ * put back using srv_idle_conn_repark() if it still exists once done. Those
+ * already queued for removal (CO_FL_IDLE_TOREMOVE) are left where they are.
+ */
+static inline int srv_idle_conn_unpark(struct connection *conn)
+{
+	if (!conn->idle_time || (conn->flags & CO_FL_IDLE_TOREMOVE) ||
+	    LIST_ISEMPTY(&conn->list))
+		return 0;
+	LIST_DEL_LOCKED(&conn->list);
+	return 1;
+}
+
+/* Puts idle connection <conn> back into its server's idle list after it was
+ * removed by srv_idle_conn_unpark(), unless it was queued for removal since.
+ */
+static inline void srv_idle_conn_repark(struct connection *conn)
+{
+	struct server *srv = __objt_server(conn->target);
+
+	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+	if (!(conn->flags & CO_FL_IDLE_TOREMOVE))
+		LIST_ADDQ_LOCKED(&srv->idle_orphan_conns[tid], &conn->list);
+	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+}
+
 #endif /* _PROTO_SERVER_H */
 
 /*
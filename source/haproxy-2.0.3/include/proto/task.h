@@ -83,7 +83,6 @@
 
 /* a few exported variables */
 extern unsigned int nb_tasks;     /* total number of tasks */
-extern volatile unsigned long global_tasks_mask; /* Mask of threads with tasks in the global runqueue */
 extern unsigned int tasks_run_queue;    /* run queue size */
 extern unsigned int tasks_run_queue_cur;
 extern unsigned int nb_tasks_cur;
@@ -94,13 +93,10 @@ extern struct pool_head *pool_head_notification;
 extern THREAD_LOCAL struct task *curr_task; /* task currently running or NULL */
 #ifdef USE_THREAD
 extern struct eb_root timers;      /* sorted timers tree, global */
-extern struct eb_root rqueue;      /* tree constituting the run queue */
-extern int global_rqueue_size; /* Number of element sin the global runqueue */
 #endif
 
 extern struct task_per_thread task_per_thread[MAX_THREADS];
 
-__decl_hathreads(extern HA_SPINLOCK_T rq_lock);  /* spin lock related to run queue */
 __decl_hathreads(extern HA_RWLOCK_T wq_lock);    /* RW lock related to the wait queue */
 
 
@@ -108,41 +104,42 @@ __decl_hathreads(extern HA_RWLOCK_T wq_lock);    /* RW lock related to the wait
 static inline int task_in_rq(struct task *t)
 {
 	/* Check if leaf_p is NULL, in case he's not in the runqueue, and if
-	 * it's not 0x1, which would mean it's in the tasklet list.
+	 * it's not 0x1, which would mean it's in the tasklet list. A task
+	 * waiting in a thread's inbox is considered as being in the run queue.
 	 */
-	return t->rq.node.leaf_p != NULL;
+	return t->rq.node.leaf_p != NULL || (t->state & TASK_INBOX);
+}
+
+/* return non-zero if timer wheel <w> may hold tasks */
+static inline int timer_wheel_used(const struct timer_wheel *w)
+{
+	int lvl;
+
+	for (lvl = 0; lvl < TIMER_WHEEL_LEVELS; lvl++)
+		if (w->map[lvl])
+			return 1;
+	return 0;
 }
 
 /* return 0 if task is in wait queue, otherwise non-zero */
 static inline int task_in_wq(struct task *t)
 {
-	return t->wq.node.leaf_p != NULL;
+	return t->wq.node.leaf_p != NULL || !LIST_ISEMPTY(&t->wheel);
 }
 
 /* puts the task <t> in run queue with reason flags <f>, and returns <t> */
 /* This will put the task in the local runqueue if the task is only runnable
- * by the current thread, in the global runqueue otherwies.
+ * by the current thread, in the inbox of one of its threads otherwise.
  */
-void __task_wakeup(struct task *t, struct eb_root *);
+void __task_wakeup(struct task *t);
 static inline void task_wakeup(struct task *t, unsigned int f)
 {
 	unsigned short state;
 
-#ifdef USE_THREAD
-	struct eb_root *root;
-
-	if (t->thread_mask == tid_bit || global.nbthread == 1)
-		root = &task_per_thread[tid].rqueue;
-	else
-		root = &rqueue;
-#else
-	struct eb_root *root = &task_per_thread[tid].rqueue;
-#endif
-
 	state = _HA_ATOMIC_OR(&t->state, f);
 	while (!(state & (TASK_RUNNING | TASK_QUEUED))) {
 		if (_HA_ATOMIC_CAS(&t->state, &state, state | TASK_QUEUED)) {
-			__task_wakeup(t, root);
+			__task_wakeup(t);
 			break;
 		}
 	}
@@ -158,11 +155,15 @@ static inline void task_set_affinity(struct task *t, unsigned long thread_mask)
  * Unlink the task from the wait queue, and possibly update the last_timer
  * pointer. A pointer to the task itself is returned. The task *must* already
  * be in the wait queue before calling this function. If unsure, use the safer
- * task_unlink_wq() function.
+ * task_unlink_wq() function. A task leaving a timer wheel leaves its slot
+ * marked as used, this is fixed when the wheel runs over it.
  */
 static inline struct task *__task_unlink_wq(struct task *t)
 {
-	eb32_delete(&t->wq);
+	if (!LIST_ISEMPTY(&t->wheel))
+		LIST_DEL_INIT(&t->wheel);
+	else
+		eb32_delete(&t->wq);
 	return t;
 }
 
@@ -195,13 +196,7 @@ static inline struct task *task_unlink_wq(struct task *t)
 static inline struct task *__task_unlink_rq(struct task *t)
 {
 	_HA_ATOMIC_SUB(&tasks_run_queue, 1);
-#ifdef USE_THREAD
-	if (t->state & TASK_GLOBAL) {
-		_HA_ATOMIC_AND(&t->state, ~TASK_GLOBAL);
-		global_rqueue_size--;
-	} else
-#endif
-		task_per_thread[tid].rqueue_size--;
+	task_per_thread[tid].rqueue_size--;
 	eb32sc_delete(&t->rq);
 	if (likely(t->nice))
 		_HA_ATOMIC_SUB(&niced_tasks, 1);
@@ -209,18 +204,14 @@ static inline struct task *__task_unlink_rq(struct task *t)
 }
 
 /* This function unlinks task <t> from the run queue if it is in it. It also
- * takes care of updating the next run queue task if it was this task.
+ * takes care of updating the next run queue task if it was this task. It must
+ * only be called by the thread whose run queue holds the task, and does
+ * nothing for a task still waiting in an inbox.
  */
 static inline struct task *task_unlink_rq(struct task *t)
 {
-	int is_global = t->state & TASK_GLOBAL;
-
-	if (is_global)
-		HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
-	if (likely(task_in_rq(t)))
+	if (likely(t->rq.node.leaf_p))
 		__task_unlink_rq(t);
-	if (is_global)
-		HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
 	return t;
 }
 
@@ -267,6 +258,7 @@ static inline struct task *task_init(struct task *t, unsigned long thread_mask)
 {
 	t->wq.node.leaf_p = NULL;
 	t->rq.node.leaf_p = NULL;
+	LIST_INIT(&t->wheel);
 	t->state = TASK_SLEEPING;
 	t->thread_mask = thread_mask;
 	t->nice = 0;
@@ -370,12 +362,13 @@ static inline void tasklet_free(struct tasklet *tl)
 }
 
 void __task_queue(struct task *task, struct eb_root *wq);
+void __task_queue_local(struct task *task);
 
 /* Place <task> into the wait queue, where it may already be. If the expiration
  * timer is infinite, do nothing and rely on wake_expired_task to clean up.
  * If the task is bound to a single thread, it's assumed to be bound to the
- * current thread's queue and is queued without locking. Otherwise it's queued
- * into the global wait queue, protected by locks.
+ * current thread's timer wheel and is queued without locking. Otherwise it's
+ * queued into the global wait queue, protected by locks.
  */
 static inline void task_queue(struct task *task)
 {
@@ -401,7 +394,7 @@ static inline void task_queue(struct task *task)
 #endif
 	{
 		if (!task_in_wq(task) || tick_is_lt(task->expire, task->wq.key))
-			__task_queue(task, &task_per_thread[tid].timers);
+			__task_queue_local(task);
 	}
 }
 
@@ -434,7 +427,7 @@ static inline void task_schedule(struct task *task, int when)
 
 		task->expire = when;
 		if (!task_in_wq(task) || tick_is_lt(task->expire, task->wq.key))
-			__task_queue(task, &task_per_thread[tid].timers);
+			__task_queue_local(task);
 	}
 }
 
@@ -536,7 +529,7 @@ static inline int notification_registered(struct list *wake)
 
 static inline int thread_has_tasks(void)
 {
-	return (!!(global_tasks_mask & tid_bit) |
+	return ((task_per_thread[tid].inbox != NULL) |
 	        (task_per_thread[tid].rqueue_size > 0) |
 	        !LIST_ISEMPTY(&task_per_thread[tid].task_list));
 }
@@ -548,6 +541,8 @@ static inline void work_list_add(struct work_list *work, struct list *item)
 	task_wakeup(work->task, TASK_WOKEN_OTHER);
 }
 
+int tasklet_release_on(struct tasklet *tl, int thr);
+
 struct work_list *work_list_create(int nbthread,
                                    struct task *(*fct)(struct task *, void *, unsigned short),
                                    void *arg);
@@ -56,6 +56,9 @@ struct activity {
 	unsigned int accq_full;    // accept queue connection not pushed because full
 	unsigned int pool_fail;    // failed a pool allocation
 	unsigned int buf_wait;     // waited on a buffer allocation
+	unsigned int rq_steal;     // tasks taken from another thread's inbox
+	unsigned int poll_ctl;     // poller changed an FD's registration (eg: epoll_ctl)
+	unsigned int poll_nochg;   // poller skipped an FD whose polling did not change
 #if defined(DEBUG_DEV)
 	/* keep these ones at the end */
 	unsigned int ctr0;         // general purposee debug counter
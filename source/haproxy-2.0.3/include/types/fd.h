@@ -151,6 +151,7 @@ struct fdinfo {
  */
 
 #define HAP_POLL_F_RDHUP 0x00000001                          /* the poller notifies of HUP with reads */
+#define HAP_POLL_F_ET    0x00000002                          /* the poller only reports readiness changes */
 
 struct poller {
 	void   *private;                                     /* any private data for the poller */
@@ -74,6 +74,9 @@
 #define GTUNE_SET_DUMPABLE       (1<<13)
 
 #define GTUNE_USE_EVPORTS        (1<<14)
+#define GTUNE_USE_URING          (1<<15)
+
+#define GTUNE_IDLE_POOL_SHARED   (1<<16)
 
 /* Access level for a stats socket */
 #define ACCESS_LVL_NONE     0
@@ -159,6 +162,7 @@ struct global {
 		int server_rcvbuf; /* set server rcvbuf to this value if not null */
 		int chksize;       /* check buffer size in bytes, defaults to BUFSIZE */
 		int pipesize;      /* pipe size in bytes, system defaults if zero */
+		int pipesize_max;  /* max size full pipes may grow to, no growth if zero */
 		int max_http_hdr;  /* max number of HTTP headers, use MAX_HTTP_HDR if zero */
 		int requri_len;    /* max len of request URI, use REQURI_LEN if zero */
 		int cookie_len;    /* max length of cookie captures */
@@ -23,13 +23,30 @@
 #define _TYPES_LB_CHASH_H
 
 #include <common/config.h>
+#include <common/hathreads.h>
 #include <ebtree.h>
 #include <eb32tree.h>
 
+/* Flat copy of the tree of the servers in use, sorted by key, which hash
+ * lookups binary search without any lock. It is never modified once
+ * published: each change builds a new one under the lbprm lock, and the
+ * replaced one is only freed once all threads were seen out of any lookup.
+ */
+struct chash_ring {
+	unsigned int count;	/* number of entries, 0 if none or <fbck> is used */
+	unsigned int *keys;	/* <count> sorted keys */
+	struct server **srvs;	/* server owning each key */
+	struct server *fbck;	/* the only backup server to use when <count> is 0 */
+	struct chash_ring *next;	/* next replaced ring waiting to be freed */
+	unsigned int loops[MAX_THREADS]; /* threads' loop counters when replaced */
+};
+
 struct lb_chash {
 	struct eb_root act;	/* weighted chash entries of active servers */
 	struct eb_root bck;	/* weighted chash entries of backup servers */
 	struct eb32_node *last;	/* last node found in case of round robin (or NULL) */
+	struct chash_ring *ring;	/* current ring for hash lookups */
+	struct chash_ring *retired;	/* replaced rings not freed yet */
 };
 
 #endif /* _TYPES_LB_CHASH_H */
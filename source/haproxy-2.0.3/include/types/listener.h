@@ -102,6 +102,7 @@ enum li_state {
 #define LI_O_INHERITED          0x2000  /* inherited FD from the parent process (fd@) */
 #define LI_O_MWORKER            0x4000  /* keep the FD open in the master but close it in the children */
 #define LI_O_NOSTOP             0x8000  /* keep the listener active even after a soft stop */
+#define LI_O_CPU_STEER          0x10000 /* steer connections to the shard of the receiving CPU (linux) */
 
 /* Note: if a listener uses LI_O_UNLIMITED, it is highly recommended that it adds its own
  * maxconn setting to the global.maxsock value so that its resources are reserved.
@@ -170,6 +171,7 @@ struct bind_conf {
 	struct list listeners;     /* list of listeners using this bind config */
 	unsigned long bind_proc;   /* bitmask of processes allowed to use these listeners */
 	unsigned long bind_thread; /* bitmask of threads allowed to use these listeners */
+	int shards;                /* 0=single socket, -1=one per thread, >0=max number of sockets per address */
 	uint32_t ns_cip_magic;     /* Excepted NetScaler Client IP magic number */
 	struct list by_fe;         /* next binding for the same frontend, or NULL */
 	char *arg;                 /* argument passed to "bind" for better error reporting */
@@ -204,6 +206,7 @@ struct listener {
 	/* cache line boundary */
 	struct list wait_queue;		/* link element to make the listener wait for something (LI_LIMITED)  */
 	unsigned int thr_idx;           /* thread indexes for queue distribution : (t2<<16)+t1 */
+	unsigned long bind_thread;      /* threads of this shard, or 0 to use the bind_conf's */
 	unsigned int analysers;		/* bitmap of required protocol analysers */
 	int maxseg;			/* for TCP, advertised MSS */
 	int tcp_ut;                     /* for TCP, user timeout */
@@ -139,6 +139,7 @@ extern struct stktable_type stktable_types[];
 struct stksess {
 	unsigned int expire;      /* session expiration date */
 	unsigned int ref_cnt;     /* reference count, can only purge when zero */
+	unsigned int shard;       /* shard of the table holding the session */
 	__decl_hathreads(HA_RWLOCK_T lock); /* lock related to the table entry */
 	struct eb32_node exp;     /* ebtree node used to hold the session in expiration tree */
 	struct eb32_node upd;     /* ebtree node used to hold the update sequence tree */
@@ -147,6 +148,19 @@ struct stksess {
 };
 
 
+/* One shard of a stick table. Sessions are spread over the shards by a hash
+ * of their key, and each shard indexes and expires its own sessions under
+ * its own lock, so that threads working on different keys rarely meet.
+ */
+struct stktable_shard {
+	struct eb_root keys;      /* head of sticky session tree */
+	struct eb_root exps;      /* head of sticky session expiration tree */
+	__decl_hathreads(HA_SPINLOCK_T lock); /* spin lock related to the trees */
+	struct task *exp_task;    /* expiration task */
+	int exp_next;             /* next expiration date (ticks) */
+	struct stktable *table;   /* the table this shard belongs to */
+};
+
 /* stick table */
 struct stktable {
 	char *id;		  /* local table id name. */
@@ -159,12 +173,10 @@ struct stktable {
 		int line;             /* The line in this <file> the stick-table is declared. */
 	} conf;
 	struct ebpt_node name;    /* Stick-table are lookup by name here. */
-	struct eb_root keys;      /* head of sticky session tree */
-	struct eb_root exps;      /* head of sticky session expiration tree */
+	struct stktable_shard shards[STKTABLE_SHARDS]; /* sticky sessions by key hash */
 	struct eb_root updates;   /* head of sticky updates sequence tree */
 	struct pool_head *pool;   /* pool used to allocate sticky sessions */
-	__decl_hathreads(HA_SPINLOCK_T lock); /* spin lock related to the table */
-	struct task *exp_task;    /* expiration task */
+	__decl_hathreads(HA_SPINLOCK_T updt_lock); /* spin lock related to the updates */
 	struct task *sync_task;   /* sync task */
 	unsigned int update;
 	unsigned int localupdate;
@@ -181,7 +193,6 @@ struct stktable {
 	unsigned int size;        /* maximum number of sticky sessions in table */
 	unsigned int current;     /* number of sticky sessions currently in table */
 	int nopurge;              /* if non-zero, don't purge sticky sessions when full */
-	int exp_next;             /* next expiration date (ticks) */
 	int expire;               /* time to live for sticky sessions (milliseconds) */
 	int data_size;            /* the size of the data that is prepended *before* stksess */
 	int data_ofs[STKTABLE_DATA_TYPES]; /* negative offsets of present data types, or 0 if absent */
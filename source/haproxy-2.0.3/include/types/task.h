@@ -32,7 +32,7 @@
 /* values for task->state */
 #define TASK_SLEEPING     0x0000  /* task sleeping */
 #define TASK_RUNNING      0x0001  /* the task is currently running */
-#define TASK_GLOBAL       0x0002  /* The task is currently in the global runqueue */
+#define TASK_INBOX        0x0002  /* The task is in a thread's wakeup inbox */
 #define TASK_QUEUED       0x0004  /* The task has been (re-)added to the run queue */
 
 #define TASK_WOKEN_INIT   0x0100  /* woken up for initialisation purposes */
@@ -57,13 +57,33 @@ struct notification {
 	__decl_hathreads(HA_SPINLOCK_T lock);
 };
 
+/* Timers of tasks bound to a single thread are kept in a per-thread
+ * hierarchical timer wheel. Each level has TIMER_WHEEL_SLOTS slots, and a slot
+ * of level N covers 2^(N*TIMER_WHEEL_BITS) ms. A task is queued into the level
+ * matching the distance to its expiration date, and moves down one level at a
+ * time as this date approaches, so that it expires at the exact date. Dates
+ * further than the wheel's range (about 4.6 hours) go to the wait queue tree.
+ */
+#define TIMER_WHEEL_BITS     6
+#define TIMER_WHEEL_SLOTS    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS   4
+
+struct timer_wheel {
+	unsigned int clock;                     /* first date not processed yet */
+	uint64_t map[TIMER_WHEEL_LEVELS];       /* slots which may hold tasks */
+	struct list slot[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
 /* force to split per-thread stuff into separate cache lines */
 struct task_per_thread {
 	struct eb_root timers;  /* tree constituting the per-thread wait queue */
+	struct timer_wheel *wheel; /* per-thread timer wheel, NULL until allocated */
 	struct eb_root rqueue;  /* tree constituting the per-thread run queue */
 	struct list task_list;  /* List of tasks to be run, mixing tasks and tasklets */
 	int task_list_size;     /* Number of tasks in the task_list */
 	int rqueue_size;        /* Number of elements in the per-thread run queue */
+	/* tasks woken up by other threads, written by all threads */
+	__attribute__((aligned(64))) struct task *inbox;
 	__attribute__((aligned(64))) char end[0];
 };
 
@@ -84,7 +104,9 @@ struct task_per_thread {
 struct task {
 	TASK_COMMON;			/* must be at the beginning! */
 	struct eb32sc_node rq;		/* ebtree node used to hold the task in the run queue */
+	struct task *rq_next;		/* next task in a thread's wakeup inbox */
 	struct eb32_node wq;		/* ebtree node used to hold the task in the wait queue */
+	struct list wheel;		/* list element used to hold the task in a timer wheel */
 	int expire;			/* next expiration date for this task, in ticks */
 	unsigned long thread_mask;	/* mask of thread IDs authorized to process the task */
 	uint64_t call_date;		/* date of the last task wakeup or call */
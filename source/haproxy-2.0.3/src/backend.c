@@ -574,8 +574,7 @@ static struct server *get_server_rnd(struct stream *s, const struct server *avoi
 	curr = NULL;
 	do {
 		prev = curr;
-		/* ensure all 32 bits are covered as long as RAND_MAX >= 65535 */
-		hash = ((uint64_t)random() * ((uint64_t)RAND_MAX + 1)) ^ random();
+		hash = ha_random32();
 		curr = chash_get_server_hash(px, hash, avoid);
 		if (!curr)
 			break;
@@ -1301,12 +1300,25 @@ int connect_server(struct stream *s)
 		else if (srv->idle_conns && !LIST_ISEMPTY(&srv->idle_conns[tid]) &&
 			 (s->be->options & PR_O_REUSE_MASK) == PR_O_REUSE_ALWS) {
 			srv_conn = LIST_ELEM(srv->idle_conns[tid].n, struct connection *, list);
-		} else if (srv->idle_orphan_conns && !LIST_ISEMPTY(&srv->idle_orphan_conns[tid]) &&
+		} else if (srv->idle_orphan_conns && srv->curr_idle_conns &&
 		    (((s->be->options & PR_O_REUSE_MASK) == PR_O_REUSE_ALWS) ||
 		    (((s->be->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR) &&
 		     s->txn && (s->txn->flags & TX_NOT_FIRST)))) {
-			srv_conn = LIST_POP_LOCKED(&srv->idle_orphan_conns[tid],
-			                           struct connection *, list);
+			/* Pick the most recently used connection, the oldest
+			 * ones are left to the purge. If this thread has none,
+			 * try to take one over from another thread.
+			 */
+			if (!LIST_ISEMPTY(&srv->idle_orphan_conns[tid])) {
+				HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+				if (!LIST_ISEMPTY(&srv->idle_orphan_conns[tid])) {
+					srv_conn = LIST_ELEM(srv->idle_orphan_conns[tid].p,
+					                     struct connection *, list);
+					LIST_DEL_LOCKED(&srv_conn->list);
+				}
+				HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+			}
+			if (!srv_conn && (global.tune.options & GTUNE_IDLE_POOL_SHARED))
+				srv_conn = srv_takeover_idle_conn(srv);
 			if (srv_conn)
 				reuse_orphan = 1;
 		}
@@ -1344,8 +1356,10 @@ int connect_server(struct stream *s)
 		 * acceptable, attempt to kill an idling connection
 		 */
 		/* First, try from our own idle list */
+		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 		tokill_conn = LIST_POP_LOCKED(&srv->idle_orphan_conns[tid],
 		    struct connection *, list);
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 		if (tokill_conn)
 			tokill_conn->mux->destroy(tokill_conn->ctx);
 		/* If not, iterate over other thread's idling pool, and try to grab one */
@@ -1362,13 +1376,18 @@ int connect_server(struct stream *s)
 				// see it possibly larger.
 				ALREADY_CHECKED(i);
 
+				HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
 				tokill_conn = LIST_POP_LOCKED(&srv->idle_orphan_conns[i],
 				    struct connection *, list);
 				if (tokill_conn) {
 					/* We got one, put it into the concerned thread's to kill list, and wake it's kill task */
 
+					tokill_conn->flags |= CO_FL_IDLE_TOREMOVE;
 					LIST_ADDQ_LOCKED(&toremove_connections[i],
 					    &tokill_conn->list);
+				}
+				HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[i]);
+				if (tokill_conn) {
 					task_wakeup(idle_conn_cleanup[i], TASK_WOKEN_OTHER);
 					break;
 				}
@@ -1383,8 +1402,7 @@ int connect_server(struct stream *s)
 		if (reuse_orphan) {
 			srv_conn->idle_time = 0;
 			_HA_ATOMIC_SUB(&srv->curr_idle_conns, 1);
-			__ha_barrier_atomic_store();
-			srv->curr_idle_thr[tid]--;
+			_HA_ATOMIC_SUB(&srv->curr_idle_thr[tid], 1);
 			LIST_ADDQ(&srv->idle_conns[tid], &srv_conn->list);
 		}
 		else {
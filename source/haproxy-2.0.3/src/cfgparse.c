@@ -2438,6 +2438,18 @@ int check_config_validity()
 					bind_conf->bind_proc = 0;
 				}
 			}
+
+			/* split the listeners into per-thread shards if requested */
+			if (bind_conf->shards) {
+				char *err = NULL;
+
+				if (bind_conf_shard_listeners(bind_conf, &err)) {
+					ha_alert("Proxy '%s': %s for 'bind %s' at [%s:%d].\n",
+						 curproxy->id, err, bind_conf->arg, bind_conf->file, bind_conf->line);
+					free(err);
+					cfgerr++;
+				}
+			}
 		}
 
 		switch (curproxy->mode) {
@@ -47,12 +47,32 @@ void conn_fd_handler(int fd)
 	struct connection *conn = fdtab[fd].owner;
 	unsigned int flags;
 	int io_available = 0;
+	int parked = 0;
 
 	if (unlikely(!conn)) {
 		activity[tid].conn_dead++;
 		return;
 	}
 
+	if ((global.tune.options & GTUNE_IDLE_POOL_SHARED) &&
+	    obj_type(conn->target) == OBJ_TYPE_SERVER) {
+		/* Idle server connections may be taken over by other threads,
+		 * possibly since the poller reported this event, so make sure
+		 * it's still ours and that nobody takes it while we are
+		 * processing it. This is checked under the lock even when it
+		 * doesn't look idle anymore, as the new owner may already have
+		 * reset its idle_time.
+		 */
+		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+		if (fdtab[fd].owner != conn || !(fdtab[fd].thread_mask & tid_bit)) {
+			HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+			activity[tid].poll_skip++;
+			return;
+		}
+		parked = srv_idle_conn_unpark(conn);
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+	}
+
 	conn_refresh_polling_flags(conn);
 	conn->flags |= CO_FL_WILL_UPDATE;
 
@@ -150,6 +170,8 @@ void conn_fd_handler(int fd)
 	/* commit polling changes */
 	conn->flags &= ~CO_FL_WILL_UPDATE;
 	conn_cond_update_polling(conn);
+	if (parked)
+		srv_idle_conn_repark(conn);
 	return;
 }
 
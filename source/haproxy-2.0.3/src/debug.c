@@ -44,12 +44,13 @@ void ha_thread_dump(struct buffer *buf, int thr, int calling_tid)
 	int stuck = !!(thread_info[thr].flags & TI_FL_STUCK);
 
 	chunk_appendf(buf,
-	              "%c%cThread %-2u: act=%d glob=%d wq=%d rq=%d tl=%d tlsz=%d rqsz=%d\n"
+	              "%c%cThread %-2u: act=%d inbox=%d wq=%d rq=%d tl=%d tlsz=%d rqsz=%d\n"
 	              "             stuck=%d fdcache=%d prof=%d",
 	              (thr == calling_tid) ? '*' : ' ', stuck ? '>' : ' ', thr + 1,
 		      thread_has_tasks(),
-	              !!(global_tasks_mask & thr_bit),
-	              !eb_is_empty(&task_per_thread[thr].timers),
+	              task_per_thread[thr].inbox != NULL,
+	              !eb_is_empty(&task_per_thread[thr].timers) ||
+	              (task_per_thread[thr].wheel && timer_wheel_used(task_per_thread[thr].wheel)),
 	              !eb_is_empty(&task_per_thread[thr].rqueue),
 	              !LIST_ISEMPTY(&task_per_thread[thr].task_list),
 	              task_per_thread[thr].task_list_size,
@@ -32,6 +32,7 @@
 
 /* private data */
 static THREAD_LOCAL struct epoll_event *epoll_events = NULL;
+static THREAD_LOCAL unsigned char *epoll_state = NULL; // FD_EV_POLLED_RW registered per FD
 static int epoll_fd[MAX_THREADS]; // per-thread epoll_fd
 
 /* This structure may be used for any purpose. Warning! do not use it in
@@ -57,11 +58,18 @@ REGPRM1 static void __fd_clo(int fd)
 		int i;
 
 		for (i = global.nbthread - 1; i >= 0; i--)
-			if (m & (1UL << i))
+			if (m & (1UL << i)) {
 				epoll_ctl(epoll_fd[i], EPOLL_CTL_DEL, fd, &ev);
+				activity[tid].poll_ctl++;
+			}
 	}
 }
 
+/* Registers the polling changes of <fd> for the current thread. The FD may
+ * have been enabled and disabled several times since the last call, only the
+ * final state matters, and nothing is done if it is the one already known to
+ * epoll.
+ */
 static void _update_fd(int fd)
 {
 	int en, opcode;
@@ -74,6 +82,11 @@ static void _update_fd(int fd)
 			opcode = EPOLL_CTL_DEL;
 			_HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
 		}
+		else if ((en & FD_EV_POLLED_RW) == epoll_state[fd]) {
+			/* no net change */
+			activity[tid].poll_nochg++;
+			return;
+		}
 		else {
 			/* fd status changed */
 			opcode = EPOLL_CTL_MOD;
@@ -98,6 +111,8 @@ static void _update_fd(int fd)
 
 	ev.data.fd = fd;
 	epoll_ctl(epoll_fd[tid], opcode, fd, &ev);
+	activity[tid].poll_ctl++;
+	epoll_state[fd] = en & FD_EV_POLLED_RW;
 }
 
 /*
@@ -186,6 +201,7 @@ REGPRM3 static void _do_poll(struct poller *p, int exp, int wake)
 			/* FD has been migrated */
 			activity[tid].poll_skip++;
 			epoll_ctl(epoll_fd[tid], EPOLL_CTL_DEL, fd, &ev);
+			activity[tid].poll_ctl++;
 			_HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
 			continue;
 		}
@@ -224,6 +240,10 @@ static int init_epoll_per_thread()
 	if (epoll_events == NULL)
 		goto fail_alloc;
 
+	epoll_state = calloc(global.maxsock, sizeof(*epoll_state));
+	if (epoll_state == NULL)
+		goto fail_state;
+
 	if (MAX_THREADS > 1 && tid) {
 		epoll_fd[tid] = epoll_create(global.maxsock + 1);
 		if (epoll_fd[tid] < 0)
@@ -240,6 +260,9 @@ static int init_epoll_per_thread()
 
 	return 1;
  fail_fd:
+	free(epoll_state);
+	epoll_state = NULL;
+ fail_state:
 	free(epoll_events);
  fail_alloc:
 	return 0;
@@ -250,6 +273,8 @@ static void deinit_epoll_per_thread()
 	if (MAX_THREADS > 1 && tid)
 		close(epoll_fd[tid]);
 
+	free(epoll_state);
+	epoll_state = NULL;
 	free(epoll_events);
 	epoll_events = NULL;
 }
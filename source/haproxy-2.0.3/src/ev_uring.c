@@ -0,0 +1,694 @@
+/*
+ * FD polling functions for Linux io_uring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * Each thread owns one ring on which every polled FD has a single poll
+ * request. Polling changes are queued as submission entries and are passed to
+ * the kernel together with the wait for events, so that a loop costs at most
+ * one system call whatever the number of changes.
+ *
+ * FDs owned by a single thread use multishot polls, which stay armed but only
+ * report readiness changes, so the poller is edge-triggered for them and
+ * re-arms a poll to have the current readiness checked again. FDs shared by
+ * several threads (eg: listeners) may see their readiness cleared by another
+ * thread after an event, so they use one-shot polls which are armed again on
+ * the next loop, just like a level-triggered poller would report them again.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include <common/compat.h>
+#include <common/config.h>
+#include <common/debug.h>
+#include <common/hathreads.h>
+#include <common/standard.h>
+#include <common/ticks.h>
+#include <common/time.h>
+#include <common/tools.h>
+
+#include <types/global.h>
+
+#include <proto/activity.h>
+#include <proto/fd.h>
+#include <proto/signal.h>
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup  425
+#endif
+
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter  426
+#endif
+
+#ifndef POLLRDHUP
+/* POLLRDHUP was defined late in libc, and it appeared in kernel 2.6.17 */
+#define POLLRDHUP 0x2000
+#endif
+
+#define URING_SQ_ENTRIES     1024
+#define URING_CQ_ENTRIES     8192
+
+/* The user_data of a poll request holds the FD in the lower 32 bits and the
+ * number of times the FD was armed in the next 31 bits, so that completions
+ * of a previous arming can be recognized and ignored. Poll updates use the
+ * same value with URING_UD_UPDATE set, and removals use URING_UD_REMOVE whose
+ * completions are always ignored.
+ */
+#define URING_ARM_MASK       0x7fffffffU
+#define URING_UD_UPDATE      (1ULL << 63)
+#define URING_UD_REMOVE      (~0ULL)
+
+struct uring {
+	int fd;                          /* ring's fd, -1 if not created */
+	unsigned int sq_entries;
+	unsigned int *sq_head;           /* written by the kernel */
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;           /* written by the kernel */
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	char *sq_ring;
+	char *cq_ring;
+	size_t sq_ring_len;
+	size_t cq_ring_len;
+	__decl_hathreads(HA_SPINLOCK_T lock); /* serializes entries producers */
+};
+
+/* poll state of an FD on a thread's ring */
+struct uring_fd {
+	unsigned int arm;                /* arming count of the poll request */
+	unsigned int events;             /* events polled, 0 if no request */
+	unsigned int add_flags;          /* IORING_POLL_ADD_* flags of the request */
+};
+
+/* private data */
+static struct uring urings[MAX_THREADS];        // per-thread ring
+static struct uring_fd *uring_fds[MAX_THREADS]; // per-thread FD states
+
+/* io_uring stores the poll events as 32 bits split in two halves */
+static inline __u32 uring_poll_events(unsigned int events)
+{
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	return events;
+}
+
+static inline __u64 uring_ud(int fd, unsigned int arm)
+{
+	return (unsigned int)fd | ((__u64)arm << 32);
+}
+
+/* returns the number of completion entries waiting in ring <r> */
+static inline unsigned int uring_cq_ready(const struct uring *r)
+{
+	return __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+}
+
+/* passes all pending submission entries of ring <r> to the kernel. If <wait>
+ * is set, also waits at most <timeout> milliseconds for a completion if none
+ * is available yet, and returns the number of completions available.
+ */
+static unsigned int uring_enter(struct uring *r, int wait, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int submit;
+
+	submit = *(volatile unsigned int *)r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+	if (!wait || uring_cq_ready(r)) {
+		if (submit)
+			syscall(__NR_io_uring_enter, r->fd, submit, 0, 0, NULL, 0);
+	}
+	else if (timeout) {
+		memset(&arg, 0, sizeof(arg));
+		ts.tv_sec  = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (unsigned long)&ts;
+		syscall(__NR_io_uring_enter, r->fd, submit, 1,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+	else {
+		/* completions may be waiting for the task to run its work */
+		syscall(__NR_io_uring_enter, r->fd, submit, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+	}
+	return uring_cq_ready(r);
+}
+
+/* Returns a cleared submission entry of ring <r>, or NULL if the kernel does
+ * not accept any more. The ring's lock must be held, and the entry must be
+ * committed using uring_commit().
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	unsigned int tail = *r->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) {
+		/* full, hand the pending entries to the kernel first */
+		syscall(__NR_io_uring_enter, r->fd, r->sq_entries, 0, 0, NULL, 0);
+		if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+			return NULL;
+	}
+
+	sqe = &r->sqes[tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static inline void uring_commit(struct uring *r)
+{
+	__atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+	activity[tid].poll_ctl++;
+}
+
+/* queues the removal of <fd>'s poll request described by <st> on ring <r>.
+ * The ring's lock must be held.
+ */
+static void uring_poll_remove(struct uring *r, int fd, struct uring_fd *st)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_get_sqe(r);
+	if (!sqe)
+		return;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_ud(fd, st->arm);
+	sqe->user_data = URING_UD_REMOVE;
+	uring_commit(r);
+	st->events = 0;
+}
+
+/*
+ * Immediately remove file descriptor from the rings upon close. Poll requests
+ * hold a reference to the file, which would otherwise never be released. The
+ * other threads' rings are submitted at once since their owner may be sleeping,
+ * and ours will be on the next poll.
+ */
+REGPRM1 static void __fd_clo(int fd)
+{
+	unsigned long m = polled_mask[fd];
+	struct uring *r;
+	int i;
+
+	for (i = global.nbthread - 1; i >= 0; i--) {
+		if (!(m & (1UL << i)) || !uring_fds[i])
+			continue;
+
+		r = &urings[i];
+		HA_SPIN_LOCK(URING_LOCK, &r->lock);
+		if (uring_fds[i][fd].events) {
+			uring_poll_remove(r, fd, &uring_fds[i][fd]);
+			if (i != tid)
+				uring_enter(r, 0, 0);
+		}
+		HA_SPIN_UNLOCK(URING_LOCK, &r->lock);
+		_HA_ATOMIC_AND(&polled_mask[fd], ~(1UL << i));
+	}
+}
+
+/* Queues the poll request changes of <fd> for the current thread. An unchanged
+ * request is armed again since this is how the edge-triggered poller is asked
+ * to check the FD's readiness again. The ring's lock must be held.
+ */
+static void _update_fd(int fd)
+{
+	struct uring *r = &urings[tid];
+	struct uring_fd *st = &uring_fds[tid][fd];
+	struct io_uring_sqe *sqe;
+	unsigned int events = 0;
+	int en;
+
+	en = fdtab[fd].state;
+
+	if (fdtab[fd].thread_mask & tid_bit) {
+		if (en & FD_EV_POLLED_R)
+			events |= POLLIN | POLLRDHUP;
+
+		if (en & FD_EV_POLLED_W)
+			events |= POLLOUT;
+	}
+
+	if (!events) {
+		if (st->events) {
+			/* fd removed from poll list */
+			uring_poll_remove(r, fd, st);
+			_HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+		}
+		return;
+	}
+
+	sqe = uring_get_sqe(r);
+	if (!sqe)
+		return;
+
+	if (!st->events) {
+		/* new fd in the poll list */
+		st->arm = (st->arm + 1) & URING_ARM_MASK;
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		st->add_flags = atleast2(fdtab[fd].thread_mask) ? 0 : IORING_POLL_ADD_MULTI;
+		sqe->len = st->add_flags;
+		sqe->user_data = uring_ud(fd, st->arm);
+		_HA_ATOMIC_OR(&polled_mask[fd], tid_bit);
+	}
+	else {
+		/* fd status changed or must be checked again */
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = uring_ud(fd, st->arm);
+		/* the update flags replace the add ones, so a multishot
+		 * request must say so again or it would become oneshot.
+		 */
+		sqe->len = IORING_POLL_UPDATE_EVENTS | st->add_flags;
+		sqe->user_data = uring_ud(fd, st->arm) | URING_UD_UPDATE;
+	}
+	sqe->poll32_events = uring_poll_events(events);
+	uring_commit(r);
+	st->events = events;
+}
+
+/* The poll request of <fd> described by <st> is not active anymore. It is
+ * armed again if the FD is still polled, unless it was cancelled.
+ */
+static void uring_poll_ended(int fd, struct uring_fd *st, int res)
+{
+	st->events = 0;
+	_HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+	if (res != -ECANCELED && fdtab[fd].owner)
+		updt_fd_polling(fd);
+}
+
+/*
+ * Linux io_uring poller
+ */
+REGPRM3 static void _do_poll(struct poller *p, int exp, int wake)
+{
+	struct uring *r = &urings[tid];
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	int status;
+	int fd;
+	int count;
+	int updt_idx;
+	int wait_time;
+	int old_fd;
+
+	HA_SPIN_LOCK(URING_LOCK, &r->lock);
+
+	/* first, scan the update list to find polling changes */
+	for (updt_idx = 0; updt_idx < fd_nbupdt; updt_idx++) {
+		fd = fd_updt[updt_idx];
+
+		_HA_ATOMIC_AND(&fdtab[fd].update_mask, ~tid_bit);
+		if (!fdtab[fd].owner) {
+			activity[tid].poll_drop++;
+			continue;
+		}
+
+		_update_fd(fd);
+	}
+	fd_nbupdt = 0;
+	/* Scan the global update list */
+	for (old_fd = fd = update_list.first; fd != -1; fd = fdtab[fd].update.next) {
+		if (fd == -2) {
+			fd = old_fd;
+			continue;
+		}
+		else if (fd <= -3)
+			fd = -fd -4;
+		if (fd == -1)
+			break;
+		if (fdtab[fd].update_mask & tid_bit)
+			done_update_polling(fd);
+		else
+			continue;
+		if (!fdtab[fd].owner)
+			continue;
+		_update_fd(fd);
+	}
+
+	HA_SPIN_UNLOCK(URING_LOCK, &r->lock);
+
+	thread_harmless_now();
+
+	/* now let's submit the changes and wait for polled events */
+	wait_time = wake ? 0 : compute_poll_timeout(exp);
+	tv_entering_poll();
+	activity_count_runtime();
+	do {
+		int timeout = (global.tune.options & GTUNE_BUSY_POLLING) ? 0 : wait_time;
+
+		status = uring_enter(r, 1, timeout);
+		tv_update_date(timeout, status);
+
+		if (status)
+			break;
+		if (timeout || !wait_time)
+			break;
+		if (signal_queue_len || wake)
+			break;
+		if (tick_isset(exp) && tick_is_expired(exp, now_ms))
+			break;
+	} while (1);
+
+	tv_leaving_poll(wait_time, status);
+
+	thread_harmless_end();
+
+	/* process polled events */
+
+	if (status > global.tune.maxpollevents)
+		status = global.tune.maxpollevents;
+
+	head = *r->cq_head;
+	for (count = 0; count < status; count++, head++) {
+		struct uring_fd *st;
+		unsigned int n, e;
+		__u64 ud;
+		int res;
+
+		cqe = &r->cqes[head & *r->cq_mask];
+		ud  = cqe->user_data;
+		res = cqe->res;
+
+		if (ud == URING_UD_REMOVE)
+			continue;
+
+		fd = (unsigned int)ud;
+		st = &uring_fds[tid][fd];
+
+		if (((ud >> 32) & URING_ARM_MASK) != st->arm || !st->events) {
+			/* left over from a previous poll request */
+			continue;
+		}
+
+		if (ud & URING_UD_UPDATE) {
+			/* the poll request could not be updated. It has usually
+			 * ended already, otherwise it is replaced.
+			 */
+			if (res < 0) {
+				if (res != -ENOENT) {
+					HA_SPIN_LOCK(URING_LOCK, &r->lock);
+					uring_poll_remove(r, fd, st);
+					HA_SPIN_UNLOCK(URING_LOCK, &r->lock);
+				}
+				uring_poll_ended(fd, st, res);
+			}
+			continue;
+		}
+
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			uring_poll_ended(fd, st, res);
+
+		if (res <= 0)
+			continue;
+
+		if (!fdtab[fd].owner) {
+			activity[tid].poll_dead++;
+			continue;
+		}
+
+		if (!(fdtab[fd].thread_mask & tid_bit)) {
+			/* FD has been migrated */
+			activity[tid].poll_skip++;
+			if (st->events) {
+				HA_SPIN_LOCK(URING_LOCK, &r->lock);
+				uring_poll_remove(r, fd, st);
+				HA_SPIN_UNLOCK(URING_LOCK, &r->lock);
+				_HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+			}
+			continue;
+		}
+
+		e = res;
+
+		/* it looks complicated but gcc can optimize it away when constants
+		 * have same values... In fact it depends on gcc :-(
+		 */
+		if (POLLIN == FD_POLL_IN && POLLOUT == FD_POLL_OUT &&
+		    POLLPRI == FD_POLL_PRI && POLLERR == FD_POLL_ERR &&
+		    POLLHUP == FD_POLL_HUP) {
+			n = e & (POLLIN|POLLOUT|POLLPRI|POLLERR|POLLHUP);
+		}
+		else {
+			n =	((e & POLLIN ) ? FD_POLL_IN  : 0) |
+				((e & POLLPRI) ? FD_POLL_PRI : 0) |
+				((e & POLLOUT) ? FD_POLL_OUT : 0) |
+				((e & POLLERR) ? FD_POLL_ERR : 0) |
+				((e & POLLHUP) ? FD_POLL_HUP : 0);
+		}
+
+		/* always remap RDHUP to HUP as they're used similarly */
+		if (e & POLLRDHUP) {
+			_HA_ATOMIC_OR(&cur_poller.flags, HAP_POLL_F_RDHUP);
+			n |= FD_POLL_HUP;
+		}
+		fd_update_events(fd, n);
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	/* the caller will take care of cached events */
+}
+
+/* Releases ring <r> */
+static void uring_release(struct uring *r)
+{
+	if (r->fd < 0)
+		return;
+
+	if (r->sqes)
+		munmap(r->sqes, r->sq_entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_len);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_len);
+	close(r->fd);
+	HA_SPIN_DESTROY(&r->lock);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+/* Creates ring <r> and maps its queues. Returns 1 if OK, otherwise 0. The
+ * kernel must support waiting with a timeout (5.11) and multishot polls,
+ * which came with resource tags (5.13).
+ */
+static int uring_create(struct uring *r)
+{
+	struct io_uring_params params;
+	void *ptr;
+	unsigned int i;
+
+	memset(r, 0, sizeof(*r));
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+
+	r->fd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+	if (r->fd < 0) {
+		r->fd = -1;
+		return 0;
+	}
+	HA_SPIN_INIT(&r->lock);
+
+	if (!(params.features & IORING_FEAT_EXT_ARG) ||
+	    !(params.features & IORING_FEAT_RSRC_TAGS))
+		goto fail;
+
+	r->sq_entries  = params.sq_entries;
+	r->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	r->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_ring_len = r->cq_ring_len = MAX(r->sq_ring_len, r->cq_ring_len);
+
+	ptr = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	r->sq_ring = ptr;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ptr = r->sq_ring;
+	else
+		ptr = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	r->cq_ring = ptr;
+
+	ptr = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto fail;
+	r->sqes = ptr;
+
+	r->sq_head = (void *)(r->sq_ring + params.sq_off.head);
+	r->sq_tail = (void *)(r->sq_ring + params.sq_off.tail);
+	r->sq_mask = (void *)(r->sq_ring + params.sq_off.ring_mask);
+	r->cq_head = (void *)(r->cq_ring + params.cq_off.head);
+	r->cq_tail = (void *)(r->cq_ring + params.cq_off.tail);
+	r->cq_mask = (void *)(r->cq_ring + params.cq_off.ring_mask);
+	r->cqes    = (void *)(r->cq_ring + params.cq_off.cqes);
+
+	/* entries are always submitted in order */
+	for (i = 0; i < params.sq_entries; i++)
+		((unsigned int *)(r->sq_ring + params.sq_off.array))[i] = i;
+
+	return 1;
+ fail:
+	uring_release(r);
+	return 0;
+}
+
+static int init_uring_per_thread()
+{
+	int fd;
+
+	uring_fds[tid] = calloc(global.maxsock, sizeof(**uring_fds));
+	if (uring_fds[tid] == NULL)
+		goto fail_alloc;
+
+	if (MAX_THREADS > 1 && tid) {
+		if (!uring_create(&urings[tid]))
+			goto fail_ring;
+	}
+
+	/* we may have to register events on the ring of this thread. Let's
+	 * just mark them as updated, the poller will do the rest.
+	 */
+	for (fd = 0; fd < global.maxsock; fd++)
+		updt_fd_polling(fd);
+
+	return 1;
+ fail_ring:
+	free(uring_fds[tid]);
+	uring_fds[tid] = NULL;
+ fail_alloc:
+	return 0;
+}
+
+static void deinit_uring_per_thread()
+{
+	if (MAX_THREADS > 1 && tid)
+		uring_release(&urings[tid]);
+
+	free(uring_fds[tid]);
+	uring_fds[tid] = NULL;
+}
+
+/*
+ * Initialization of the io_uring poller.
+ * Returns 0 in case of failure, non-zero in case of success. If it fails, it
+ * disables the poller by setting its pref to 0.
+ */
+REGPRM1 static int _do_init(struct poller *p)
+{
+	p->private = NULL;
+
+	if (!uring_create(&urings[tid]))
+		goto fail_ring;
+
+	hap_register_per_thread_init(init_uring_per_thread);
+	hap_register_per_thread_deinit(deinit_uring_per_thread);
+
+	return 1;
+
+ fail_ring:
+	p->pref = 0;
+	return 0;
+}
+
+/*
+ * Termination of the io_uring poller.
+ * Memory is released and the poller is marked as unselectable.
+ */
+REGPRM1 static void _do_term(struct poller *p)
+{
+	uring_release(&urings[tid]);
+
+	p->private = NULL;
+	p->pref = 0;
+}
+
+/*
+ * Check that the poller works.
+ * Returns 1 if OK, otherwise 0.
+ */
+REGPRM1 static int _do_test(struct poller *p)
+{
+	struct uring r;
+
+	if (!uring_create(&r))
+		return 0;
+	uring_release(&r);
+	return 1;
+}
+
+/*
+ * Recreate the ring after a fork(). Returns 1 if OK, otherwise 0. The ring's
+ * memory is shared, so processes must not keep using the same one.
+ */
+REGPRM1 static int _do_fork(struct poller *p)
+{
+	uring_release(&urings[tid]);
+	return uring_create(&urings[tid]);
+}
+
+/*
+ * It is a constructor, which means that it will automatically be called before
+ * main(). This is GCC-specific but it works at least since 2.95.
+ * Special care must be taken so that it does not need any uninitialized data.
+ */
+__attribute__((constructor))
+static void _do_register(void)
+{
+	struct poller *p;
+	int i;
+
+	if (nbpollers >= MAX_POLLERS)
+		return;
+
+	for (i = 0; i < MAX_THREADS; i++)
+		urings[i].fd = -1;
+
+	p = &pollers[nbpollers++];
+
+	p->name = "uring";
+	p->pref = 350;
+	p->flags = HAP_POLL_F_ET;
+	p->private = NULL;
+
+	p->clo  = __fd_clo;
+	p->test = _do_test;
+	p->init = _do_init;
+	p->term = _do_term;
+	p->poll = _do_poll;
+	p->fork = _do_fork;
+}
+
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -425,8 +425,19 @@ static inline void fdlist_process_cached_events(volatile struct fdlist *fdlist)
 		if (fd == -1)
 			break;
 		old_fd = fd;
-		if (!(fdtab[fd].thread_mask & tid_bit))
+		if (!(fdtab[fd].thread_mask & tid_bit)) {
+			if (fdlist == &fd_cache_local[tid]) {
+				/* the FD was taken over by another thread
+				 * while its event was pending here, pass it
+				 * along and resume on next call.
+				 */
+				fd_rm_from_fd_list(fdlist, fd, offsetof(struct fdtab, cache));
+				fd_update_cache(fd);
+				_HA_ATOMIC_OR(&fd_cache_mask, tid_bit);
+				break;
+			}
 			continue;
+		}
 		if (fdtab[fd].cache.next < -3)
 			continue;
 
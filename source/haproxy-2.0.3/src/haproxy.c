@@ -111,6 +111,7 @@
 #include <proto/hdr_idx.h>
 #include <proto/hlua.h>
 #include <proto/http_rules.h>
+#include <proto/lb_chash.h>
 #include <proto/listener.h>
 #include <proto/log.h>
 #include <proto/mworker.h>
@@ -157,7 +158,7 @@ struct global global = {
 		 }
 	},
 	.tune = {
-		.options = GTUNE_LISTENER_MQ,
+		.options = GTUNE_LISTENER_MQ | GTUNE_IDLE_POOL_SHARED,
 		.bufsize = (BUFSIZE + 2*sizeof(void *) - 1) & -(2*sizeof(void *)),
 		.maxrewrite = -1,
 		.chksize = (BUFSIZE + 2*sizeof(void *) - 1) & -(2*sizeof(void *)),
@@ -511,6 +512,9 @@ static void usage(char *name)
 #if defined(USE_EVPORTS)
 		"        -dv disables event ports usage even when available\n"
 #endif
+#if defined(USE_URING)
+		"        -du disables io_uring usage even when available\n"
+#endif
 #if defined(USE_POLL)
 		"        -dp disables poll() usage even when available\n"
 #endif
@@ -1409,6 +1413,9 @@ static void init(int argc, char **argv)
 #if defined(USE_EVPORTS)
 	global.tune.options |= GTUNE_USE_EVPORTS;
 #endif
+#if defined(USE_URING)
+	global.tune.options |= GTUNE_USE_URING;
+#endif
 #if defined(USE_LINUX_SPLICE)
 	global.tune.options |= GTUNE_USE_SPLICE;
 #endif
@@ -1457,6 +1464,10 @@ static void init(int argc, char **argv)
 			else if (*flag == 'd' && flag[1] == 'v')
 				global.tune.options &= ~GTUNE_USE_EVPORTS;
 #endif
+#if defined(USE_URING)
+			else if (*flag == 'd' && flag[1] == 'u')
+				global.tune.options &= ~GTUNE_USE_URING;
+#endif
 #if defined(USE_LINUX_SPLICE)
 			else if (*flag == 'd' && flag[1] == 'S')
 				global.tune.options &= ~GTUNE_USE_SPLICE;
@@ -2089,6 +2100,9 @@ static void init(int argc, char **argv)
 	if (!(global.tune.options & GTUNE_USE_EVPORTS))
 		disable_poller("evports");
 
+	if (!(global.tune.options & GTUNE_USE_URING))
+		disable_poller("uring");
+
 	if (!(global.tune.options & GTUNE_USE_EPOLL))
 		disable_poller("epoll");
 
@@ -2218,6 +2232,8 @@ void deinit(void)
 		free(p->conf.uif_file);
 		if ((p->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MAP)
 			free(p->lbprm.map.srv);
+		else if ((p->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
+			chash_deinit_rings(p);
 
 		if (p->conf.logformat_sd_string != default_rfc5424_sd_log_format)
 			free(p->conf.logformat_sd_string);
@@ -2542,7 +2558,7 @@ static void run_poll_loop()
 		else {
 			_HA_ATOMIC_OR(&sleeping_thread_mask, tid_bit);
 			__ha_barrier_atomic_store();
-			if (global_tasks_mask & tid_bit) {
+			if (task_per_thread[tid].inbox) {
 				activity[tid].wake_tasks++;
 				_HA_ATOMIC_AND(&sleeping_thread_mask, ~tid_bit);
 			} else
@@ -25,6 +25,7 @@
 #include <types/global.h>
 #include <types/server.h>
 
+#include <proto/activity.h>
 #include <proto/backend.h>
 #include <proto/queue.h>
 
@@ -109,6 +110,101 @@ static inline void chash_queue_dequeue_srv(struct server *s)
 	}
 }
 
+/* Returns non-zero if no other thread may still be looking up ring <r>,
+ * which means that each of them either completed a loop since <r> was
+ * replaced, or is currently harmless.
+ */
+static inline int chash_ring_unused(const struct chash_ring *r)
+{
+	int thr;
+
+	for (thr = 0; thr < global.nbthread && thr < MAX_THREADS; thr++) {
+		if (thr == tid)
+			continue;
+		if (activity[thr].loops == r->loops[thr] &&
+		    !(threads_harmless_mask & (1UL << thr)))
+			return 0;
+	}
+	return 1;
+}
+
+/* Builds a new ring from the tree in use for hash lookups in backend <p> and
+ * publishes it. The replaced ring is freed later, once unused. If memory is
+ * lacking, the previous ring is kept until the next change.
+ *
+ * The lbprm's lock must be held.
+ */
+static void chash_update_ring(struct proxy *p)
+{
+	struct chash_ring *ring, *old, **prev;
+	struct eb_root *root = NULL;
+	struct eb32_node *node;
+	unsigned int count = 0;
+	int thr;
+
+	if (p->srv_act)
+		root = &p->lbprm.chash.act;
+	else if (!p->lbprm.fbck && p->srv_bck)
+		root = &p->lbprm.chash.bck;
+
+	if (root) {
+		for (node = eb32_first(root); node; node = eb32_next(node))
+			count++;
+	}
+
+	ring = malloc(sizeof(*ring) + count * (sizeof(*ring->srvs) + sizeof(*ring->keys)));
+	if (!ring)
+		return;
+
+	ring->count = count;
+	ring->srvs = (struct server **)(ring + 1);
+	ring->keys = (unsigned int *)(ring->srvs + count);
+	ring->fbck = root ? NULL : p->lbprm.fbck;
+	ring->next = NULL;
+
+	count = 0;
+	if (root) {
+		for (node = eb32_first(root); node; node = eb32_next(node)) {
+			ring->keys[count] = node->key;
+			ring->srvs[count] = eb32_entry(node, struct tree_occ, node)->server;
+			count++;
+		}
+	}
+
+	old = HA_ATOMIC_XCHG(&p->lbprm.chash.ring, ring);
+	if (old) {
+		for (thr = 0; thr < global.nbthread && thr < MAX_THREADS; thr++)
+			old->loops[thr] = activity[thr].loops;
+		old->next = p->lbprm.chash.retired;
+		p->lbprm.chash.retired = old;
+	}
+
+	prev = &p->lbprm.chash.retired;
+	while ((old = *prev) != NULL) {
+		if (chash_ring_unused(old)) {
+			*prev = old->next;
+			free(old);
+		}
+		else
+			prev = &old->next;
+	}
+}
+
+/* Releases the current and retired rings of proxy <p>, on deinit only since
+ * they may otherwise still be in use.
+ */
+void chash_deinit_rings(struct proxy *p)
+{
+	struct chash_ring *ring;
+
+	free(p->lbprm.chash.ring);
+	p->lbprm.chash.ring = NULL;
+	while ((ring = p->lbprm.chash.retired) != NULL) {
+		p->lbprm.chash.retired = ring->next;
+		free(ring);
+	}
+}
+
 /* This function updates the server trees according to server <srv>'s new
  * state. It should be called when server <srv>'s status changes to down.
  * It is not important whether the server was already down or not. It is not
@@ -159,6 +255,7 @@ static void chash_set_server_status_down(struct server *srv)
 out_update_backend:
 	/* check/update tot_used, tot_weight */
 	update_backend_weight(p);
+	chash_update_ring(p);
  out_update_state:
 	srv_lb_commit_status(srv);
 
@@ -221,6 +318,7 @@ static void chash_set_server_status_up(struct server *srv)
  out_update_backend:
 	/* check/update tot_used, tot_weight */
 	update_backend_weight(p);
+	chash_update_ring(p);
  out_update_state:
 	srv_lb_commit_status(srv);
 
@@ -275,6 +373,7 @@ static void chash_update_server_weight(struct server *srv)
 		p->lbprm.tot_wact += srv->next_eweight - srv->cur_eweight;
 
 	update_backend_weight(p);
+	chash_update_ring(p);
 	srv_lb_commit_status(srv);
 
 	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
@@ -290,16 +389,23 @@ int chash_server_is_eligible(struct server *s)
 	/* The total number of slots to allocate is the total number of outstanding requests
 	 * (including the one we're about to make) times the load-balance-factor, rounded up.
 	 */
+	unsigned tot_weight = s->proxy->lbprm.tot_weight;
 	unsigned tot_slots = ((s->proxy->served + 1) * s->proxy->lbprm.hash_balance_factor + 99) / 100;
-	unsigned slots_per_weight = tot_slots / s->proxy->lbprm.tot_weight;
-	unsigned remainder = tot_slots % s->proxy->lbprm.tot_weight;
+	unsigned slots_per_weight, remainder, slots;
+
+	/* lookups don't hold the lbprm lock, the weights may be changing */
+	if (!tot_weight)
+		return 1;
+
+	slots_per_weight = tot_slots / tot_weight;
+	remainder = tot_slots % tot_weight;
 
 	/* Allocate a whole number of slots per weight unit... */
-	unsigned slots = s->cur_eweight * slots_per_weight;
+	slots = s->cur_eweight * slots_per_weight;
 
 	/* And then distribute the rest among servers proportionally to their weight. */
-	slots += ((s->cumulative_weight + s->cur_eweight) * remainder) / s->proxy->lbprm.tot_weight
-		- (s->cumulative_weight * remainder) / s->proxy->lbprm.tot_weight;
+	slots += ((s->cumulative_weight + s->cur_eweight) * remainder) / tot_weight
+		- (s->cumulative_weight * remainder) / tot_weight;
 
 	/* But never leave a server with 0. */
 	if (slots == 0)
@@ -309,77 +415,65 @@ int chash_server_is_eligible(struct server *s)
 }
 
 /*
- * This function returns the running server from the CHASH tree, which is at
+ * This function returns the running server from the CHASH ring, which is at
  * the closest distance from the value of <hash>. Doing so ensures that even
  * with a well imbalanced hash, if some servers are close to each other, they
  * will still both receive traffic. If any server is found, it will be returned.
  * It will also skip server <avoid> if the hash result ends on this one.
- * If no valid server is found, NULL is returned.
+ * If no valid server is found, NULL is returned. No lock is needed.
  */
 struct server *chash_get_server_hash(struct proxy *p, unsigned int hash, const struct server *avoid)
 {
-	struct eb32_node *next, *prev;
-	struct server *nsrv, *psrv;
-	struct eb_root *root;
+	const struct chash_ring *ring;
+	struct server *nsrv;
+	unsigned int next, prev, lo, hi, mid;
 	unsigned int dn, dp;
 	int loop;
 
-	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	ring = HA_ATOMIC_LOAD(&p->lbprm.chash.ring);
+	if (!ring)
+		return NULL;
 
-	if (p->srv_act)
-		root = &p->lbprm.chash.act;
-	else if (p->lbprm.fbck) {
-		nsrv = p->lbprm.fbck;
-		goto out;
-	}
-	else if (p->srv_bck)
-		root = &p->lbprm.chash.bck;
-	else {
-		nsrv = NULL;
-		goto out;
-	}
+	if (!ring->count)
+		return ring->fbck;
 
-	/* find the node after and the node before */
-	next = eb32_lookup_ge(root, hash);
-	if (!next)
-		next = eb32_first(root);
-	if (!next) {
-		nsrv = NULL; /* tree is empty */
-		goto out;
+	/* find the first key at or after the hash, wrapping to the
+	 * first one, and the one before
+	 */
+	lo = 0;
+	hi = ring->count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ring->keys[mid] < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-
-	prev = eb32_prev(next);
-	if (!prev)
-		prev = eb32_last(root);
-
-	nsrv = eb32_entry(next, struct tree_occ, node)->server;
-	psrv = eb32_entry(prev, struct tree_occ, node)->server;
+	next = (lo < ring->count) ? lo : 0;
+	prev = next ? next - 1 : ring->count - 1;
 
 	/* OK we're located between two servers, let's
 	 * compare distances between hash and the two servers
 	 * and select the closest server.
 	 */
-	dp = hash - prev->key;
-	dn = next->key - hash;
+	dp = hash - ring->keys[prev];
+	dn = ring->keys[next] - hash;
 
-	if (dp <= dn) {
+	if (dp <= dn)
 		next = prev;
-		nsrv = psrv;
-	}
+
+	nsrv = ring->srvs[next];
 
 	loop = 0;
 	while (nsrv == avoid || (p->lbprm.hash_balance_factor && !chash_server_is_eligible(nsrv))) {
-		next = eb32_next(next);
-		if (!next) {
-			next = eb32_first(root);
+		if (++next == ring->count) {
+			next = 0;
 			if (++loop > 1) // protection against accidental loop
 				break;
 		}
-		nsrv = eb32_entry(next, struct tree_occ, node)->server;
+		nsrv = ring->srvs[next];
 	}
 
- out:
-	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
 	return nsrv;
 }
 
@@ -487,6 +581,8 @@ void chash_init_server_tree(struct proxy *p)
 	p->lbprm.chash.act = init_head;
 	p->lbprm.chash.bck = init_head;
 	p->lbprm.chash.last = NULL;
+	p->lbprm.chash.ring = NULL;
+	p->lbprm.chash.retired = NULL;
 
 	/* queue active and backup servers in two distinct groups */
 	for (srv = p->srv; srv; srv = srv->next) {
@@ -503,4 +599,6 @@ void chash_init_server_tree(struct proxy *p)
 		if (srv_currently_usable(srv))
 			chash_queue_dequeue_srv(srv);
 	}
+
+	chash_update_ring(p);
 }
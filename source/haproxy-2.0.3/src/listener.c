@@ -382,11 +382,11 @@ int resume_listener(struct listener *l)
 		goto end;
 	}
 
-	if (!(thread_mask(l->bind_conf->bind_thread) & tid_bit)) {
+	if (!(listener_thread_mask(l) & tid_bit)) {
 		/* we're not allowed to touch this listener's FD, let's requeue
 		 * the listener into one of its owning thread's queue instead.
 		 */
-		int first_thread = my_flsl(thread_mask(l->bind_conf->bind_thread)) - 1;
+		int first_thread = my_flsl(listener_thread_mask(l)) - 1;
 		work_list_add(&local_listener_queue[first_thread], &l->wait_queue);
 		goto end;
 	}
@@ -594,6 +594,75 @@ void delete_listener(struct listener *listener)
 	HA_SPIN_UNLOCK(LISTENER_LOCK, &listener->lock);
 }
 
+/* Splits each TCP listener of bind_conf <bc> into shards sharing the same
+ * address with SO_REUSEPORT, each bound to a subset of the bind_conf's threads.
+ * The number of shards is the number of threads, possibly limited by
+ * bc->shards, and threads are distributed round-robin over the shards. The new
+ * listeners inherit the settings of the one they are cloned from, except its
+ * ID. A shard running on a single thread accepts its connections itself
+ * without going through the accept queues. Returns 0 on success, otherwise
+ * non-zero with the error message set in <err>.
+ */
+int bind_conf_shard_listeners(struct bind_conf *bc, char **err)
+{
+	unsigned long shard_mask[MAX_THREADS];
+	unsigned long mask;
+	struct listener *l, *new, *last;
+	int nbshards, shard, thr, i;
+
+	mask = thread_mask(bc->bind_thread) & all_threads_mask;
+	nbshards = my_popcountl(mask);
+	if (bc->shards > 0 && nbshards > bc->shards)
+		nbshards = bc->shards;
+
+	if (nbshards < 2)
+		return 0;
+
+	memset(shard_mask, 0, sizeof(shard_mask));
+	for (thr = i = 0; thr < MAX_THREADS; thr++) {
+		if (mask & (1UL << thr))
+			shard_mask[i++ % nbshards] |= 1UL << thr;
+	}
+
+	/* only walk the original listeners, not the ones we're appending */
+	last = LIST_PREV(&bc->listeners, struct listener *, by_bind);
+	list_for_each_entry(l, &bc->listeners, by_bind) {
+		if ((l->addr.ss_family != AF_INET && l->addr.ss_family != AF_INET6) ||
+		    (l->options & LI_O_INHERITED)) {
+			memprintf(err, "'shards' is only supported on TCP sockets which are not inherited");
+			return 1;
+		}
+
+		l->bind_thread = shard_mask[0];
+		for (shard = 1; shard < nbshards; shard++) {
+			if (!create_listeners(bc, &l->addr, get_host_port(&l->addr), get_host_port(&l->addr), -1, 0, err))
+				return 1;
+
+			/* each shard holds its own socket */
+			global.maxsock++;
+
+			new = LIST_PREV(&bc->listeners, struct listener *, by_bind);
+			new->bind_thread = shard_mask[shard];
+			new->options    |= l->options;
+			new->nice        = l->nice;
+			new->maxconn     = l->maxconn;
+			new->backlog     = l->backlog;
+			new->maxaccept   = l->maxaccept;
+			new->maxseg      = l->maxseg;
+			new->tcp_ut      = l->tcp_ut;
+			new->netns       = l->netns;
+			if (l->interface)
+				new->interface = strdup(l->interface);
+			if (l->name)
+				new->name = strdup(l->name);
+		}
+
+		if (l == last)
+			break;
+	}
+	return 0;
+}
+
 /* Returns a suitable value for a listener's backlog. It uses the listener's,
  * otherwise the frontend's backlog, otherwise the listener's maxconn,
  * otherwise the frontend's maxconn, otherwise 1024.
@@ -877,7 +946,7 @@ void listener_accept(int fd)
 		next_actconn = 0;
 
 #if defined(USE_THREAD)
-		mask = thread_mask(l->bind_conf->bind_thread) & all_threads_mask;
+		mask = listener_thread_mask(l) & all_threads_mask;
 		if (atleast2(mask) && (global.tune.options & GTUNE_LISTENER_MQ)) {
 			struct accept_queue_ring *ring;
 			unsigned int t, t0, t1, t2;
@@ -1413,6 +1482,37 @@ static int bind_parse_proto(char **args, int cur_arg, struct proxy *px, struct b
 	return 0;
 }
 
+/* parse the "shards" bind keyword */
+static int bind_parse_shards(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+	int val;
+
+	if (px == global.stats_fe) {
+		memprintf(err, "'%s' : not supported on stats sockets", args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	if (!*args[cur_arg + 1]) {
+		memprintf(err, "'%s' : missing value", args[cur_arg]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	if (strcmp(args[cur_arg + 1], "by-thread") == 0) {
+		conf->shards = -1;
+		return 0;
+	}
+
+	val = atol(args[cur_arg + 1]);
+	if (val < 1 || val > MAX_THREADS) {
+		memprintf(err, "'%s' : expects 'by-thread' or a value between 1 and %d, found '%s'",
+		          args[cur_arg], MAX_THREADS, args[cur_arg + 1]);
+		return ERR_ALERT | ERR_FATAL;
+	}
+
+	conf->shards = val;
+	return 0;
+}
+
 /* config parser for global "tune.listener.multi-queue", accepts "on" or "off" */
 static int cfg_parse_tune_listener_mq(char **args, int section_type, struct proxy *curpx,
                                       struct proxy *defpx, const char *file, int line,
@@ -1469,6 +1569,7 @@ static struct bind_kw_list bind_kws = { "ALL", { }, {
 	{ "nice",         bind_parse_nice,         1 }, /* set nice of listening socket */
 	{ "process",      bind_parse_process,      1 }, /* set list of allowed process for this socket */
 	{ "proto",        bind_parse_proto,        1 }, /* set the proto to use for all incoming connections */
+	{ "shards",       bind_parse_shards,       1 }, /* open one SO_REUSEPORT socket per thread or group of threads */
 	{ /* END */ },
 }};
 
@@ -10,6 +10,7 @@
  *
  */
 #include <errno.h>
+#include <sys/mman.h>
 
 #include <types/applet.h>
 #include <types/cli.h>
@@ -54,6 +55,238 @@ static int mem_fail_rate = 0;
 static int mem_should_fail(const struct pool_head *);
 #endif
 
+#ifdef CONFIG_HAP_POOL_SLABS
+/* room taken by the slab header, keeping objects cache-line aligned */
+#define POOL_SLAB_HDR ((sizeof(struct pool_slab) + 63) & -64)
+
+/* pools with fewer objects per slab keep using malloc() */
+#define POOL_SLAB_MIN_OBJS 8
+
+/* minimum number of objects carved on each refill */
+#define POOL_REFILL_BATCH 16
+
+static int pool_hugepages = 0;     /* tune.pool-hugepages */
+static size_t pool_page_size = 4096;
+
+/* returns the distance between two consecutive objects of pool <pool> */
+static inline size_t pool_slab_stride(const struct pool_head *pool)
+{
+	return (pool->size + POOL_EXTRA + 15) & -16;
+}
+
+/* returns the slab holding object <ptr> */
+static inline struct pool_slab *pool_slab_of(void *ptr)
+{
+	return (struct pool_slab *)((uintptr_t)ptr & -(uintptr_t)CONFIG_HAP_POOL_SLAB_SIZE);
+}
+
+/* Maps a new slab, aligned on its size, and returns it, or NULL if the
+ * memory is lacking. The trick is to map twice the size and to trim what
+ * is outside of the aligned part.
+ */
+static struct pool_slab *pool_slab_map()
+{
+	size_t size = CONFIG_HAP_POOL_SLAB_SIZE;
+	char *area, *slab;
+
+	area = mmap(NULL, 2 * size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		return NULL;
+
+	slab = (char *)(((uintptr_t)area + size - 1) & -(uintptr_t)size);
+	if (slab > area)
+		munmap(area, slab - area);
+	munmap(slab + size, area + size - slab);
+#ifdef MADV_HUGEPAGE
+	if (pool_hugepages)
+		madvise(slab, size, MADV_HUGEPAGE);
+#endif
+	return (struct pool_slab *)slab;
+}
+
+/* Carves up to <count> objects for pool <pool> from its slabs, mapping new
+ * ones as needed, and chains them through POOL_LINK from <*head> to <*tail>.
+ * Slabs already partially carved are used first. Returns the number of
+ * objects, which is 0 only if no slab could be mapped.
+ */
+static unsigned int pool_slab_carve(struct pool_head *pool, unsigned int count, void **head, void **tail)
+{
+	struct pool_slab *slab;
+	unsigned int n = 0;
+	void *ptr;
+
+	*head = *tail = NULL;
+	HA_SPIN_LOCK(POOL_LOCK, &pool->slab_lock);
+	while (n < count) {
+		if (LIST_ISEMPTY(&pool->partial)) {
+			if (!LIST_ISEMPTY(&pool->empty)) {
+				slab = LIST_NEXT(&pool->empty, struct pool_slab *, list);
+				LIST_DEL(&slab->list);
+				pool->empty_slabs--;
+			}
+			else {
+				slab = pool_slab_map();
+				if (!slab)
+					break;
+				slab->free = NULL;
+				slab->carved = slab->used = 0;
+				pool->slabs++;
+			}
+			LIST_ADD(&pool->partial, &slab->list);
+		}
+
+		slab = LIST_NEXT(&pool->partial, struct pool_slab *, list);
+		if (slab->free) {
+			ptr = slab->free;
+			slab->free = *(void **)ptr;
+		}
+		else
+			ptr = (char *)slab + POOL_SLAB_HDR + slab->carved++ * pool_slab_stride(pool);
+		slab->used++;
+
+		if (!slab->free && slab->carved == pool->per_slab) {
+			LIST_DEL(&slab->list);
+			LIST_ADDQ(&pool->full, &slab->list);
+		}
+
+		if (*tail)
+			*POOL_LINK(pool, *tail) = ptr;
+		else
+			*head = ptr;
+		*tail = ptr;
+		n++;
+	}
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool->slab_lock);
+	return n;
+}
+
+/* Gives object <ptr> of pool <pool> back to its slab. Once the pool owns no
+ * more object in a slab, the pages of this slab are returned to the OS, and
+ * it is kept mapped to be reused first.
+ */
+static void pool_slab_release(struct pool_head *pool, void *ptr)
+{
+	struct pool_slab *slab = pool_slab_of(ptr);
+
+	HA_SPIN_LOCK(POOL_LOCK, &pool->slab_lock);
+	if (!slab->free && slab->carved == pool->per_slab) {
+		LIST_DEL(&slab->list);
+		LIST_ADD(&pool->partial, &slab->list);
+	}
+	*(void **)ptr = slab->free;
+	slab->free = ptr;
+
+	if (!--slab->used) {
+		/* the first page holds the header */
+		madvise((char *)slab + pool_page_size, CONFIG_HAP_POOL_SLAB_SIZE - pool_page_size, MADV_DONTNEED);
+		slab->free = NULL;
+		slab->carved = 0;
+		LIST_DEL(&slab->list);
+		LIST_ADD(&pool->empty, &slab->list);
+		pool->empty_slabs++;
+	}
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool->slab_lock);
+}
+
+/* Unmaps the empty slabs of pool <pool> */
+static void pool_slab_unmap_empty(struct pool_head *pool)
+{
+	struct pool_slab *slab, *back;
+
+	HA_SPIN_LOCK(POOL_LOCK, &pool->slab_lock);
+	list_for_each_entry_safe(slab, back, &pool->empty, list) {
+		LIST_DEL(&slab->list);
+		munmap(slab, CONFIG_HAP_POOL_SLAB_SIZE);
+		pool->slabs--;
+		pool->empty_slabs--;
+	}
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool->slab_lock);
+}
+
+/* Carves at least enough objects for pool <pool> to have <avail> + 1 of them
+ * available, and never less than a batch, then returns one for immediate use
+ * and puts the other ones in the free list. The pool's lock must be held if
+ * the pool is not lockless. The semantics are those of __pool_refill_alloc().
+ */
+static void *pool_refill_from_slabs(struct pool_head *pool, unsigned int avail)
+{
+	void *head, *tail, *ptr;
+	unsigned int count = 1;
+	unsigned int got;
+	int failed = 0;
+
+	avail += pool->used + 1;
+	if (avail > pool->allocated)
+		count = avail - pool->allocated;
+	if (count < POOL_REFILL_BATCH)
+		count = POOL_REFILL_BATCH;
+
+	if (pool->limit) {
+		if (pool->allocated >= pool->limit) {
+			activity[tid].pool_fail++;
+			return NULL;
+		}
+		if (count > pool->limit - pool->allocated)
+			count = pool->limit - pool->allocated;
+	}
+
+	while (!(got = pool_slab_carve(pool, count, &head, &tail))) {
+		HA_ATOMIC_ADD(&pool->failed, 1);
+		if (failed) {
+			activity[tid].pool_fail++;
+			return NULL;
+		}
+		failed++;
+		pool_gc(pool);
+	}
+
+	ptr = head;
+	if (got > 1) {
+		head = *POOL_LINK(pool, ptr);
+#ifdef CONFIG_HAP_LOCKLESS_POOLS
+		{
+			void **free_list = pool->free_list;
+
+			do {
+				*POOL_LINK(pool, tail) = free_list;
+				__ha_barrier_store();
+			} while (_HA_ATOMIC_CAS(&pool->free_list, &free_list, head) == 0);
+			__ha_barrier_atomic_store();
+		}
+#else
+		*POOL_LINK(pool, tail) = (void *)pool->free_list;
+		pool->free_list = head;
+#endif
+	}
+
+	HA_ATOMIC_ADD(&pool->allocated, got);
+	HA_ATOMIC_ADD(&pool->used, 1);
+#ifdef DEBUG_MEMORY_POOLS
+	/* keep track of where the element was allocated from */
+	*POOL_LINK(pool, ptr) = (void *)pool;
+#endif
+	return ptr;
+}
+#endif /* CONFIG_HAP_POOL_SLABS */
+
+/* Releases area <ptr> of pool <pool> to the slab or the allocator it comes
+ * from.
+ */
+static inline void pool_release_area(struct pool_head *pool, void *ptr)
+{
+#ifdef CONFIG_HAP_POOL_SLABS
+	if (pool->flags & MEM_F_SLAB) {
+		pool_slab_release(pool, ptr);
+		return;
+	}
+#endif
+#ifdef CONFIG_HAP_LOCKLESS_POOLS
+	free(ptr);
+#else
+	pool_free_area(ptr, pool->size + POOL_EXTRA);
+#endif
+}
+
 /* Try to find an existing shared pool with the same characteristics and
  * returns it, otherwise creates this one. NULL is returned if no memory
  * is available for a new creation. Two flags are supported :
@@ -132,6 +365,15 @@ struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 		pool->size = size;
 		pool->flags = flags;
 		LIST_ADDQ(start, &pool->list);
+#ifdef CONFIG_HAP_POOL_SLABS
+		HA_SPIN_INIT(&pool->slab_lock);
+		LIST_INIT(&pool->partial);
+		LIST_INIT(&pool->full);
+		LIST_INIT(&pool->empty);
+		pool->per_slab = (CONFIG_HAP_POOL_SLAB_SIZE - POOL_SLAB_HDR) / pool_slab_stride(pool);
+		if (pool->per_slab >= POOL_SLAB_MIN_OBJS)
+			pool->flags |= MEM_F_SLAB;
+#endif
 
 		/* update per-thread pool cache if necessary */
 		idx = pool_get_index(pool);
@@ -164,6 +406,10 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 	int limit = pool->limit;
 	int allocated = pool->allocated, allocated_orig = allocated;
 
+#ifdef CONFIG_HAP_POOL_SLABS
+	if (pool->flags & MEM_F_SLAB)
+		return pool_refill_from_slabs(pool, avail);
+#endif
 	/* stop point */
 	avail += pool->used;
 
@@ -230,10 +476,14 @@ void pool_flush(struct pool_head *pool)
 		temp = next;
 		next = *POOL_LINK(pool, temp);
 		removed++;
-		free(temp);
+		pool_release_area(pool, temp);
 	}
 	pool->free_list = next;
 	_HA_ATOMIC_SUB(&pool->allocated, removed);
+#ifdef CONFIG_HAP_POOL_SLABS
+	if (pool->flags & MEM_F_SLAB)
+		pool_slab_unmap_empty(pool);
+#endif
 	/* here, we should have pool->allocate == pool->used */
 }
 
@@ -267,7 +517,7 @@ void pool_gc(struct pool_head *pool_ctx)
 			new.seq = cmp.seq + 1;
 			if (HA_ATOMIC_DWCAS(&entry->free_list, &cmp, &new) == 0)
 				continue;
-			free(cmp.free_list);
+			pool_release_area(entry, cmp.free_list);
 			_HA_ATOMIC_SUB(&entry->allocated, 1);
 		}
 	}
@@ -325,6 +575,10 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 #ifdef DEBUG_FAIL_ALLOC
 	if (mem_should_fail(pool))
 		return NULL;
+#endif
+#ifdef CONFIG_HAP_POOL_SLABS
+	if (pool->flags & MEM_F_SLAB)
+		return pool_refill_from_slabs(pool, avail);
 #endif
 	/* stop point */
 	avail += pool->used;
@@ -383,9 +637,13 @@ void pool_flush(struct pool_head *pool)
 		temp = next;
 		next = *POOL_LINK(pool, temp);
 		pool->allocated--;
-		pool_free_area(temp, pool->size + POOL_EXTRA);
+		pool_release_area(pool, temp);
 	}
 	pool->free_list = next;
+#ifdef CONFIG_HAP_POOL_SLABS
+	if (pool->flags & MEM_F_SLAB)
+		pool_slab_unmap_empty(pool);
+#endif
 	HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
 	/* here, we should have pool->allocate == pool->used */
 }
@@ -419,7 +677,7 @@ void pool_gc(struct pool_head *pool_ctx)
 			temp = next;
 			next = *POOL_LINK(entry, temp);
 			entry->allocated--;
-			pool_free_area(temp, entry->size + POOL_EXTRA);
+			pool_release_area(entry, temp);
 		}
 		entry->free_list = next;
 		if (entry != pool_ctx)
@@ -448,6 +706,9 @@ void *pool_destroy(struct pool_head *pool)
 			LIST_DEL(&pool->list);
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
 			HA_SPIN_DESTROY(&pool->lock);
+#endif
+#ifdef CONFIG_HAP_POOL_SLABS
+			HA_SPIN_DESTROY(&pool->slab_lock);
 #endif
 			if ((pool - pool_base_start) < MAX_BASE_POOLS)
 				memset(pool, 0, sizeof(*pool));
@@ -473,6 +734,9 @@ void dump_pools_to_trash()
 	struct pool_head *entry;
 	unsigned long allocated, used;
 	int nbpools;
+#ifdef CONFIG_HAP_POOL_SLABS
+	unsigned int slabs = 0, empty_slabs = 0;
+#endif
 
 	allocated = used = nbpools = 0;
 	chunk_printf(&trash, "Dumping pools usage. Use SIGQUIT to flush them.\n");
@@ -485,6 +749,15 @@ void dump_pools_to_trash()
 		         entry->size * entry->allocated, entry->used, entry->failed,
 			 entry->users, entry, (int)pool_get_index(entry),
 			 (entry->flags & MEM_F_SHARED) ? " [SHARED]" : "");
+#ifdef CONFIG_HAP_POOL_SLABS
+		if (entry->flags & MEM_F_SLAB) {
+			chunk_appendf(&trash, "      slabs: %u mapped (%lu bytes), %u empty, %u objects per slab\n",
+				      entry->slabs, (unsigned long)entry->slabs * CONFIG_HAP_POOL_SLAB_SIZE,
+				      entry->empty_slabs, entry->per_slab);
+			slabs += entry->slabs;
+			empty_slabs += entry->empty_slabs;
+		}
+#endif
 
 		allocated += entry->allocated * entry->size;
 		used += entry->used * entry->size;
@@ -495,6 +768,10 @@ void dump_pools_to_trash()
 	}
 	chunk_appendf(&trash, "Total: %d pools, %lu bytes allocated, %lu used.\n",
 		 nbpools, allocated, used);
+#ifdef CONFIG_HAP_POOL_SLABS
+	chunk_appendf(&trash, "Slabs: %u mapped (%lu bytes), %u empty returned to the OS.\n",
+		      slabs, (unsigned long)slabs * CONFIG_HAP_POOL_SLAB_SIZE, empty_slabs);
+#endif
 }
 
 /* Dump statistics on pools usage. */
@@ -579,6 +856,10 @@ static void init_pools()
 		}
 		LIST_INIT(&pool_lru_head[thr]);
 	}
+#ifdef CONFIG_HAP_POOL_SLABS
+	if (sysconf(_SC_PAGESIZE) > 0)
+		pool_page_size = sysconf(_SC_PAGESIZE);
+#endif
 }
 
 INITCALL0(STG_PREPARE, init_pools);
@@ -645,11 +926,25 @@ static int mem_parse_global_fail_alloc(char **args, int section_type, struct pro
 }
 #endif
 
+/* config parser for global "tune.pool-hugepages", ignored without slabs */
+static int mem_parse_global_pool_hugepages(char **args, int section_type, struct proxy *curpx,
+                                           struct proxy *defpx, const char *file, int line,
+                                           char **err)
+{
+	if (too_many_args(0, args, err, NULL))
+		return -1;
+#ifdef CONFIG_HAP_POOL_SLABS
+	pool_hugepages = 1;
+#endif
+	return 0;
+}
+
 /* register global config keywords */
 static struct cfg_kw_list mem_cfg_kws = {ILH, {
 #ifdef DEBUG_FAIL_ALLOC
 	{ CFG_GLOBAL, "tune.fail-alloc", mem_parse_global_fail_alloc },
 #endif
+	{ CFG_GLOBAL, "tune.pool-hugepages", mem_parse_global_pool_hugepages },
 	{ 0, NULL, NULL }
 }};
 
@@ -2034,14 +2034,33 @@ static int h1_process(struct h1c * h1c)
 static struct task *h1_io_cb(struct task *t, void *ctx, unsigned short status)
 {
 	struct h1c *h1c = ctx;
+	struct connection *conn;
+	int parked;
 	int ret = 0;
 
+	/* If the connection was taken over by another thread while it was
+	 * idle, this tasklet was replaced and only waits for being released
+	 * (see h1_takeover()). Otherwise make sure nobody takes it while we
+	 * are processing it. Both must be checked under the lock since the
+	 * takeover may happen at any time until then.
+	 */
+	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+	if (!curr_task->context) {
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+		return NULL;
+	}
+	conn = h1c->conn;
+	parked = srv_idle_conn_unpark(conn);
+	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+
 	if (!(h1c->wait_event.events & SUB_RETRY_SEND))
 		ret = h1_send(h1c);
 	if (!(h1c->wait_event.events & SUB_RETRY_RECV))
 		ret |= h1_recv(h1c);
-	if (ret || !h1c->h1s)
-		h1_process(h1c);
+	if ((ret || !h1c->h1s) && h1_process(h1c) < 0)
+		return NULL;
+	if (parked)
+		srv_idle_conn_repark(conn);
 	return NULL;
 }
 
@@ -2080,6 +2099,16 @@ static struct task *h1_timeout_task(struct task *t, void *context, unsigned shor
 	if (!expired && h1c)
 		return t;
 
+	if (h1c) {
+		/* the connection may have been taken over by another thread */
+		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+		if (t->context)
+			srv_idle_conn_unpark(h1c->conn);
+		else
+			h1c = NULL;
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+	}
+
 	task_destroy(t);
 
 	if (!h1c) {
@@ -2197,27 +2226,33 @@ static void h1_detach(struct conn_stream *cs)
 			h1c->conn->owner = sess;
 			if (!session_add_conn(sess, h1c->conn, h1c->conn->target)) {
 				h1c->conn->owner = NULL;
+				/* Wake the task so we can subscribe to events. This
+				 * must be done first since another thread may take
+				 * the connection over as soon as it's in the server
+				 * list.
+				 */
+				tasklet_wakeup(h1c->wait_event.tasklet);
 				if (!srv_add_to_idle_list(objt_server(h1c->conn->target), h1c->conn))
 					/* The server doesn't want it, let's kill the connection right away */
 					h1c->conn->mux->destroy(h1c->conn);
-				else
-					tasklet_wakeup(h1c->wait_event.tasklet);
 				return;
 
 			}
 		}
 		if (h1c->conn->owner == sess) {
-			int ret = session_check_idle_conn(sess, h1c->conn);
+			int ret;
+
+			/* The connection may be added to the server list, wake
+			 * the task first so we can subscribe to events (see above).
+			 */
+			tasklet_wakeup(h1c->wait_event.tasklet);
+			ret = session_check_idle_conn(sess, h1c->conn);
 			if (ret == -1)
 				/* The connection got destroyed, let's leave */
 				return;
-			else if (ret == 1) {
-				/* The connection was added to the server list,
-				 * wake the task so we can subscribe to events
-				 */
-				tasklet_wakeup(h1c->wait_event.tasklet);
+			else if (ret == 1)
+				/* The connection was added to the server list */
 				return;
-			}
 		}
 		/* we're in keep-alive with an idle connection, monitor it if not already done */
 		if (LIST_ISEMPTY(&h1c->conn->list)) {
@@ -2512,6 +2547,61 @@ static void h1_show_fd(struct buffer *msg, struct connection *conn)
 	}
 }
 
+/* Takes over idle connection <conn>, parked by thread <orig_tid>, on behalf of
+ * the current thread. It is called with toremove_lock[orig_tid] held, which
+ * guarantees that the original thread is not processing it. The tasklet and
+ * the timeout task, which may still be queued there, are replaced and the old
+ * ones are released by the original thread. Only connections over a raw
+ * socket may be migrated since the SSL layer has its own tasklet. Returns 0 on
+ * success or -1 if the connection cannot be taken over.
+ */
+static int h1_takeover(struct connection *conn, int orig_tid)
+{
+	struct h1c *h1c = conn->ctx;
+	struct tasklet *tl;
+	struct task *task = NULL;
+
+	if (conn->xprt != xprt_get(XPRT_RAW) ||
+	    (conn->flags & (CO_FL_ERROR|CO_FL_SOCK_RD_SH|CO_FL_SOCK_WR_SH)) ||
+	    (h1c->flags & (H1C_F_CS_ERROR|H1C_F_CS_SHUTW_NOW|H1C_F_CS_SHUTDOWN|H1C_F_CS_WAIT_CONN)) ||
+	    h1c->h1s || b_data(&h1c->ibuf) || b_data(&h1c->obuf) ||
+	    !LIST_ISEMPTY(&h1c->buf_wait.list) ||
+	    (h1c->task && tick_isset(h1c->task->expire)))
+		return -1;
+
+	tl = tasklet_new();
+	if (!tl)
+		return -1;
+
+	if (h1c->task) {
+		task = task_new(tid_bit);
+		if (!task)
+			goto fail;
+	}
+
+	if (tasklet_release_on(h1c->wait_event.tasklet, orig_tid) < 0)
+		goto fail;
+
+	tl->process = h1_io_cb;
+	tl->context = h1c;
+	h1c->wait_event.tasklet = tl;
+
+	if (task) {
+		task->process = h1_timeout_task;
+		task->context = h1c;
+		task->expire = TICK_ETERNITY;
+		h1c->task->context = NULL;
+		task_wakeup(h1c->task, TASK_WOKEN_OTHER);
+		h1c->task = task;
+	}
+	return 0;
+
+  fail:
+	task_destroy(task);
+	tasklet_free(tl);
+	return -1;
+}
+
 /****************************************/
 /* MUX initialization and instanciation */
 /****************************************/
@@ -2539,6 +2629,7 @@ static const struct mux_ops mux_h1_ops = {
 	.shutw       = h1_shutw,
 	.show_fd     = h1_show_fd,
 	.reset       = h1_reset,
+	.takeover    = h1_takeover,
 	.flags       = MX_FL_HTX,
 	.name        = "H1",
 };
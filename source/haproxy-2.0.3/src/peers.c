@@ -1199,7 +1199,7 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 	new_pushed = 1;
 
 	if (!locked)
-		HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
+		HA_SPIN_LOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 
 	while (1) {
 		struct stksess *ts;
@@ -1211,20 +1211,20 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 			break;
 
 		updateid = ts->upd.key;
-		ts->ref_cnt++;
-		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+		HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+		HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 
 		ret = peer_send_updatemsg(st, appctx, ts, updateid, new_pushed, use_timed);
 		if (ret <= 0) {
-			HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
-			ts->ref_cnt--;
+			HA_SPIN_LOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
+			HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 			if (!locked)
-				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+				HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 			return ret;
 		}
 
-		HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
-		ts->ref_cnt--;
+		HA_SPIN_LOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 		st->last_pushed = updateid;
 
 		if (peer_stksess_lookup == peer_teach_process_stksess_lookup &&
@@ -1237,7 +1237,7 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 
  out:
 	if (!locked)
-		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+		HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 	return 1;
 }
 
@@ -1907,17 +1907,17 @@ static inline int peer_send_msgs(struct appctx *appctx, struct peer *peer)
 			}
 
 			if (!(peer->flags & PEER_F_TEACH_PROCESS)) {
-				HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
+				HA_SPIN_LOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 				if (!(peer->flags & PEER_F_LEARN_ASSIGN) &&
 					((int)(st->last_pushed - st->table->localupdate) < 0)) {
 
 					repl = peer_send_teach_process_msgs(appctx, peer, st);
 					if (repl <= 0) {
-						HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+						HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 						return repl;
 					}
 				}
-				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+				HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &st->table->updt_lock);
 			}
 			else {
 				if (!(st->flags & SHTABLE_F_TEACH_STAGE1)) {
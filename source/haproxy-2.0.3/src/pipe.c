@@ -15,6 +15,7 @@
 
 #include <common/config.h>
 #include <common/hathreads.h>
+#include <common/initcall.h>
 #include <common/memory.h>
 
 #include <types/global.h>
@@ -26,58 +27,81 @@ struct pipe *pipes_live = NULL; /* pipes which are still ready to use */
 
 __decl_spinlock(pipes_lock); /* lock used to protect pipes list */
 
+/* max number of unused pipes a thread may keep for itself. It is kept small
+ * so that pipes sleeping in other threads' caches never deprive a thread of
+ * one when maxpipes is reached.
+ */
+#define MAX_LOCAL_PIPES 4
+
+static THREAD_LOCAL int local_pipes_free = 0;  /* #cache objects   */
+static THREAD_LOCAL struct pipe *local_pipes = NULL;
+
 int pipes_used = 0;             /* # of pipes in use (2 fds each) */
 int pipes_free = 0;             /* # of pipes unused */
 
 /* return a pre-allocated empty pipe. Try to allocate one if there isn't any
- * left. NULL is returned if a pipe could not be allocated.
+ * left. NULL is returned if a pipe could not be allocated. The calling thread's
+ * cache is looked up first, then the shared pool.
  */
 struct pipe *get_pipe()
 {
 	struct pipe *ret = NULL;
 	int pipefd[2];
 
-	HA_SPIN_LOCK(PIPES_LOCK, &pipes_lock);
+	ret = local_pipes;
+	if (likely(ret)) {
+		local_pipes = ret->next;
+		local_pipes_free--;
+		_HA_ATOMIC_ADD(&pipes_used, 1);
+		_HA_ATOMIC_SUB(&pipes_free, 1);
+		return ret;
+	}
+
 	if (likely(pipes_live)) {
+		HA_SPIN_LOCK(PIPES_LOCK, &pipes_lock);
 		ret = pipes_live;
-		pipes_live = pipes_live->next;
-		pipes_free--;
-		pipes_used++;
-		goto out;
+		if (likely(ret))
+			pipes_live = ret->next;
+		HA_SPIN_UNLOCK(PIPES_LOCK, &pipes_lock);
+		if (ret) {
+			_HA_ATOMIC_ADD(&pipes_used, 1);
+			_HA_ATOMIC_SUB(&pipes_free, 1);
+			return ret;
+		}
 	}
 
-	if (pipes_used >= global.maxpipes)
-		goto out;
+	/* unused pipes count against maxpipes as well, wherever they are */
+	if (_HA_ATOMIC_ADD(&pipes_used, 1) + pipes_free > global.maxpipes)
+		goto fail;
 
 	ret = pool_alloc(pool_head_pipe);
 	if (!ret)
-		goto out;
+		goto fail;
 
 	if (pipe(pipefd) < 0) {
 		pool_free(pool_head_pipe, ret);
-		goto out;
+		ret = NULL;
+		goto fail;
 	}
+
+	ret->size = 0;
 #ifdef F_SETPIPE_SZ
 	if (global.tune.pipesize)
-		fcntl(pipefd[0], F_SETPIPE_SZ, global.tune.pipesize);
+		ret->size = fcntl(pipefd[0], F_SETPIPE_SZ, global.tune.pipesize);
+	if (ret->size <= 0)
+		ret->size = fcntl(pipefd[0], F_GETPIPE_SZ);
+	if (ret->size < 0)
+		ret->size = 0;
 #endif
 	ret->data = 0;
 	ret->prod = pipefd[1];
 	ret->cons = pipefd[0];
 	ret->next = NULL;
-	pipes_used++;
- out:
-	HA_SPIN_UNLOCK(PIPES_LOCK, &pipes_lock);
 	return ret;
-}
 
-static inline void __kill_pipe(struct pipe *p)
-{
-	close(p->prod);
-	close(p->cons);
-	pool_free(pool_head_pipe, p);
-	pipes_used--;
-	return;
+ fail:
+	_HA_ATOMIC_SUB(&pipes_used, 1);
+	return ret;
 }
 
 /* destroy a pipe, possibly because an error was encountered on it. Its FDs
@@ -85,31 +109,99 @@ static inline void __kill_pipe(struct pipe *p)
  */
 void kill_pipe(struct pipe *p)
 {
-	HA_SPIN_LOCK(PIPES_LOCK, &pipes_lock);
-	__kill_pipe(p);
-	HA_SPIN_UNLOCK(PIPES_LOCK, &pipes_lock);
-	return;
+	close(p->prod);
+	close(p->cons);
+	pool_free(pool_head_pipe, p);
+	_HA_ATOMIC_SUB(&pipes_used, 1);
 }
 
 /* put back a unused pipe into the live pool. If it still has data in it, it is
  * closed and not reinjected into the live pool. The caller is not allowed to
- * use it once released.
+ * use it once released. The pipe goes to the calling thread's cache unless
+ * this one already holds MAX_LOCAL_PIPES pipes, otherwise to the shared pool.
  */
 void put_pipe(struct pipe *p)
 {
-	HA_SPIN_LOCK(PIPES_LOCK, &pipes_lock);
-	if (p->data) {
-		__kill_pipe(p);
+	if (unlikely(p->data)) {
+		kill_pipe(p);
+		return;
+	}
+
+	if (likely(local_pipes_free < MAX_LOCAL_PIPES)) {
+		p->next = local_pipes;
+		local_pipes = p;
+		local_pipes_free++;
 		goto out;
 	}
+
+	HA_SPIN_LOCK(PIPES_LOCK, &pipes_lock);
 	p->next = pipes_live;
 	pipes_live = p;
-	pipes_free++;
-	pipes_used--;
- out:
 	HA_SPIN_UNLOCK(PIPES_LOCK, &pipes_lock);
+ out:
+	_HA_ATOMIC_ADD(&pipes_free, 1);
+	_HA_ATOMIC_SUB(&pipes_used, 1);
+}
+
+/* Tries to double the capacity of pipe <p> after it was found full, without
+ * going beyond tune.pipesize.max. Does nothing if growing is disabled. Returns
+ * non-zero if the pipe was grown.
+ */
+int grow_pipe(struct pipe *p)
+{
+#ifdef F_SETPIPE_SZ
+	int size;
+
+	if (!p->size || p->size >= global.tune.pipesize_max)
+		return 0;
+
+	size = p->size * 2;
+	if (size > global.tune.pipesize_max)
+		size = global.tune.pipesize_max;
+
+	size = fcntl(p->cons, F_SETPIPE_SZ, size);
+	if (size <= p->size)
+		return 0;
+
+	p->size = size;
+	return 1;
+#else
+	return 0;
+#endif
 }
 
+/* closes the unused pipes kept in the calling thread's cache */
+static void deinit_pipes_per_thread()
+{
+	struct pipe *p;
+
+	while ((p = local_pipes)) {
+		local_pipes = p->next;
+		local_pipes_free--;
+		close(p->prod);
+		close(p->cons);
+		pool_free(pool_head_pipe, p);
+		_HA_ATOMIC_SUB(&pipes_free, 1);
+	}
+}
+
+/* closes the unused pipes left in the shared pool */
+static void deinit_pipes()
+{
+	struct pipe *p;
+
+	while ((p = pipes_live)) {
+		pipes_live = p->next;
+		close(p->prod);
+		close(p->cons);
+		pool_free(pool_head_pipe, p);
+		pipes_free--;
+	}
+}
+
+REGISTER_PER_THREAD_DEINIT(deinit_pipes_per_thread);
+REGISTER_POST_DEINIT(deinit_pipes);
+
 /*
  * Local variables:
  *  c-indent-level: 8
@@ -32,6 +32,10 @@
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
+
 #include <common/compat.h>
 #include <common/config.h>
 #include <common/debug.h>
@@ -797,6 +801,61 @@ static int tcp_find_compatible_fd(struct listener *l)
 }
 #undef L1_MANDATORY_FLAGS
 
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+/* Attaches to the SO_REUSEPORT group of sharded listener <listener>'s socket
+ * <fd> a classic BPF program returning, for each incoming connection, the index
+ * of the shard whose threads run on the CPU which received it. The shards are
+ * the listeners of the same bind_conf on the same address, which are bound in
+ * this order. CPUs are mapped using "cpu-map" when it is set, and connections
+ * arriving on other CPUs are spread using the CPU number modulo the number of
+ * shards. Returns 0 on success, -1 on error.
+ */
+static int tcp_attach_cpu_steering(int fd, struct listener *listener)
+{
+	struct sock_filter code[2 * LONGBITS + 3];
+	struct sock_fprog prog;
+	struct listener *l;
+	unsigned long done = 0;
+	int len = 0, nbshards = 0;
+
+	code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+	list_for_each_entry(l, &listener->bind_conf->listeners, by_bind) {
+		if (!l->bind_thread || compare_sockaddr(&l->addr, &listener->addr) != 0)
+			continue;
+#ifdef USE_CPU_AFFINITY
+		{
+			unsigned long cpus = 0;
+			int thr, cpu;
+
+			for (thr = 0; thr < global.nbthread && thr < MAX_THREADS; thr++)
+				if (l->bind_thread & (1UL << thr))
+					cpus |= global.cpu_map.thread[thr];
+
+			for (cpu = 0; cpu < LONGBITS; cpu++) {
+				if (!(cpus & ~done & (1UL << cpu)))
+					continue;
+				done |= 1UL << cpu;
+				code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpu, 0, 1);
+				code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, nbshards);
+			}
+		}
+#endif
+		nbshards++;
+	}
+
+	if (nbshards < 2)
+		return 0;
+
+	code[len++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, nbshards);
+	code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+	prog.len = len;
+	prog.filter = code;
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+#endif
+
 /* This function tries to bind a TCPv4/v6 listener. It may return a warning or
  * an error message in <errmsg> if the message is at most <errlen> bytes long
  * (including '\0'). Note that <errmsg> may be NULL if <errlen> is also zero.
@@ -912,9 +971,10 @@ int tcp_bind_listener(struct listener *listener, char *errmsg, int errlen)
 
 #ifdef SO_REUSEPORT
 	/* OpenBSD and Linux 3.9 support this. As it's present in old libc versions of
-	 * Linux, it might return an error that we will silently ignore.
+	 * Linux, it might return an error that we will silently ignore. Sharded
+	 * listeners always need it since they share their address.
 	 */
-	if (!ext && (global.tune.options & GTUNE_USE_REUSEPORT))
+	if (!ext && ((global.tune.options & GTUNE_USE_REUSEPORT) || listener->bind_thread))
 		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
 #endif
 
@@ -1070,6 +1130,14 @@ int tcp_bind_listener(struct listener *listener, char *errmsg, int errlen)
 		goto tcp_close_return;
 	}
 
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+	if ((listener->options & LI_O_CPU_STEER) && listener->bind_thread &&
+	    tcp_attach_cpu_steering(fd, listener) == -1) {
+		msg = "cannot attach CPU steering program";
+		err |= ERR_WARN;
+	}
+#endif
+
 #if defined(TCP_QUICKACK)
 	if (listener->options & LI_O_NOQUICKACK)
 		setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &zero, sizeof(zero));
@@ -1082,7 +1150,7 @@ int tcp_bind_listener(struct listener *listener, char *errmsg, int errlen)
 	listener->state = LI_LISTEN;
 
 	fd_insert(fd, listener, listener->proto->accept,
-	          thread_mask(listener->bind_conf->bind_thread));
+	          listener_thread_mask(listener));
 
  tcp_return:
 	if (msg && errlen) {
@@ -1745,6 +1813,21 @@ static int bind_parse_transparent(char **args, int cur_arg, struct proxy *px, st
 }
 #endif
 
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+/* parse the "steer-by-cpu" bind keyword */
+static int bind_parse_steer_by_cpu(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+	struct listener *l;
+
+	list_for_each_entry(l, &conf->listeners, by_bind) {
+		if (l->addr.ss_family == AF_INET || l->addr.ss_family == AF_INET6)
+			l->options |= LI_O_CPU_STEER;
+	}
+
+	return 0;
+}
+#endif
+
 #ifdef TCP_DEFER_ACCEPT
 /* parse the "defer-accept" bind keyword */
 static int bind_parse_defer_accept(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
@@ -1974,6 +2057,9 @@ static struct bind_kw_list bind_kws = { "TCP", { }, {
 #ifdef TCP_MAXSEG
 	{ "mss",           bind_parse_mss,          1 }, /* set MSS of listening socket */
 #endif
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+	{ "steer-by-cpu",  bind_parse_steer_by_cpu, 0 }, /* steer connections to the shard running on the receiving CPU */
+#endif
 #ifdef TCP_USER_TIMEOUT
 	{ "tcp-ut",        bind_parse_tcp_ut,       1 }, /* set User Timeout on listening socket */
 #endif
@@ -1994,6 +2080,7 @@ static struct bind_kw_list bind_kws = { "TCP", { }, {
 	{ "defer-accept",  NULL,  0 },
 	{ "interface",     NULL,  1 },
 	{ "mss",           NULL,  1 },
+	{ "steer-by-cpu",  NULL,  0 },
 	{ "transparent",   NULL,  0 },
 	{ "v4v6",          NULL,  0 },
 	{ "v6only",        NULL,  0 },
@@ -50,6 +50,16 @@
  */
 #define SPLICE_FULL_HINT	16*1448
 
+/* Same as above for pipes which were made larger than the default 64kB, which
+ * hold one segment per 4kB page.
+ */
+static inline int splice_full_hint(const struct pipe *pipe)
+{
+	if (pipe->size > 65536)
+		return pipe->size / 4096 * 1448;
+	return SPLICE_FULL_HINT;
+}
+
 /* how many data we attempt to splice at once when the buffer is configured for
  * infinite forwarding */
 #define MAX_SPLICE_AT_ONCE	(1<<30)
@@ -114,7 +124,12 @@ int raw_sock_to_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe,
 				 * empty the pipe.
 				 */
 				if (pipe->data) {
-					/* alway stop reading until the pipe is flushed */
+					/* alway stop reading until the pipe is flushed,
+					 * and give it more room for next time if it
+					 * was full.
+					 */
+					if (pipe->data >= pipe->size)
+						grow_pipe(pipe);
 					conn->flags |= CO_FL_WAIT_ROOM;
 					break;
 				}
@@ -143,7 +158,7 @@ int raw_sock_to_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe,
 		pipe->data += ret;
 		count -= ret;
 
-		if (pipe->data >= SPLICE_FULL_HINT || ret >= global.tune.recv_enough) {
+		if (pipe->data >= splice_full_hint(pipe) || ret >= global.tune.recv_enough) {
 			/* We've read enough of it for this time, let's stop before
 			 * being asked to poll.
 			 */
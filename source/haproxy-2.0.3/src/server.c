@@ -5471,6 +5471,55 @@ struct task *srv_cleanup_toremove_connections(struct task *task, void *context,
 	return task;
 }
 
+/* Takes over an idle connection to server <srv> parked by another thread, so
+ * that a request processed by the current thread doesn't have to establish a
+ * new connection when other threads have some available. Threads are scanned
+ * starting from the next one, the busy ones being skipped instead of waited
+ * for, and only their most recently parked connection is considered as it is
+ * the least likely to have been closed by the server. On success, the
+ * connection is returned, out of any list and accounted as an idle connection
+ * of the current thread. Otherwise NULL is returned.
+ */
+struct connection *srv_takeover_idle_conn(struct server *srv)
+{
+	struct connection *conn;
+	int i;
+
+	for (i = tid + 1; ; i++) {
+		if (i >= global.nbthread)
+			i = 0;
+		if (i == tid)
+			break;
+
+		/* see connect_server() */
+		ALREADY_CHECKED(i);
+
+		if (!srv->curr_idle_thr[i] ||
+		    HA_SPIN_TRYLOCK(OTHER_LOCK, &toremove_lock[i]) != 0)
+			continue;
+
+		conn = NULL;
+		if (!LIST_ISEMPTY(&srv->idle_orphan_conns[i])) {
+			conn = LIST_ELEM(srv->idle_orphan_conns[i].p, struct connection *, list);
+			if (conn->mux && conn->mux->takeover &&
+			    conn->mux->takeover(conn, i) == 0) {
+				LIST_DEL_LOCKED(&conn->list);
+				fd_takeover(conn->handle.fd);
+			}
+			else
+				conn = NULL;
+		}
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[i]);
+
+		if (conn) {
+			_HA_ATOMIC_SUB(&srv->curr_idle_thr[i], 1);
+			_HA_ATOMIC_ADD(&srv->curr_idle_thr[tid], 1);
+			return conn;
+		}
+	}
+	return NULL;
+}
+
 struct task *srv_cleanup_idle_connections(struct task *task, void *context, unsigned short state)
 {
 	struct server *srv;
@@ -5513,6 +5562,7 @@ struct task *srv_cleanup_idle_connections(struct task *task, void *context, unsi
 				if (!conn)
 					break;
 				did_remove = 1;
+				conn->flags |= CO_FL_IDLE_TOREMOVE;
 				LIST_ADDQ_LOCKED(&toremove_connections[i], &conn->list);
 			}
 			HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[i]);
@@ -5566,8 +5616,28 @@ static int cfg_parse_pool_fd_ratio(char **args, int section_type, struct proxy *
 	return 0;
 }
 
+/* config parser for global "tune.idle-pool.shared", accepts "on" or "off" */
+static int cfg_parse_idle_pool_shared(char **args, int section_type, struct proxy *curpx,
+                                      struct proxy *defpx, const char *file, int line,
+                                      char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		global.tune.options |= GTUNE_IDLE_POOL_SHARED;
+	else if (strcmp(args[1], "off") == 0)
+		global.tune.options &= ~GTUNE_IDLE_POOL_SHARED;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.idle-pool.shared",       cfg_parse_idle_pool_shared },
 	{ CFG_GLOBAL, "tune.pool-high-fd-ratio",     cfg_parse_pool_fd_ratio },
 	{ CFG_GLOBAL, "tune.pool-low-fd-ratio",      cfg_parse_pool_fd_ratio },
 	{ 0, NULL, NULL }
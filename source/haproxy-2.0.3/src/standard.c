@@ -28,6 +28,7 @@
 
 #include <common/chunk.h>
 #include <common/config.h>
+#include <common/initcall.h>
 #include <common/standard.h>
 #include <common/tools.h>
 #include <types/global.h>
@@ -58,6 +59,11 @@ THREAD_LOCAL int itoa_idx = 0; /* index of next itoa_str to use */
 THREAD_LOCAL char quoted_str[NB_QSTR][QSTR_SIZE + 1];
 THREAD_LOCAL int quoted_idx = 0;
 
+/* ha_random32() state, seeded for each thread once random() is seeded. Any
+ * non-zero value works until then.
+ */
+THREAD_LOCAL unsigned int ha_rnd_state = 2463534242U;
+
 /*
  * unsigned long long ASCII representation
  *
@@ -4305,6 +4311,17 @@ int parse_dotted_uints(const char *str, unsigned int **nums, size_t *sz)
 	return 1;
 }
 
+/* gives each thread its own ha_random32() sequence */
+static int init_random_per_thread()
+{
+	ha_rnd_state = full_hash(random() + tid);
+	if (!ha_rnd_state)
+		ha_rnd_state = 2463534242U;
+	return 1;
+}
+
+REGISTER_PER_THREAD_INIT(init_random_per_thread);
+
 /* do nothing, just a placeholder for debugging calls, the real one is in trace.c */
 #ifndef USE_OBSOLETE_LINKER
 __attribute__((weak,format(printf, 1, 2)))
@@ -24,7 +24,7 @@
 
 #include <ebmbtree.h>
 #include <ebsttree.h>
-
+#include <import/xxhash.h>
 #include <types/cli.h>
 #include <types/global.h>
 #include <types/stats.h>
@@ -77,38 +77,96 @@ struct stktable *stktable_find_by_name(const char *name)
 	return NULL;
 }
 
+/*
+ * Returns the shard which holds, or would hold, the sticky sessions whose key
+ * is the <len> bytes at <key>.
+ */
+static inline unsigned int stktable_shard(const void *key, size_t len)
+{
+	if (STKTABLE_SHARDS == 1)
+		return 0;
+	return XXH32(key, len, 0) % STKTABLE_SHARDS;
+}
+
+/*
+ * Returns the shard of table <t> for key <key>. String keys are only hashed
+ * up to their end, as they are once stored in a sticky session.
+ */
+static unsigned int stktable_key_shard(struct stktable *t, struct stktable_key *key)
+{
+	size_t len = t->key_size;
+
+	if (t->type == SMP_T_STR)
+		len = strnlen(key->key, key->key_len+1 < t->key_size ? key->key_len : t->key_size-1);
+
+	return stktable_shard(key->key, len);
+}
+
+/*
+ * Returns the shard of table <t> for the key of sticky session <ts>.
+ */
+static unsigned int stksess_shard(struct stktable *t, struct stksess *ts)
+{
+	size_t len = t->key_size;
+
+	if (t->type == SMP_T_STR)
+		len = strnlen((char *)ts->key.key, t->key_size - 1);
+
+	return stktable_shard(ts->key.key, len);
+}
+
 /*
  * Free an allocated sticky session <ts>, and decrease sticky sessions counter
  * in table <t>.
  */
 void __stksess_free(struct stktable *t, struct stksess *ts)
 {
-	t->current--;
+	HA_ATOMIC_SUB(&t->current, 1);
 	pool_free(t->pool, (void *)ts - round_ptr_size(t->data_size));
 }
 
 /*
  * Free an allocated sticky session <ts>, and decrease sticky sessions counter
- * in table <t>.
- * This function locks the table
+ * in table <t>. The session must not be in the table anymore, so no lock is
+ * needed.
  */
 void stksess_free(struct stktable *t, struct stksess *ts)
 {
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
 	__stksess_free(t, ts);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+}
+
+/*
+ * Remove <ts> from the update tree of table <t>, only if its ref_cnt is zero.
+ * The lock of the shard holding <ts> must be held. Peers take references
+ * under the update lock only, so the ref_cnt is checked under this lock too.
+ * Returns non-zero if <ts> may be freed.
+ */
+static int __stksess_unlink_upd(struct stktable *t, struct stksess *ts)
+{
+	int ret = 0;
+
+	if (!t->sync_task)
+		return !ts->ref_cnt;
+
+	HA_SPIN_LOCK(STK_TABLE_UPDT_LOCK, &t->updt_lock);
+	if (!ts->ref_cnt) {
+		eb32_delete(&ts->upd);
+		ret = 1;
+	}
+	HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &t->updt_lock);
+	return ret;
 }
 
 /*
  * Kill an stksess (only if its ref_cnt is zero).
+ * The lock of the shard holding <ts> must be held.
  */
 int __stksess_kill(struct stktable *t, struct stksess *ts)
 {
-	if (ts->ref_cnt)
+	if (!__stksess_unlink_upd(t, ts))
 		return 0;
 
 	eb32_delete(&ts->exp);
-	eb32_delete(&ts->upd);
 	ebmb_delete(&ts->key);
 	__stksess_free(t, ts);
 	return 1;
@@ -117,17 +175,17 @@ int __stksess_kill(struct stktable *t, struct stksess *ts)
 /*
  * Decrease the refcount if decrefcnt is not 0.
  * and try to kill the stksess
- * This function locks the table
+ * This function locks the shard holding <ts>
  */
 int stksess_kill(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
 	int ret;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[ts->shard].lock);
 	if (decrefcnt)
-		ts->ref_cnt--;
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 	ret = __stksess_kill(t, ts);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[ts->shard].lock);
 
 	return ret;
 }
@@ -155,6 +213,7 @@ static struct stksess *__stksess_init(struct stktable *t, struct stksess * ts)
 {
 	memset((void *)ts - t->data_size, 0, t->data_size);
 	ts->ref_cnt = 0;
+	ts->shard = 0;
 	ts->key.node.leaf_p = NULL;
 	ts->exp.node.leaf_p = NULL;
 	ts->upd.node.leaf_p = NULL;
@@ -164,17 +223,17 @@ static struct stksess *__stksess_init(struct stktable *t, struct stksess * ts)
 }
 
 /*
- * Trash oldest <to_batch> sticky sessions from table <t>
+ * Trash oldest <to_batch> sticky sessions from shard <shard> of table <t>
  * Returns number of trashed sticky sessions.
  */
-int __stktable_trash_oldest(struct stktable *t, int to_batch)
+static int __stktable_trash_oldest(struct stktable *t, struct stktable_shard *shard, int to_batch)
 {
 	struct stksess *ts;
 	struct eb32_node *eb;
 	int batched = 0;
 	int looped = 0;
 
-	eb = eb32_lookup_ge(&t->exps, now_ms - TIMER_LOOK_BACK);
+	eb = eb32_lookup_ge(&shard->exps, now_ms - TIMER_LOOK_BACK);
 
 	while (batched < to_batch) {
 
@@ -187,7 +246,7 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 			if (looped)
 				break;
 			looped = 1;
-			eb = eb32_first(&t->exps);
+			eb = eb32_first(&shard->exps);
 			if (likely(!eb))
 				break;
 		}
@@ -207,7 +266,7 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 				continue;
 
 			ts->exp.key = ts->expire;
-			eb32_insert(&t->exps, &ts->exp);
+			eb32_insert(&shard->exps, &ts->exp);
 
 			if (!eb || eb->key > ts->exp.key)
 				eb = &ts->exp;
@@ -215,9 +274,14 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 			continue;
 		}
 
+		/* a peer may just have taken a reference */
+		if (!__stksess_unlink_upd(t, ts)) {
+			eb32_insert(&shard->exps, &ts->exp);
+			continue;
+		}
+
 		/* session expired, trash it */
 		ebmb_delete(&ts->key);
-		eb32_delete(&ts->upd);
 		__stksess_free(t, ts);
 		batched++;
 	}
@@ -228,17 +292,30 @@ int __stktable_trash_oldest(struct stktable *t, int to_batch)
 /*
  * Trash oldest <to_batch> sticky sessions from table <t>
  * Returns number of trashed sticky sessions.
- * This function locks the table
+ * This function locks the shards one at a time, so it must not be called
+ * with any of them locked.
  */
 int stktable_trash_oldest(struct stktable *t, int to_batch)
 {
-	int ret;
+	struct stktable_shard *shard;
+	int share = (to_batch + STKTABLE_SHARDS - 1) / STKTABLE_SHARDS;
+	int batched = 0;
+	int pass, i;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ret = __stktable_trash_oldest(t, to_batch);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	/* Keys are evenly spread over the shards, and so are the oldest
+	 * sessions. Each shard first gives its share, then whatever is still
+	 * missing is taken wherever it may be found.
+	 */
+	for (pass = 0; pass < 2 && batched < to_batch; pass++) {
+		for (i = 0; i < STKTABLE_SHARDS && batched < to_batch; i++) {
+			shard = &t->shards[i];
+			HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+			batched += __stktable_trash_oldest(t, shard, pass ? to_batch - batched : MIN(share, to_batch - batched));
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+		}
+	}
 
-	return ret;
+	return batched;
 }
 /*
  * Allocate and initialise a new sticky session.
@@ -246,22 +323,24 @@ int stktable_trash_oldest(struct stktable *t, int to_batch)
  * Sticky sessions should only be allocated this way, and must be freed using
  * stksess_free(). Table <t>'s sticky session counter is increased. If <key>
  * is not NULL, it is assigned to the new session.
+ * This function may have to purge the table, so it must not be called with
+ * any of its shards locked.
  */
-struct stksess *__stksess_new(struct stktable *t, struct stktable_key *key)
+struct stksess *stksess_new(struct stktable *t, struct stktable_key *key)
 {
 	struct stksess *ts;
 
-	if (unlikely(t->current == t->size)) {
+	if (unlikely(t->current >= t->size)) {
 		if ( t->nopurge )
 			return NULL;
 
-		if (!__stktable_trash_oldest(t, (t->size >> 8) + 1))
+		if (!stktable_trash_oldest(t, (t->size >> 8) + 1))
 			return NULL;
 	}
 
 	ts = pool_alloc(t->pool);
 	if (ts) {
-		t->current++;
+		HA_ATOMIC_ADD(&t->current, 1);
 		ts = (void *)ts + round_ptr_size(t->data_size);
 		__stksess_init(t, ts);
 		if (key)
@@ -270,37 +349,19 @@ struct stksess *__stksess_new(struct stktable *t, struct stktable_key *key)
 
 	return ts;
 }
-/*
- * Allocate and initialise a new sticky session.
- * The new sticky session is returned or NULL in case of lack of memory.
- * Sticky sessions should only be allocated this way, and must be freed using
- * stksess_free(). Table <t>'s sticky session counter is increased. If <key>
- * is not NULL, it is assigned to the new session.
- * This function locks the table
- */
-struct stksess *stksess_new(struct stktable *t, struct stktable_key *key)
-{
-	struct stksess *ts;
-
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ts = __stksess_new(t, key);
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
-
-	return ts;
-}
 
 /*
- * Looks in table <t> for a sticky session matching key <key>.
+ * Looks in shard <shard> of table <t> for a sticky session matching key <key>.
  * Returns pointer on requested sticky session or NULL if none was found.
  */
-struct stksess *__stktable_lookup_key(struct stktable *t, struct stktable_key *key)
+struct stksess *__stktable_lookup_key(struct stktable *t, unsigned int shard, struct stktable_key *key)
 {
 	struct ebmb_node *eb;
 
 	if (t->type == SMP_T_STR)
-		eb = ebst_lookup_len(&t->keys, key->key, key->key_len+1 < t->key_size ? key->key_len : t->key_size-1);
+		eb = ebst_lookup_len(&t->shards[shard].keys, key->key, key->key_len+1 < t->key_size ? key->key_len : t->key_size-1);
 	else
-		eb = ebmb_lookup(&t->keys, key->key, t->key_size);
+		eb = ebmb_lookup(&t->shards[shard].keys, key->key, t->key_size);
 
 	if (unlikely(!eb)) {
 		/* no session found */
@@ -314,33 +375,34 @@ struct stksess *__stktable_lookup_key(struct stktable *t, struct stktable_key *k
  * Looks in table <t> for a sticky session matching key <key>.
  * Returns pointer on requested sticky session or NULL if none was found.
  * The refcount of the found entry is increased and this function
- * is protected using the table lock
+ * is protected using the shard lock
  */
 struct stksess *stktable_lookup_key(struct stktable *t, struct stktable_key *key)
 {
+	unsigned int shard = stktable_key_shard(t, key);
 	struct stksess *ts;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ts = __stktable_lookup_key(t, key);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
+	ts = __stktable_lookup_key(t, shard, key);
 	if (ts)
-		ts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
 
 	return ts;
 }
 
 /*
- * Looks in table <t> for a sticky session with same key as <ts>.
- * Returns pointer on requested sticky session or NULL if none was found.
+ * Looks in shard <shard> of table <t> for a sticky session with same key as
+ * <ts>. Returns pointer on requested sticky session or NULL if none was found.
  */
-struct stksess *__stktable_lookup(struct stktable *t, struct stksess *ts)
+struct stksess *__stktable_lookup(struct stktable *t, unsigned int shard, struct stksess *ts)
 {
 	struct ebmb_node *eb;
 
 	if (t->type == SMP_T_STR)
-		eb = ebst_lookup(&(t->keys), (char *)ts->key.key);
+		eb = ebst_lookup(&(t->shards[shard].keys), (char *)ts->key.key);
 	else
-		eb = ebmb_lookup(&(t->keys), ts->key.key, t->key_size);
+		eb = ebmb_lookup(&(t->shards[shard].keys), ts->key.key, t->key_size);
 
 	if (unlikely(!eb))
 		return NULL;
@@ -352,37 +414,41 @@ struct stksess *__stktable_lookup(struct stktable *t, struct stksess *ts)
  * Looks in table <t> for a sticky session with same key as <ts>.
  * Returns pointer on requested sticky session or NULL if none was found.
  * The refcount of the found entry is increased and this function
- * is protected using the table lock
+ * is protected using the shard lock
  */
 struct stksess *stktable_lookup(struct stktable *t, struct stksess *ts)
 {
+	unsigned int shard = stksess_shard(t, ts);
 	struct stksess *lts;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	lts = __stktable_lookup(t, ts);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
+	lts = __stktable_lookup(t, shard, ts);
 	if (lts)
-		lts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_ADD(&lts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
 
 	return lts;
 }
 
 /* Update the expiration timer for <ts> but do not touch its expiration node.
- * The table's expiration timer is updated if set.
+ * The shard's expiration timer is updated if set.
  * The node will be also inserted into the update tree if needed, at a position
  * depending if the update is a local or coming from a remote node
+ * The lock of the shard holding <ts> must be held.
  */
 void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local, int expire)
 {
+	struct stktable_shard *shard = &t->shards[ts->shard];
 	struct eb32_node * eb;
 	ts->expire = expire;
 	if (t->expire) {
-		t->exp_task->expire = t->exp_next = tick_first(ts->expire, t->exp_next);
-		task_queue(t->exp_task);
+		shard->exp_task->expire = shard->exp_next = tick_first(ts->expire, shard->exp_next);
+		task_queue(shard->exp_task);
 	}
 
 	/* If sync is enabled */
 	if (t->sync_task) {
+		HA_SPIN_LOCK(STK_TABLE_UPDT_LOCK, &t->updt_lock);
 		if (local) {
 			/* If this entry is not in the tree
 			   or not scheduled for at least one peer */
@@ -411,6 +477,7 @@ void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local
 				}
 			}
 		}
+		HA_SPIN_UNLOCK(STK_TABLE_UPDT_LOCK, &t->updt_lock);
 	}
 }
 
@@ -422,11 +489,11 @@ void __stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local
  */
 void stktable_touch_remote(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[ts->shard].lock);
 	__stktable_touch_with_exp(t, ts, 0, ts->expire);
 	if (decrefcnt)
-		ts->ref_cnt--;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[ts->shard].lock);
 }
 
 /* Update the expiration timer for <ts> but do not touch its expiration node.
@@ -439,59 +506,53 @@ void stktable_touch_local(struct stktable *t, struct stksess *ts, int decrefcnt)
 {
 	int expire = tick_add(now_ms, MS_TO_TICKS(t->expire));
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[ts->shard].lock);
 	__stktable_touch_with_exp(t, ts, 1, expire);
 	if (decrefcnt)
-		ts->ref_cnt--;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		HA_ATOMIC_SUB(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[ts->shard].lock);
 }
 /* Just decrease the ref_cnt of the current session. Does nothing if <ts> is NULL */
 static void stktable_release(struct stktable *t, struct stksess *ts)
 {
 	if (!ts)
 		return;
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	ts->ref_cnt--;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	HA_ATOMIC_SUB(&ts->ref_cnt, 1);
 }
 
 /* Insert new sticky session <ts> in the table. It is assumed that it does not
- * yet exist (the caller must check this). The table's timeout is updated if it
+ * yet exist (the caller must check this). The shard's timeout is updated if it
  * is set. <ts> is returned.
+ * The lock of the shard holding <ts> must be held.
  */
 void __stktable_store(struct stktable *t, struct stksess *ts)
 {
+	struct stktable_shard *shard = &t->shards[ts->shard];
 
-	ebmb_insert(&t->keys, &ts->key, t->key_size);
+	ebmb_insert(&shard->keys, &ts->key, t->key_size);
 	ts->exp.key = ts->expire;
-	eb32_insert(&t->exps, &ts->exp);
+	eb32_insert(&shard->exps, &ts->exp);
 	if (t->expire) {
-		t->exp_task->expire = t->exp_next = tick_first(ts->expire, t->exp_next);
-		task_queue(t->exp_task);
+		shard->exp_task->expire = shard->exp_next = tick_first(ts->expire, shard->exp_next);
+		task_queue(shard->exp_task);
 	}
 }
 
-/* Returns a valid or initialized stksess for the specified stktable_key in the
- * specified table, or NULL if the key was NULL, or if no entry was found nor
- * could be created. The entry's expiration is updated.
+/* Lookup for an entry with the same key and store the submitted
+ * stksess if not found. The shard of <nts> must be set and locked.
  */
-struct stksess *__stktable_get_entry(struct stktable *table, struct stktable_key *key)
+struct stksess *__stktable_set_entry(struct stktable *table, struct stksess *nts)
 {
 	struct stksess *ts;
 
-	if (!key)
-		return NULL;
-
-	ts = __stktable_lookup_key(table, key);
+	ts = __stktable_lookup(table, nts->shard, nts);
 	if (ts == NULL) {
-		/* entry does not exist, initialize a new one */
-		ts = __stksess_new(table, key);
-		if (!ts)
-			return NULL;
+		ts = nts;
 		__stktable_store(table, ts);
 	}
 	return ts;
 }
+
 /* Returns a valid or initialized stksess for the specified stktable_key in the
  * specified table, or NULL if the key was NULL, or if no entry was found nor
  * could be created. The entry's expiration is updated.
@@ -499,29 +560,40 @@ struct stksess *__stktable_get_entry(struct stktable *table, struct stktable_key
  */
 struct stksess *stktable_get_entry(struct stktable *table, struct stktable_key *key)
 {
-	struct stksess *ts;
+	struct stksess *ts, *nts;
+	unsigned int shard;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->lock);
-	ts = __stktable_get_entry(table, key);
+	if (!key)
+		return NULL;
+
+	shard = stktable_key_shard(table, key);
+
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->shards[shard].lock);
+	ts = __stktable_lookup_key(table, shard, key);
 	if (ts)
-		ts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->lock);
+		HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->shards[shard].lock);
 
-	return ts;
-}
+	if (ts)
+		return ts;
 
-/* Lookup for an entry with the same key and store the submitted
- * stksess if not found.
- */
-struct stksess *__stktable_set_entry(struct stktable *table, struct stksess *nts)
-{
-	struct stksess *ts;
+	/* entry does not exist, initialize a new one. This is done unlocked
+	 * since it may have to purge other shards, so another thread may have
+	 * stored the same key meanwhile.
+	 */
+	nts = stksess_new(table, key);
+	if (!nts)
+		return NULL;
+	nts->shard = shard;
+
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->shards[shard].lock);
+	ts = __stktable_set_entry(table, nts);
+	HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->shards[shard].lock);
+
+	if (ts != nts)
+		__stksess_free(table, nts);
 
-	ts = __stktable_lookup(table, nts);
-	if (ts == NULL) {
-		ts = nts;
-		__stktable_store(table, ts);
-	}
 	return ts;
 }
 
@@ -532,26 +604,53 @@ struct stksess *__stktable_set_entry(struct stktable *table, struct stksess *nts
 struct stksess *stktable_set_entry(struct stktable *table, struct stksess *nts)
 {
 	struct stksess *ts;
+	unsigned int shard = stksess_shard(table, nts);
+
+	nts->shard = shard;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->lock);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &table->shards[shard].lock);
 	ts = __stktable_set_entry(table, nts);
-	ts->ref_cnt++;
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->lock);
+	HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &table->shards[shard].lock);
 
 	return ts;
 }
+
+/* Returns the first sticky session of table <t> found in shard <shard> or in
+ * one of the shards after it, with its refcount increased, or NULL if they
+ * are all empty. Walking a whole table is done one shard after the other.
+ */
+struct stksess *stktable_first_entry(struct stktable *t, unsigned int shard)
+{
+	struct ebmb_node *eb;
+	struct stksess *ts;
+
+	for (; shard < STKTABLE_SHARDS; shard++) {
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
+		eb = ebmb_first(&t->shards[shard].keys);
+		if (eb) {
+			ts = ebmb_entry(eb, struct stksess, key);
+			HA_ATOMIC_ADD(&ts->ref_cnt, 1);
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
+			return ts;
+		}
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->shards[shard].lock);
+	}
+	return NULL;
+}
+
 /*
- * Trash expired sticky sessions from table <t>. The next expiration date is
- * returned.
+ * Trash expired sticky sessions from shard <shard> of table <t>. The next
+ * expiration date is returned.
  */
-static int stktable_trash_expired(struct stktable *t)
+static int stktable_trash_expired(struct stktable *t, struct stktable_shard *shard)
 {
 	struct stksess *ts;
 	struct eb32_node *eb;
 	int looped = 0;
 
-	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
-	eb = eb32_lookup_ge(&t->exps, now_ms - TIMER_LOOK_BACK);
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &shard->lock);
+	eb = eb32_lookup_ge(&shard->exps, now_ms - TIMER_LOOK_BACK);
 
 	while (1) {
 		if (unlikely(!eb)) {
@@ -563,14 +662,14 @@ static int stktable_trash_expired(struct stktable *t)
 			if (looped)
 				break;
 			looped = 1;
-			eb = eb32_first(&t->exps);
+			eb = eb32_first(&shard->exps);
 			if (likely(!eb))
 				break;
 		}
 
 		if (likely(tick_is_lt(now_ms, eb->key))) {
 			/* timer not expired yet, revisit it later */
-			t->exp_next = eb->key;
+			shard->exp_next = eb->key;
 			goto out_unlock;
 		}
 
@@ -589,56 +688,72 @@ static int stktable_trash_expired(struct stktable *t)
 				continue;
 
 			ts->exp.key = ts->expire;
-			eb32_insert(&t->exps, &ts->exp);
+			eb32_insert(&shard->exps, &ts->exp);
 
 			if (!eb || eb->key > ts->exp.key)
 				eb = &ts->exp;
 			continue;
 		}
 
+		/* a peer may just have taken a reference */
+		if (!__stksess_unlink_upd(t, ts)) {
+			eb32_insert(&shard->exps, &ts->exp);
+			continue;
+		}
+
 		/* session expired, trash it */
 		ebmb_delete(&ts->key);
-		eb32_delete(&ts->upd);
 		__stksess_free(t, ts);
 	}
 
 	/* We have found no task to expire in any tree */
-	t->exp_next = TICK_ETERNITY;
+	shard->exp_next = TICK_ETERNITY;
 out_unlock:
-	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
-	return t->exp_next;
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &shard->lock);
+	return shard->exp_next;
 }
 
 /*
- * Task processing function to trash expired sticky sessions. A pointer to the
- * task itself is returned since it never dies.
+ * Task processing function to trash expired sticky sessions of a shard. A
+ * pointer to the task itself is returned since it never dies.
  */
 static struct task *process_table_expire(struct task *task, void *context, unsigned short state)
 {
-	struct stktable *t = context;
+	struct stktable_shard *shard = context;
 
-	task->expire = stktable_trash_expired(t);
+	task->expire = stktable_trash_expired(shard->table, shard);
 	return task;
 }
 
 /* Perform minimal stick table intializations, report 0 in case of error, 1 if OK. */
 int stktable_init(struct stktable *t)
 {
+	struct stktable_shard *shard;
+	int i;
+
 	if (t->size) {
-		t->keys = EB_ROOT_UNIQUE;
-		memset(&t->exps, 0, sizeof(t->exps));
+		for (i = 0; i < STKTABLE_SHARDS; i++) {
+			shard = &t->shards[i];
+			shard->keys = EB_ROOT_UNIQUE;
+			memset(&shard->exps, 0, sizeof(shard->exps));
+			HA_SPIN_INIT(&shard->lock);
+			shard->exp_next = TICK_ETERNITY;
+			shard->table = t;
+		}
 		t->updates = EB_ROOT_UNIQUE;
-		HA_SPIN_INIT(&t->lock);
+		HA_SPIN_INIT(&t->updt_lock);
 
 		t->pool = create_pool("sticktables", sizeof(struct stksess) + round_ptr_size(t->data_size) + t->key_size, MEM_F_SHARED);
 
-		t->exp_next = TICK_ETERNITY;
 		if ( t->expire ) {
-			t->exp_task = task_new(MAX_THREADS_MASK);
-			if (!t->exp_task)
-				return 0;
-			t->exp_task->process = process_table_expire;
-			t->exp_task->context = (void *)t;
+			for (i = 0; i < STKTABLE_SHARDS; i++) {
+				shard = &t->shards[i];
+				shard->exp_task = task_new(MAX_THREADS_MASK);
+				if (!shard->exp_task)
+					return 0;
+				shard->exp_task->process = process_table_expire;
+				shard->exp_task->context = (void *)shard;
+			}
 		}
 		if (t->peers.p && t->peers.p->peers_fe && t->peers.p->peers_fe->state != PR_STSTOPPED) {
 			peers_register_table(t->peers.p, t);
@@ -3694,6 +3809,7 @@ static int cli_io_handler_table(struct appctx *appctx)
 	struct ebmb_node *eb;
 	int dt;
 	int skip_entry;
+	unsigned int shard;
 	int show = appctx->ctx.table.action == STK_CLI_ACT_SHOW;
 
 	/*
@@ -3744,16 +3860,11 @@ static int cli_io_handler_table(struct appctx *appctx)
 				if (appctx->ctx.table.target &&
 				    (strm_li(s)->bind_conf->level & ACCESS_LVL_MASK) >= ACCESS_LVL_OPER) {
 					/* dump entries only if table explicitly requested */
-					HA_SPIN_LOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
-					eb = ebmb_first(&appctx->ctx.table.t->keys);
-					if (eb) {
-						appctx->ctx.table.entry = ebmb_entry(eb, struct stksess, key);
-						appctx->ctx.table.entry->ref_cnt++;
+					appctx->ctx.table.entry = stktable_first_entry(appctx->ctx.table.t, 0);
+					if (appctx->ctx.table.entry) {
 						appctx->st2 = STAT_ST_LIST;
-						HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
 						break;
 					}
-					HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
 				}
 			}
 			appctx->ctx.table.t = appctx->ctx.table.t->next;
@@ -3816,8 +3927,9 @@ static int cli_io_handler_table(struct appctx *appctx)
 
 			HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &appctx->ctx.table.entry->lock);
 
-			HA_SPIN_LOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
-			appctx->ctx.table.entry->ref_cnt--;
+			shard = appctx->ctx.table.entry->shard;
+			HA_SPIN_LOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->shards[shard].lock);
+			HA_ATOMIC_SUB(&appctx->ctx.table.entry->ref_cnt, 1);
 
 			eb = ebmb_next(&appctx->ctx.table.entry->key);
 			if (eb) {
@@ -3827,8 +3939,8 @@ static int cli_io_handler_table(struct appctx *appctx)
 					__stksess_kill_if_expired(appctx->ctx.table.t, old);
 				else if (!skip_entry && !appctx->ctx.table.entry->ref_cnt)
 					__stksess_kill(appctx->ctx.table.t, old);
-				appctx->ctx.table.entry->ref_cnt++;
-				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
+				HA_ATOMIC_ADD(&appctx->ctx.table.entry->ref_cnt, 1);
+				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->shards[shard].lock);
 				break;
 			}
 
@@ -3838,7 +3950,12 @@ static int cli_io_handler_table(struct appctx *appctx)
 			else if (!skip_entry && !appctx->ctx.table.entry->ref_cnt)
 				__stksess_kill(appctx->ctx.table.t, appctx->ctx.table.entry);
 
-			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->lock);
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &appctx->ctx.table.t->shards[shard].lock);
+
+			/* this shard is done, go on with the next ones */
+			appctx->ctx.table.entry = stktable_first_entry(appctx->ctx.table.t, shard + 1);
+			if (appctx->ctx.table.entry)
+				break;
 
 			appctx->ctx.table.t = appctx->ctx.table.t->next;
 			appctx->st2 = STAT_ST_INFO;
@@ -1776,6 +1776,30 @@ static int process_store_rules(struct stream *s, struct channel *rep, int an_bit
 		}							\
 	}
 
+/* Returns non-zero if the message forwarded on channel <chn> of stream <s> is
+ * known to still have more data to come than a buffer can hold. Such a
+ * transfer is worth splicing right away with "option splice-auto", without
+ * waiting for the channel to be detected as a fast streamer.
+ */
+static inline int stream_chn_is_bulk(const struct stream *s, const struct channel *chn)
+{
+	unsigned long long left;
+
+	if (IS_HTX_STRM(s)) {
+		if (!c_data(chn))
+			return 0;
+		left = htxbuf(&chn->buf)->extra;
+		if (left == ULLONG_MAX)
+			return 0;
+	}
+	else {
+		if (chn->to_forward == CHN_INFINITE_FORWARD)
+			return 0;
+		left = chn->to_forward;
+	}
+	return left >= global.tune.bufsize;
+}
+
 /* Processes the client, server, request and response jobs of a stream task,
  * then puts it back to the wait queue in a clean state, or cleans up its
  * resources if it must be deleted. Returns in <next> the date the task wants
@@ -2343,7 +2367,7 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 	    (pipes_used < global.maxpipes) &&
 	    (((sess->fe->options2|s->be->options2) & PR_O2_SPLIC_REQ) ||
 	     (((sess->fe->options2|s->be->options2) & PR_O2_SPLIC_AUT) &&
-	      (req->flags & CF_STREAMER_FAST)))) {
+	      ((req->flags & CF_STREAMER_FAST) || stream_chn_is_bulk(s, req))))) {
 		req->flags |= CF_KERN_SPLICING;
 	}
 
@@ -2547,7 +2571,7 @@ struct task *process_stream(struct task *t, void *context, unsigned short state)
 	    (pipes_used < global.maxpipes) &&
 	    (((sess->fe->options2|s->be->options2) & PR_O2_SPLIC_RTR) ||
 	     (((sess->fe->options2|s->be->options2) & PR_O2_SPLIC_AUT) &&
-	      (res->flags & CF_STREAMER_FAST)))) {
+	      ((res->flags & CF_STREAMER_FAST) || stream_chn_is_bulk(s, res))))) {
 		res->flags |= CF_KERN_SPLICING;
 	}
 
@@ -35,7 +35,6 @@ DECLARE_POOL(pool_head_tasklet, "tasklet", sizeof(struct tasklet));
 DECLARE_POOL(pool_head_notification, "notification", sizeof(struct notification));
 
 unsigned int nb_tasks = 0;
-volatile unsigned long global_tasks_mask = 0; /* Mask of threads with tasks in the global runqueue */
 unsigned int tasks_run_queue = 0;
 unsigned int tasks_run_queue_cur = 0;    /* copy of the run queue size */
 unsigned int nb_tasks_cur = 0;     /* copy of the tasks count */
@@ -43,44 +42,193 @@ unsigned int niced_tasks = 0;      /* number of niced tasks in the run queue */
 
 THREAD_LOCAL struct task *curr_task = NULL; /* task currently running or NULL */
 
-__decl_aligned_spinlock(rq_lock); /* spin lock related to run queue */
 __decl_aligned_rwlock(wq_lock);   /* RW lock related to the wait queue */
 
 #ifdef USE_THREAD
 struct eb_root timers;      /* sorted timers tree, global */
-struct eb_root rqueue;      /* tree constituting the run queue */
-int global_rqueue_size; /* Number of element sin the global runqueue */
 #endif
 
 static unsigned int rqueue_ticks;  /* insertion count */
 
 struct task_per_thread task_per_thread[MAX_THREADS];
 
+#ifdef USE_THREAD
+/* Pushes the chain of tasks going from <first> to <last> at the head of the
+ * inbox of thread <thr>. Any thread may push at any time. An inbox is only
+ * ever emptied as a whole, either by its owner or by a thread stealing from
+ * it, so that there is no ABA issue here.
+ */
+static inline void task_inbox_push(int thr, struct task *first, struct task *last)
+{
+	struct task *head = task_per_thread[thr].inbox;
+
+	do {
+		last->rq_next = head;
+	} while (!HA_ATOMIC_CAS(&task_per_thread[thr].inbox, &head, first));
+}
+
+/* Wakes up thread <thr> if it is sleeping. Must be called after something was
+ * pushed into its inbox.
+ */
+static inline void task_inbox_notify(int thr)
+{
+	unsigned long bit = 1UL << thr;
+
+	if (thr != tid && (sleeping_thread_mask & bit)) {
+		_HA_ATOMIC_AND(&sleeping_thread_mask, ~bit);
+		wake_thread(thr);
+	}
+}
+
+/* Queues task <t> into the inbox of one of the threads allowed to run it. The
+ * current thread is preferred if it is one of them, then threads which are not
+ * sleeping, so that one is only woken up if all of them are sleeping. The task
+ * must already carry its run queue key.
+ */
+static void task_inbox_dispatch(struct task *t)
+{
+	unsigned long mask = t->thread_mask & all_threads_mask;
+	unsigned long m;
+	int thr;
+
+	if (!mask || (mask & tid_bit))
+		thr = tid;
+	else {
+		/* start from a random thread to spread the load */
+		m = mask & ~sleeping_thread_mask;
+		if (!m)
+			m = mask;
+		thr = ha_random32() % global.nbthread;
+		thr = my_ffsl((m & (~0UL << thr)) ? (m & (~0UL << thr)) : m) - 1;
+	}
+
+	_HA_ATOMIC_OR(&t->state, TASK_INBOX);
+	task_inbox_push(thr, t, t);
+	task_inbox_notify(thr);
+}
+
+/* Inserts task <t> taken from an inbox into the current thread's run queue. */
+static inline void task_inbox_take(struct task *t)
+{
+	eb32sc_insert(&task_per_thread[tid].rqueue, &t->rq, t->thread_mask);
+	task_per_thread[tid].rqueue_size++;
+	_HA_ATOMIC_AND(&t->state, ~TASK_INBOX);
+}
+
+/* Moves the tasks found in the current thread's inbox to its run queue. At
+ * most <max> of them are taken, the oldest ones. The more recent ones are put
+ * back into the inbox so that idle threads may steal them, and one of these
+ * threads is woken up if all of them are sleeping. Tasks which are not allowed
+ * to run on this thread anymore are dispatched again. Returns the number of
+ * tasks moved.
+ */
+static int task_drain_inbox(int max)
+{
+	struct task *list, *last, *t;
+	unsigned long held;
+	int count = 0;
+
+	list = _HA_ATOMIC_XCHG(&task_per_thread[tid].inbox, NULL);
+	if (!list)
+		return 0;
+
+	/* the inbox is a stack, the most recent tasks come first */
+	for (t = list; t; t = t->rq_next)
+		count++;
+
+	if (count > max) {
+		last = list;
+		held = last->thread_mask;
+		while (--count > max) {
+			last = last->rq_next;
+			held |= last->thread_mask;
+		}
+		t = last->rq_next;
+		task_inbox_push(tid, list, last);
+		list = t;
+
+		held &= all_threads_mask & sleeping_thread_mask & ~tid_bit;
+		if (held)
+			task_inbox_notify(my_ffsl(held) - 1);
+	}
+
+	count = 0;
+	while (list) {
+		t = list;
+		list = t->rq_next;
+		if (likely(t->thread_mask & tid_bit)) {
+			task_inbox_take(t);
+			count++;
+		}
+		else
+			task_inbox_dispatch(t);
+	}
+	return count;
+}
+
+/* Called by a thread which has nothing to run. Looks for another thread's
+ * inbox holding tasks the current thread may run, and moves up to <max> of
+ * them to its own run queue. The other ones are given back. Returns the number
+ * of tasks stolen.
+ */
+static int task_steal(int max)
+{
+	struct task *list, *first, *last, *t;
+	int stolen = 0;
+	int i, thr;
+
+	for (i = 1; i < global.nbthread && !stolen; i++) {
+		thr = tid + i;
+		if (thr >= global.nbthread)
+			thr -= global.nbthread;
+
+		if (!task_per_thread[thr].inbox)
+			continue;
+
+		list = _HA_ATOMIC_XCHG(&task_per_thread[thr].inbox, NULL);
+		first = last = NULL;
+		while (list) {
+			t = list;
+			list = t->rq_next;
+			if ((t->thread_mask & tid_bit) && stolen < max) {
+				task_inbox_take(t);
+				stolen++;
+				continue;
+			}
+			if (last)
+				last->rq_next = t;
+			else
+				first = t;
+			last = t;
+		}
+
+		if (first) {
+			/* the owner may have found its inbox empty meanwhile */
+			task_inbox_push(thr, first, last);
+			task_inbox_notify(thr);
+		}
+	}
+
+	activity[tid].rq_steal += stolen;
+	return stolen;
+}
+#endif
+
 /* Puts the task <t> in run queue at a position depending on t->nice. <t> is
  * returned. The nice value assigns boosts in 32th of the run queue size. A
  * nice value of -1024 sets the task to -tasks_run_queue*32, while a nice value
  * of 1024 sets the task to tasks_run_queue*32. The state flags are cleared, so
  * the caller will have to set its flags after this call.
+ * A task which may only run on the current thread is directly inserted into
+ * its run queue. Other ones are pushed into the lock-free inbox of one of the
+ * threads allowed to run them, which will move them to its run queue, unless
+ * an idle thread steals them first.
  * The task must not already be in the run queue. If unsure, use the safer
  * task_wakeup() function.
  */
-void __task_wakeup(struct task *t, struct eb_root *root)
+void __task_wakeup(struct task *t)
 {
-#ifdef USE_THREAD
-	if (root == &rqueue) {
-		HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
-	}
-#endif
-	/* Make sure if the task isn't in the runqueue, nobody inserts it
-	 * in the meanwhile.
-	 */
 	_HA_ATOMIC_ADD(&tasks_run_queue, 1);
-#ifdef USE_THREAD
-	if (root == &rqueue) {
-		global_tasks_mask |= t->thread_mask;
-		__ha_barrier_store();
-	}
-#endif
 	t->rq.key = _HA_ATOMIC_ADD(&rqueue_ticks, 1);
 
 	if (likely(t->nice)) {
@@ -94,32 +242,14 @@ void __task_wakeup(struct task *t, struct eb_root *root)
 	if (task_profiling_mask & tid_bit)
 		t->call_date = now_mono_time();
 
-	eb32sc_insert(root, &t->rq, t->thread_mask);
-#ifdef USE_THREAD
-	if (root == &rqueue) {
-		global_rqueue_size++;
-		_HA_ATOMIC_OR(&t->state, TASK_GLOBAL);
-		HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
-	} else
-#endif
-	{
-		int nb = ((void *)root - (void *)&task_per_thread[0].rqueue) / sizeof(task_per_thread[0]);
-		task_per_thread[nb].rqueue_size++;
-	}
 #ifdef USE_THREAD
-	/* If all threads that are supposed to handle this task are sleeping,
-	 * wake one.
-	 */
-	if ((((t->thread_mask & all_threads_mask) & sleeping_thread_mask) ==
-	     (t->thread_mask & all_threads_mask))) {
-		unsigned long m = (t->thread_mask & all_threads_mask) &~ tid_bit;
-
-		m = (m & (m - 1)) ^ m; // keep lowest bit set
-		_HA_ATOMIC_AND(&sleeping_thread_mask, ~m);
-		wake_thread(my_ffsl(m) - 1);
+	if (t->thread_mask != tid_bit && global.nbthread > 1) {
+		task_inbox_dispatch(t);
+		return;
 	}
 #endif
-	return;
+	eb32sc_insert(&task_per_thread[tid].rqueue, &t->rq, t->thread_mask);
+	task_per_thread[tid].rqueue_size++;
 }
 
 /*
@@ -153,6 +283,203 @@ void __task_queue(struct task *task, struct eb_root *wq)
 	eb32_insert(wq, &task->wq);
 }
 
+/* Inserts task <t> into timer wheel <w> at date t->wq.key, or at the wheel's
+ * clock if this date is already past. Returns 0 if the date is out of the
+ * wheel's range, in which case the task is not queued.
+ */
+static int timer_wheel_insert(struct timer_wheel *w, struct task *t)
+{
+	unsigned int date = t->wq.key;
+	unsigned int delta = date - w->clock;
+	int lvl, idx;
+
+	if ((int)delta < 0) {
+		date = w->clock;
+		delta = 0;
+	}
+
+	for (lvl = 0; delta >> ((lvl + 1) * TIMER_WHEEL_BITS); lvl++)
+		if (lvl == TIMER_WHEEL_LEVELS - 1)
+			return 0;
+
+	idx = (date >> (lvl * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+	LIST_ADDQ(&w->slot[lvl][idx], &t->wheel);
+	w->map[lvl] |= 1ULL << idx;
+	return 1;
+}
+
+/* Moves the tasks of slot <idx> of level <lvl> of wheel <w> to the lower
+ * levels, now that the wheel's clock has reached this slot.
+ */
+static void timer_wheel_cascade(struct timer_wheel *w, int lvl, int idx)
+{
+	struct list *slot = &w->slot[lvl][idx];
+	struct task *t;
+
+	while (!LIST_ISEMPTY(slot)) {
+		t = LIST_NEXT(slot, struct task *, wheel);
+		LIST_DEL_INIT(&t->wheel);
+		timer_wheel_insert(w, t);
+	}
+	w->map[lvl] &= ~(1ULL << idx);
+}
+
+/* Returns the date of the first slot of wheel <w> holding tasks, or
+ * TICK_ETERNITY if the wheel is empty. For the upper levels, this is the date
+ * their tasks will be moved down, which is never later than their expiration
+ * date. Empty slots found on the way are cleared from the map.
+ */
+static int timer_wheel_next(struct timer_wheel *w)
+{
+	int ret = TICK_ETERNITY;
+	unsigned int base, date;
+	uint64_t map;
+	int lvl, idx, dist, first;
+
+	for (lvl = 0; lvl < TIMER_WHEEL_LEVELS; lvl++) {
+		base = w->clock >> (lvl * TIMER_WHEEL_BITS);
+		/* level 0 starts at the clock's slot, the other ones after it */
+		first = !!lvl;
+		while ((map = w->map[lvl])) {
+			idx = (base + first) & (TIMER_WHEEL_SLOTS - 1);
+			map = (map >> idx) | (idx ? map << (TIMER_WHEEL_SLOTS - idx) : 0);
+			dist = __builtin_ctzll(map);
+			idx = (idx + dist) & (TIMER_WHEEL_SLOTS - 1);
+			if (!LIST_ISEMPTY(&w->slot[lvl][idx])) {
+				date = (base + first + dist) << (lvl * TIMER_WHEEL_BITS);
+				ret = tick_first(ret, date ? date : 1);
+				break;
+			}
+			w->map[lvl] &= ~(1ULL << idx);
+		}
+	}
+	return ret;
+}
+
+/* Inserts task <task>, bound to the current thread, into this thread's timer
+ * wheel at the position given by its expiration date, or into its wait queue
+ * tree if the wheel is not allocated yet or the date is too far. It has the
+ * same requirements as __task_queue() and no locking is needed.
+ */
+void __task_queue_local(struct task *task)
+{
+	struct timer_wheel *w = task_per_thread[tid].wheel;
+
+	if (likely(task_in_wq(task)))
+		__task_unlink_wq(task);
+
+	task->wq.key = task->expire;
+#ifdef DEBUG_CHECK_INVALID_EXPIRATION_DATES
+	if (tick_is_lt(task->wq.key, now_ms))
+		/* we're queuing too far away or in the past (most likely) */
+		return;
+#endif
+
+	if (likely(w) && timer_wheel_insert(w, task))
+		return;
+
+	eb32_insert(&task_per_thread[tid].timers, &task->wq);
+}
+
+/* Runs the current thread's timer wheel up to <now_ms>, waking up the expired
+ * tasks and requeuing the ones whose expiration date was pushed back. Returns
+ * the date of the next event in the wheel, or eternity.
+ */
+static int timer_wheel_run()
+{
+	struct timer_wheel *w = task_per_thread[tid].wheel;
+	struct list *slot;
+	struct task *task;
+	uint64_t map;
+	int lvl, idx, step;
+
+	if (!w)
+		return TICK_ETERNITY;
+
+	while (tick_is_le(w->clock, now_ms)) {
+		if (!timer_wheel_used(w)) {
+			w->clock = now_ms + 1;
+			break;
+		}
+
+		idx = w->clock & (TIMER_WHEEL_SLOTS - 1);
+		for (lvl = 1; !idx && lvl < TIMER_WHEEL_LEVELS; lvl++) {
+			idx = (w->clock >> (lvl * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+			timer_wheel_cascade(w, lvl, idx);
+		}
+
+		idx = w->clock & (TIMER_WHEEL_SLOTS - 1);
+		slot = &w->slot[0][idx];
+		while (!LIST_ISEMPTY(slot)) {
+			task = LIST_NEXT(slot, struct task *, wheel);
+			LIST_DEL_INIT(&task->wheel);
+
+			/* same as for the trees, the expiration date may have
+			 * been pushed back or disabled since the task was queued.
+			 */
+			if (!tick_is_expired(task->expire, now_ms)) {
+				if (tick_isset(task->expire))
+					__task_queue_local(task);
+				continue;
+			}
+			task_wakeup(task, TASK_WOKEN_TIMER);
+		}
+		w->map[0] &= ~(1ULL << idx);
+
+		/* skip to the next used slot or to the next cascade */
+		map = idx < TIMER_WHEEL_SLOTS - 1 ? w->map[0] >> (idx + 1) : 0;
+		step = map ? __builtin_ctzll(map) + 1 : TIMER_WHEEL_SLOTS - idx;
+		if (tick_is_lt(now_ms, w->clock + step))
+			w->clock = now_ms + 1;
+		else
+			w->clock += step;
+	}
+
+	return timer_wheel_next(w);
+}
+
+/* allocates the timer wheel of the current thread */
+static int alloc_timer_wheel_per_thread()
+{
+	struct timer_wheel *w;
+	int lvl, idx;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return 0;
+
+	for (lvl = 0; lvl < TIMER_WHEEL_LEVELS; lvl++)
+		for (idx = 0; idx < TIMER_WHEEL_SLOTS; idx++)
+			LIST_INIT(&w->slot[lvl][idx]);
+	w->clock = now_ms;
+	task_per_thread[tid].wheel = w;
+	return 1;
+}
+
+/* releases the timer wheel of the current thread. The tasks still in it are
+ * detached first so that they may still be destroyed later.
+ */
+static void free_timer_wheel_per_thread()
+{
+	struct timer_wheel *w = task_per_thread[tid].wheel;
+	struct task *t;
+	int lvl, idx;
+
+	if (!w)
+		return;
+
+	task_per_thread[tid].wheel = NULL;
+	for (lvl = 0; lvl < TIMER_WHEEL_LEVELS; lvl++) {
+		for (idx = 0; idx < TIMER_WHEEL_SLOTS; idx++) {
+			while (!LIST_ISEMPTY(&w->slot[lvl][idx])) {
+				t = LIST_NEXT(&w->slot[lvl][idx], struct task *, wheel);
+				LIST_DEL_INIT(&t->wheel);
+			}
+		}
+	}
+	free(w);
+}
+
 /*
  * Extract all expired timers from the timer queue, and wakes up all
  * associated tasks. Returns the date of next event (or eternity).
@@ -208,6 +535,8 @@ int wake_expired_tasks()
 		task_wakeup(task, TASK_WOKEN_TIMER);
 	}
 
+	ret = tick_first(ret, timer_wheel_run());
+
 #ifdef USE_THREAD
 	if (eb_is_empty(&timers))
 		goto leave;
@@ -289,84 +618,55 @@ leave:
  * other variables (eg: nice value) to set the final position in the tree. The
  * counter may wrap without a problem, of course. We then limit the number of
  * tasks processed to 200 in any case, so that general latency remains low and
- * so that task positions have a chance to be considered. The function scans
- * both the global and local run queues and picks the most urgent task between
- * the two. We need to grab the global runqueue lock to touch it so it's taken
- * on the very first access to the global run queue and is released as soon as
- * it reaches the end.
+ * so that task positions have a chance to be considered. Each thread only
+ * scans its own run queue, so that no lock is needed. Tasks other threads woke
+ * up for it are first moved there from its inbox, keeping their position, and
+ * a thread with nothing to do tries to steal some from another thread's inbox.
  *
  * The function adjusts <next> if a new event is closer.
  */
 void process_runnable_tasks()
 {
 	struct eb32sc_node *lrq = NULL; // next local run queue entry
-	struct eb32sc_node *grq = NULL; // next global run queue entry
 	struct task *t;
 	int max_processed;
 
 	ti->flags &= ~TI_FL_STUCK; // this thread is still running
 
-	if (!thread_has_tasks()) {
-		activity[tid].empty_rq++;
-		return;
-	}
-
-	tasks_run_queue_cur = tasks_run_queue; /* keep a copy for reporting */
-	nb_tasks_cur = nb_tasks;
 	max_processed = global.tune.runqueue_depth;
 
 	if (likely(niced_tasks))
 		max_processed = (max_processed + 3) / 4;
 
-	/* Note: the grq lock is always held when grq is not null */
-
-	while (task_per_thread[tid].task_list_size < max_processed) {
-		if ((global_tasks_mask & tid_bit) && !grq) {
 #ifdef USE_THREAD
-			HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
-			grq = eb32sc_lookup_ge(&rqueue, rqueue_ticks - TIMER_LOOK_BACK, tid_bit);
-			if (unlikely(!grq)) {
-				grq = eb32sc_first(&rqueue, tid_bit);
-				if (!grq) {
-					global_tasks_mask &= ~tid_bit;
-					HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
-				}
-			}
+	if (task_per_thread[tid].inbox)
+		task_drain_inbox(max_processed);
+
+	if (!thread_has_tasks() && global.nbthread > 1)
+		task_steal(max_processed);
 #endif
-		}
 
-		/* If a global task is available for this thread, it's in grq
-		 * now and the global RQ is locked.
-		 */
+	if (!thread_has_tasks()) {
+		activity[tid].empty_rq++;
+		return;
+	}
+
+	tasks_run_queue_cur = tasks_run_queue; /* keep a copy for reporting */
+	nb_tasks_cur = nb_tasks;
 
+	while (task_per_thread[tid].task_list_size < max_processed) {
 		if (!lrq) {
 			lrq = eb32sc_lookup_ge(&task_per_thread[tid].rqueue, rqueue_ticks - TIMER_LOOK_BACK, tid_bit);
 			if (unlikely(!lrq))
 				lrq = eb32sc_first(&task_per_thread[tid].rqueue, tid_bit);
 		}
 
-		if (!lrq && !grq)
+		if (!lrq)
 			break;
 
-		if (likely(!grq || (lrq && (int)(lrq->key - grq->key) <= 0))) {
-			t = eb32sc_entry(lrq, struct task, rq);
-			lrq = eb32sc_next(lrq, tid_bit);
-			__task_unlink_rq(t);
-		}
-#ifdef USE_THREAD
-		else {
-			t = eb32sc_entry(grq, struct task, rq);
-			grq = eb32sc_next(grq, tid_bit);
-			__task_unlink_rq(t);
-			if (unlikely(!grq)) {
-				grq = eb32sc_first(&rqueue, tid_bit);
-				if (!grq) {
-					global_tasks_mask &= ~tid_bit;
-					HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
-				}
-			}
-		}
-#endif
+		t = eb32sc_entry(lrq, struct task, rq);
+		lrq = eb32sc_next(lrq, tid_bit);
+		__task_unlink_rq(t);
 
 		/* And add it to the local task list */
 		tasklet_insert_into_tasklet_list((struct tasklet *)t);
@@ -374,12 +674,6 @@ void process_runnable_tasks()
 		activity[tid].tasksw++;
 	}
 
-	/* release the rqueue lock */
-	if (grq) {
-		HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
-		grq = NULL;
-	}
-
 	while (max_processed > 0 && !LIST_ISEMPTY(&task_per_thread[tid].task_list)) {
 		struct task *t;
 		unsigned short state;
@@ -447,6 +741,35 @@ void process_runnable_tasks()
 		activity[tid].long_rq++;
 }
 
+/* frees the tasklet passed in <context> on the thread this task runs on */
+static struct task *tasklet_release_task(struct task *t, void *context, unsigned short state)
+{
+	tasklet_free(context);
+	task_destroy(t);
+	return NULL;
+}
+
+/* Releases tasklet <tl> which was used by thread <thr> and may still be queued
+ * there or about to be run by it. Its context is reset so that its handler
+ * knows it must not do anything anymore, and the tasklet is freed by a task
+ * run on thread <thr>. Returns 0 on success or -1 on memory allocation error,
+ * in which case the tasklet is left untouched.
+ */
+int tasklet_release_on(struct tasklet *tl, int thr)
+{
+	struct task *t;
+
+	t = task_new(1UL << thr);
+	if (!t)
+		return -1;
+	t->process = tasklet_release_task;
+	t->context = tl;
+	tl->context = NULL;
+	__ha_barrier_store();
+	task_wakeup(t, TASK_WOKEN_OTHER);
+	return 0;
+}
+
 /* create a work list array for <nbthread> threads, using tasks made of
  * function <fct>. The context passed to the function will be the pointer to
  * the thread's work list, which will contain a copy of argument <arg>. The
@@ -503,12 +826,16 @@ void mworker_cleantasks()
 	struct eb32sc_node *tmp_rq = NULL;
 
 #ifdef USE_THREAD
-	/* cleanup the global run queue */
-	tmp_rq = eb32sc_first(&rqueue, MAX_THREADS_MASK);
-	while (tmp_rq) {
-		t = eb32sc_entry(tmp_rq, struct task, rq);
-		tmp_rq = eb32sc_next(tmp_rq, MAX_THREADS_MASK);
-		task_destroy(t);
+	/* cleanup the inboxes */
+	for (i = 0; i < global.nbthread; i++) {
+		struct task *next;
+
+		t = _HA_ATOMIC_XCHG(&task_per_thread[i].inbox, NULL);
+		while (t) {
+			next = t->rq_next;
+			task_destroy(t);
+			t = next;
+		}
 	}
 	/* cleanup the timers queue */
 	tmp_wq = eb32_first(&timers);
@@ -533,6 +860,22 @@ void mworker_cleantasks()
 			tmp_wq = eb32_next(tmp_wq);
 			task_destroy(t);
 		}
+		/* and the per thread timer wheel */
+		if (task_per_thread[i].wheel) {
+			int lvl, idx;
+
+			for (lvl = 0; lvl < TIMER_WHEEL_LEVELS; lvl++) {
+				for (idx = 0; idx < TIMER_WHEEL_SLOTS; idx++) {
+					struct list *slot = &task_per_thread[i].wheel->slot[lvl][idx];
+
+					while (!LIST_ISEMPTY(slot)) {
+						t = LIST_NEXT(slot, struct task *, wheel);
+						LIST_DEL_INIT(&t->wheel);
+						task_destroy(t);
+					}
+				}
+			}
+		}
 	}
 }
 
@@ -543,7 +886,6 @@ static void init_task()
 
 #ifdef USE_THREAD
 	memset(&timers, 0, sizeof(timers));
-	memset(&rqueue, 0, sizeof(rqueue));
 #endif
 	memset(&task_per_thread, 0, sizeof(task_per_thread));
 	for (i = 0; i < MAX_THREADS; i++) {
@@ -552,6 +894,8 @@ static void init_task()
 }
 
 INITCALL0(STG_PREPARE, init_task);
+REGISTER_PER_THREAD_ALLOC(alloc_timer_wheel_per_thread);
+REGISTER_PER_THREAD_FREE(free_timer_wheel_per_thread);
 
 /*
  * Local variables:
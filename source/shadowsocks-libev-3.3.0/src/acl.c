@@ -26,6 +26,12 @@
 
 #include <ctype.h>
 
+#ifdef HAVE_LIBEV_EV_H
+#include <libev/ev.h>
+#else
+#include <ev.h>
+#endif
+
 #ifdef USE_SYSTEM_SHARED_LIB
 #include <libcorkipset/ipset.h>
 #else
@@ -33,25 +39,58 @@
 #endif
 
 #include "rule.h"
+#include "lpm.h"
 #include "netutils.h"
 #include "utils.h"
-#include "cache.h"
 #include "acl.h"
 
-static struct ip_set white_list_ipv4;
-static struct ip_set white_list_ipv6;
-
-static struct ip_set black_list_ipv4;
-static struct ip_set black_list_ipv6;
-
-static struct cork_dllist black_list_rules;
-static struct cork_dllist white_list_rules;
-
-static int acl_mode = BLACK_LIST;
-
-static struct ip_set outbound_block_list_ipv4;
-static struct ip_set outbound_block_list_ipv6;
-static struct cork_dllist outbound_block_list_rules;
+/*
+ * Everything loaded from one ACL file lives in a snapshot. Lookups only
+ * ever see the published one; a reload builds its replacement a few lines
+ * per event loop iteration and swaps it in once complete.
+ */
+typedef struct acl {
+    int mode;
+
+    struct ip_set white_list_ipv4;
+    struct ip_set white_list_ipv6;
+    struct ip_set black_list_ipv4;
+    struct ip_set black_list_ipv6;
+    struct ip_set outbound_block_list_ipv4;
+    struct ip_set outbound_block_list_ipv6;
+
+    struct cork_dllist black_list_rules;
+    struct cork_dllist white_list_rules;
+    struct cork_dllist outbound_block_list_rules;
+
+    /*
+     * The IP sets above stay the source of truth, lookups go through
+     * these flat tables compiled from them.
+     */
+    lpm_t ipv4;
+    lpm_t ipv6;
+} acl_t;
+
+/* An ACL file being parsed into a new snapshot */
+typedef struct acl_loader {
+    FILE *f;
+    acl_t *ctx;
+
+    struct ip_set *list_ipv4;
+    struct ip_set *list_ipv6;
+    struct cork_dllist *rules;
+} acl_loader_t;
+
+#define ACL_BLACK    1
+#define ACL_WHITE    2
+#define ACL_OUTBOUND 4
+
+#define ACL_RELOAD_LINES 256 /* Lines parsed per loop iteration on reload */
+
+static acl_t *acl_current        = NULL;
+static acl_loader_t *acl_pending = NULL;
+static char *acl_path            = NULL;
+static struct ev_idle acl_watcher;
 
 static void
 parse_addr_cidr(const char *str, char *host, int *cidr)
@@ -97,41 +136,122 @@ trimwhitespace(char *str)
     return str;
 }
 
-int
-init_acl(const char *path)
+static void
+compile_ip_set(acl_t *ctx, struct ip_set *set, uint32_t flag)
 {
-    if (path == NULL)
-    {
-        return -1;
+    struct ipset_iterator *it = ipset_iterate_networks(set, true);
+
+    for (; !it->finished; ipset_iterator_advance(it)) {
+        if (it->addr.version == 4) {
+            lpm_insert(&ctx->ipv4, (const uint8_t *)&it->addr.ip.v4, 32,
+                       it->cidr_prefix, flag);
+        } else if (it->addr.version == 6) {
+            lpm_insert(&ctx->ipv6, (const uint8_t *)&it->addr.ip.v6, 128,
+                       it->cidr_prefix, flag);
+        }
     }
 
-    // initialize ipset
-    ipset_init_library();
+    ipset_iterator_free(it);
+}
+
+static void
+compile_acl(acl_t *ctx)
+{
+    lpm_free(&ctx->ipv4);
+    lpm_free(&ctx->ipv6);
+    lpm_init(&ctx->ipv4);
+    lpm_init(&ctx->ipv6);
+
+    compile_ip_set(ctx, &ctx->black_list_ipv4, ACL_BLACK);
+    compile_ip_set(ctx, &ctx->black_list_ipv6, ACL_BLACK);
+    compile_ip_set(ctx, &ctx->white_list_ipv4, ACL_WHITE);
+    compile_ip_set(ctx, &ctx->white_list_ipv6, ACL_WHITE);
+    compile_ip_set(ctx, &ctx->outbound_block_list_ipv4, ACL_OUTBOUND);
+    compile_ip_set(ctx, &ctx->outbound_block_list_ipv6, ACL_OUTBOUND);
+}
+
+void
+free_rules(struct cork_dllist *rules)
+{
+    struct cork_dllist_item *iter;
+    while ((iter = cork_dllist_head(rules)) != NULL) {
+        rule_t *rule = cork_container_of(iter, rule_t, entries);
+        remove_rule(rule);
+    }
+}
 
-    ipset_init(&white_list_ipv4);
-    ipset_init(&white_list_ipv6);
-    ipset_init(&black_list_ipv4);
-    ipset_init(&black_list_ipv6);
-    ipset_init(&outbound_block_list_ipv4);
-    ipset_init(&outbound_block_list_ipv6);
+static void
+free_acl_ctx(acl_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
 
-    cork_dllist_init(&black_list_rules);
-    cork_dllist_init(&white_list_rules);
-    cork_dllist_init(&outbound_block_list_rules);
+    ipset_done(&ctx->black_list_ipv4);
+    ipset_done(&ctx->black_list_ipv6);
+    ipset_done(&ctx->white_list_ipv4);
+    ipset_done(&ctx->white_list_ipv6);
+    ipset_done(&ctx->outbound_block_list_ipv4);
+    ipset_done(&ctx->outbound_block_list_ipv6);
 
-    struct ip_set *list_ipv4  = &black_list_ipv4;
-    struct ip_set *list_ipv6  = &black_list_ipv6;
-    struct cork_dllist *rules = &black_list_rules;
+    free_rules(&ctx->black_list_rules);
+    free_rules(&ctx->white_list_rules);
+    free_rules(&ctx->outbound_block_list_rules);
 
+    lpm_free(&ctx->ipv4);
+    lpm_free(&ctx->ipv6);
+
+    ss_free(ctx);
+}
+
+static acl_loader_t *
+load_acl_begin(const char *path)
+{
     FILE *f = fopen(path, "r");
     if (f == NULL) {
         LOGE("Invalid acl path.");
-        return -1;
+        return NULL;
     }
 
+    acl_t *ctx = ss_malloc(sizeof(acl_t));
+    memset(ctx, 0, sizeof(acl_t));
+
+    ctx->mode = BLACK_LIST;
+
+    ipset_init(&ctx->white_list_ipv4);
+    ipset_init(&ctx->white_list_ipv6);
+    ipset_init(&ctx->black_list_ipv4);
+    ipset_init(&ctx->black_list_ipv6);
+    ipset_init(&ctx->outbound_block_list_ipv4);
+    ipset_init(&ctx->outbound_block_list_ipv6);
+
+    cork_dllist_init(&ctx->black_list_rules);
+    cork_dllist_init(&ctx->white_list_rules);
+    cork_dllist_init(&ctx->outbound_block_list_rules);
+
+    acl_loader_t *loader = ss_malloc(sizeof(acl_loader_t));
+    loader->f         = f;
+    loader->ctx       = ctx;
+    loader->list_ipv4 = &ctx->black_list_ipv4;
+    loader->list_ipv6 = &ctx->black_list_ipv6;
+    loader->rules     = &ctx->black_list_rules;
+
+    return loader;
+}
+
+/*
+ * Parse up to <lines> more lines. Return 1 once the whole file is loaded
+ * and compiled, 0 if there is more to parse.
+ */
+static int
+load_acl_step(acl_loader_t *loader, int lines)
+{
+    FILE *f    = loader->f;
+    acl_t *ctx = loader->ctx;
+
     char buf[MAX_HOSTNAME_LEN];
 
-    while (!feof(f))
+    while (lines-- > 0 && !feof(f))
         if (fgets(buf, 256, f)) {
             // Discards the whole line if longer than 255 characters
             int long_line = 0;  // 1: Long  2: Error
@@ -167,29 +287,29 @@ init_acl(const char *path)
             }
 
             if (strcmp(line, "[outbound_block_list]") == 0) {
-                list_ipv4 = &outbound_block_list_ipv4;
-                list_ipv6 = &outbound_block_list_ipv6;
-                rules     = &outbound_block_list_rules;
+                loader->list_ipv4 = &ctx->outbound_block_list_ipv4;
+                loader->list_ipv6 = &ctx->outbound_block_list_ipv6;
+                loader->rules     = &ctx->outbound_block_list_rules;
                 continue;
             } else if (strcmp(line, "[black_list]") == 0
                        || strcmp(line, "[bypass_list]") == 0) {
-                list_ipv4 = &black_list_ipv4;
-                list_ipv6 = &black_list_ipv6;
-                rules     = &black_list_rules;
+                loader->list_ipv4 = &ctx->black_list_ipv4;
+                loader->list_ipv6 = &ctx->black_list_ipv6;
+                loader->rules     = &ctx->black_list_rules;
                 continue;
             } else if (strcmp(line, "[white_list]") == 0
                        || strcmp(line, "[proxy_list]") == 0) {
-                list_ipv4 = &white_list_ipv4;
-                list_ipv6 = &white_list_ipv6;
-                rules     = &white_list_rules;
+                loader->list_ipv4 = &ctx->white_list_ipv4;
+                loader->list_ipv6 = &ctx->white_list_ipv6;
+                loader->rules     = &ctx->white_list_rules;
                 continue;
             } else if (strcmp(line, "[reject_all]") == 0
                        || strcmp(line, "[bypass_all]") == 0) {
-                acl_mode = WHITE_LIST;
+                ctx->mode = WHITE_LIST;
                 continue;
             } else if (strcmp(line, "[accept_all]") == 0
                        || strcmp(line, "[proxy_all]") == 0) {
-                acl_mode = BLACK_LIST;
+                ctx->mode = BLACK_LIST;
                 continue;
             }
 
@@ -202,56 +322,162 @@ init_acl(const char *path)
             if (!err) {
                 if (addr.version == 4) {
                     if (cidr >= 0) {
-                        ipset_ipv4_add_network(list_ipv4, &(addr.ip.v4), cidr);
+                        ipset_ipv4_add_network(loader->list_ipv4, &(addr.ip.v4), cidr);
                     } else {
-                        ipset_ipv4_add(list_ipv4, &(addr.ip.v4));
+                        ipset_ipv4_add(loader->list_ipv4, &(addr.ip.v4));
                     }
                 } else if (addr.version == 6) {
                     if (cidr >= 0) {
-                        ipset_ipv6_add_network(list_ipv6, &(addr.ip.v6), cidr);
+                        ipset_ipv6_add_network(loader->list_ipv6, &(addr.ip.v6), cidr);
                     } else {
-                        ipset_ipv6_add(list_ipv6, &(addr.ip.v6));
+                        ipset_ipv6_add(loader->list_ipv6, &(addr.ip.v6));
                     }
                 }
             } else {
                 rule_t *rule = new_rule();
                 accept_rule_arg(rule, line);
                 init_rule(rule);
-                add_rule(rules, rule);
+                add_rule(loader->rules, rule);
             }
         }
 
+    if (!feof(f) && !ferror(f)) {
+        return 0;
+    }
+
     fclose(f);
+    loader->f = NULL;
+
+    compile_acl(ctx);
+
+    return 1;
+}
+
+static void
+load_acl_abort(acl_loader_t *loader)
+{
+    if (loader->f != NULL) {
+        fclose(loader->f);
+    }
+    free_acl_ctx(loader->ctx);
+    ss_free(loader);
+}
+
+static acl_t *
+load_acl(const char *path)
+{
+    acl_loader_t *loader = load_acl_begin(path);
+    if (loader == NULL) {
+        return NULL;
+    }
+
+    while (!load_acl_step(loader, ACL_RELOAD_LINES)) {
+    }
+
+    acl_t *ctx = loader->ctx;
+    ss_free(loader);
+
+    return ctx;
+}
+
+/*
+ * Runs on the event loop, once per iteration while a reload is pending,
+ * so libipset and libcork are never used from another thread. No lookup
+ * can be in progress between two callbacks, so the old snapshot has no
+ * readers left once the pointer is swapped and is freed right away.
+ */
+static void
+reload_cb(EV_P_ ev_idle *w, int revents)
+{
+    if (!load_acl_step(acl_pending, ACL_RELOAD_LINES)) {
+        return;
+    }
+
+    ev_idle_stop(EV_A_ w);
+
+    acl_t *old = acl_current;
+    acl_current = acl_pending->ctx;
+    ss_free(acl_pending);
+    acl_pending = NULL;
+    free_acl_ctx(old);
+
+    LOGI("acl reloaded");
+}
+
+int
+init_acl(const char *path)
+{
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    // initialize ipset
+    ipset_init_library();
+
+    acl_t *ctx = load_acl(path);
+    if (ctx == NULL) {
+        return -1;
+    }
+
+    free_acl_ctx(acl_current);
+    acl_current = ctx;
+
+    // started on reload, the loop may not exist yet
+    if (acl_path == NULL) {
+        ev_idle_init(&acl_watcher, reload_cb);
+        // keep parsing even when the loop never runs out of events
+        ev_set_priority(&acl_watcher, EV_MAXPRI);
+    } else {
+        ss_free(acl_path);
+    }
+    acl_path = ss_strndup(path, strlen(path));
 
     return 0;
 }
 
-void
-free_rules(struct cork_dllist *rules)
+/*
+ * Reread the ACL file given to init_acl() without blocking lookups.
+ * Addresses added with acl_add_ip() are dropped by the new snapshot.
+ *
+ * Return 0 if a reload was started, -1 otherwise.
+ */
+int
+reload_acl(void)
 {
-    struct cork_dllist_item *iter;
-    while ((iter = cork_dllist_head(rules)) != NULL) {
-        rule_t *rule = cork_container_of(iter, rule_t, entries);
-        remove_rule(rule);
+    if (acl_path == NULL || acl_pending != NULL) {
+        return -1;
+    }
+
+    acl_pending = load_acl_begin(acl_path);
+    if (acl_pending == NULL) {
+        LOGE("failed to reload acl, keeping the current one");
+        return -1;
     }
+
+    ev_idle_start(EV_DEFAULT, &acl_watcher);
+
+    return 0;
 }
 
 void
 free_acl(void)
 {
-    ipset_done(&black_list_ipv4);
-    ipset_done(&black_list_ipv6);
-    ipset_done(&white_list_ipv4);
-    ipset_done(&white_list_ipv6);
+    if (acl_pending != NULL) {
+        ev_idle_stop(EV_DEFAULT, &acl_watcher);
+        load_acl_abort(acl_pending);
+        acl_pending = NULL;
+    }
 
-    free_rules(&black_list_rules);
-    free_rules(&white_list_rules);
+    free_acl_ctx(acl_current);
+    acl_current = NULL;
+    ss_free(acl_path);
 }
 
 int
 get_acl_mode(void)
 {
-    return acl_mode;
+    return acl_current != NULL ? acl_current->mode : BLACK_LIST;
 }
 
 /*
@@ -262,67 +488,78 @@ get_acl_mode(void)
 int
 acl_match_host(const char *host)
 {
+    acl_t *ctx = acl_current;
     struct cork_ip addr;
     int ret = 0;
     int err = cork_ip_init(&addr, host);
 
+    if (ctx == NULL) {
+        return 0;
+    }
+
     if (err) {
         int host_len = strlen(host);
-        if (lookup_rule(&black_list_rules, host, host_len) != NULL)
+        if (lookup_rule(&ctx->black_list_rules, host, host_len) != NULL)
             ret = 1;
-        else if (lookup_rule(&white_list_rules, host, host_len) != NULL)
+        else if (lookup_rule(&ctx->white_list_rules, host, host_len) != NULL)
             ret = -1;
         return ret;
     }
 
+    uint32_t flags = 0;
     if (addr.version == 4) {
-        if (ipset_contains_ipv4(&black_list_ipv4, &(addr.ip.v4)))
-            ret = 1;
-        else if (ipset_contains_ipv4(&white_list_ipv4, &(addr.ip.v4)))
-            ret = -1;
+        flags = lpm_lookup(&ctx->ipv4, (const uint8_t *)&addr.ip.v4);
     } else if (addr.version == 6) {
-        if (ipset_contains_ipv6(&black_list_ipv6, &(addr.ip.v6)))
-            ret = 1;
-        else if (ipset_contains_ipv6(&white_list_ipv6, &(addr.ip.v6)))
-            ret = -1;
+        flags = lpm_lookup(&ctx->ipv6, (const uint8_t *)&addr.ip.v6);
     }
 
+    if (flags & ACL_BLACK)
+        ret = 1;
+    else if (flags & ACL_WHITE)
+        ret = -1;
+
     return ret;
 }
 
 int
 acl_add_ip(const char *ip)
 {
+    acl_t *ctx = acl_current;
     struct cork_ip addr;
     int err = cork_ip_init(&addr, ip);
-    if (err) {
+    if (ctx == NULL || err) {
         return -1;
     }
 
     if (addr.version == 4) {
-        ipset_ipv4_add(&black_list_ipv4, &(addr.ip.v4));
+        ipset_ipv4_add(&ctx->black_list_ipv4, &(addr.ip.v4));
     } else if (addr.version == 6) {
-        ipset_ipv6_add(&black_list_ipv6, &(addr.ip.v6));
+        ipset_ipv6_add(&ctx->black_list_ipv6, &(addr.ip.v6));
     }
 
+    compile_acl(ctx);
+
     return 0;
 }
 
 int
 acl_remove_ip(const char *ip)
 {
+    acl_t *ctx = acl_current;
     struct cork_ip addr;
     int err = cork_ip_init(&addr, ip);
-    if (err) {
+    if (ctx == NULL || err) {
         return -1;
     }
 
     if (addr.version == 4) {
-        ipset_ipv4_remove(&black_list_ipv4, &(addr.ip.v4));
+        ipset_ipv4_remove(&ctx->black_list_ipv4, &(addr.ip.v4));
     } else if (addr.version == 6) {
-        ipset_ipv6_remove(&black_list_ipv6, &(addr.ip.v6));
+        ipset_ipv6_remove(&ctx->black_list_ipv6, &(addr.ip.v6));
     }
 
+    compile_acl(ctx);
+
     return 0;
 }
 
@@ -333,24 +570,31 @@ acl_remove_ip(const char *ip)
 int
 outbound_block_match_host(const char *host)
 {
+    acl_t *ctx = acl_current;
     struct cork_ip addr;
     int ret = 0;
     int err = cork_ip_init(&addr, host);
 
+    if (ctx == NULL) {
+        return 0;
+    }
+
     if (err) {
         int host_len = strlen(host);
-        if (lookup_rule(&outbound_block_list_rules, host, host_len) != NULL)
+        if (lookup_rule(&ctx->outbound_block_list_rules, host, host_len) != NULL)
             ret = 1;
         return ret;
     }
 
+    uint32_t flags = 0;
     if (addr.version == 4) {
-        if (ipset_contains_ipv4(&outbound_block_list_ipv4, &(addr.ip.v4)))
-            ret = 1;
+        flags = lpm_lookup(&ctx->ipv4, (const uint8_t *)&addr.ip.v4);
     } else if (addr.version == 6) {
-        if (ipset_contains_ipv6(&outbound_block_list_ipv6, &(addr.ip.v6)))
-            ret = 1;
+        flags = lpm_lookup(&ctx->ipv6, (const uint8_t *)&addr.ip.v6);
     }
 
+    if (flags & ACL_OUTBOUND)
+        ret = 1;
+
     return ret;
 }
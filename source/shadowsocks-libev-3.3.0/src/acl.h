@@ -27,6 +27,7 @@
 #define WHITE_LIST 1
 
 int init_acl(const char *path);
+int reload_acl(void);
 void free_acl(void);
 
 int acl_match_host(const char *ip);
@@ -58,6 +58,10 @@
 #define CHUNK_SIZE_LEN          2
 #define CHUNK_SIZE_MASK         0x3FFF
 
+#ifndef AEAD_KEY_POOL_SIZE
+#define AEAD_KEY_POOL_SIZE      64
+#endif
+
 /*
  * Spec: http://shadowsocks.org/en/spec/AEAD-Ciphers.html
  *
@@ -162,7 +166,6 @@ aead_cipher_encrypt(cipher_ctx_t *cipher_ctx,
     int err                      = CRYPTO_OK;
     unsigned long long long_clen = 0;
 
-    size_t nlen = cipher_ctx->cipher->nonce_len;
     size_t tlen = cipher_ctx->cipher->tag_len;
 
     switch (cipher_ctx->cipher->method) {
@@ -174,13 +177,11 @@ aead_cipher_encrypt(cipher_ctx_t *cipher_ctx,
             *clen = (size_t)long_clen; // it's safe to cast 64bit to 32bit length here
             break;
         }
-        // Otherwise, just use the mbedTLS one with crappy AES-NI.
+        // Otherwise, use our own backend, picked at runtime by CPU features.
     case AES192GCM:
     case AES128GCM:
-
-        err = mbedtls_cipher_auth_encrypt(cipher_ctx->evp, n, nlen, ad, adlen,
-                                          m, mlen, c, clen, c + mlen, tlen);
-        *clen += tlen;
+        gcm_encrypt(cipher_ctx->gcm, c, c + mlen, m, mlen, ad, adlen, n);
+        *clen = mlen + tlen;
         break;
     case CHACHA20POLY1305IETF:
         err = crypto_aead_chacha20poly1305_ietf_encrypt(c, &long_clen, m, mlen,
@@ -211,7 +212,6 @@ aead_cipher_decrypt(cipher_ctx_t *cipher_ctx,
     int err                      = CRYPTO_ERROR;
     unsigned long long long_plen = 0;
 
-    size_t nlen = cipher_ctx->cipher->nonce_len;
     size_t tlen = cipher_ctx->cipher->tag_len;
 
     switch (cipher_ctx->cipher->method) {
@@ -223,11 +223,14 @@ aead_cipher_decrypt(cipher_ctx_t *cipher_ctx,
             *plen = (size_t)long_plen; // it's safe to cast 64bit to 32bit length here
             break;
         }
-        // Otherwise, just use the mbedTLS one with crappy AES-NI.
+        // Otherwise, use our own backend, picked at runtime by CPU features.
     case AES192GCM:
     case AES128GCM:
-        err = mbedtls_cipher_auth_decrypt(cipher_ctx->evp, n, nlen, ad, adlen,
-                                          m, mlen - tlen, p, plen, m + mlen - tlen, tlen);
+        if (mlen < tlen)
+            return CRYPTO_ERROR;
+        err = gcm_decrypt(cipher_ctx->gcm, p, m, mlen - tlen, m + mlen - tlen,
+                          ad, adlen, n);
+        *plen = mlen - tlen;
         break;
     case CHACHA20POLY1305IETF:
         err = crypto_aead_chacha20poly1305_ietf_decrypt(p, &long_plen, NULL, m, mlen,
@@ -248,6 +251,55 @@ aead_cipher_decrypt(cipher_ctx_t *cipher_ctx,
     return err;
 }
 
+/*
+ * Expanded AES key schedules are recycled instead of being allocated
+ * for every connection and every UDP packet. Like the static buffers
+ * used by aead_encrypt_all(), the pool assumes a single event loop.
+ */
+typedef union {
+    aes256gcm_ctx aes256gcm;
+    gcm_ctx_t gcm;
+} aead_key_sched_t;
+
+static void *key_pool[AEAD_KEY_POOL_SIZE];
+static int key_pool_len = 0;
+
+static void *
+aead_key_sched_get(void)
+{
+    if (key_pool_len > 0) {
+        return key_pool[--key_pool_len];
+    }
+
+    void *sched = ss_aligned_malloc(sizeof(aead_key_sched_t));
+    memset(sched, 0, sizeof(aead_key_sched_t));
+    return sched;
+}
+
+static void
+aead_key_sched_put(void *sched)
+{
+    sodium_memzero(sched, sizeof(aead_key_sched_t));
+    if (key_pool_len < AEAD_KEY_POOL_SIZE) {
+        key_pool[key_pool_len++] = sched;
+        return;
+    }
+    ss_aligned_free(sched);
+}
+
+/*
+ * name of the implementation doing the work for a method
+ */
+const char *
+aead_backend_name(int method)
+{
+    if (method == AES256GCM && crypto_aead_aes256gcm_is_available())
+        return "libsodium";
+    if (method >= AES128GCM && method <= AES256GCM)
+        return gcm_backend_name();
+    return "libsodium";
+}
+
 /*
  * get basic cipher info structure
  * it's a wrapper offered by crypto library
@@ -278,16 +330,10 @@ aead_get_cipher_type(int method)
 static void
 aead_cipher_ctx_set_key(cipher_ctx_t *cipher_ctx, int enc)
 {
-    const digest_type_t *md = mbedtls_md_info_from_string("SHA1");
-    if (md == NULL) {
-        FATAL("SHA1 Digest not found in crypto library");
-    }
-
-    int err = crypto_hkdf(md,
-                          cipher_ctx->salt, cipher_ctx->cipher->key_len,
-                          cipher_ctx->cipher->key, cipher_ctx->cipher->key_len,
-                          (uint8_t *)SUBKEY_INFO, strlen(SUBKEY_INFO),
-                          cipher_ctx->skey, cipher_ctx->cipher->key_len);
+    int err = crypto_hkdf_sha1(cipher_ctx->salt, cipher_ctx->cipher->key_len,
+                               cipher_ctx->cipher->key, cipher_ctx->cipher->key_len,
+                               (uint8_t *)SUBKEY_INFO, sizeof(SUBKEY_INFO) - 1,
+                               cipher_ctx->skey, cipher_ctx->cipher->key_len);
     if (err) {
         FATAL("Unable to generate subkey");
     }
@@ -305,12 +351,9 @@ aead_cipher_ctx_set_key(cipher_ctx_t *cipher_ctx, int enc)
         }
         return;
     }
-    if (mbedtls_cipher_setkey(cipher_ctx->evp, cipher_ctx->skey,
-                              cipher_ctx->cipher->key_len * 8, enc) != 0) {
-        FATAL("Cannot set mbed TLS cipher key");
-    }
-    if (mbedtls_cipher_reset(cipher_ctx->evp) != 0) {
-        FATAL("Cannot finish preparation of mbed TLS cipher context");
+    if (gcm_setkey(cipher_ctx->gcm, cipher_ctx->skey,
+                   cipher_ctx->cipher->key_len) != 0) {
+        FATAL("Cannot set AES-GCM cipher key");
     }
 }
 
@@ -326,30 +369,13 @@ aead_cipher_ctx_init(cipher_ctx_t *cipher_ctx, int method, int enc)
         return;
     }
 
-    const char *ciphername = supported_aead_ciphers[method];
-
-    const cipher_kt_t *cipher = aead_get_cipher_type(method);
-
     if (method == AES256GCM && crypto_aead_aes256gcm_is_available()) {
-        cipher_ctx->aes256gcm_ctx = ss_aligned_malloc(sizeof(aes256gcm_ctx));
-        memset(cipher_ctx->aes256gcm_ctx, 0, sizeof(aes256gcm_ctx));
+        cipher_ctx->aes256gcm_ctx = aead_key_sched_get();
     } else {
         cipher_ctx->aes256gcm_ctx = NULL;
-        cipher_ctx->evp = ss_malloc(sizeof(cipher_evp_t));
-        memset(cipher_ctx->evp, 0, sizeof(cipher_evp_t));
-        cipher_evp_t *evp = cipher_ctx->evp;
-        mbedtls_cipher_init(evp);
-        if (mbedtls_cipher_setup(evp, cipher) != 0) {
-            FATAL("Cannot initialize mbed TLS cipher context");
-        }
-    }
-
-    if (cipher == NULL) {
-        LOGE("Cipher %s not found in mbed TLS library", ciphername);
-        FATAL("Cannot initialize mbed TLS cipher");
+        cipher_ctx->gcm = aead_key_sched_get();
     }
 
-
 #ifdef SS_DEBUG
     dump("KEY", (char *)cipher_ctx->cipher->key, cipher_ctx->cipher->key_len);
 #endif
@@ -382,12 +408,15 @@ aead_ctx_release(cipher_ctx_t *cipher_ctx)
     }
 
     if (cipher_ctx->aes256gcm_ctx != NULL) {
-        ss_aligned_free(cipher_ctx->aes256gcm_ctx);
+        aead_key_sched_put(cipher_ctx->aes256gcm_ctx);
+        cipher_ctx->aes256gcm_ctx = NULL;
         return;
     }
 
-    mbedtls_cipher_free(cipher_ctx->evp);
-    ss_free(cipher_ctx->evp);
+    if (cipher_ctx->gcm != NULL) {
+        aead_key_sched_put(cipher_ctx->gcm);
+        cipher_ctx->gcm = NULL;
+    }
 }
 
 int
@@ -457,6 +486,7 @@ aead_decrypt_all(buffer_t *ciphertext, cipher_t *cipher, size_t capacity)
 
     if (ppbloom_check((void *)salt, salt_len) == 1) {
         LOGE("crypto: AEAD: repeat salt detected");
+        aead_ctx_release(&cipher_ctx);
         return CRYPTO_ERROR;
     }
 
@@ -523,15 +553,12 @@ aead_chunk_encrypt(cipher_ctx_t *ctx, uint8_t *p, uint8_t *c,
 
 /* TCP */
 int
-aead_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
+aead_encrypt_batch(buffer_t *out, const struct iovec *iov, int iovcnt,
+                   cipher_ctx_t *cipher_ctx, size_t capacity)
 {
     if (cipher_ctx == NULL)
         return CRYPTO_ERROR;
 
-    if (plaintext->len == 0) {
-        return CRYPTO_OK;
-    }
-
     static buffer_t tmp = { 0, 0, 0, NULL };
     buffer_t *ciphertext;
 
@@ -540,12 +567,25 @@ aead_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
     size_t salt_ofst = 0;
     size_t salt_len  = cipher->key_len;
     size_t tag_len   = cipher->tag_len;
+    size_t plen      = 0;
+    size_t nchunk    = 0;
+
+    // an empty chunk would read as a bad one, so empty iovecs get none
+    for (int i = 0; i < iovcnt; i++) {
+        plen   += iov[i].iov_len;
+        nchunk += (iov[i].iov_len + CHUNK_SIZE_MASK - 1) / CHUNK_SIZE_MASK;
+    }
+
+    if (plen == 0) {
+        out->len = 0;
+        return CRYPTO_OK;
+    }
 
     if (!cipher_ctx->init) {
         salt_ofst = salt_len;
     }
 
-    size_t out_len = salt_ofst + 2 * tag_len + plaintext->len + CHUNK_SIZE_LEN;
+    size_t out_len = salt_ofst + nchunk * (2 * tag_len + CHUNK_SIZE_LEN) + plen;
     brealloc(&tmp, out_len, capacity);
     ciphertext      = &tmp;
     ciphertext->len = out_len;
@@ -558,18 +598,33 @@ aead_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
         ppbloom_add((void *)cipher_ctx->salt, salt_len);
     }
 
-    err = aead_chunk_encrypt(cipher_ctx,
-                             (uint8_t *)plaintext->data,
-                             (uint8_t *)ciphertext->data + salt_ofst,
-                             cipher_ctx->nonce, plaintext->len);
-    if (err)
-        return err;
+    uint8_t *c = (uint8_t *)ciphertext->data + salt_ofst;
+    for (int i = 0; i < iovcnt; i++) {
+        uint8_t *p  = (uint8_t *)iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+        while (left > 0) {
+            uint16_t len = min(left, CHUNK_SIZE_MASK);
+            err = aead_chunk_encrypt(cipher_ctx, p, c, cipher_ctx->nonce, len);
+            if (err)
+                return err;
+            p    += len;
+            c    += 2 * tag_len + CHUNK_SIZE_LEN + len;
+            left -= len;
+        }
+    }
 
-    brealloc(plaintext, ciphertext->len, capacity);
-    memcpy(plaintext->data, ciphertext->data, ciphertext->len);
-    plaintext->len = ciphertext->len;
+    brealloc(out, ciphertext->len, capacity);
+    memcpy(out->data, ciphertext->data, ciphertext->len);
+    out->len = ciphertext->len;
 
-    return 0;
+    return CRYPTO_OK;
+}
+
+int
+aead_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
+{
+    struct iovec iov = { plaintext->data, plaintext->len };
+    return aead_encrypt_batch(plaintext, &iov, 1, cipher_ctx, capacity);
 }
 
 static int
@@ -621,8 +676,12 @@ aead_chunk_decrypt(cipher_ctx_t *ctx, uint8_t *p, uint8_t *c, uint8_t *n,
 }
 
 int
-aead_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
+aead_decrypt_batch(buffer_t *out, const struct iovec *iov, int iovcnt,
+                   cipher_ctx_t *cipher_ctx, size_t capacity)
 {
+    if (cipher_ctx == NULL)
+        return CRYPTO_ERROR;
+
     int err             = CRYPTO_OK;
     static buffer_t tmp = { 0, 0, 0, NULL };
 
@@ -637,10 +696,12 @@ aead_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
     }
 
     brealloc(cipher_ctx->chunk,
-             cipher_ctx->chunk->len + ciphertext->len, capacity);
-    memcpy(cipher_ctx->chunk->data + cipher_ctx->chunk->len,
-           ciphertext->data, ciphertext->len);
-    cipher_ctx->chunk->len += ciphertext->len;
+             cipher_ctx->chunk->len + iov_length(iov, iovcnt), capacity);
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(cipher_ctx->chunk->data + cipher_ctx->chunk->len,
+               iov[i].iov_base, iov[i].iov_len);
+        cipher_ctx->chunk->len += iov[i].iov_len;
+    }
 
     brealloc(&tmp, cipher_ctx->chunk->len, capacity);
     buffer_t *plaintext = &tmp;
@@ -696,13 +757,20 @@ aead_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
         cipher_ctx->init = 2;
     }
 
-    brealloc(ciphertext, plaintext->len, capacity);
-    memcpy(ciphertext->data, plaintext->data, plaintext->len);
-    ciphertext->len = plaintext->len;
+    brealloc(out, plaintext->len, capacity);
+    memcpy(out->data, plaintext->data, plaintext->len);
+    out->len = plaintext->len;
 
     return CRYPTO_OK;
 }
 
+int
+aead_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
+{
+    struct iovec iov = { ciphertext->data, ciphertext->len };
+    return aead_decrypt_batch(ciphertext, &iov, 1, cipher_ctx, capacity);
+}
+
 cipher_t *
 aead_key_init(int method, const char *pass, const char *key)
 {
@@ -744,6 +812,9 @@ aead_key_init(int method, const char *pass, const char *key)
     cipher->tag_len   = supported_aead_ciphers_tag_size[method];
     cipher->method    = method;
 
+    LOGI("using %s for %s", aead_backend_name(method),
+         supported_aead_ciphers[method]);
+
     return cipher;
 }
 
@@ -764,3 +835,19 @@ aead_init(const char *pass, const char *key, const char *method)
     }
     return aead_key_init(m, pass, key);
 }
+
+const cipher_engine_t aead_engine = {
+    .methods    = supported_aead_ciphers,
+    .method_num = AEAD_CIPHER_NUM,
+    .init       = &aead_init,
+    .ops        = {
+        .encrypt_all   = &aead_encrypt_all,
+        .decrypt_all   = &aead_decrypt_all,
+        .encrypt       = &aead_encrypt,
+        .decrypt       = &aead_decrypt,
+        .encrypt_batch = &aead_encrypt_batch,
+        .decrypt_batch = &aead_decrypt_batch,
+        .ctx_init      = &aead_ctx_init,
+        .ctx_release   = &aead_ctx_release,
+    },
+};
@@ -38,10 +38,17 @@ int aead_decrypt_all(buffer_t *, cipher_t *, size_t);
 
 int aead_encrypt(buffer_t *, cipher_ctx_t *, size_t);
 int aead_decrypt(buffer_t *, cipher_ctx_t *, size_t);
+int aead_encrypt_batch(buffer_t *, const struct iovec *, int,
+                       cipher_ctx_t *, size_t);
+int aead_decrypt_batch(buffer_t *, const struct iovec *, int,
+                       cipher_ctx_t *, size_t);
 
 void aead_ctx_init(cipher_t *, cipher_ctx_t *, int);
 void aead_ctx_release(cipher_ctx_t *);
 
 cipher_t *aead_init(const char *pass, const char *key, const char *method);
+const char *aead_backend_name(int method);
+
+extern const cipher_engine_t aead_engine;
 
 #endif // _AEAD_H
@@ -0,0 +1,415 @@
+/*
+ * bench.c - Throughput benchmark for the stream and AEAD ciphers
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "ppbloom.h"
+#include "crypto.h"
+#include "stream.h"
+#include "aead.h"
+#include "netutils.h"
+#include "utils.h"
+
+#define BENCH_PASSWORD   "shadowsocks-bench"
+#define BENCH_STREAM_LEN (1024 * 1024)
+#define BENCH_MIN_RECORD 8
+#define BENCH_SLACK      256
+
+/* relays never hand more than SOCKET_BUF_SIZE bytes to a single call */
+static const size_t default_sizes[] = { 64, 256, 1024, 4096, SOCKET_BUF_SIZE };
+
+static double bench_seconds = 0.2;
+
+typedef struct bench {
+    crypto_t *crypto;
+    cipher_ctx_t ctx;
+    buffer_t buf;
+    size_t size;
+    char *plain;
+    buffer_t *records;
+    int nrecord;
+    int cur;
+} bench_t;
+
+typedef int (*bench_fn)(bench_t *);
+
+typedef struct bench_op {
+    const char *name;
+    int enc;
+    int tcp;
+    bench_fn fn;
+} bench_op_t;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+now_cycles(void)
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void
+reset_ppbloom(void)
+{
+    ppbloom_free();
+    ppbloom_init(BF_NUM_ENTRIES_FOR_CLIENT, BF_ERROR_RATE_FOR_CLIENT);
+}
+
+static int
+do_encrypt(bench_t *b)
+{
+    memcpy(b->buf.data, b->plain, b->size);
+    b->buf.len = b->size;
+    return b->crypto->encrypt(&b->buf, &b->ctx, b->buf.capacity);
+}
+
+static int
+do_encrypt_all(bench_t *b)
+{
+    memcpy(b->buf.data, b->plain, b->size);
+    b->buf.len = b->size;
+    return b->crypto->encrypt_all(&b->buf, b->crypto->cipher, b->buf.capacity);
+}
+
+/*
+ * Decryption replays records captured from the matching encryption
+ * pass. Every salt is remembered by the replay filter, so it has to
+ * be cleared before the same records can be accepted again.
+ */
+static int
+do_decrypt(bench_t *b)
+{
+    if (b->cur == b->nrecord) {
+        b->crypto->ctx_release(&b->ctx);
+        reset_ppbloom();
+        b->crypto->ctx_init(b->crypto->cipher, &b->ctx, 0);
+        b->cur = 0;
+    }
+
+    buffer_t *r = &b->records[b->cur++];
+    memcpy(b->buf.data, r->data, r->len);
+    b->buf.len = r->len;
+    int err = b->crypto->decrypt(&b->buf, &b->ctx, b->buf.capacity);
+    if (err == CRYPTO_OK && b->buf.len != b->size)
+        return CRYPTO_ERROR;
+    return err;
+}
+
+static int
+do_decrypt_all(bench_t *b)
+{
+    if (b->cur == b->nrecord) {
+        reset_ppbloom();
+        b->cur = 0;
+    }
+
+    buffer_t *r = &b->records[b->cur++];
+    memcpy(b->buf.data, r->data, r->len);
+    b->buf.len = r->len;
+    int err = b->crypto->decrypt_all(&b->buf, b->crypto->cipher, b->buf.capacity);
+    if (err == CRYPTO_OK && b->buf.len != b->size)
+        return CRYPTO_ERROR;
+    return err;
+}
+
+static const bench_op_t bench_ops[] = {
+    { "encrypt",     1, 1, do_encrypt     },
+    { "decrypt",     0, 1, do_decrypt     },
+    { "encrypt_all", 1, 0, do_encrypt_all },
+    { "decrypt_all", 0, 0, do_decrypt_all },
+};
+
+static int
+prepare_records(bench_t *b, int tcp)
+{
+    int i;
+
+    b->nrecord = max(BENCH_MIN_RECORD, BENCH_STREAM_LEN / b->size);
+    b->records = ss_malloc(b->nrecord * sizeof(buffer_t));
+
+    if (tcp)
+        b->crypto->ctx_init(b->crypto->cipher, &b->ctx, 1);
+
+    for (i = 0; i < b->nrecord; i++) {
+        int err = tcp ? do_encrypt(b) : do_encrypt_all(b);
+        if (err != CRYPTO_OK) {
+            b->nrecord = i;
+            break;
+        }
+        balloc(&b->records[i], b->buf.len);
+        memcpy(b->records[i].data, b->buf.data, b->buf.len);
+        b->records[i].len = b->buf.len;
+    }
+
+    if (tcp)
+        b->crypto->ctx_release(&b->ctx);
+    reset_ppbloom();
+
+    return i == b->nrecord && b->nrecord > 0 ? 0 : -1;
+}
+
+static void
+release_records(bench_t *b)
+{
+    int i;
+    for (i = 0; i < b->nrecord; i++)
+        bfree(&b->records[i]);
+    ss_free(b->records);
+    b->nrecord = 0;
+}
+
+static void
+print_rate(const char *method, const char *op, size_t size,
+           uint64_t bytes, uint64_t ns, uint64_t cycles)
+{
+    double mbps = bytes / 1048576.0 / (ns / 1e9);
+#ifdef HAVE_RDTSC
+    printf("%-24s %-12s %6zu %10.2f %10.2f\n", method, op, size, mbps,
+           (double)cycles / bytes);
+#else
+    printf("%-24s %-12s %6zu %10.2f %10s\n", method, op, size, mbps, "-");
+#endif
+}
+
+static int
+run_op(const char *method, crypto_t *crypto, const bench_op_t *op, size_t size)
+{
+    bench_t b;
+    uint64_t bytes = 0;
+    uint64_t start = 0, stop = 0, c_start = 0, c_stop = 0;
+    uint64_t budget = bench_seconds * 1e9;
+    int err = CRYPTO_OK;
+
+    memset(&b, 0, sizeof(bench_t));
+    b.crypto = crypto;
+    b.size   = size;
+    b.plain  = ss_malloc(size);
+    randombytes_buf(b.plain, size);
+    balloc(&b.buf, size + BENCH_SLACK);
+
+    if (!op->enc && prepare_records(&b, op->tcp) != 0) {
+        err = CRYPTO_ERROR;
+        goto out;
+    }
+
+    if (op->tcp)
+        crypto->ctx_init(crypto->cipher, &b.ctx, op->enc);
+
+    start   = now_ns();
+    c_start = now_cycles();
+    do {
+        int i;
+        for (i = 0; i < 16 && err == CRYPTO_OK; i++) {
+            err    = op->fn(&b);
+            bytes += size;
+        }
+        stop = now_ns();
+    } while (err == CRYPTO_OK && stop - start < budget);
+    c_stop = now_cycles();
+
+    if (op->tcp)
+        crypto->ctx_release(&b.ctx);
+
+out:
+    if (err == CRYPTO_OK)
+        print_rate(method, op->name, size, bytes, stop - start, c_stop - c_start);
+    else
+        printf("%-24s %-12s %6zu %10s\n", method, op->name, size, "failed");
+
+    release_records(&b);
+    bfree(&b.buf);
+    ss_free(b.plain);
+    reset_ppbloom();
+
+    return err == CRYPTO_OK ? 0 : -1;
+}
+
+static int
+run_method(const char *method, const size_t *sizes, int nsize)
+{
+    int i, j, ret = 0;
+
+    crypto_t *crypto = crypto_init(BENCH_PASSWORD, NULL, method);
+    if (crypto == NULL) {
+        printf("%-24s %-12s %6s %10s\n", method, "-", "-", "unsupported");
+        ppbloom_free();
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++)
+        for (j = 0; j < nsize; j++)
+            ret |= run_op(method, crypto, &bench_ops[i], sizes[j]);
+
+    ss_free(crypto->cipher);
+    ss_free(crypto);
+    ppbloom_free();
+
+    return ret;
+}
+
+static void
+run_kdf(void)
+{
+    uint8_t key[MAX_KEY_LENGTH];
+    uint8_t salt[32], okm[32];
+    uint64_t iters = 0, start, stop, c_start, c_stop;
+    uint64_t budget = bench_seconds * 1e9;
+    const digest_type_t *md = mbedtls_md_info_from_string("SHA1");
+
+    randombytes_buf(salt, sizeof(salt));
+    crypto_derive_key(BENCH_PASSWORD, key, 32);
+
+    printf("\n%-24s %12s %12s\n", "key derivation", "ops/s", "cycles/op");
+
+    start   = now_ns();
+    c_start = now_cycles();
+    do {
+        crypto_derive_key(BENCH_PASSWORD, key, 32);
+        iters++;
+        stop = now_ns();
+    } while (stop - start < budget);
+    c_stop = now_cycles();
+    printf("%-24s %12.0f %12.0f\n", "crypto_derive_key",
+           iters / ((stop - start) / 1e9), (double)(c_stop - c_start) / iters);
+
+    iters   = 0;
+    start   = now_ns();
+    c_start = now_cycles();
+    do {
+        crypto_hkdf(md, salt, sizeof(salt), key, 32,
+                    (uint8_t *)SUBKEY_INFO, strlen(SUBKEY_INFO), okm, sizeof(okm));
+        iters++;
+        stop = now_ns();
+    } while (stop - start < budget);
+    c_stop = now_cycles();
+    printf("%-24s %12.0f %12.0f\n", "crypto_hkdf (sha1)",
+           iters / ((stop - start) / 1e9), (double)(c_stop - c_start) / iters);
+
+    iters   = 0;
+    start   = now_ns();
+    c_start = now_cycles();
+    do {
+        crypto_hkdf_sha1(salt, sizeof(salt), key, 32,
+                         (uint8_t *)SUBKEY_INFO, strlen(SUBKEY_INFO), okm, sizeof(okm));
+        iters++;
+        stop = now_ns();
+    } while (stop - start < budget);
+    c_stop = now_cycles();
+    printf("%-24s %12.0f %12.0f\n", "crypto_hkdf_sha1",
+           iters / ((stop - start) / 1e9), (double)(c_stop - c_start) / iters);
+}
+
+static void
+bench_usage(void)
+{
+    printf("usage: ss-bench [-m <method>] [-s <size>] [-t <seconds>] [-k]\n\n"
+           "  -m <method>    Only benchmark the given cipher.\n"
+           "  -s <size>      Only benchmark the given chunk size, up to %d.\n"
+           "  -t <seconds>   Time spent on every measurement, default 0.2.\n"
+           "  -k             Only benchmark key derivation.\n", SOCKET_BUF_SIZE);
+}
+
+int
+main(int argc, char **argv)
+{
+    int c, i, ret = 0, kdf_only = 0;
+    const char *method = NULL;
+    size_t size        = 0;
+
+    while ((c = getopt(argc, argv, "m:s:t:kh")) != -1) {
+        switch (c) {
+        case 'm':
+            method = optarg;
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 't':
+            bench_seconds = atof(optarg);
+            break;
+        case 'k':
+            kdf_only = 1;
+            break;
+        default:
+            bench_usage();
+            return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (bench_seconds <= 0 || size > SOCKET_BUF_SIZE) {
+        bench_usage();
+        return 1;
+    }
+
+    USE_TTY();
+
+    if (sodium_init() == -1) {
+        FATAL("Failed to initialize sodium");
+    }
+
+    const size_t *sizes = size ? &size : default_sizes;
+    int nsize           = size ? 1 : sizeof(default_sizes) / sizeof(default_sizes[0]);
+
+    if (!kdf_only) {
+        printf("AES-GCM backend: %s\n\n", gcm_backend_name());
+        printf("%-24s %-12s %6s %10s %10s\n",
+               "method", "operation", "size", "MB/s", "cycles/B");
+
+        if (method != NULL) {
+            ret |= run_method(method, sizes, nsize);
+        } else {
+            for (i = 0; i < AEAD_CIPHER_NUM; i++)
+                ret |= run_method(supported_aead_ciphers[i], sizes, nsize);
+            /* skip the deprecated table cipher */
+            for (i = 1; i < STREAM_CIPHER_NUM; i++)
+                ret |= run_method(supported_stream_ciphers[i], sizes, nsize);
+        }
+    }
+
+    run_kdf();
+
+    return ret ? 1 : 0;
+}
@@ -72,6 +72,9 @@ enum {
     GETOPT_VAL_MANAGER_ADDRESS,
     GETOPT_VAL_EXECUTABLE,
     GETOPT_VAL_WORKDIR,
+    GETOPT_VAL_WARM_POOL,
+    GETOPT_VAL_MUX,
+    GETOPT_VAL_TRACE,
 };
 
 #endif // _COMMON_H
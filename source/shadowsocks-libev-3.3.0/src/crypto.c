@@ -35,6 +35,7 @@
 #include <sodium.h>
 #include <mbedtls/version.h>
 #include <mbedtls/md5.h>
+#include <mbedtls/sha1.h>
 
 #include "base64.h"
 #include "crypto.h"
@@ -43,6 +44,12 @@
 #include "utils.h"
 #include "ppbloom.h"
 
+static const cipher_engine_t *cipher_engines[] = {
+    &stream_engine,
+    &aead_engine,
+    NULL
+};
+
 int
 balloc(buffer_t *ptr, size_t capacity)
 {
@@ -88,6 +95,15 @@ bprepend(buffer_t *dst, buffer_t *src, size_t capacity)
     return dst->len;
 }
 
+size_t
+iov_length(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    return len;
+}
+
 int
 rand_bytes(void *output, int len)
 {
@@ -134,7 +150,8 @@ entropy_check(void)
 crypto_t *
 crypto_init(const char *password, const char *key, const char *method)
 {
-    int i, m = -1;
+    const cipher_engine_t **e;
+    int i;
 
     entropy_check();
     // Initialize sodium for random generator
@@ -150,49 +167,20 @@ crypto_init(const char *password, const char *key, const char *method)
 #endif
 
     if (method != NULL) {
-        for (i = 0; i < STREAM_CIPHER_NUM; i++)
-            if (strcmp(method, supported_stream_ciphers[i]) == 0) {
-                m = i;
-                break;
-            }
-        if (m != -1) {
-            cipher_t *cipher = stream_init(password, key, method);
-            if (cipher == NULL)
-                return NULL;
-            crypto_t *crypto = (crypto_t *)ss_malloc(sizeof(crypto_t));
-            crypto_t tmp     = {
-                .cipher      = cipher,
-                .encrypt_all = &stream_encrypt_all,
-                .decrypt_all = &stream_decrypt_all,
-                .encrypt     = &stream_encrypt,
-                .decrypt     = &stream_decrypt,
-                .ctx_init    = &stream_ctx_init,
-                .ctx_release = &stream_ctx_release,
-            };
-            memcpy(crypto, &tmp, sizeof(crypto_t));
-            return crypto;
-        }
-
-        for (i = 0; i < AEAD_CIPHER_NUM; i++)
-            if (strcmp(method, supported_aead_ciphers[i]) == 0) {
-                m = i;
-                break;
-            }
-        if (m != -1) {
-            cipher_t *cipher = aead_init(password, key, method);
+        for (e = cipher_engines; *e != NULL; e++) {
+            for (i = 0; i < (*e)->method_num; i++)
+                if (strcmp(method, (*e)->methods[i]) == 0) {
+                    break;
+                }
+            if (i == (*e)->method_num)
+                continue;
+
+            cipher_t *cipher = (*e)->init(password, key, method);
             if (cipher == NULL)
                 return NULL;
             crypto_t *crypto = (crypto_t *)ss_malloc(sizeof(crypto_t));
-            crypto_t tmp     = {
-                .cipher      = cipher,
-                .encrypt_all = &aead_encrypt_all,
-                .decrypt_all = &aead_decrypt_all,
-                .encrypt     = &aead_encrypt,
-                .decrypt     = &aead_decrypt,
-                .ctx_init    = &aead_ctx_init,
-                .ctx_release = &aead_ctx_release,
-            };
-            memcpy(crypto, &tmp, sizeof(crypto_t));
+            memcpy(crypto, &(*e)->ops, sizeof(crypto_t));
+            crypto->cipher = cipher;
             return crypto;
         }
     }
@@ -258,6 +246,158 @@ crypto_hkdf(const mbedtls_md_info_t *md, const unsigned char *salt,
                               okm, okm_len);
 }
 
+#if MBEDTLS_VERSION_NUMBER >= 0x02070000
+#define sha1_starts mbedtls_sha1_starts_ret
+#define sha1_update mbedtls_sha1_update_ret
+#define sha1_finish mbedtls_sha1_finish_ret
+#else
+#define sha1_starts mbedtls_sha1_starts
+#define sha1_update mbedtls_sha1_update
+#define sha1_finish mbedtls_sha1_finish
+#endif
+
+#define SHA1_BLOCK_SIZE 64
+#define SHA1_SIZE       20
+
+/*
+ * HMAC-SHA1 keeping the hash states after the ipad and opad blocks,
+ * so the pads are hashed once per key instead of once per message.
+ */
+typedef struct {
+    mbedtls_sha1_context ipad;
+    mbedtls_sha1_context opad;
+    mbedtls_sha1_context work;
+} hmac_sha1_t;
+
+static void
+hmac_sha1_init(hmac_sha1_t *h, const unsigned char *key, size_t key_len)
+{
+    unsigned char pad[SHA1_BLOCK_SIZE];
+    unsigned char sum[SHA1_SIZE];
+    size_t i;
+
+    mbedtls_sha1_init(&h->ipad);
+    mbedtls_sha1_init(&h->opad);
+    mbedtls_sha1_init(&h->work);
+
+    if (key_len > SHA1_BLOCK_SIZE) {
+        sha1_starts(&h->work);
+        sha1_update(&h->work, key, key_len);
+        sha1_finish(&h->work, sum);
+        key     = sum;
+        key_len = SHA1_SIZE;
+    }
+
+    memset(pad, 0x36, SHA1_BLOCK_SIZE);
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    sha1_starts(&h->ipad);
+    sha1_update(&h->ipad, pad, SHA1_BLOCK_SIZE);
+
+    memset(pad, 0x5C, SHA1_BLOCK_SIZE);
+    for (i = 0; i < key_len; i++)
+        pad[i] ^= key[i];
+    sha1_starts(&h->opad);
+    sha1_update(&h->opad, pad, SHA1_BLOCK_SIZE);
+
+    sodium_memzero(pad, sizeof(pad));
+    sodium_memzero(sum, sizeof(sum));
+}
+
+static void
+hmac_sha1_starts(hmac_sha1_t *h)
+{
+    mbedtls_sha1_clone(&h->work, &h->ipad);
+}
+
+static void
+hmac_sha1_update(hmac_sha1_t *h, const unsigned char *d, size_t n)
+{
+    sha1_update(&h->work, d, n);
+}
+
+static void
+hmac_sha1_finish(hmac_sha1_t *h, unsigned char *out)
+{
+    unsigned char inner[SHA1_SIZE];
+
+    sha1_finish(&h->work, inner);
+    mbedtls_sha1_clone(&h->work, &h->opad);
+    sha1_update(&h->work, inner, SHA1_SIZE);
+    sha1_finish(&h->work, out);
+}
+
+static void
+hmac_sha1_free(hmac_sha1_t *h)
+{
+    mbedtls_sha1_free(&h->ipad);
+    mbedtls_sha1_free(&h->opad);
+    mbedtls_sha1_free(&h->work);
+}
+
+/*
+ * HKDF with HMAC-SHA1, the subkey derivation done for every AEAD
+ * session and UDP packet. Same result as crypto_hkdf() with SHA1,
+ * without the digest lookup and context allocation, and with the
+ * PRK pads hashed once for all output blocks.
+ */
+int
+crypto_hkdf_sha1(const unsigned char *salt, int salt_len,
+                 const unsigned char *ikm, int ikm_len,
+                 const unsigned char *info, int info_len,
+                 unsigned char *okm, int okm_len)
+{
+    hmac_sha1_t h;
+    unsigned char null_salt[SHA1_SIZE] = { '\0' };
+    unsigned char prk[SHA1_SIZE];
+    unsigned char T[SHA1_SIZE];
+    int i, N, where = 0;
+
+    if (salt_len < 0 || ikm_len < 0 || info_len < 0 || okm_len < 0
+        || okm == NULL) {
+        return CRYPTO_ERROR;
+    }
+
+    N = (okm_len + SHA1_SIZE - 1) / SHA1_SIZE;
+    if (N > 255) {
+        return CRYPTO_ERROR;
+    }
+
+    if (salt == NULL) {
+        salt     = null_salt;
+        salt_len = SHA1_SIZE;
+    }
+
+    /* HKDF-Extract(salt, IKM) -> PRK */
+    hmac_sha1_init(&h, salt, salt_len);
+    hmac_sha1_starts(&h);
+    hmac_sha1_update(&h, ikm, ikm_len);
+    hmac_sha1_finish(&h, prk);
+    hmac_sha1_free(&h);
+
+    /* HKDF-Expand(PRK, info, L) -> OKM */
+    hmac_sha1_init(&h, prk, SHA1_SIZE);
+    for (i = 1; i <= N; i++) {
+        unsigned char c = i;
+
+        hmac_sha1_starts(&h);
+        if (i > 1)
+            hmac_sha1_update(&h, T, SHA1_SIZE);
+        hmac_sha1_update(&h, info, info_len);
+        hmac_sha1_update(&h, &c, 1);
+        hmac_sha1_finish(&h, T);
+
+        memcpy(okm + where, T, (i != N) ? SHA1_SIZE : (okm_len - where));
+        where += SHA1_SIZE;
+    }
+    hmac_sha1_free(&h);
+
+    sodium_memzero(prk, sizeof(prk));
+    sodium_memzero(T, sizeof(T));
+
+    return 0;
+}
+
 /* HKDF-Extract(salt, IKM) -> PRK */
 int
 crypto_hkdf_extract(const mbedtls_md_info_t *md, const unsigned char *salt,
@@ -25,6 +25,7 @@
 
 #ifndef __MINGW32__
 #include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 #include <string.h>
 #include <stdlib.h>
@@ -58,6 +59,8 @@ typedef mbedtls_md_info_t digest_type_t;
 #ifdef crypto_aead_xchacha20poly1305_ietf_ABYTES
 #define FS_HAVE_XCHACHA20IETF
 #endif
+/* Definitions for our own AES-GCM backends */
+#include "gcm.h"
 
 #define ADDRTYPE_MASK 0xF
 
@@ -109,6 +112,7 @@ typedef struct {
     uint64_t counter;
     cipher_evp_t *evp;
     aes256gcm_ctx *aes256gcm_ctx;
+    gcm_ctx_t *gcm;
     cipher_t *cipher;
     buffer_t *chunk;
     uint8_t salt[MAX_KEY_LENGTH];
@@ -123,15 +127,37 @@ typedef struct crypto {
     int(*const decrypt_all) (buffer_t *, cipher_t *, size_t);
     int(*const encrypt) (buffer_t *, cipher_ctx_t *, size_t);
     int(*const decrypt) (buffer_t *, cipher_ctx_t *, size_t);
+    int(*const encrypt_batch) (buffer_t *, const struct iovec *, int,
+                               cipher_ctx_t *, size_t);
+    int(*const decrypt_batch) (buffer_t *, const struct iovec *, int,
+                               cipher_ctx_t *, size_t);
 
     void(*const ctx_init) (cipher_t *, cipher_ctx_t *, int);
     void(*const ctx_release) (cipher_ctx_t *);
 } crypto_t;
 
+/*
+ * A cipher engine implements a family of methods. crypto_init() asks the
+ * registered engines in turn for the method, and the one that lists it
+ * sets up the key and lends its operations to the returned crypto_t.
+ *
+ * The batch operations work on the data of several iovecs as if it were
+ * one buffer, and leave the result in the given buffer, which may be the
+ * one behind any of the iovecs. An AEAD engine seals each iovec in a
+ * chunk of its own.
+ */
+typedef struct cipher_engine {
+    const char **methods;
+    int method_num;
+    cipher_t *(*init)(const char *, const char *, const char *);
+    crypto_t ops;
+} cipher_engine_t;
+
 int balloc(buffer_t *, size_t);
 int brealloc(buffer_t *, size_t, size_t);
 int bprepend(buffer_t *, buffer_t *, size_t);
 void bfree(buffer_t *);
+size_t iov_length(const struct iovec *, int);
 int rand_bytes(void *, int);
 
 crypto_t *crypto_init(const char *, const char *, const char *);
@@ -143,6 +169,10 @@ int crypto_hkdf(const mbedtls_md_info_t *md, const unsigned char *salt,
                 int salt_len, const unsigned char *ikm, int ikm_len,
                 const unsigned char *info, int info_len, unsigned char *okm,
                 int okm_len);
+int crypto_hkdf_sha1(const unsigned char *salt, int salt_len,
+                     const unsigned char *ikm, int ikm_len,
+                     const unsigned char *info, int info_len,
+                     unsigned char *okm, int okm_len);
 int crypto_hkdf_extract(const mbedtls_md_info_t *md, const unsigned char *salt,
                         int salt_len, const unsigned char *ikm, int ikm_len,
                         unsigned char *prk);
@@ -0,0 +1,75 @@
+/*
+ * frame.c - Adaptive framing of relayed reads
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "frame.h"
+
+void
+frame_init(frame_t *frame, void (*cb)(EV_P_ ev_timer *watcher, int revents))
+{
+    memset(frame, 0, sizeof(frame_t));
+    ev_timer_init(&frame->watcher, cb, FRAME_DELAY, 0);
+}
+
+/*
+ * Called after a read of r bytes left len bytes in a buffer of the given
+ * capacity. Returns 1 if the data should be held back for more, 0 if it
+ * should be sent now.
+ */
+int
+frame_hold(EV_P_ frame_t *frame, size_t r, size_t len, size_t capacity)
+{
+    ev_tstamp now = ev_now(EV_A);
+
+    if (now - frame->last > FRAME_IDLE) {
+        frame->avg = r;
+        frame->run = 0;
+    }
+    frame->last = now;
+    frame->avg  = (frame->avg * 3 + r) / 4;
+    frame->run++;
+
+    if (frame->run <= FRAME_RUN || frame->avg < FRAME_BULK
+        || len + frame->avg > capacity) {
+        ev_timer_stop(EV_A_ & frame->watcher);
+        return 0;
+    }
+
+    // the budget runs from the first byte held
+    if (!ev_is_active(&frame->watcher)) {
+        ev_timer_set(&frame->watcher, FRAME_DELAY, 0);
+        ev_timer_start(EV_A_ & frame->watcher);
+    }
+
+    return 1;
+}
+
+void
+frame_stop(EV_P_ frame_t *frame)
+{
+    ev_timer_stop(EV_A_ & frame->watcher);
+}
@@ -0,0 +1,60 @@
+/*
+ * frame.h - Define the adaptive framing of relayed reads
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stddef.h>
+
+#ifdef HAVE_LIBEV_EV_H
+#include <libev/ev.h>
+#else
+#include <ev.h>
+#endif
+
+#define FRAME_DELAY 0.002   /* longest time data is held back, in seconds */
+#define FRAME_IDLE  0.01    /* a pause this long ends a burst */
+#define FRAME_BULK  1024    /* smoothed read size of a bulk flow */
+#define FRAME_RUN   4       /* reads in a burst before it counts as bulk */
+
+/*
+ * Every encrypt call makes one chunk, so chunks follow the reads. For
+ * bulk flows, reads are held back and appended to until the next one of
+ * the usual size would no longer fit, or FRAME_DELAY has passed, so each
+ * chunk and send carries more data. Small reads, and the first few reads
+ * after a pause, such as a whole request or response, are sent right
+ * away.
+ */
+typedef struct frame {
+    ev_timer watcher;       /* fires when the held data must go out */
+    ev_tstamp last;         /* time of the previous read */
+    size_t avg;             /* smoothed read size */
+    int run;                /* reads since the last pause */
+} frame_t;
+
+void frame_init(frame_t *frame, void (*cb)(EV_P_ ev_timer *watcher, int revents));
+int frame_hold(EV_P_ frame_t *frame, size_t r, size_t len, size_t capacity);
+void frame_stop(EV_P_ frame_t *frame);
+
+#define frame_held(frame) ev_is_active(&(frame)->watcher)
+
+#endif // _FRAME_H
@@ -0,0 +1,972 @@
+/*
+ * gcm.c - AES-GCM with runtime selected backends
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <sodium.h>
+
+#include "gcm.h"
+
+/*
+ * Three implementations live here, tried in this order:
+ *
+ *  - x86 AES-NI + PCLMULQDQ, compiled with per-function target attributes
+ *    and selected through CPUID, so the binary still runs on older CPUs.
+ *  - ARMv8 Crypto Extensions (AESE/AESMC + PMULL), when the compiler
+ *    targets them, selected through the kernel's HWCAP bits.
+ *  - A portable T-table AES with a 4-bit Shoup GHASH table, both computed
+ *    once per key.
+ *
+ * All of them share the FIPS-197 key expansion below.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GCM_HAVE_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#define GCM_X86_TARGET __attribute__((target("aes,pclmul,ssse3")))
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) \
+    && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+#define GCM_HAVE_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES   (1 << 3)
+#endif
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1 << 4)
+#endif
+#endif
+
+#define GET_BE32(b) \
+    (((uint32_t)(b)[0] << 24) | ((uint32_t)(b)[1] << 16) | \
+     ((uint32_t)(b)[2] << 8) | (uint32_t)(b)[3])
+#define GET_LE32(b) \
+    (((uint32_t)(b)[3] << 24) | ((uint32_t)(b)[2] << 16) | \
+     ((uint32_t)(b)[1] << 8) | (uint32_t)(b)[0])
+#define PUT_LE32(n, b)                \
+    {                                 \
+        (b)[0] = (uint8_t)(n);        \
+        (b)[1] = (uint8_t)((n) >> 8);  \
+        (b)[2] = (uint8_t)((n) >> 16); \
+        (b)[3] = (uint8_t)((n) >> 24); \
+    }
+#define GET_BE64(b) (((uint64_t)GET_BE32(b) << 32) | GET_BE32((b) + 4))
+#define PUT_BE64(n, b)                        \
+    {                                         \
+        int _i;                               \
+        for (_i = 0; _i < 8; _i++)            \
+            (b)[_i] = (uint8_t)((n) >> (56 - 8 * _i)); \
+    }
+
+#define XTIME(x) ((((x) << 1) ^ (((x) & 0x80) ? 0x1B : 0x00)) & 0xFF)
+#define ROTL8(x) (((x) << 8) | ((x) >> 24))
+
+static uint8_t fsb[256];
+static uint32_t ft0[256];
+static int tables_ready = 0;
+
+static void
+gcm_gen_tables(void)
+{
+    int i, x, y, z;
+    int pow[256], log[256];
+
+    for (i = 0, x = 1; i < 256; i++) {
+        pow[i] = x;
+        log[x] = i;
+        x      = (x ^ XTIME(x)) & 0xFF;
+    }
+
+    fsb[0] = 0x63;
+    for (i = 1; i < 256; i++) {
+        x  = pow[255 - log[i]];
+        y  = x;
+        y  = ((y << 1) | (y >> 7)) & 0xFF;
+        x ^= y;
+        y  = ((y << 1) | (y >> 7)) & 0xFF;
+        x ^= y;
+        y  = ((y << 1) | (y >> 7)) & 0xFF;
+        x ^= y;
+        y  = ((y << 1) | (y >> 7)) & 0xFF;
+        x ^= y ^ 0x63;
+        fsb[i] = (uint8_t)x;
+    }
+
+    for (i = 0; i < 256; i++) {
+        x      = fsb[i];
+        y      = XTIME(x);
+        z      = y ^ x;
+        ft0[i] = (uint32_t)y ^ ((uint32_t)x << 8)
+                 ^ ((uint32_t)x << 16) ^ ((uint32_t)z << 24);
+    }
+
+    tables_ready = 1;
+}
+
+static void
+gcm_expand_key(gcm_ctx_t *ctx, const uint8_t *key, size_t key_len)
+{
+    int nk    = key_len / 4;
+    int words = 4 * (nk + 7);
+    uint8_t rcon = 1;
+    uint8_t t[4];
+    int i, j;
+
+    ctx->rounds = nk + 6;
+    memset(ctx->rk, 0, sizeof(ctx->rk));
+    memcpy(ctx->rk, key, key_len);
+
+    for (i = nk; i < words; i++) {
+        memcpy(t, ctx->rk + 4 * (i - 1), 4);
+        if (i % nk == 0) {
+            uint8_t t0 = t[0];
+            t[0] = fsb[t[1]] ^ rcon;
+            t[1] = fsb[t[2]];
+            t[2] = fsb[t[3]];
+            t[3] = fsb[t0];
+            rcon = XTIME(rcon);
+        } else if (nk > 6 && i % nk == 4) {
+            for (j = 0; j < 4; j++)
+                t[j] = fsb[t[j]];
+        }
+        for (j = 0; j < 4; j++)
+            ctx->rk[4 * i + j] = ctx->rk[4 * (i - nk) + j] ^ t[j];
+    }
+
+    for (i = 0; i < words; i++)
+        ctx->erk[i] = GET_LE32(ctx->rk + 4 * i);
+}
+
+/*
+ * Portable backend
+ */
+
+#define FT(n, y) ((n) == 0 ? ft0[(y)] : \
+                  (n) == 1 ? ROTL8(ft0[(y)]) : \
+                  (n) == 2 ? ROTL8(ROTL8(ft0[(y)])) : ROTL8(ROTL8(ROTL8(ft0[(y)]))))
+
+#define AES_FROUND(X0, X1, X2, X3, Y0, Y1, Y2, Y3)                          \
+    {                                                                       \
+        X0 = *rk++ ^ FT(0, Y0 & 0xFF) ^ FT(1, (Y1 >> 8) & 0xFF)             \
+             ^ FT(2, (Y2 >> 16) & 0xFF) ^ FT(3, (Y3 >> 24) & 0xFF);         \
+        X1 = *rk++ ^ FT(0, Y1 & 0xFF) ^ FT(1, (Y2 >> 8) & 0xFF)             \
+             ^ FT(2, (Y3 >> 16) & 0xFF) ^ FT(3, (Y0 >> 24) & 0xFF);         \
+        X2 = *rk++ ^ FT(0, Y2 & 0xFF) ^ FT(1, (Y3 >> 8) & 0xFF)             \
+             ^ FT(2, (Y0 >> 16) & 0xFF) ^ FT(3, (Y1 >> 24) & 0xFF);         \
+        X3 = *rk++ ^ FT(0, Y3 & 0xFF) ^ FT(1, (Y0 >> 8) & 0xFF)             \
+             ^ FT(2, (Y1 >> 16) & 0xFF) ^ FT(3, (Y2 >> 24) & 0xFF);         \
+    }
+
+#define AES_FSB(Y0, Y1, Y2, Y3)                         \
+    (*rk++ ^ (uint32_t)fsb[Y0 & 0xFF]                   \
+     ^ ((uint32_t)fsb[(Y1 >> 8) & 0xFF] << 8)           \
+     ^ ((uint32_t)fsb[(Y2 >> 16) & 0xFF] << 16)         \
+     ^ ((uint32_t)fsb[(Y3 >> 24) & 0xFF] << 24))
+
+static void
+gcm_soft_block(const gcm_ctx_t *ctx, const uint8_t in[16], uint8_t out[16])
+{
+    const uint32_t *rk = ctx->erk;
+    uint32_t x0, x1, x2, x3, y0, y1, y2, y3;
+    int i;
+
+    x0 = GET_LE32(in) ^ *rk++;
+    x1 = GET_LE32(in + 4) ^ *rk++;
+    x2 = GET_LE32(in + 8) ^ *rk++;
+    x3 = GET_LE32(in + 12) ^ *rk++;
+
+    for (i = (ctx->rounds >> 1) - 1; i > 0; i--) {
+        AES_FROUND(y0, y1, y2, y3, x0, x1, x2, x3);
+        AES_FROUND(x0, x1, x2, x3, y0, y1, y2, y3);
+    }
+    AES_FROUND(y0, y1, y2, y3, x0, x1, x2, x3);
+
+    x0 = AES_FSB(y0, y1, y2, y3);
+    x1 = AES_FSB(y1, y2, y3, y0);
+    x2 = AES_FSB(y2, y3, y0, y1);
+    x3 = AES_FSB(y3, y0, y1, y2);
+
+    PUT_LE32(x0, out);
+    PUT_LE32(x1, out + 4);
+    PUT_LE32(x2, out + 8);
+    PUT_LE32(x3, out + 12);
+}
+
+static const uint64_t last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static int
+gcm_soft_available(void)
+{
+    return 1;
+}
+
+static void
+gcm_soft_setkey(gcm_ctx_t *ctx)
+{
+    uint8_t h[16] = { 0 };
+    uint64_t *hl = ctx->h.tbl.hl;
+    uint64_t *hh = ctx->h.tbl.hh;
+    uint64_t vh, vl;
+    int i, j;
+
+    gcm_soft_block(ctx, h, h);
+
+    vh = GET_BE64(h);
+    vl = GET_BE64(h + 8);
+
+    hl[8] = vl;
+    hh[8] = vh;
+    hl[0] = 0;
+    hh[0] = 0;
+
+    for (i = 4; i > 0; i >>= 1) {
+        uint32_t t = (vl & 1) * 0xe1000000U;
+        vl    = (vh << 63) | (vl >> 1);
+        vh    = (vh >> 1) ^ ((uint64_t)t << 32);
+        hl[i] = vl;
+        hh[i] = vh;
+    }
+
+    for (i = 2; i <= 8; i *= 2) {
+        vh = hh[i];
+        vl = hl[i];
+        for (j = 1; j < i; j++) {
+            hh[i + j] = vh ^ hh[j];
+            hl[i + j] = vl ^ hl[j];
+        }
+    }
+}
+
+static void
+gcm_soft_mult(const gcm_ctx_t *ctx, uint8_t x[16])
+{
+    const uint64_t *hl = ctx->h.tbl.hl;
+    const uint64_t *hh = ctx->h.tbl.hh;
+    uint64_t zh, zl;
+    uint8_t lo, hi, rem;
+    int i;
+
+    lo = x[15] & 0xf;
+    zh = hh[lo];
+    zl = hl[lo];
+
+    for (i = 15; i >= 0; i--) {
+        lo = x[i] & 0xf;
+        hi = (x[i] >> 4) & 0xf;
+
+        if (i != 15) {
+            rem = (uint8_t)zl & 0xf;
+            zl  = (zh << 60) | (zl >> 4);
+            zh  = (zh >> 4) ^ (last4[rem] << 48);
+            zh ^= hh[lo];
+            zl ^= hl[lo];
+        }
+
+        rem = (uint8_t)zl & 0xf;
+        zl  = (zh << 60) | (zl >> 4);
+        zh  = (zh >> 4) ^ (last4[rem] << 48);
+        zh ^= hh[hi];
+        zl ^= hl[hi];
+    }
+
+    PUT_BE64(zh, x);
+    PUT_BE64(zl, x + 8);
+}
+
+static void
+gcm_soft_ghash(const gcm_ctx_t *ctx, uint8_t y[16], const uint8_t *p, size_t len)
+{
+    size_t i;
+
+    while (len > 0) {
+        size_t n = len < 16 ? len : 16;
+        for (i = 0; i < n; i++)
+            y[i] ^= p[i];
+        gcm_soft_mult(ctx, y);
+        p   += n;
+        len -= n;
+    }
+}
+
+static void
+gcm_soft_crypt(gcm_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len,
+               const uint8_t *ad, size_t adlen, const uint8_t *nonce,
+               uint8_t *tag, int enc)
+{
+    uint8_t j0[16], cb[16], ks[16], y[16] = { 0 };
+    uint32_t ctr = 1;
+    size_t total = len;
+    size_t i;
+
+    memcpy(j0, nonce, GCM_NONCE_LEN);
+    j0[12] = j0[13] = j0[14] = 0;
+    j0[15] = 1;
+    memcpy(cb, j0, 16);
+
+    gcm_soft_ghash(ctx, y, ad, adlen);
+
+    while (len > 0) {
+        size_t n = len < 16 ? len : 16;
+
+        ctr++;
+        cb[12] = (uint8_t)(ctr >> 24);
+        cb[13] = (uint8_t)(ctr >> 16);
+        cb[14] = (uint8_t)(ctr >> 8);
+        cb[15] = (uint8_t)ctr;
+        gcm_soft_block(ctx, cb, ks);
+
+        if (!enc)
+            gcm_soft_ghash(ctx, y, in, n);
+        for (i = 0; i < n; i++)
+            out[i] = in[i] ^ ks[i];
+        if (enc)
+            gcm_soft_ghash(ctx, y, out, n);
+
+        in  += n;
+        out += n;
+        len -= n;
+    }
+
+    memset(cb, 0, 16);
+    PUT_BE64((uint64_t)adlen * 8, cb);
+    PUT_BE64((uint64_t)total * 8, cb + 8);
+    gcm_soft_ghash(ctx, y, cb, 16);
+
+    gcm_soft_block(ctx, j0, ks);
+    for (i = 0; i < 16; i++)
+        tag[i] = y[i] ^ ks[i];
+}
+
+static const gcm_impl_t gcm_soft_impl = {
+    .name      = "portable",
+    .available = gcm_soft_available,
+    .setkey    = gcm_soft_setkey,
+    .crypt     = gcm_soft_crypt,
+};
+
+/*
+ * x86 AES-NI + PCLMULQDQ backend
+ *
+ * GHASH operates on byte-reflected blocks as described in Intel's
+ * "Carry-Less Multiplication and Its Usage for Computing the GCM Mode",
+ * with four blocks aggregated per reduction.
+ */
+
+#ifdef GCM_HAVE_X86
+
+static int
+gcm_x86_available(void)
+{
+    unsigned int a, b, c, d;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return 0;
+
+    return (c & bit_AES) && (c & bit_PCLMUL) && (c & bit_SSSE3);
+}
+
+static inline GCM_X86_TARGET __m128i
+gcm_x86_bswap(__m128i x)
+{
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                            8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+static inline GCM_X86_TARGET void
+gcm_x86_clmul(__m128i a, __m128i b, __m128i *lo, __m128i *mid, __m128i *hi)
+{
+    *lo  = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+    *hi  = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+static inline GCM_X86_TARGET __m128i
+gcm_x86_reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+    __m128i t2, t4, t5, t7, t8, t9;
+
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    /* shift the 256-bit product left by one bit */
+    t7 = _mm_srli_epi32(lo, 31);
+    t8 = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    t9 = _mm_srli_si128(t7, 12);
+    t8 = _mm_slli_si128(t8, 4);
+    t7 = _mm_slli_si128(t7, 4);
+    lo = _mm_or_si128(lo, t7);
+    hi = _mm_or_si128(hi, t8);
+    hi = _mm_or_si128(hi, t9);
+
+    /* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+    t7 = _mm_slli_epi32(lo, 31);
+    t8 = _mm_slli_epi32(lo, 30);
+    t9 = _mm_slli_epi32(lo, 25);
+    t7 = _mm_xor_si128(t7, t8);
+    t7 = _mm_xor_si128(t7, t9);
+    t8 = _mm_srli_si128(t7, 4);
+    t7 = _mm_slli_si128(t7, 12);
+    lo = _mm_xor_si128(lo, t7);
+
+    t2 = _mm_srli_epi32(lo, 1);
+    t4 = _mm_srli_epi32(lo, 2);
+    t5 = _mm_srli_epi32(lo, 7);
+    t2 = _mm_xor_si128(t2, t4);
+    t2 = _mm_xor_si128(t2, t5);
+    t2 = _mm_xor_si128(t2, t8);
+    lo = _mm_xor_si128(lo, t2);
+
+    return _mm_xor_si128(hi, lo);
+}
+
+static inline GCM_X86_TARGET __m128i
+gcm_x86_gfmul(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+
+    gcm_x86_clmul(a, b, &lo, &mid, &hi);
+    return gcm_x86_reduce(lo, mid, hi);
+}
+
+static inline GCM_X86_TARGET __m128i
+gcm_x86_block(const __m128i *k, int rounds, __m128i b)
+{
+    int i;
+
+    b = _mm_xor_si128(b, k[0]);
+    for (i = 1; i < rounds; i++)
+        b = _mm_aesenc_si128(b, k[i]);
+    return _mm_aesenclast_si128(b, k[rounds]);
+}
+
+static GCM_X86_TARGET void
+gcm_x86_setkey(gcm_ctx_t *ctx)
+{
+    __m128i k[GCM_MAX_ROUNDS + 1];
+    __m128i h, hp;
+    int i;
+
+    for (i = 0; i <= GCM_MAX_ROUNDS; i++)
+        k[i] = _mm_loadu_si128((const __m128i *)(ctx->rk + 16 * i));
+
+    h  = gcm_x86_bswap(gcm_x86_block(k, ctx->rounds, _mm_setzero_si128()));
+    hp = h;
+    _mm_storeu_si128((__m128i *)ctx->h.hpow[0], h);
+    for (i = 1; i < GCM_HPOW_NUM; i++) {
+        hp = gcm_x86_gfmul(hp, h);
+        _mm_storeu_si128((__m128i *)ctx->h.hpow[i], hp);
+    }
+}
+
+static GCM_X86_TARGET __m128i
+gcm_x86_ghash(__m128i y, __m128i h, const uint8_t *p, size_t len)
+{
+    uint8_t last[16];
+
+    while (len >= 16) {
+        __m128i x = gcm_x86_bswap(_mm_loadu_si128((const __m128i *)p));
+        y    = gcm_x86_gfmul(_mm_xor_si128(y, x), h);
+        p   += 16;
+        len -= 16;
+    }
+    if (len > 0) {
+        memset(last, 0, 16);
+        memcpy(last, p, len);
+        __m128i x = gcm_x86_bswap(_mm_loadu_si128((const __m128i *)last));
+        y = gcm_x86_gfmul(_mm_xor_si128(y, x), h);
+    }
+    return y;
+}
+
+static GCM_X86_TARGET void
+gcm_x86_crypt(gcm_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len,
+              const uint8_t *ad, size_t adlen, const uint8_t *nonce,
+              uint8_t *tag, int enc)
+{
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i k[GCM_MAX_ROUNDS + 1];
+    __m128i h1, h2, h3, h4, y, ctr, ek0;
+    uint8_t block[16];
+    int rounds   = ctx->rounds;
+    size_t total = len;
+    int i;
+
+    for (i = 0; i <= GCM_MAX_ROUNDS; i++)
+        k[i] = _mm_loadu_si128((const __m128i *)(ctx->rk + 16 * i));
+    h1 = _mm_loadu_si128((const __m128i *)ctx->h.hpow[0]);
+    h2 = _mm_loadu_si128((const __m128i *)ctx->h.hpow[1]);
+    h3 = _mm_loadu_si128((const __m128i *)ctx->h.hpow[2]);
+    h4 = _mm_loadu_si128((const __m128i *)ctx->h.hpow[3]);
+
+    /* the counter lives byte-swapped so that inc32 is a plain add */
+    memcpy(block, nonce, GCM_NONCE_LEN);
+    block[12] = block[13] = block[14] = 0;
+    block[15] = 1;
+    ctr = gcm_x86_bswap(_mm_loadu_si128((const __m128i *)block));
+    ek0 = gcm_x86_block(k, rounds, gcm_x86_bswap(ctr));
+
+    y = gcm_x86_ghash(_mm_setzero_si128(), h1, ad, adlen);
+
+    while (len >= 64) {
+        __m128i b0, b1, b2, b3, x0, x1, x2, x3;
+        __m128i lo = _mm_setzero_si128(), mid = lo, hi = lo;
+
+        ctr = _mm_add_epi32(ctr, one);
+        b0  = _mm_xor_si128(gcm_x86_bswap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        b1  = _mm_xor_si128(gcm_x86_bswap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        b2  = _mm_xor_si128(gcm_x86_bswap(ctr), k[0]);
+        ctr = _mm_add_epi32(ctr, one);
+        b3  = _mm_xor_si128(gcm_x86_bswap(ctr), k[0]);
+        for (i = 1; i < rounds; i++) {
+            b0 = _mm_aesenc_si128(b0, k[i]);
+            b1 = _mm_aesenc_si128(b1, k[i]);
+            b2 = _mm_aesenc_si128(b2, k[i]);
+            b3 = _mm_aesenc_si128(b3, k[i]);
+        }
+        b0 = _mm_aesenclast_si128(b0, k[rounds]);
+        b1 = _mm_aesenclast_si128(b1, k[rounds]);
+        b2 = _mm_aesenclast_si128(b2, k[rounds]);
+        b3 = _mm_aesenclast_si128(b3, k[rounds]);
+
+        x0 = _mm_loadu_si128((const __m128i *)in);
+        x1 = _mm_loadu_si128((const __m128i *)(in + 16));
+        x2 = _mm_loadu_si128((const __m128i *)(in + 32));
+        x3 = _mm_loadu_si128((const __m128i *)(in + 48));
+        b0 = _mm_xor_si128(b0, x0);
+        b1 = _mm_xor_si128(b1, x1);
+        b2 = _mm_xor_si128(b2, x2);
+        b3 = _mm_xor_si128(b3, x3);
+        _mm_storeu_si128((__m128i *)out, b0);
+        _mm_storeu_si128((__m128i *)(out + 16), b1);
+        _mm_storeu_si128((__m128i *)(out + 32), b2);
+        _mm_storeu_si128((__m128i *)(out + 48), b3);
+
+        if (enc) {
+            x0 = b0;
+            x1 = b1;
+            x2 = b2;
+            x3 = b3;
+        }
+        x0 = _mm_xor_si128(y, gcm_x86_bswap(x0));
+        gcm_x86_clmul(x0, h4, &lo, &mid, &hi);
+        gcm_x86_clmul(gcm_x86_bswap(x1), h3, &lo, &mid, &hi);
+        gcm_x86_clmul(gcm_x86_bswap(x2), h2, &lo, &mid, &hi);
+        gcm_x86_clmul(gcm_x86_bswap(x3), h1, &lo, &mid, &hi);
+        y = gcm_x86_reduce(lo, mid, hi);
+
+        in  += 64;
+        out += 64;
+        len -= 64;
+    }
+
+    while (len > 0) {
+        size_t n = len < 16 ? len : 16;
+        __m128i ks, x;
+
+        ctr = _mm_add_epi32(ctr, one);
+        ks  = gcm_x86_block(k, rounds, gcm_x86_bswap(ctr));
+
+        memset(block, 0, 16);
+        memcpy(block, in, n);
+        x = _mm_loadu_si128((const __m128i *)block);
+        if (!enc)
+            y = gcm_x86_ghash(y, h1, block, n);
+        _mm_storeu_si128((__m128i *)block, _mm_xor_si128(x, ks));
+        memcpy(out, block, n);
+        if (enc)
+            y = gcm_x86_ghash(y, h1, block, n);
+
+        in  += n;
+        out += n;
+        len -= n;
+    }
+
+    memset(block, 0, 16);
+    PUT_BE64((uint64_t)adlen * 8, block);
+    PUT_BE64((uint64_t)total * 8, block + 8);
+    y = gcm_x86_ghash(y, h1, block, 16);
+
+    _mm_storeu_si128((__m128i *)tag, _mm_xor_si128(gcm_x86_bswap(y), ek0));
+}
+
+static const gcm_impl_t gcm_x86_impl = {
+    .name      = "aesni-pclmul",
+    .available = gcm_x86_available,
+    .setkey    = gcm_x86_setkey,
+    .crypt     = gcm_x86_crypt,
+};
+
+#endif
+
+/*
+ * ARMv8 Crypto Extensions backend
+ *
+ * The same reflected GHASH as the x86 path, with PMULL standing in for
+ * PCLMULQDQ and EXT for the byte shifts.
+ */
+
+#ifdef GCM_HAVE_ARMV8
+
+static int
+gcm_arm_available(void)
+{
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+    return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+}
+
+#define ARM_ZERO        vdupq_n_u8(0)
+#define ARM_SLL(x, n)   vextq_u8(ARM_ZERO, (x), 16 - (n))
+#define ARM_SRL(x, n)   vextq_u8((x), ARM_ZERO, (n))
+#define ARM_U32(x)      vreinterpretq_u32_u8(x)
+#define ARM_U8(x)       vreinterpretq_u8_u32(x)
+
+static inline uint8x16_t
+gcm_arm_bswap(uint8x16_t x)
+{
+    x = vrev64q_u8(x);
+    return vextq_u8(x, x, 8);
+}
+
+#define ARM_PMULL(a, b) vreinterpretq_u8_p128(vmull_p64((a), (b)))
+
+static inline void
+gcm_arm_clmul(uint8x16_t a, uint8x16_t b,
+              uint8x16_t *lo, uint8x16_t *mid, uint8x16_t *hi)
+{
+    poly64x2_t pa = vreinterpretq_p64_u8(a);
+    poly64x2_t pb = vreinterpretq_p64_u8(b);
+
+    *lo  = veorq_u8(*lo, ARM_PMULL(vgetq_lane_p64(pa, 0), vgetq_lane_p64(pb, 0)));
+    *hi  = veorq_u8(*hi, vreinterpretq_u8_p128(vmull_high_p64(pa, pb)));
+    *mid = veorq_u8(*mid, ARM_PMULL(vgetq_lane_p64(pa, 0), vgetq_lane_p64(pb, 1)));
+    *mid = veorq_u8(*mid, ARM_PMULL(vgetq_lane_p64(pa, 1), vgetq_lane_p64(pb, 0)));
+}
+
+static inline uint8x16_t
+gcm_arm_reduce(uint8x16_t lo, uint8x16_t mid, uint8x16_t hi)
+{
+    uint8x16_t t2, t4, t5, t7, t8, t9;
+
+    lo = veorq_u8(lo, ARM_SLL(mid, 8));
+    hi = veorq_u8(hi, ARM_SRL(mid, 8));
+
+    t7 = ARM_U8(vshrq_n_u32(ARM_U32(lo), 31));
+    t8 = ARM_U8(vshrq_n_u32(ARM_U32(hi), 31));
+    lo = ARM_U8(vshlq_n_u32(ARM_U32(lo), 1));
+    hi = ARM_U8(vshlq_n_u32(ARM_U32(hi), 1));
+    t9 = ARM_SRL(t7, 12);
+    t8 = ARM_SLL(t8, 4);
+    t7 = ARM_SLL(t7, 4);
+    lo = vorrq_u8(lo, t7);
+    hi = vorrq_u8(hi, t8);
+    hi = vorrq_u8(hi, t9);
+
+    t7 = ARM_U8(vshlq_n_u32(ARM_U32(lo), 31));
+    t8 = ARM_U8(vshlq_n_u32(ARM_U32(lo), 30));
+    t9 = ARM_U8(vshlq_n_u32(ARM_U32(lo), 25));
+    t7 = veorq_u8(t7, t8);
+    t7 = veorq_u8(t7, t9);
+    t8 = ARM_SRL(t7, 4);
+    t7 = ARM_SLL(t7, 12);
+    lo = veorq_u8(lo, t7);
+
+    t2 = ARM_U8(vshrq_n_u32(ARM_U32(lo), 1));
+    t4 = ARM_U8(vshrq_n_u32(ARM_U32(lo), 2));
+    t5 = ARM_U8(vshrq_n_u32(ARM_U32(lo), 7));
+    t2 = veorq_u8(t2, t4);
+    t2 = veorq_u8(t2, t5);
+    t2 = veorq_u8(t2, t8);
+    lo = veorq_u8(lo, t2);
+
+    return veorq_u8(hi, lo);
+}
+
+static inline uint8x16_t
+gcm_arm_gfmul(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t lo = ARM_ZERO, mid = ARM_ZERO, hi = ARM_ZERO;
+
+    gcm_arm_clmul(a, b, &lo, &mid, &hi);
+    return gcm_arm_reduce(lo, mid, hi);
+}
+
+static inline uint8x16_t
+gcm_arm_block(const uint8x16_t *k, int rounds, uint8x16_t b)
+{
+    int i;
+
+    for (i = 0; i < rounds - 1; i++)
+        b = vaesmcq_u8(vaeseq_u8(b, k[i]));
+    b = vaeseq_u8(b, k[rounds - 1]);
+    return veorq_u8(b, k[rounds]);
+}
+
+static void
+gcm_arm_setkey(gcm_ctx_t *ctx)
+{
+    uint8x16_t k[GCM_MAX_ROUNDS + 1];
+    uint8x16_t h, hp;
+    int i;
+
+    for (i = 0; i <= GCM_MAX_ROUNDS; i++)
+        k[i] = vld1q_u8(ctx->rk + 16 * i);
+
+    h  = gcm_arm_bswap(gcm_arm_block(k, ctx->rounds, ARM_ZERO));
+    hp = h;
+    vst1q_u8(ctx->h.hpow[0], h);
+    for (i = 1; i < GCM_HPOW_NUM; i++) {
+        hp = gcm_arm_gfmul(hp, h);
+        vst1q_u8(ctx->h.hpow[i], hp);
+    }
+}
+
+static uint8x16_t
+gcm_arm_ghash(uint8x16_t y, uint8x16_t h, const uint8_t *p, size_t len)
+{
+    uint8_t last[16];
+
+    while (len >= 16) {
+        y    = gcm_arm_gfmul(veorq_u8(y, gcm_arm_bswap(vld1q_u8(p))), h);
+        p   += 16;
+        len -= 16;
+    }
+    if (len > 0) {
+        memset(last, 0, 16);
+        memcpy(last, p, len);
+        y = gcm_arm_gfmul(veorq_u8(y, gcm_arm_bswap(vld1q_u8(last))), h);
+    }
+    return y;
+}
+
+static void
+gcm_arm_crypt(gcm_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len,
+              const uint8_t *ad, size_t adlen, const uint8_t *nonce,
+              uint8_t *tag, int enc)
+{
+    const uint32x4_t one = { 1, 0, 0, 0 };
+    uint8x16_t k[GCM_MAX_ROUNDS + 1];
+    uint8x16_t h1, h2, h3, h4, y, ek0;
+    uint32x4_t ctr;
+    uint8_t block[16];
+    int rounds   = ctx->rounds;
+    size_t total = len;
+    int i;
+
+    for (i = 0; i <= GCM_MAX_ROUNDS; i++)
+        k[i] = vld1q_u8(ctx->rk + 16 * i);
+    h1 = vld1q_u8(ctx->h.hpow[0]);
+    h2 = vld1q_u8(ctx->h.hpow[1]);
+    h3 = vld1q_u8(ctx->h.hpow[2]);
+    h4 = vld1q_u8(ctx->h.hpow[3]);
+
+    memcpy(block, nonce, GCM_NONCE_LEN);
+    block[12] = block[13] = block[14] = 0;
+    block[15] = 1;
+    ctr = ARM_U32(gcm_arm_bswap(vld1q_u8(block)));
+    ek0 = gcm_arm_block(k, rounds, vld1q_u8(block));
+
+    y = gcm_arm_ghash(ARM_ZERO, h1, ad, adlen);
+
+    while (len >= 64) {
+        uint8x16_t b0, b1, b2, b3, x0, x1, x2, x3;
+        uint8x16_t lo = ARM_ZERO, mid = ARM_ZERO, hi = ARM_ZERO;
+
+        ctr = vaddq_u32(ctr, one);
+        b0  = gcm_arm_bswap(ARM_U8(ctr));
+        ctr = vaddq_u32(ctr, one);
+        b1  = gcm_arm_bswap(ARM_U8(ctr));
+        ctr = vaddq_u32(ctr, one);
+        b2  = gcm_arm_bswap(ARM_U8(ctr));
+        ctr = vaddq_u32(ctr, one);
+        b3  = gcm_arm_bswap(ARM_U8(ctr));
+        for (i = 0; i < rounds - 1; i++) {
+            b0 = vaesmcq_u8(vaeseq_u8(b0, k[i]));
+            b1 = vaesmcq_u8(vaeseq_u8(b1, k[i]));
+            b2 = vaesmcq_u8(vaeseq_u8(b2, k[i]));
+            b3 = vaesmcq_u8(vaeseq_u8(b3, k[i]));
+        }
+        b0 = veorq_u8(vaeseq_u8(b0, k[rounds - 1]), k[rounds]);
+        b1 = veorq_u8(vaeseq_u8(b1, k[rounds - 1]), k[rounds]);
+        b2 = veorq_u8(vaeseq_u8(b2, k[rounds - 1]), k[rounds]);
+        b3 = veorq_u8(vaeseq_u8(b3, k[rounds - 1]), k[rounds]);
+
+        x0 = vld1q_u8(in);
+        x1 = vld1q_u8(in + 16);
+        x2 = vld1q_u8(in + 32);
+        x3 = vld1q_u8(in + 48);
+        b0 = veorq_u8(b0, x0);
+        b1 = veorq_u8(b1, x1);
+        b2 = veorq_u8(b2, x2);
+        b3 = veorq_u8(b3, x3);
+        vst1q_u8(out, b0);
+        vst1q_u8(out + 16, b1);
+        vst1q_u8(out + 32, b2);
+        vst1q_u8(out + 48, b3);
+
+        if (enc) {
+            x0 = b0;
+            x1 = b1;
+            x2 = b2;
+            x3 = b3;
+        }
+        x0 = veorq_u8(y, gcm_arm_bswap(x0));
+        gcm_arm_clmul(x0, h4, &lo, &mid, &hi);
+        gcm_arm_clmul(gcm_arm_bswap(x1), h3, &lo, &mid, &hi);
+        gcm_arm_clmul(gcm_arm_bswap(x2), h2, &lo, &mid, &hi);
+        gcm_arm_clmul(gcm_arm_bswap(x3), h1, &lo, &mid, &hi);
+        y = gcm_arm_reduce(lo, mid, hi);
+
+        in  += 64;
+        out += 64;
+        len -= 64;
+    }
+
+    while (len > 0) {
+        size_t n = len < 16 ? len : 16;
+        uint8x16_t ks;
+
+        ctr = vaddq_u32(ctr, one);
+        ks  = gcm_arm_block(k, rounds, gcm_arm_bswap(ARM_U8(ctr)));
+
+        memset(block, 0, 16);
+        memcpy(block, in, n);
+        if (!enc)
+            y = gcm_arm_ghash(y, h1, block, n);
+        vst1q_u8(block, veorq_u8(vld1q_u8(block), ks));
+        memcpy(out, block, n);
+        if (enc)
+            y = gcm_arm_ghash(y, h1, block, n);
+
+        in  += n;
+        out += n;
+        len -= n;
+    }
+
+    memset(block, 0, 16);
+    PUT_BE64((uint64_t)adlen * 8, block);
+    PUT_BE64((uint64_t)total * 8, block + 8);
+    y = gcm_arm_ghash(y, h1, block, 16);
+
+    vst1q_u8(tag, veorq_u8(gcm_arm_bswap(y), ek0));
+}
+
+static const gcm_impl_t gcm_arm_impl = {
+    .name      = "armv8-ce",
+    .available = gcm_arm_available,
+    .setkey    = gcm_arm_setkey,
+    .crypt     = gcm_arm_crypt,
+};
+
+#endif
+
+static const gcm_impl_t *gcm_impls[] = {
+#ifdef GCM_HAVE_X86
+    &gcm_x86_impl,
+#endif
+#ifdef GCM_HAVE_ARMV8
+    &gcm_arm_impl,
+#endif
+    &gcm_soft_impl,
+};
+
+static const gcm_impl_t *gcm_selected = NULL;
+
+static const gcm_impl_t *
+gcm_select(void)
+{
+    size_t i;
+
+    if (gcm_selected != NULL)
+        return gcm_selected;
+
+    if (!tables_ready)
+        gcm_gen_tables();
+
+    for (i = 0; i < sizeof(gcm_impls) / sizeof(gcm_impls[0]); i++)
+        if (gcm_impls[i]->available()) {
+            gcm_selected = gcm_impls[i];
+            break;
+        }
+
+    return gcm_selected;
+}
+
+const char *
+gcm_backend_name(void)
+{
+    return gcm_select()->name;
+}
+
+int
+gcm_setkey(gcm_ctx_t *ctx, const uint8_t *key, size_t key_len)
+{
+    if (key_len != 16 && key_len != 24 && key_len != 32)
+        return -1;
+
+    ctx->impl = gcm_select();
+    gcm_expand_key(ctx, key, key_len);
+    ctx->impl->setkey(ctx);
+
+    return 0;
+}
+
+void
+gcm_encrypt(gcm_ctx_t *ctx, uint8_t *c, uint8_t *tag,
+            const uint8_t *m, size_t mlen,
+            const uint8_t *ad, size_t adlen, const uint8_t *nonce)
+{
+    uint8_t s[GCM_TAG_LEN];
+
+    ctx->impl->crypt(ctx, c, m, mlen, ad, adlen, nonce, s, 1);
+    memcpy(tag, s, GCM_TAG_LEN);
+}
+
+int
+gcm_decrypt(gcm_ctx_t *ctx, uint8_t *m,
+            const uint8_t *c, size_t clen, const uint8_t *tag,
+            const uint8_t *ad, size_t adlen, const uint8_t *nonce)
+{
+    uint8_t s[GCM_TAG_LEN];
+
+    ctx->impl->crypt(ctx, m, c, clen, ad, adlen, nonce, s, 0);
+    if (sodium_memcmp(s, tag, GCM_TAG_LEN) != 0) {
+        sodium_memzero(m, clen);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * gcm.h - Define the AES-GCM backend interface
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GCM_H
+#define _GCM_H
+
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+
+#define GCM_NONCE_LEN   12
+#define GCM_TAG_LEN     16
+#define GCM_MAX_ROUNDS  14
+#define GCM_HPOW_NUM    4
+
+struct gcm_impl;
+
+/*
+ * The key schedule and the GHASH key material are expanded once in
+ * gcm_setkey() and reused for every chunk sealed under that key.
+ */
+typedef struct gcm_ctx {
+    const struct gcm_impl *impl;
+    int rounds;
+    uint8_t rk[16 * (GCM_MAX_ROUNDS + 1)];      /* FIPS-197 byte order */
+    uint32_t erk[4 * (GCM_MAX_ROUNDS + 1)];     /* same, as words      */
+    union {
+        struct {
+            uint64_t hl[16];
+            uint64_t hh[16];
+        } tbl;                                  /* 4-bit GHASH tables  */
+        uint8_t hpow[GCM_HPOW_NUM][16];         /* H^1..H^4, reflected */
+    } h;
+} gcm_ctx_t;
+
+typedef struct gcm_impl {
+    const char *name;
+    int (*available)(void);
+    void (*setkey)(gcm_ctx_t *);
+    void (*crypt)(gcm_ctx_t *, uint8_t *out, const uint8_t *in, size_t len,
+                  const uint8_t *ad, size_t adlen, const uint8_t *nonce,
+                  uint8_t *tag, int enc);
+} gcm_impl_t;
+
+const char *gcm_backend_name(void);
+
+int gcm_setkey(gcm_ctx_t *, const uint8_t *key, size_t key_len);
+void gcm_encrypt(gcm_ctx_t *, uint8_t *c, uint8_t *tag,
+                 const uint8_t *m, size_t mlen,
+                 const uint8_t *ad, size_t adlen, const uint8_t *nonce);
+int gcm_decrypt(gcm_ctx_t *, uint8_t *m,
+                const uint8_t *c, size_t clen, const uint8_t *tag,
+                const uint8_t *ad, size_t adlen, const uint8_t *nonce);
+
+#endif // _GCM_H
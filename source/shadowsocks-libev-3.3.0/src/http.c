@@ -30,20 +30,25 @@
 
 #include <stdio.h>
 #include <stdlib.h> /* malloc() */
-#include <string.h> /* strncpy() */
-#include <strings.h> /* strncasecmp() */
+#include <string.h> /* memchr(), memcpy() */
 #include <ctype.h> /* isblank(), isdigit() */
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
 
 #include "http.h"
 #include "protocol.h"
 
 static int parse_http_header(const char *, size_t, char **);
-static int get_header(const char *, const char *, int, char **);
-static int next_header(const char **, int *);
+static int sniff_http_header(sniff_t *, const char *, size_t, char **);
+static int is_host_header(const char *, size_t);
 
 static const protocol_t http_protocol_st = {
     .default_port =                 80,
     .parse_packet = &parse_http_header,
+    .sniff        = &sniff_http_header,
 };
 const protocol_t *const http_protocol = &http_protocol_st;
 
@@ -63,91 +68,100 @@ const protocol_t *const http_protocol = &http_protocol_st;
 static int
 parse_http_header(const char *data, size_t data_len, char **hostname)
 {
-    int result, i;
-
-    if (hostname == NULL)
-        return -3;
-
-    if (data_len == 0)
-        return -1;
-
-    result = get_header("Host:", data, data_len, hostname);
-    if (result < 0)
-        return result;
-
-    /*
-     *  if the user specifies the port in the request, it is included here.
-     *  Host: example.com:80
-     *  Host: [2001:db8::1]:8080
-     *  so we trim off port portion
-     */
-    for (i = result - 1; i >= 0; i--)
-        if ((*hostname)[i] == ':') {
-            (*hostname)[i] = '\0';
-            result         = i;
-            break;
-        } else if (!isdigit((*hostname)[i])) {
-            break;
-        }
+    sniff_t st = { 0 };
 
-    return result;
+    return sniff_http_header(&st, data, data_len, hostname);
 }
 
+/*
+ * Same as parse_http_header(), resuming at the first line not seen by
+ * an earlier call. Line ends are found with memchr(), which the C
+ * library implements with vector instructions.
+ */
 static int
-get_header(const char *header, const char *data, int data_len, char **value)
+sniff_http_header(sniff_t *st, const char *data, size_t data_len,
+                  char **hostname)
 {
-    int len, header_len;
-
-    header_len = strlen(header);
+    const char *eol;
+    size_t line, len;
+    int i;
 
-    /* loop through headers stopping at first blank line */
-    while ((len = next_header(&data, &data_len)) != 0)
-        if (len > header_len && strncasecmp(header, data, header_len) == 0) {
-            /* Eat leading whitespace */
-            while (header_len < len && isblank((unsigned char)data[header_len]))
-                header_len++;
-
-            *value = malloc(len - header_len + 1);
-            if (*value == NULL)
-                return -4;
-
-            strncpy(*value, data + header_len, len - header_len);
-            (*value)[len - header_len] = '\0';
+    if (hostname == NULL)
+        return -3;
 
-            return len - header_len;
-        }
+    while (st->scan < data_len) {
+        eol = memchr(data + st->scan, '\n', data_len - st->scan);
+        if (eol == NULL)
+            break;
 
-    /* If there is no data left after reading all the headers then we do not
-     * have a complete HTTP request, there must be a blank line */
-    if (data_len == 0)
-        return -1;
+        line       = st->offset;
+        len        = eol - data - line;
+        st->offset = st->scan = eol - data + 1;
+
+        if (len > 0 && data[line + len - 1] == '\r')
+            len--;
+
+        /* skip the request line */
+        if (st->count++ == 0)
+            continue;
+
+        /* a blank line ends the headers */
+        if (len == 0)
+            return -2;
+
+        if (!is_host_header(data + line, len))
+            continue;
+
+        /* Eat leading whitespace */
+        i = 5;
+        while (i < len && isblank((unsigned char)data[line + i]))
+            i++;
+        line += i;
+        len  -= i;
+
+        *hostname = malloc(len + 1);
+        if (*hostname == NULL)
+            return -4;
+
+        memcpy(*hostname, data + line, len);
+        (*hostname)[len] = '\0';
+
+        /*
+         *  if the user specifies the port in the request, it is included here.
+         *  Host: example.com:80
+         *  Host: [2001:db8::1]:8080
+         *  so we trim off port portion
+         */
+        for (i = len - 1; i >= 0; i--)
+            if ((*hostname)[i] == ':') {
+                (*hostname)[i] = '\0';
+                len            = i;
+                break;
+            } else if (!isdigit((unsigned char)(*hostname)[i])) {
+                break;
+            }
+
+        return len;
+    }
 
-    return -2;
+    st->scan = data_len;
+    return -1;
 }
 
+/*
+ * Case-insensitive match of "Host:", comparing the name as one word.
+ * Setting bit 5 folds the upper case letters onto the lower case ones
+ * and no other byte onto "host".
+ */
 static int
-next_header(const char **data, int *len)
+is_host_header(const char *line, size_t len)
 {
-    int header_len;
-
-    /* perhaps we can optimize this to reuse the value of header_len, rather
-     * than scanning twice.
-     * Walk our data stream until the end of the header */
-    while (*len > 2 && (*data)[0] != '\r' && (*data)[1] != '\n') {
-        (*len)--;
-        (*data)++;
-    }
-
-    /* advanced past the <CR><LF> pair */
-    *data += 2;
-    *len  -= 2;
+    uint32_t name, host;
 
-    /* Find the length of the next header */
-    header_len = 0;
-    while (*len > header_len + 1
-           && (*data)[header_len] != '\r'
-           && (*data)[header_len + 1] != '\n')
-        header_len++;
+    if (len <= 5 || line[4] != ':')
+        return 0;
 
-    return header_len;
+    memcpy(&name, line, sizeof(name));
+    memcpy(&host, "host", sizeof(host));
+    return (name | 0x20202020) == host;
 }
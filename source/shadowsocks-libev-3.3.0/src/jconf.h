@@ -82,8 +82,11 @@ typedef struct {
     int mptcp;
     int ipv6_first;
     int no_delay;
+    int warm_pool;
+    int mux;
     char *workdir;
     char *acl;
+    char *trace;
 } jconf_t;
 
 jconf_t *read_jconf(const char *file);
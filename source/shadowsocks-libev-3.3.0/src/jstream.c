@@ -0,0 +1,467 @@
+/*
+ * jstream.c - Streaming JSON reader for config files and manager commands
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "jstream.h"
+
+#define STATE_VALUE       0 /* start of input, after ':' */
+#define STATE_FIRST_VALUE 1 /* after '[' */
+#define STATE_FIRST_KEY   2 /* after '{' */
+#define STATE_NEXT        3 /* after a complete value */
+#define STATE_FAIL        4
+
+#define in_object(js) (((js)->stack >> ((js)->depth - 1)) & 1)
+
+static int
+fail(jstream_t *js, const char *reason)
+{
+    int line = 1, col = 1;
+
+    // only paid for on error
+    for (const char *p = js->start; p < js->pos; p++) {
+        if (*p == '\n') {
+            line++;
+            col = 1;
+        } else {
+            col++;
+        }
+    }
+
+    snprintf(js->error, sizeof(js->error), "%d:%d: %s", line, col, reason);
+    js->state = STATE_FAIL;
+    return JSTREAM_ERROR;
+}
+
+static void
+skip_space(jstream_t *js)
+{
+    while (js->pos < js->end
+           && (*js->pos == ' ' || *js->pos == '\t'
+               || *js->pos == '\n' || *js->pos == '\r'))
+        js->pos++;
+}
+
+static int
+read_string(jstream_t *js)
+{
+    const char *p = js->pos + 1;
+
+    js->escaped = 0;
+    while (p < js->end && *p != '"') {
+        if (*p == '\\') {
+            js->escaped = 1;
+            if (++p == js->end)
+                break;
+            switch (*p) {
+            case '"': case '\\': case '/':
+            case 'b': case 'f': case 'n': case 'r': case 't':
+                break;
+            case 'u':
+                for (int i = 1; i <= 4; i++) {
+                    if (p + i >= js->end || !isxdigit((unsigned char)p[i])) {
+                        js->pos = p;
+                        return fail(js, "invalid unicode escape");
+                    }
+                }
+                p += 4;
+                break;
+            default:
+                js->pos = p;
+                return fail(js, "invalid escape");
+            }
+        }
+        p++;
+    }
+
+    if (p >= js->end) {
+        return fail(js, "unterminated string");
+    }
+
+    js->str = js->pos + 1;
+    js->len = p - js->str;
+    js->pos = p + 1;
+    return JSTREAM_STRING;
+}
+
+static int
+read_number(jstream_t *js)
+{
+    const char *p = js->pos;
+    uint64_t value = 0;
+    int negative = 0, integer = 1;
+
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p == js->end || !isdigit((unsigned char)*p)
+        || (*p == '0' && p + 1 < js->end && isdigit((unsigned char)p[1]))) {
+        return fail(js, "invalid number");
+    }
+    for (; p < js->end && isdigit((unsigned char)*p); p++) {
+        if (value > (UINT64_MAX - 9) / 10)
+            integer = 0;
+        value = value * 10 + (*p - '0');
+    }
+    if (p < js->end && *p == '.') {
+        integer = 0;
+        if (++p == js->end || !isdigit((unsigned char)*p)) {
+            js->pos = p;
+            return fail(js, "invalid number");
+        }
+        while (p < js->end && isdigit((unsigned char)*p))
+            p++;
+    }
+    if (p < js->end && (*p == 'e' || *p == 'E')) {
+        integer = 0;
+        if (++p < js->end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == js->end || !isdigit((unsigned char)*p)) {
+            js->pos = p;
+            return fail(js, "invalid number");
+        }
+        while (p < js->end && isdigit((unsigned char)*p))
+            p++;
+    }
+
+    if (integer && value <= (uint64_t)INT64_MAX + negative) {
+        js->integer = negative ? -(int64_t)(value - 1) - 1 : (int64_t)value;
+        js->number  = (double)js->integer;
+        js->pos     = p;
+        return JSTREAM_INTEGER;
+    }
+
+    // the input need not be terminated, so strtod works on a copy
+    char tmp[64];
+    size_t len = p - js->pos;
+    if (len >= sizeof(tmp)) {
+        return fail(js, "number too long");
+    }
+    memcpy(tmp, js->pos, len);
+    tmp[len]   = '\0';
+    js->number = strtod(tmp, NULL);
+    js->pos    = p;
+    return JSTREAM_DOUBLE;
+}
+
+static int
+read_literal(jstream_t *js, const char *word, size_t len, int type)
+{
+    if ((size_t)(js->end - js->pos) < len || memcmp(js->pos, word, len) != 0) {
+        return fail(js, "unexpected character");
+    }
+    js->pos += len;
+    return type;
+}
+
+static int
+open_container(jstream_t *js, int object)
+{
+    if (js->depth == JSTREAM_MAX_DEPTH) {
+        return fail(js, "too deeply nested");
+    }
+    if (object)
+        js->stack |= (uint64_t)1 << js->depth;
+    else
+        js->stack &= ~((uint64_t)1 << js->depth);
+    js->depth++;
+    js->pos++;
+    js->state = object ? STATE_FIRST_KEY : STATE_FIRST_VALUE;
+    return object ? JSTREAM_OBJECT : JSTREAM_ARRAY;
+}
+
+static int
+close_container(jstream_t *js)
+{
+    int object = in_object(js);
+
+    if (js->pos == js->end) {
+        return fail(js, "unexpected end of input");
+    }
+    if (*js->pos != (object ? '}' : ']')) {
+        return fail(js, object ? "expected ',' or '}'" : "expected ',' or ']'");
+    }
+    js->depth--;
+    js->pos++;
+    js->state = STATE_NEXT;
+    return object ? JSTREAM_OBJECT_END : JSTREAM_ARRAY_END;
+}
+
+static int
+read_value(jstream_t *js)
+{
+    int type;
+
+    if (js->pos == js->end) {
+        return fail(js, "unexpected end of input");
+    }
+
+    switch (*js->pos) {
+    case '{':
+        return open_container(js, 1);
+    case '[':
+        return open_container(js, 0);
+    case '"':
+        type = read_string(js);
+        break;
+    case 't':
+        type        = read_literal(js, "true", 4, JSTREAM_BOOLEAN);
+        js->boolean = 1;
+        break;
+    case 'f':
+        type        = read_literal(js, "false", 5, JSTREAM_BOOLEAN);
+        js->boolean = 0;
+        break;
+    case 'n':
+        type = read_literal(js, "null", 4, JSTREAM_NULL);
+        break;
+    default:
+        type = read_number(js);
+        break;
+    }
+
+    if (type == JSTREAM_ERROR) {
+        return type;
+    }
+
+    js->state = STATE_NEXT;
+    return type;
+}
+
+static int
+read_key(jstream_t *js)
+{
+    if (js->pos == js->end || *js->pos != '"') {
+        return fail(js, "expected a key");
+    }
+    if (read_string(js) == JSTREAM_ERROR) {
+        return JSTREAM_ERROR;
+    }
+    skip_space(js);
+    if (js->pos == js->end || *js->pos != ':') {
+        return fail(js, "expected ':'");
+    }
+    js->pos++;
+    js->state = STATE_VALUE;
+    return JSTREAM_KEY;
+}
+
+void
+jstream_init(jstream_t *js, const char *buf, size_t len)
+{
+    memset(js, 0, sizeof(jstream_t));
+    js->start = buf;
+    js->pos   = buf;
+    js->end   = buf + len;
+    js->state = STATE_VALUE;
+}
+
+int
+jstream_next(jstream_t *js)
+{
+    if (js->state == STATE_FAIL) {
+        return JSTREAM_ERROR;
+    }
+
+    skip_space(js);
+
+    switch (js->state) {
+    case STATE_NEXT:
+        if (js->depth == 0) {
+            if (js->pos != js->end) {
+                return fail(js, "trailing garbage");
+            }
+            return JSTREAM_END;
+        }
+        if (js->pos < js->end && *js->pos == ',') {
+            js->pos++;
+            skip_space(js);
+            return in_object(js) ? read_key(js) : read_value(js);
+        }
+        return close_container(js);
+    case STATE_FIRST_KEY:
+        if (js->pos < js->end && *js->pos == '}') {
+            return close_container(js);
+        }
+        return read_key(js);
+    case STATE_FIRST_VALUE:
+        if (js->pos < js->end && *js->pos == ']') {
+            return close_container(js);
+        }
+        return read_value(js);
+    default:
+        return read_value(js);
+    }
+}
+
+/*
+ * Skips the rest of a value whose first token was type, and returns the
+ * last token read.
+ */
+int
+jstream_skip(jstream_t *js, int type)
+{
+    if (type != JSTREAM_OBJECT && type != JSTREAM_ARRAY) {
+        return type;
+    }
+
+    int depth = js->depth - 1;
+    do
+        type = jstream_next(js);
+    while (type != JSTREAM_ERROR && js->depth > depth);
+
+    return type;
+}
+
+static uint32_t
+hex4(const char *p)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < 4; i++) {
+        int c = (unsigned char)p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else
+            value |= (c | 0x20) - 'a' + 10;
+    }
+    return value;
+}
+
+static size_t
+utf8_encode(uint32_t cp, char *out)
+{
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/*
+ * Copies the current string or key into dst, decoding escapes, and
+ * always terminates it. Anything beyond size - 1 bytes is cut off.
+ */
+size_t
+jstream_strcpy(jstream_t *js, char *dst, size_t size)
+{
+    const char *p   = js->str;
+    const char *end = js->str + js->len;
+    size_t n        = 0;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    if (!js->escaped) {
+        n = js->len < size - 1 ? js->len : size - 1;
+        memcpy(dst, p, n);
+        dst[n] = '\0';
+        return n;
+    }
+
+    while (p < end) {
+        char c[4];
+        size_t len = 1;
+
+        if (*p != '\\') {
+            c[0] = *p++;
+        } else {
+            p++;
+            switch (*p++) {
+            case 'b':
+                c[0] = '\b';
+                break;
+            case 'f':
+                c[0] = '\f';
+                break;
+            case 'n':
+                c[0] = '\n';
+                break;
+            case 'r':
+                c[0] = '\r';
+                break;
+            case 't':
+                c[0] = '\t';
+                break;
+            case 'u':
+            {
+                uint32_t cp = hex4(p);
+                p += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6
+                    && p[0] == '\\' && p[1] == 'u') {
+                    uint32_t low = hex4(p + 2);
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                len = utf8_encode(cp, c);
+                break;
+            }
+            default:
+                c[0] = p[-1];
+                break;
+            }
+        }
+
+        if (n + len >= size)
+            break;
+        memcpy(dst + n, c, len);
+        n += len;
+    }
+
+    dst[n] = '\0';
+    return n;
+}
+
+char *
+jstream_strdup(jstream_t *js)
+{
+    // decoding never makes a string longer
+    char *str = ss_malloc(js->len + 1);
+    jstream_strcpy(js, str, js->len + 1);
+    return str;
+}
@@ -0,0 +1,79 @@
+/*
+ * jstream.h - Define the streaming JSON reader
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _JSTREAM_H
+#define _JSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSTREAM_MAX_DEPTH 64
+
+#define JSTREAM_ERROR      -1
+#define JSTREAM_END        0
+#define JSTREAM_OBJECT     1
+#define JSTREAM_OBJECT_END 2
+#define JSTREAM_ARRAY      3
+#define JSTREAM_ARRAY_END  4
+#define JSTREAM_KEY        5
+#define JSTREAM_STRING     6
+#define JSTREAM_INTEGER    7
+#define JSTREAM_DOUBLE     8
+#define JSTREAM_BOOLEAN    9
+#define JSTREAM_NULL       10
+
+/*
+ * Pull reader over a JSON document in memory. Each call to jstream_next()
+ * returns the next token. The reader never allocates and never writes to
+ * the input. A string or key token refers to its raw text; it is only
+ * decoded when copied out with jstream_strcpy() or jstream_strdup().
+ * Errors are sticky: once a token is JSTREAM_ERROR, every later call
+ * returns JSTREAM_ERROR as well, and error holds a "line:col: reason"
+ * message.
+ */
+typedef struct jstream {
+    const char *start;
+    const char *pos;
+    const char *end;
+    uint64_t stack;         /* one bit per open container, set for objects */
+    int depth;
+    int state;
+
+    /* the current token */
+    const char *str;        /* raw string, without quotes */
+    size_t len;
+    int escaped;
+    int64_t integer;
+    double number;
+    int boolean;
+
+    char error[128];
+} jstream_t;
+
+void jstream_init(jstream_t *js, const char *buf, size_t len);
+int jstream_next(jstream_t *js);
+int jstream_skip(jstream_t *js, int type);
+
+size_t jstream_strcpy(jstream_t *js, char *dst, size_t size);
+char *jstream_strdup(jstream_t *js);
+
+#endif // _JSTREAM_H
@@ -58,6 +58,7 @@
 #include "http.h"
 #include "tls.h"
 #include "plugin.h"
+#include "mux.h"
 #include "local.h"
 #include "winsock.h"
 
@@ -79,6 +80,9 @@
 #define EWOULDBLOCK EAGAIN
 #endif
 
+// how long a connection may wait for the rest of its HTTP or TLS header
+#define SNI_WAIT 0.05
+
 int verbose    = 0;
 int reuse_port = 0;
 
@@ -102,11 +106,15 @@ static int no_delay  = 0;
 static int udp_fd    = 0;
 static int ret_val   = 0;
 
+static mux_pool_t *mux = NULL;
+
 static struct ev_signal sigint_watcher;
 static struct ev_signal sigterm_watcher;
 #ifndef __MINGW32__
 static struct ev_signal sigchld_watcher;
+static struct ev_signal sighup_watcher;
 static struct ev_signal sigusr1_watcher;
+static struct ev_signal sigusr2_watcher;
 #else
 #ifndef LIB_ONLY
 static struct plugin_watcher_t {
@@ -139,6 +147,7 @@ static int create_and_bind(const char *addr, const char *port);
 static int launch_or_create(const char *addr, const char *port);
 #endif
 static remote_t *create_remote(listen_ctx_t *listener, struct sockaddr *addr, int direct);
+static int create_remote_socket(listen_ctx_t *listener, struct sockaddr *remote_addr);
 static void free_remote(remote_t *remote);
 static void close_and_free_remote(EV_P_ remote_t *remote);
 static void free_server(server_t *server);
@@ -273,6 +282,14 @@ delayed_connect_cb(EV_P_ ev_timer *watcher, int revents)
     server_recv_cb(EV_A_ & server->recv_ctx->io, revents);
 }
 
+static void
+frame_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    server_t *server = cork_container_of(watcher, server_t, frame.watcher);
+
+    server_recv_cb(EV_A_ & server->recv_ctx->io, revents);
+}
+
 static int
 server_handshake_reply(EV_P_ ev_io *w, int udp_assc, struct socks5_response *response)
 {
@@ -441,15 +458,20 @@ server_handshake(EV_P_ ev_io *w, buffer_t *buf)
 
     if (atyp == SOCKS5_ATYP_IPV4 || atyp == SOCKS5_ATYP_IPV6) {
         if (dst_port == http_protocol->default_port)
-            hostname_len = http_protocol->parse_packet(buf->data + 3 + abuf->len,
-                                              buf->len - 3 - abuf->len, &hostname);
+            hostname_len = http_protocol->sniff(&server->sniff, buf->data + 3 + abuf->len,
+                                                buf->len - 3 - abuf->len, &hostname);
         else if (dst_port == tls_protocol->default_port)
-            hostname_len = tls_protocol->parse_packet(buf->data + 3 + abuf->len,
-                                             buf->len - 3 - abuf->len, &hostname);
-        if (hostname_len == -1 && buf->len < SOCKET_BUF_SIZE && server->stage != STAGE_SNI) {
+            hostname_len = tls_protocol->sniff(&server->sniff, buf->data + 3 + abuf->len,
+                                               buf->len - 3 - abuf->len, &hostname);
+        // keep waiting while the request trickles in, for SNI_WAIT at most
+        if (hostname_len == -1 && buf->len < SOCKET_BUF_SIZE
+            && (server->stage != STAGE_SNI || ev_now(EV_A) < server->sniff_deadline)) {
             if (server_handshake_reply(EV_A_ w, 0, &response) < 0)
                 return -1;
-            server->stage = STAGE_SNI;
+            if (server->stage != STAGE_SNI) {
+                server->stage          = STAGE_SNI;
+                server->sniff_deadline = ev_now(EV_A) + SNI_WAIT;
+            }
             ev_timer_start(EV_A_ & server->delayed_connect_watcher);
             return -1;
         } else if (hostname_len > 0) {
@@ -572,7 +594,8 @@ server_handshake(EV_P_ ev_io *w, buffer_t *buf)
 not_bypass:
     // Not bypass
     if (remote == NULL) {
-        remote = create_remote(server->listener, NULL, 0);
+        if (mux == NULL)
+            remote = create_remote(server->listener, NULL, 0);
 
         if (sni_detected && acl
 #ifdef __ANDROID__
@@ -589,6 +612,18 @@ not_bypass:
             memcpy(abuf->data + abuf->len, &dst_port, 2);
             abuf->len += 2;
         }
+
+        if (mux != NULL) {
+            if (mux_open(EV_A_ mux, server->fd, abuf, buf) == 0) {
+                // the stream owns the client socket from now on
+                ev_io_stop(EV_A_ & server_recv_ctx->io);
+                ev_io_stop(EV_A_ & server->send_ctx->io);
+                ev_timer_stop(EV_A_ & server->delayed_connect_watcher);
+                free_server(server);
+                return -1;
+            }
+            remote = create_remote(server->listener, NULL, 0);
+        }
     }
 
     if (remote == NULL) {
@@ -597,16 +632,6 @@ not_bypass:
         return -1;
     }
 
-    if (!remote->direct) {
-        int err = crypto->encrypt(abuf, server->e_ctx, SOCKET_BUF_SIZE);
-        if (err) {
-            LOGE("invalid password or cipher");
-            close_and_free_remote(EV_A_ remote);
-            close_and_free_server(EV_A_ server);
-            return -1;
-        }
-    }
-
     if (buf->len > 0) {
         memcpy(remote->buf->data, buf->data, buf->len);
         remote->buf->len = buf->len;
@@ -642,7 +667,20 @@ server_stream(EV_P_ ev_io *w, buffer_t *buf)
 #ifdef __ANDROID__
         tx += remote->buf->len;
 #endif
-        int err = crypto->encrypt(remote->buf, server->e_ctx, SOCKET_BUF_SIZE);
+        // the header goes out with the first data, in one batch
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (server->abuf) {
+            iov[iovcnt].iov_base  = server->abuf->data;
+            iov[iovcnt++].iov_len = server->abuf->len;
+        }
+        iov[iovcnt].iov_base  = remote->buf->data;
+        iov[iovcnt++].iov_len = remote->buf->len;
+
+        ev_tstamp since = trace_clock();
+        int err         = crypto->encrypt_batch(remote->buf, iov, iovcnt,
+                                                server->e_ctx, SOCKET_BUF_SIZE);
+        trace_crypto(&server->trace, since);
 
         if (err) {
             LOGE("invalid password or cipher");
@@ -652,7 +690,6 @@ server_stream(EV_P_ ev_io *w, buffer_t *buf)
         }
 
         if (server->abuf) {
-            bprepend(remote->buf, server->abuf, SOCKET_BUF_SIZE);
             bfree(server->abuf);
             ss_free(server->abuf);
             server->abuf = NULL;
@@ -680,6 +717,7 @@ server_stream(EV_P_ ev_io *w, buffer_t *buf)
 #endif
 
         remote->buf->idx = 0;
+        trace_mark(EV_A_ & server->trace.connecting);
 
         if (!fast_open || remote->direct) {
             // connecting, wait until connected
@@ -847,7 +885,12 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
     if (revents != EV_TIMER) {
         r = recv(server->fd, buf->data + buf->len, SOCKET_BUF_SIZE - buf->len, 0);
 
-        if (r == 0) {
+        if (r == 0 && frame_held(&server->frame)) {
+            // send what was held back, the next read sees the EOF again
+            frame_stop(EV_A_ & server->frame);
+            server_stream(EV_A_ w, buf);
+            return;
+        } else if (r == 0) {
             // connection closed
             close_and_free_remote(EV_A_ remote);
             close_and_free_server(EV_A_ server);
@@ -866,6 +909,13 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
             }
         }
         buf->len += r;
+        server->trace.tx += r;
+
+        if (server->stage == STAGE_STREAM && !no_delay && remote != NULL
+            && !remote->direct && remote->send_ctx->connected
+            && frame_hold(EV_A_ & server->frame, r, buf->len, SOCKET_BUF_SIZE)) {
+            return;
+        }
     }
 
     while (1) {
@@ -1030,13 +1080,17 @@ remote_recv_cb(EV_P_ ev_io *w, int revents)
     }
 
     server->buf->len = r;
+    server->trace.rx += r;
+    trace_mark(EV_A_ & server->trace.first_byte);
 
     if (!remote->direct) {
 #ifdef __ANDROID__
         rx += server->buf->len;
         stat_update_cb();
 #endif
-        int err = crypto->decrypt(server->buf, server->d_ctx, SOCKET_BUF_SIZE);
+        ev_tstamp since = trace_clock();
+        int err         = crypto->decrypt(server->buf, server->d_ctx, SOCKET_BUF_SIZE);
+        trace_crypto(&server->trace, since);
         if (err == CRYPTO_ERROR) {
             LOGE("invalid password or cipher");
             close_and_free_remote(EV_A_ remote);
@@ -1121,6 +1175,7 @@ remote_send_cb(EV_P_ ev_io *w, int revents)
         int r         = getpeername(remote->fd, (struct sockaddr *)&addr, &len);
         if (r == 0) {
             remote_send_ctx->connected = 1;
+            trace_mark(EV_A_ & server->trace.connected);
             ev_timer_stop(EV_A_ & remote_send_ctx->watcher);
             ev_io_start(EV_A_ & remote->recv_ctx->io);
 
@@ -1259,6 +1314,7 @@ new_server(int fd)
 
     ev_timer_init(&server->delayed_connect_watcher,
                   delayed_connect_cb, 0.05, 0);
+    frame_init(&server->frame, frame_cb);
 
     cork_dllist_add(&connections, &server->entries);
 
@@ -1298,33 +1354,24 @@ static void
 close_and_free_server(EV_P_ server_t *server)
 {
     if (server != NULL) {
+        trace_end(EV_A_ & server->trace);
         ev_io_stop(EV_A_ & server->send_ctx->io);
         ev_io_stop(EV_A_ & server->recv_ctx->io);
         ev_timer_stop(EV_A_ & server->delayed_connect_watcher);
+        frame_stop(EV_A_ & server->frame);
         close(server->fd);
         free_server(server);
     }
 }
 
-static remote_t *
-create_remote(listen_ctx_t *listener,
-              struct sockaddr *addr,
-              int direct)
+static int
+create_remote_socket(listen_ctx_t *listener, struct sockaddr *remote_addr)
 {
-    struct sockaddr *remote_addr;
-
-    int index = rand() % listener->remote_num;
-    if (addr == NULL) {
-        remote_addr = listener->remote_addr[index];
-    } else {
-        remote_addr = addr;
-    }
-
     int remotefd = socket(remote_addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
 
     if (remotefd == -1) {
         ERROR("socket");
-        return NULL;
+        return -1;
     }
 
     int opt = 1;
@@ -1361,6 +1408,28 @@ create_remote(listen_ctx_t *listener,
     }
 #endif
 
+    return remotefd;
+}
+
+static remote_t *
+create_remote(listen_ctx_t *listener,
+              struct sockaddr *addr,
+              int direct)
+{
+    struct sockaddr *remote_addr;
+
+    int index = rand() % listener->remote_num;
+    if (addr == NULL) {
+        remote_addr = listener->remote_addr[index];
+    } else {
+        remote_addr = addr;
+    }
+
+    int remotefd = create_remote_socket(listener, remote_addr);
+    if (remotefd == -1) {
+        return NULL;
+    }
+
     remote_t *remote = new_remote(remotefd, direct ? MAX_CONNECT_TIMEOUT : listener->timeout);
     remote->addr_len = get_sockaddr_len(remote_addr);
     memcpy(&(remote->addr), remote_addr, remote->addr_len);
@@ -1374,12 +1443,30 @@ create_remote(listen_ctx_t *listener,
     return remote;
 }
 
+/*
+ * Creates the sockets of the mux pool, which connects them itself.
+ */
+static int
+mux_socket(void *data, struct sockaddr *addr)
+{
+    return create_remote_socket((listen_ctx_t *)data, addr);
+}
+
 static void
 signal_cb(EV_P_ ev_signal *w, int revents)
 {
     if (revents & EV_SIGNAL) {
         switch (w->signum) {
 #ifndef __MINGW32__
+        case SIGHUP:
+            if (acl) {
+                LOGI("reloading acl...");
+                reload_acl();
+            }
+            return;
+        case SIGUSR2:
+            trace_dump();
+            return;
         case SIGCHLD:
             if (!is_plugin_running()) {
                 LOGE("plugin service exit unexpectedly");
@@ -1394,7 +1481,9 @@ signal_cb(EV_P_ ev_signal *w, int revents)
             ev_signal_stop(EV_DEFAULT, &sigterm_watcher);
 #ifndef __MINGW32__
             ev_signal_stop(EV_DEFAULT, &sigchld_watcher);
+            ev_signal_stop(EV_DEFAULT, &sighup_watcher);
             ev_signal_stop(EV_DEFAULT, &sigusr1_watcher);
+            ev_signal_stop(EV_DEFAULT, &sigusr2_watcher);
 #else
 #ifndef LIB_ONLY
             ev_io_stop(EV_DEFAULT, &plugin_watcher.io);
@@ -1444,6 +1533,7 @@ accept_cb(EV_P_ ev_io *w, int revents)
 
     server_t *server = new_server(serverfd);
     server->listener = listener;
+    trace_start(EV_A_ & server->trace);
 
     ev_io_start(EV_A_ & server->recv_ctx->io);
 }
@@ -1456,6 +1546,8 @@ main(int argc, char **argv)
     int pid_flags    = 0;
     int mtu          = 0;
     int mptcp        = 0;
+    int mux_conns    = 0;
+    char *trace_file = NULL;
     char *user       = NULL;
     char *local_port = NULL;
     char *local_addr = NULL;
@@ -1484,6 +1576,8 @@ main(int argc, char **argv)
         { "reuse-port",  no_argument,       NULL, GETOPT_VAL_REUSE_PORT  },
         { "fast-open",   no_argument,       NULL, GETOPT_VAL_FAST_OPEN   },
         { "no-delay",    no_argument,       NULL, GETOPT_VAL_NODELAY     },
+        { "mux",         required_argument, NULL, GETOPT_VAL_MUX         },
+        { "trace",       required_argument, NULL, GETOPT_VAL_TRACE       },
         { "acl",         required_argument, NULL, GETOPT_VAL_ACL         },
         { "mtu",         required_argument, NULL, GETOPT_VAL_MTU         },
         { "mptcp",       no_argument,       NULL, GETOPT_VAL_MPTCP       },
@@ -1526,6 +1620,12 @@ main(int argc, char **argv)
             no_delay = 1;
             LOGI("enable TCP no-delay");
             break;
+        case GETOPT_VAL_MUX:
+            mux_conns = atoi(optarg);
+            break;
+        case GETOPT_VAL_TRACE:
+            trace_file = optarg;
+            break;
         case GETOPT_VAL_PLUGIN:
             plugin = optarg;
             break;
@@ -1683,6 +1783,12 @@ main(int argc, char **argv)
         if (no_delay == 0) {
             no_delay = conf->no_delay;
         }
+        if (mux_conns == 0) {
+            mux_conns = conf->mux;
+        }
+        if (trace_file == NULL) {
+            trace_file = conf->trace;
+        }
 #ifdef HAVE_SETRLIMIT
         if (nofile == 0) {
             nofile = conf->nofile;
@@ -1892,6 +1998,13 @@ main(int argc, char **argv)
     listen_ctx.iface   = iface;
     listen_ctx.mptcp   = mptcp;
 
+    if (mux_conns > 0 && mode != UDP_ONLY) {
+        LOGI("multiplex streams over %d connections", mux_conns);
+        mux = mux_pool_new(crypto, mux_conns, listen_ctx.timeout,
+                           listen_ctx.remote_addr, listen_ctx.remote_num,
+                           mux_socket, &listen_ctx);
+    }
+
     // Setup signal handler
     ev_signal_init(&sigint_watcher, signal_cb, SIGINT);
     ev_signal_init(&sigterm_watcher, signal_cb, SIGTERM);
@@ -1900,8 +2013,17 @@ main(int argc, char **argv)
 #ifndef __MINGW32__
     ev_signal_init(&sigchld_watcher, signal_cb, SIGCHLD);
     ev_signal_start(EV_DEFAULT, &sigchld_watcher);
+    ev_signal_init(&sighup_watcher, signal_cb, SIGHUP);
+    ev_signal_start(EV_DEFAULT, &sighup_watcher);
+    ev_signal_init(&sigusr2_watcher, signal_cb, SIGUSR2);
+    ev_signal_start(EV_DEFAULT, &sigusr2_watcher);
 #endif
 
+    if (trace_file != NULL) {
+        LOGI("tracing connections to %s", trace_file);
+        trace_init(trace_file);
+    }
+
     if (ss_is_ipv6addr(local_addr))
         LOGI("listening at [%s]:%s", local_addr, local_port);
     else
@@ -1973,6 +2095,8 @@ main(int argc, char **argv)
         LOGI("closed gracefully");
     }
 
+    trace_dump();
+
     // Clean up
     if (plugin != NULL) {
         stop_plugin();
@@ -1981,6 +2105,9 @@ main(int argc, char **argv)
     if (mode != UDP_ONLY) {
         ev_io_stop(loop, &listen_ctx.io);
         free_connections(loop);
+        if (mux != NULL) {
+            mux_pool_free(loop, mux);
+        }
 
         for (i = 0; i < listen_ctx.remote_num; i++)
             ss_free(listen_ctx.remote_addr[i]);
@@ -38,6 +38,8 @@
 #include "crypto.h"
 #include "jconf.h"
 #include "protocol.h"
+#include "frame.h"
+#include "trace.h"
 
 #include "common.h"
 
@@ -71,8 +73,14 @@ typedef struct server {
     buffer_t *buf;
     buffer_t *abuf;
 
+    sniff_t sniff;
+    ev_tstamp sniff_deadline;
+
     ev_timer delayed_connect_watcher;
 
+    frame_t frame;
+    trace_t trace;
+
     struct cork_dllist_item entries;
 } server_t;
 
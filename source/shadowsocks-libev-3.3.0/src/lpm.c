@@ -0,0 +1,131 @@
+/*
+ * lpm.c - Flat prefix table used by the ACL
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "lpm.h"
+#include "utils.h"
+
+#define LPM_ROOT_SIZE  (1U << LPM_ROOT_BITS)
+#define LPM_GROUP_SIZE 256U
+#define LPM_ROOT       ((uint32_t)-1)
+
+void
+lpm_init(lpm_t *lpm)
+{
+    memset(lpm, 0, sizeof(lpm_t));
+    lpm->root = ss_malloc(LPM_ROOT_SIZE * sizeof(uint32_t));
+    memset(lpm->root, 0, LPM_ROOT_SIZE * sizeof(uint32_t));
+}
+
+void
+lpm_free(lpm_t *lpm)
+{
+    ss_free(lpm->root);
+    ss_free(lpm->groups);
+    lpm->ngroups = lpm->cap = 0;
+}
+
+static inline uint32_t *
+lpm_entry(lpm_t *lpm, uint32_t group, uint32_t pos)
+{
+    if (group == LPM_ROOT)
+        return &lpm->root[pos];
+    return &lpm->groups[group * LPM_GROUP_SIZE + pos];
+}
+
+/*
+ * Push a leaf one level down: the new group starts out with the flags the
+ * entry it replaces already carried.
+ */
+static uint32_t
+lpm_new_group(lpm_t *lpm, uint32_t leaf)
+{
+    if (lpm->ngroups == lpm->cap) {
+        lpm->cap    = lpm->cap ? lpm->cap * 2 : 64;
+        lpm->groups = ss_realloc(lpm->groups,
+                                 (size_t)lpm->cap * LPM_GROUP_SIZE * sizeof(uint32_t));
+    }
+
+    uint32_t *g = &lpm->groups[lpm->ngroups * LPM_GROUP_SIZE];
+    for (uint32_t i = 0; i < LPM_GROUP_SIZE; i++)
+        g[i] = leaf;
+
+    return lpm->ngroups++;
+}
+
+static void
+lpm_mark(lpm_t *lpm, uint32_t *e, uint32_t flags)
+{
+    if (*e & LPM_CHILD) {
+        uint32_t *g = &lpm->groups[(*e & ~LPM_CHILD) * LPM_GROUP_SIZE];
+        for (uint32_t i = 0; i < LPM_GROUP_SIZE; i++)
+            lpm_mark(lpm, &g[i], flags);
+    } else {
+        *e |= flags;
+    }
+}
+
+/** Adds flags to every address covered by addr/prefix
+ *
+ *  @param addr
+ *  The network address in network byte order, addr_bits / 8 bytes long
+ *
+ *  @return 0 on success, -1 if the prefix or flags are out of range
+ */
+int
+lpm_insert(lpm_t *lpm, const uint8_t *addr, int addr_bits,
+           int prefix, uint32_t flags)
+{
+    if (prefix < 0 || prefix > addr_bits || addr_bits < LPM_ROOT_BITS
+        || (flags & LPM_CHILD)) {
+        return -1;
+    }
+
+    uint32_t group = LPM_ROOT;
+    uint32_t pos   = (addr[0] << 8) | addr[1];
+    int depth      = LPM_ROOT_BITS;
+
+    for (int i = 2;; i++) {
+        if (prefix <= depth) {
+            uint32_t span = 1U << (depth - prefix);
+            uint32_t base = pos & ~(span - 1);
+            for (uint32_t j = 0; j < span; j++)
+                lpm_mark(lpm, lpm_entry(lpm, group, base + j), flags);
+            return 0;
+        }
+
+        uint32_t e = *lpm_entry(lpm, group, pos);
+        if (!(e & LPM_CHILD)) {
+            e = LPM_CHILD | lpm_new_group(lpm, e);
+            *lpm_entry(lpm, group, pos) = e;
+        }
+
+        group  = e & ~LPM_CHILD;
+        pos    = addr[i];
+        depth += 8;
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * lpm.h - Define the flat prefix table used by the ACL
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LPM_H
+#define _LPM_H
+
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+
+#define LPM_ROOT_BITS 16
+#define LPM_CHILD     0x80000000U
+
+/*
+ * A multibit trie with a 16-bit root stride followed by 8-bit strides.
+ * Every entry either holds the OR of the flags of all prefixes covering
+ * it or, with LPM_CHILD set, the index of a 256-entry group one level
+ * down. Flags are pushed to the leaves, so a lookup is one load per level
+ * and stops at the first plain entry: IPv4 prefixes up to /16 resolve in
+ * the root, up to /24 in two loads.
+ */
+typedef struct lpm {
+    uint32_t *root;
+    uint32_t *groups;
+    uint32_t ngroups;
+    uint32_t cap;
+} lpm_t;
+
+void lpm_init(lpm_t *lpm);
+void lpm_free(lpm_t *lpm);
+int lpm_insert(lpm_t *lpm, const uint8_t *addr, int addr_bits,
+               int prefix, uint32_t flags);
+
+static inline uint32_t
+lpm_lookup(const lpm_t *lpm, const uint8_t *addr)
+{
+    uint32_t e = lpm->root[(addr[0] << 8) | addr[1]];
+    for (int i = 2; e & LPM_CHILD; i++)
+        e = lpm->groups[((e & ~LPM_CHILD) << 8) | addr[i]];
+    return e;
+}
+
+#endif // _LPM_H
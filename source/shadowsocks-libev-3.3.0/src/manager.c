@@ -37,6 +37,7 @@
 #include <math.h>
 #include <ctype.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <dirent.h>
 
 #include <netdb.h>
@@ -56,7 +57,7 @@
 #define SET_INTERFACE
 #endif
 
-#include "json.h"
+#include "jstream.h"
 #include "utils.h"
 #include "netutils.h"
 #include "manager.h"
@@ -94,6 +95,8 @@ destroy_server(struct server *server)
         ss_free(server->plugin_opts);
     if (server->mode)
         ss_free(server->mode);
+    if (server->trace)
+        ss_free(server->trace);
 }
 
 static void
@@ -200,6 +203,11 @@ construct_command_line(struct manager_ctx *manager, struct server *server)
         int len = strlen(cmd);
         snprintf(cmd + len, BUF_SIZE - len, " --mtu %d", manager->mtu);
     }
+    if (manager->trace) {
+        int len = strlen(cmd);
+        snprintf(cmd + len, BUF_SIZE - len, " --trace %s/.shadowsocks_%d.trace",
+                 working_dir, port);
+    }
     if (server->plugin == NULL && manager->plugin) {
         int len = strlen(cmd);
         snprintf(cmd + len, BUF_SIZE - len, " --plugin \"%s\"", manager->plugin);
@@ -240,7 +248,7 @@ get_data(char *buf, int len)
     if (pos == len) {
         return NULL;
     }
-    data = buf + pos - 1;
+    data = buf + pos;
 
     return data;
 }
@@ -269,70 +277,76 @@ static struct server *
 get_server(char *buf, int len)
 {
     char *data = get_data(buf, len);
-    char error_buf[512];
+    jstream_t js;
+    int type;
 
     if (data == NULL) {
         LOGE("No data found");
         return NULL;
     }
 
-    json_settings settings = { 0 };
-    json_value *obj        = json_parse_ex(&settings, data, strlen(data), error_buf);
-
-    if (obj == NULL) {
-        LOGE("%s", error_buf);
-        return NULL;
-    }
-
     struct server *server = ss_malloc(sizeof(struct server));
     memset(server, 0, sizeof(struct server));
-    if (obj->type == json_object) {
-        int i = 0;
-        for (i = 0; i < obj->u.object.length; i++) {
-            char *name        = obj->u.object.values[i].name;
-            json_value *value = obj->u.object.values[i].value;
+
+    jstream_init(&js, data, strlen(data));
+    type = jstream_next(&js);
+    if (type == JSTREAM_OBJECT) {
+        while ((type = jstream_next(&js)) == JSTREAM_KEY) {
+            char name[32];
+            jstream_strcpy(&js, name, sizeof(name));
+            type = jstream_next(&js);
             if (strcmp(name, "server_port") == 0) {
-                if (value->type == json_string) {
-                    strncpy(server->port, value->u.string.ptr, 7);
-                } else if (value->type == json_integer) {
-                    snprintf(server->port, 8, "%" PRIu64 "", value->u.integer);
+                if (type == JSTREAM_STRING) {
+                    jstream_strcpy(&js, server->port, sizeof(server->port));
+                } else if (type == JSTREAM_INTEGER) {
+                    snprintf(server->port, sizeof(server->port), "%" PRId64 "", js.integer);
                 }
             } else if (strcmp(name, "password") == 0) {
-                if (value->type == json_string) {
-                    strncpy(server->password, value->u.string.ptr, 127);
+                if (type == JSTREAM_STRING) {
+                    jstream_strcpy(&js, server->password, sizeof(server->password));
                 }
             } else if (strcmp(name, "method") == 0) {
-                if (value->type == json_string) {
-                    server->method = strdup(value->u.string.ptr);
+                if (type == JSTREAM_STRING) {
+                    server->method = jstream_strdup(&js);
                 }
             } else if (strcmp(name, "fast_open") == 0) {
-                if (value->type == json_boolean) {
-                    strncpy(server->fast_open, (value->u.boolean ? "true" : "false"), 8);
+                if (type == JSTREAM_BOOLEAN) {
+                    strncpy(server->fast_open, (js.boolean ? "true" : "false"), 8);
                 }
             } else if (strcmp(name, "no_delay") == 0) {
-                if (value->type == json_boolean) {
-                    strncpy(server->no_delay, (value->u.boolean ? "true" : "false"), 8);
+                if (type == JSTREAM_BOOLEAN) {
+                    strncpy(server->no_delay, (js.boolean ? "true" : "false"), 8);
                 }
             } else if (strcmp(name, "plugin") == 0) {
-                if (value->type == json_string) {
-                    server->plugin = strdup(value->u.string.ptr);
+                if (type == JSTREAM_STRING) {
+                    server->plugin = jstream_strdup(&js);
                 }
             } else if (strcmp(name, "plugin_opts") == 0) {
-                if (value->type == json_string) {
-                    server->plugin_opts = strdup(value->u.string.ptr);
+                if (type == JSTREAM_STRING) {
+                    server->plugin_opts = jstream_strdup(&js);
                 }
             } else if (strcmp(name, "mode") == 0) {
-                if (value->type == json_string) {
-                    server->mode = strdup(value->u.string.ptr);
+                if (type == JSTREAM_STRING) {
+                    server->mode = jstream_strdup(&js);
                 }
             } else {
                 LOGE("invalid data: %s", data);
                 break;
             }
+            jstream_skip(&js, type);
+        }
+        if (type == JSTREAM_OBJECT_END) {
+            type = jstream_next(&js);
         }
     }
 
-    json_value_free(obj);
+    if (type == JSTREAM_ERROR) {
+        LOGE("%s", js.error);
+        destroy_server(server);
+        ss_free(server);
+        return NULL;
+    }
+
     return server;
 }
 
@@ -340,33 +354,86 @@ static int
 parse_traffic(char *buf, int len, char *port, uint64_t *traffic)
 {
     char *data = get_data(buf, len);
-    char error_buf[512];
-    json_settings settings = { 0 };
+    jstream_t js;
+    int type;
 
     if (data == NULL) {
         LOGE("No data found");
         return -1;
     }
 
-    json_value *obj = json_parse_ex(&settings, data, strlen(data), error_buf);
-    if (obj == NULL) {
-        LOGE("%s", error_buf);
+    jstream_init(&js, data, strlen(data));
+    type = jstream_next(&js);
+    if (type == JSTREAM_OBJECT) {
+        while ((type = jstream_next(&js)) == JSTREAM_KEY) {
+            char name[8];
+            jstream_strcpy(&js, name, sizeof(name));
+            type = jstream_next(&js);
+            if (type == JSTREAM_INTEGER) {
+                memcpy(port, name, sizeof(name));
+                *traffic = js.integer;
+            }
+            jstream_skip(&js, type);
+        }
+        if (type == JSTREAM_OBJECT_END) {
+            type = jstream_next(&js);
+        }
+    }
+
+    if (type == JSTREAM_ERROR) {
+        LOGE("%s", js.error);
         return -1;
     }
 
-    if (obj->type == json_object) {
-        int i = 0;
-        for (i = 0; i < obj->u.object.length; i++) {
-            char *name        = obj->u.object.values[i].name;
-            json_value *value = obj->u.object.values[i].value;
-            if (value->type == json_integer) {
-                strncpy(port, name, 7);
-                *traffic = value->u.integer;
+    return 0;
+}
+
+/*
+ * Parses a "trace: {"<port>":{...}}" report from ss-server. The histograms
+ * are only handed back to clients, so the value is kept as raw JSON.
+ */
+static int
+parse_trace(char *buf, int len, char *port, char **trace)
+{
+    char *data = get_data(buf, len);
+    jstream_t js;
+    int type;
+
+    if (data == NULL) {
+        LOGE("No data found");
+        return -1;
+    }
+
+    jstream_init(&js, data, strlen(data));
+    type = jstream_next(&js);
+    if (type == JSTREAM_OBJECT) {
+        while ((type = jstream_next(&js)) == JSTREAM_KEY) {
+            char name[8];
+            jstream_strcpy(&js, name, sizeof(name));
+            type = jstream_next(&js);
+            if (type == JSTREAM_OBJECT) {
+                const char *start = js.pos - 1;
+                type = jstream_skip(&js, type);
+                if (type == JSTREAM_OBJECT_END) {
+                    memcpy(port, name, sizeof(name));
+                    if (*trace != NULL)
+                        ss_free(*trace);
+                    *trace = ss_strndup(start, js.pos - start);
+                }
+            } else {
+                jstream_skip(&js, type);
             }
         }
+        if (type == JSTREAM_OBJECT_END) {
+            type = jstream_next(&js);
+        }
+    }
+
+    if (type == JSTREAM_ERROR) {
+        LOGE("%s", js.error);
+        return -1;
     }
 
-    json_value_free(obj);
     return 0;
 }
 
@@ -590,6 +657,20 @@ update_stat(char *port, uint64_t traffic)
     }
 }
 
+static void
+update_trace(char *port, char *trace)
+{
+    void *ret = cork_hash_table_get(server_table, (void *)port);
+    if (ret != NULL) {
+        struct server *server = (struct server *)ret;
+        if (server->trace)
+            ss_free(server->trace);
+        server->trace = trace;
+    } else {
+        ss_free(trace);
+    }
+}
+
 static void
 manager_recv_cb(EV_P_ ev_io *w, int revents)
 {
@@ -709,6 +790,58 @@ manager_recv_cb(EV_P_ ev_io *w, int revents)
         }
 
         update_stat(port, traffic);
+    } else if (strcmp(action, "trace") == 0 && get_data(buf, r) != NULL) {
+        char port[8];
+        char *trace = NULL;
+
+        if (parse_trace(buf, r, port, &trace) == -1 || trace == NULL) {
+            LOGE("invalid command: %s:%s", buf, get_data(buf, r));
+            if (trace != NULL)
+                ss_free(trace);
+            return;
+        }
+
+        update_trace(port, trace);
+    } else if (strcmp(action, "trace") == 0) {
+        struct cork_hash_table_entry *entry;
+        struct cork_hash_table_iterator server_iter;
+
+        char buf[BUF_SIZE];
+        size_t pos = 0;
+
+        memset(buf, 0, BUF_SIZE);
+        pos = sprintf(buf, "trace: {");
+
+        cork_hash_table_iterator_init(server_table, &server_iter);
+
+        while ((entry = cork_hash_table_iterator_next(&server_iter)) != NULL) {
+            struct server *server = (struct server *)entry->value;
+            if (server->trace == NULL) {
+                continue;
+            }
+            size_t entry_len = strlen(server->port) + strlen(server->trace) + 4;
+            if (pos > 8 && pos + entry_len + 1 > BUF_SIZE / 2) {
+                buf[pos - 1] = '}';
+                if (sendto(manager->fd, buf, pos, 0, (struct sockaddr *)&claddr, len)
+                    != pos) {
+                    ERROR("trace_sendto");
+                }
+                pos = sprintf(buf, "trace: {");
+            }
+            pos += snprintf(buf + pos, BUF_SIZE - pos, "\"%s\":%s,",
+                            server->port, server->trace);
+        }
+
+        if (pos > 8) {
+            buf[pos - 1] = '}';
+        } else {
+            buf[pos++] = '}';
+        }
+
+        if (sendto(manager->fd, buf, pos, 0, (struct sockaddr *)&claddr, len)
+            != pos) {
+            ERROR("trace_sendto");
+        }
     } else if (strcmp(action, "ping") == 0) {
         struct cork_hash_table_entry *entry;
         struct cork_hash_table_iterator server_iter;
@@ -864,6 +997,7 @@ main(int argc, char **argv)
     char *workdir         = NULL;
 
     int fast_open  = 0;
+    int trace      = 0;
     int no_delay   = 0;
     int reuse_port = 0;
     int mode       = TCP_ONLY;
@@ -895,6 +1029,7 @@ main(int argc, char **argv)
         { "plugin-opts",     required_argument, NULL, GETOPT_VAL_PLUGIN_OPTS },
         { "password",        required_argument, NULL, GETOPT_VAL_PASSWORD    },
         { "workdir",         required_argument, NULL, GETOPT_VAL_WORKDIR     },
+        { "trace",           no_argument,       NULL, GETOPT_VAL_TRACE       },
         { "help",            no_argument,       NULL, GETOPT_VAL_HELP        },
         { NULL,                              0, NULL,                      0 }
     };
@@ -977,6 +1112,9 @@ main(int argc, char **argv)
         case 'D':
             workdir = optarg;
             break;
+        case GETOPT_VAL_TRACE:
+            trace = 1;
+            break;
         case 'v':
             verbose = 1;
             break;
@@ -1057,6 +1195,9 @@ main(int argc, char **argv)
         if (acl == NULL) {
             acl = conf->acl;
         }
+        if (trace == 0) {
+            trace = conf->trace != NULL;
+        }
 #ifdef HAVE_SETRLIMIT
         if (nofile == 0) {
             nofile = conf->nofile;
@@ -1138,6 +1279,7 @@ main(int argc, char **argv)
     manager.plugin_opts     = plugin_opts;
     manager.ipv6first       = ipv6first;
     manager.workdir         = workdir;
+    manager.trace           = trace;
 #ifdef HAVE_SETRLIMIT
     manager.nofile = nofile;
 #endif
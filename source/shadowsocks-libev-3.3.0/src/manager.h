@@ -59,6 +59,7 @@ struct manager_ctx {
     char *nameservers;
     int mtu;
     int ipv6first;
+    int trace;
     char *workdir;
 #ifdef HAVE_SETRLIMIT
     int nofile;
@@ -74,6 +75,7 @@ struct server {
     char *method;
     char *plugin;
     char *plugin_opts;
+    char *trace;            /* latest histograms reported by ss-server */
     uint64_t traffic;
 };
 
@@ -0,0 +1,945 @@
+/*
+ * mux.c - Multiplex many TCP streams over few encrypted connections
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef __MINGW32__
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#endif
+
+#include <libcork/core.h>
+#include <libcork/ds.h>
+
+#include "mux.h"
+#include "netutils.h"
+#include "utils.h"
+#include "winsock.h"
+
+#ifndef EAGAIN
+#define EAGAIN EWOULDBLOCK
+#endif
+
+#ifndef EWOULDBLOCK
+#define EWOULDBLOCK EAGAIN
+#endif
+
+#define MUX_WINDOW_SIZE   (256 * 1024)          /* Initial send credit of a stream   */
+#define MUX_CREDIT_BATCH  (MUX_WINDOW_SIZE / 4) /* Written bytes before a WINDOW     */
+#define MUX_HIGH_WATER    (64 * 1024)           /* Pending ciphertext pausing reads  */
+#define MUX_WBUF_MAX      (16 * MUX_HIGH_WATER) /* Pending ciphertext closing a conn */
+#define MUX_FRAME_MAX     (SOCKET_BUF_SIZE - MUX_HEADER_LEN)
+
+#define MUX_CONNECTING    0x01 /* fd attached, connect() not finished */
+#define MUX_LOCAL_CLOSED  0x02 /* CLOSE sent, fd gone                 */
+#define MUX_REMOTE_CLOSED 0x04 /* CLOSE received                      */
+#define MUX_BLOCKED       0x08 /* reads paused on connection backlog  */
+
+#ifdef MODULE_REMOTE
+extern uint64_t tx;
+extern uint64_t rx;
+#endif
+
+extern int verbose;
+
+typedef struct mux_conn {
+    ev_io recv_io;
+    ev_io send_io;
+    ev_timer watcher;
+
+    int fd;
+    int slot;                   /* index in the pool, -1 on the server */
+    int connecting;
+    int broken;                 /* closed on the next write event */
+    int nstreams;
+    uint16_t next_id;
+
+    crypto_t *crypto;
+    cipher_ctx_t *e_ctx;
+    cipher_ctx_t *d_ctx;
+
+    buffer_t *rbuf;             /* plaintext waiting for a complete frame */
+    buffer_t *wbuf;             /* ciphertext waiting for the socket */
+    buffer_t *frame;            /* frame being built, encrypted in place */
+    buffer_t *tmp;              /* ciphertext being decrypted */
+
+    mux_stream_t **streams;
+    struct cork_dllist blocked;
+
+    struct mux_pool *pool;
+    mux_open_cb open_cb;
+    void (*release_cb)(void *);
+    void *data;
+} mux_conn_t;
+
+struct mux_stream {
+    ev_io recv_io;
+    ev_io send_io;
+
+    int fd;
+    int flags;
+    uint16_t id;
+    int32_t window;             /* bytes we may still send to the peer */
+    uint32_t consumed;          /* bytes written to fd, not yet credited */
+
+    buffer_t *buf;              /* peer data waiting for fd */
+    mux_conn_t *conn;
+    void *data;
+
+    struct cork_dllist_item entries;
+};
+
+struct mux_pool {
+    crypto_t *crypto;
+    int size;
+    int timeout;
+    int remote_num;
+    struct sockaddr **remote_addr;
+    int (*socket_cb)(void *data, struct sockaddr *addr);
+    void *data;
+    mux_conn_t **conns;
+};
+
+static void conn_recv_cb(EV_P_ ev_io *w, int revents);
+static void conn_send_cb(EV_P_ ev_io *w, int revents);
+static void conn_timeout_cb(EV_P_ ev_timer *watcher, int revents);
+static void stream_recv_cb(EV_P_ ev_io *w, int revents);
+static void stream_send_cb(EV_P_ ev_io *w, int revents);
+static void stream_shutdown(EV_P_ mux_stream_t *stream);
+
+static mux_conn_t *
+new_conn(crypto_t *crypto, int fd, ev_tstamp timeout)
+{
+    mux_conn_t *conn = ss_malloc(sizeof(mux_conn_t));
+    memset(conn, 0, sizeof(mux_conn_t));
+
+    conn->fd     = fd;
+    conn->slot   = -1;
+    conn->crypto = crypto;
+
+    conn->rbuf  = ss_malloc(sizeof(buffer_t));
+    conn->wbuf  = ss_malloc(sizeof(buffer_t));
+    conn->frame = ss_malloc(sizeof(buffer_t));
+    conn->tmp   = ss_malloc(sizeof(buffer_t));
+    balloc(conn->rbuf, SOCKET_BUF_SIZE);
+    balloc(conn->wbuf, SOCKET_BUF_SIZE);
+    balloc(conn->frame, SOCKET_BUF_SIZE);
+    balloc(conn->tmp, SOCKET_BUF_SIZE);
+
+    conn->streams = ss_malloc(MUX_MAX_STREAMS * sizeof(mux_stream_t *));
+    memset(conn->streams, 0, MUX_MAX_STREAMS * sizeof(mux_stream_t *));
+    cork_dllist_init(&conn->blocked);
+
+    ev_io_init(&conn->recv_io, conn_recv_cb, fd, EV_READ);
+    ev_io_init(&conn->send_io, conn_send_cb, fd, EV_WRITE);
+    ev_timer_init(&conn->watcher, conn_timeout_cb, timeout, timeout);
+
+    return conn;
+}
+
+static mux_stream_t *
+new_stream(mux_conn_t *conn, uint16_t id, int fd)
+{
+    mux_stream_t *stream = ss_malloc(sizeof(mux_stream_t));
+    memset(stream, 0, sizeof(mux_stream_t));
+
+    stream->fd     = fd;
+    stream->id     = id;
+    stream->window = MUX_WINDOW_SIZE;
+    stream->conn   = conn;
+    stream->buf    = ss_malloc(sizeof(buffer_t));
+    balloc(stream->buf, SOCKET_BUF_SIZE);
+
+    ev_io_init(&stream->recv_io, stream_recv_cb, fd, EV_READ);
+    ev_io_init(&stream->send_io, stream_send_cb, fd, EV_WRITE);
+
+    conn->streams[id] = stream;
+    conn->nstreams++;
+
+    return stream;
+}
+
+static void
+free_stream(mux_stream_t *stream)
+{
+    mux_conn_t *conn = stream->conn;
+
+    conn->streams[stream->id] = NULL;
+    conn->nstreams--;
+
+    bfree(stream->buf);
+    ss_free(stream->buf);
+    ss_free(stream);
+}
+
+/*
+ * Release everything bound to the local end of a stream. The stream itself
+ * stays in the table until the peer has closed it as well.
+ */
+static void
+stream_detach(EV_P_ mux_stream_t *stream)
+{
+    mux_conn_t *conn = stream->conn;
+
+    if (stream->flags & MUX_BLOCKED) {
+        cork_dllist_remove(&stream->entries);
+        stream->flags &= ~MUX_BLOCKED;
+    }
+    if (stream->fd != -1) {
+        ev_io_stop(EV_A_ & stream->recv_io);
+        ev_io_stop(EV_A_ & stream->send_io);
+        close(stream->fd);
+        stream->fd = -1;
+    }
+    if (stream->data != NULL && conn->release_cb != NULL) {
+        conn->release_cb(stream->data);
+    }
+    stream->data     = NULL;
+    stream->buf->len = 0;
+    stream->buf->idx = 0;
+}
+
+static void
+conn_close(EV_P_ mux_conn_t *conn)
+{
+    for (int i = 0; i < MUX_MAX_STREAMS && conn->nstreams > 0; i++) {
+        mux_stream_t *stream = conn->streams[i];
+        if (stream != NULL) {
+            stream_detach(EV_A_ stream);
+            free_stream(stream);
+        }
+    }
+
+    if (conn->pool != NULL) {
+        conn->pool->conns[conn->slot] = NULL;
+    }
+
+    ev_io_stop(EV_A_ & conn->recv_io);
+    ev_io_stop(EV_A_ & conn->send_io);
+    ev_timer_stop(EV_A_ & conn->watcher);
+    close(conn->fd);
+
+    if (conn->e_ctx != NULL) {
+        conn->crypto->ctx_release(conn->e_ctx);
+        ss_free(conn->e_ctx);
+    }
+    if (conn->d_ctx != NULL) {
+        conn->crypto->ctx_release(conn->d_ctx);
+        ss_free(conn->d_ctx);
+    }
+
+    bfree(conn->rbuf);
+    bfree(conn->wbuf);
+    bfree(conn->frame);
+    bfree(conn->tmp);
+    ss_free(conn->rbuf);
+    ss_free(conn->wbuf);
+    ss_free(conn->frame);
+    ss_free(conn->tmp);
+    ss_free(conn->streams);
+    ss_free(conn);
+}
+
+/*
+ * Encrypt the plaintext in buf and queue it. Errors only mark the
+ * connection, it is torn down from its own write callback so that no
+ * caller ever sees it disappear. Stream data stops at MUX_HIGH_WATER,
+ * but control frames do not, so a peer that never reads gets its
+ * connection closed once MUX_WBUF_MAX is queued.
+ */
+static void
+conn_write(EV_P_ mux_conn_t *conn, buffer_t *buf)
+{
+    buffer_t *wbuf = conn->wbuf;
+
+    if (!conn->broken) {
+        if (conn->crypto->encrypt(buf, conn->e_ctx, SOCKET_BUF_SIZE)) {
+            LOGE("mux: invalid password or cipher");
+            conn->broken = 1;
+        } else if (wbuf->len + buf->len > MUX_WBUF_MAX) {
+            LOGE("mux: peer not reading, closing connection");
+            conn->broken = 1;
+        } else {
+            if (wbuf->idx + wbuf->len + buf->len > wbuf->capacity) {
+                memmove(wbuf->data, wbuf->data + wbuf->idx, wbuf->len);
+                wbuf->idx = 0;
+            }
+            brealloc(wbuf, wbuf->len + buf->len, SOCKET_BUF_SIZE);
+            memcpy(wbuf->data + wbuf->idx + wbuf->len, buf->data, buf->len);
+            wbuf->len += buf->len;
+        }
+    }
+
+    ev_io_start(EV_A_ & conn->send_io);
+}
+
+static char *
+frame_begin(mux_conn_t *conn, int type, uint16_t id)
+{
+    char *data = conn->frame->data;
+
+    data[0] = type;
+    data[1] = id >> 8;
+    data[2] = id & 0xFF;
+
+    return data + MUX_HEADER_LEN;
+}
+
+static void
+frame_end(EV_P_ mux_conn_t *conn, size_t len)
+{
+    buffer_t *frame = conn->frame;
+
+    frame->data[3] = len >> 8;
+    frame->data[4] = len & 0xFF;
+    frame->len     = MUX_HEADER_LEN + len;
+    frame->idx     = 0;
+
+    conn_write(EV_A_ conn, frame);
+}
+
+static void
+send_ctrl(EV_P_ mux_conn_t *conn, int type, uint16_t id, uint32_t credit)
+{
+    char *payload = frame_begin(conn, type, id);
+    size_t len    = 0;
+
+    if (type == MUX_WINDOW) {
+        credit = htonl(credit);
+        memcpy(payload, &credit, sizeof(credit));
+        len = sizeof(credit);
+    }
+
+    frame_end(EV_A_ conn, len);
+}
+
+static void
+stream_resume(EV_P_ mux_stream_t *stream)
+{
+    if (stream->fd == -1 || stream->window <= 0
+        || (stream->flags & (MUX_CONNECTING | MUX_LOCAL_CLOSED
+                             | MUX_REMOTE_CLOSED | MUX_BLOCKED))) {
+        return;
+    }
+    ev_io_start(EV_A_ & stream->recv_io);
+}
+
+static void
+stream_consumed(EV_P_ mux_stream_t *stream, size_t len)
+{
+    stream->consumed += len;
+    if (stream->consumed >= MUX_CREDIT_BATCH) {
+        send_ctrl(EV_A_ stream->conn, MUX_WINDOW, stream->id, stream->consumed);
+        stream->consumed = 0;
+    }
+}
+
+static void
+stream_shutdown(EV_P_ mux_stream_t *stream)
+{
+    stream_detach(EV_A_ stream);
+
+    if (!(stream->flags & MUX_LOCAL_CLOSED)) {
+        stream->flags |= MUX_LOCAL_CLOSED;
+        send_ctrl(EV_A_ stream->conn, MUX_CLOSE, stream->id, 0);
+    }
+    if (stream->flags & MUX_REMOTE_CLOSED) {
+        free_stream(stream);
+    }
+}
+
+static int
+stream_write(EV_P_ mux_stream_t *stream, const char *data, size_t len)
+{
+    buffer_t *buf = stream->buf;
+
+    // the peer may never have more in flight than the window it was given
+    if (buf->len + stream->consumed + len > MUX_WINDOW_SIZE) {
+        return -1;
+    }
+
+    if (buf->len == 0 && stream->fd != -1
+        && !(stream->flags & MUX_CONNECTING)) {
+        ssize_t s = send(stream->fd, data, len, 0);
+        if (s == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                if (verbose) {
+                    ERROR("mux stream send");
+                }
+                stream_shutdown(EV_A_ stream);
+                return 0;
+            }
+            s = 0;
+        }
+        stream_consumed(EV_A_ stream, s);
+        data += s;
+        len  -= s;
+        if (len == 0) {
+            return 0;
+        }
+    }
+
+    if (buf->idx + buf->len + len > buf->capacity) {
+        memmove(buf->data, buf->data + buf->idx, buf->len);
+        buf->idx = 0;
+    }
+    brealloc(buf, buf->len + len, SOCKET_BUF_SIZE);
+    memcpy(buf->data + buf->idx + buf->len, data, len);
+    buf->len += len;
+
+    if (stream->fd != -1) {
+        ev_io_start(EV_A_ & stream->send_io);
+    }
+
+    return 0;
+}
+
+static int
+conn_frame(EV_P_ mux_conn_t *conn, int type, uint16_t id,
+           const char *payload, size_t len)
+{
+    if (id >= MUX_MAX_STREAMS) {
+        return -1;
+    }
+
+    mux_stream_t *stream = conn->streams[id];
+
+    switch (type) {
+    case MUX_OPEN:
+        if (conn->pool != NULL || stream != NULL || len == 0) {
+            return -1;
+        }
+        stream = new_stream(conn, id, -1);
+        conn->open_cb(EV_A_ stream, conn->data, payload, len);
+        return 0;
+    case MUX_DATA:
+        if (stream == NULL || (stream->flags & MUX_REMOTE_CLOSED)) {
+            return -1;
+        }
+        if (stream->flags & MUX_LOCAL_CLOSED) {
+            return 0;
+        }
+        return stream_write(EV_A_ stream, payload, len);
+    case MUX_CLOSE:
+        if (stream == NULL || (stream->flags & MUX_REMOTE_CLOSED)) {
+            return -1;
+        }
+        stream->flags |= MUX_REMOTE_CLOSED;
+        if (stream->flags & MUX_LOCAL_CLOSED) {
+            free_stream(stream);
+        } else if (stream->buf->len == 0) {
+            stream_shutdown(EV_A_ stream);
+        } else if (stream->fd != -1) {
+            // flush what is left, stream_send_cb finishes the close
+            ev_io_stop(EV_A_ & stream->recv_io);
+        }
+        return 0;
+    case MUX_WINDOW:
+    {
+        uint32_t credit;
+        if (stream == NULL || len != sizeof(credit)) {
+            return -1;
+        }
+        memcpy(&credit, payload, sizeof(credit));
+        credit = ntohl(credit);
+        if (credit > MUX_WINDOW_SIZE
+            || stream->window + (int32_t)credit > MUX_WINDOW_SIZE) {
+            return -1;
+        }
+        stream->window += credit;
+        stream_resume(EV_A_ stream);
+        return 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+static int
+conn_parse(EV_P_ mux_conn_t *conn)
+{
+    buffer_t *rbuf = conn->rbuf;
+    size_t offset  = 0;
+
+    while (rbuf->len - offset >= MUX_HEADER_LEN) {
+        uint8_t *frame = (uint8_t *)rbuf->data + offset;
+        uint16_t id    = (frame[1] << 8) | frame[2];
+        size_t len     = (frame[3] << 8) | frame[4];
+
+        if (len > MUX_FRAME_MAX) {
+            return -1;
+        }
+        if (rbuf->len - offset < MUX_HEADER_LEN + len) {
+            break;
+        }
+        if (conn_frame(EV_A_ conn, frame[0], id,
+                       (char *)frame + MUX_HEADER_LEN, len) == -1) {
+            return -1;
+        }
+        offset += MUX_HEADER_LEN + len;
+    }
+
+    rbuf->len -= offset;
+    memmove(rbuf->data, rbuf->data + offset, rbuf->len);
+
+    return 0;
+}
+
+static void
+conn_recv_cb(EV_P_ ev_io *w, int revents)
+{
+    mux_conn_t *conn = cork_container_of(w, mux_conn_t, recv_io);
+    buffer_t *tmp    = conn->tmp;
+    buffer_t *rbuf   = conn->rbuf;
+
+    ssize_t r = recv(conn->fd, tmp->data, SOCKET_BUF_SIZE, 0);
+
+    if (r == 0) {
+        if (verbose) {
+            LOGI("mux: connection closed");
+        }
+        conn_close(EV_A_ conn);
+        return;
+    } else if (r == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        ERROR("mux recv");
+        conn_close(EV_A_ conn);
+        return;
+    }
+
+#ifdef MODULE_REMOTE
+    tx += r;
+#endif
+    ev_timer_again(EV_A_ & conn->watcher);
+
+    tmp->len = r;
+    tmp->idx = 0;
+    int err = conn->crypto->decrypt(tmp, conn->d_ctx, SOCKET_BUF_SIZE);
+    if (err == CRYPTO_ERROR) {
+        LOGE("mux: authentication error");
+        conn_close(EV_A_ conn);
+        return;
+    } else if (err == CRYPTO_NEED_MORE) {
+        return;
+    }
+
+    brealloc(rbuf, rbuf->len + tmp->len, SOCKET_BUF_SIZE);
+    memcpy(rbuf->data + rbuf->len, tmp->data, tmp->len);
+    rbuf->len += tmp->len;
+
+    if (conn_parse(EV_A_ conn) == -1) {
+        LOGE("mux: protocol error");
+        conn_close(EV_A_ conn);
+    }
+}
+
+static void
+conn_send_cb(EV_P_ ev_io *w, int revents)
+{
+    mux_conn_t *conn = cork_container_of(w, mux_conn_t, send_io);
+    buffer_t *wbuf   = conn->wbuf;
+
+    if (conn->broken) {
+        conn_close(EV_A_ conn);
+        return;
+    }
+
+    if (conn->connecting) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(struct sockaddr_storage);
+        if (getpeername(conn->fd, (struct sockaddr *)&addr, &len) != 0) {
+            ERROR("mux connect");
+            conn_close(EV_A_ conn);
+            return;
+        }
+        conn->connecting = 0;
+        ev_io_start(EV_A_ & conn->recv_io);
+    }
+
+    if (wbuf->len > 0) {
+        ssize_t s = send(conn->fd, wbuf->data + wbuf->idx, wbuf->len, 0);
+        if (s == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ERROR("mux send");
+                conn_close(EV_A_ conn);
+            }
+            return;
+        }
+        wbuf->idx += s;
+        wbuf->len -= s;
+        ev_timer_again(EV_A_ & conn->watcher);
+    }
+
+    if (wbuf->len == 0) {
+        wbuf->idx = 0;
+        ev_io_stop(EV_A_ & conn->send_io);
+    }
+
+    if (wbuf->len <= MUX_HIGH_WATER / 2) {
+        struct cork_dllist_item *item;
+        while ((item = cork_dllist_head(&conn->blocked)) != NULL) {
+            mux_stream_t *stream = cork_container_of(item, mux_stream_t, entries);
+            cork_dllist_remove(item);
+            stream->flags &= ~MUX_BLOCKED;
+            stream_resume(EV_A_ stream);
+        }
+    }
+}
+
+static void
+conn_timeout_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    mux_conn_t *conn = cork_container_of(watcher, mux_conn_t, watcher);
+
+    // the client only gives up connections nobody is using
+    if (conn->pool != NULL && conn->nstreams > 0) {
+        return;
+    }
+
+    if (verbose) {
+        LOGI("mux: connection timeout");
+    }
+
+    conn_close(EV_A_ conn);
+}
+
+static void
+stream_recv_cb(EV_P_ ev_io *w, int revents)
+{
+    mux_stream_t *stream = cork_container_of(w, mux_stream_t, recv_io);
+    mux_conn_t *conn     = stream->conn;
+
+    if (conn->wbuf->len >= MUX_HIGH_WATER) {
+        ev_io_stop(EV_A_ & stream->recv_io);
+        stream->flags |= MUX_BLOCKED;
+        cork_dllist_add(&conn->blocked, &stream->entries);
+        return;
+    }
+
+    if (stream->window <= 0) {
+        ev_io_stop(EV_A_ & stream->recv_io);
+        return;
+    }
+
+    char *payload = frame_begin(conn, MUX_DATA, stream->id);
+    ssize_t r     = recv(stream->fd, payload, min(MUX_FRAME_MAX, stream->window), 0);
+
+    if (r == 0) {
+        stream_shutdown(EV_A_ stream);
+        return;
+    } else if (r == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        if (verbose) {
+            ERROR("mux stream recv");
+        }
+        stream_shutdown(EV_A_ stream);
+        return;
+    }
+
+#ifdef MODULE_REMOTE
+    rx += r;
+#endif
+    stream->window -= r;
+    frame_end(EV_A_ conn, r);
+}
+
+static void
+stream_send_cb(EV_P_ ev_io *w, int revents)
+{
+    mux_stream_t *stream = cork_container_of(w, mux_stream_t, send_io);
+    buffer_t *buf        = stream->buf;
+
+    if (stream->flags & MUX_CONNECTING) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(struct sockaddr_storage);
+        if (getpeername(stream->fd, (struct sockaddr *)&addr, &len) != 0) {
+            if (verbose) {
+                ERROR("mux stream connect");
+            }
+            stream_shutdown(EV_A_ stream);
+            return;
+        }
+        stream->flags &= ~MUX_CONNECTING;
+        stream_resume(EV_A_ stream);
+    }
+
+    if (buf->len > 0) {
+        ssize_t s = send(stream->fd, buf->data + buf->idx, buf->len, 0);
+        if (s == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                if (verbose) {
+                    ERROR("mux stream send");
+                }
+                stream_shutdown(EV_A_ stream);
+            }
+            return;
+        }
+        buf->idx += s;
+        buf->len -= s;
+        stream_consumed(EV_A_ stream, s);
+    }
+
+    if (buf->len == 0) {
+        buf->idx = 0;
+        ev_io_stop(EV_A_ & stream->send_io);
+        if (stream->flags & MUX_REMOTE_CLOSED) {
+            stream_shutdown(EV_A_ stream);
+        }
+    }
+}
+
+static mux_conn_t *
+pool_connect(EV_P_ mux_pool_t *pool, int slot)
+{
+    struct sockaddr *addr = pool->remote_addr[rand() % pool->remote_num];
+
+    int fd = pool->socket_cb(pool->data, addr);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    // the connection waits for the connect to finish itself
+    int r = connect(fd, addr, get_sockaddr_len(addr));
+    if (r == -1 && errno != CONNECT_IN_PROGRESS) {
+        ERROR("mux connect");
+        close(fd);
+        return NULL;
+    }
+
+    // idle connections are dropped well before the server would drop them
+    mux_conn_t *conn = new_conn(pool->crypto, fd, pool->timeout / 2.0);
+    conn->pool       = pool;
+    conn->slot       = slot;
+    conn->connecting = 1;
+
+    conn->e_ctx = ss_malloc(sizeof(cipher_ctx_t));
+    conn->d_ctx = ss_malloc(sizeof(cipher_ctx_t));
+    pool->crypto->ctx_init(pool->crypto->cipher, conn->e_ctx, 1);
+    pool->crypto->ctx_init(pool->crypto->cipher, conn->d_ctx, 0);
+
+    buffer_t *frame = conn->frame;
+    frame->data[0] = MUX_ATYP;
+    frame->data[1] = MUX_VERSION;
+    frame->len     = 2;
+    frame->idx     = 0;
+    conn_write(EV_A_ conn, frame);
+
+    ev_timer_start(EV_A_ & conn->watcher);
+
+    if (verbose) {
+        LOGI("mux: new connection %d", slot);
+    }
+
+    return conn;
+}
+
+/*
+ * Spread streams over the pool, opening another connection only while
+ * every open one is already carrying at least as many streams.
+ */
+static mux_conn_t *
+pool_pick(EV_P_ mux_pool_t *pool)
+{
+    int best = -1;
+    int load = MUX_MAX_STREAMS;
+
+    for (int i = 0; i < pool->size; i++) {
+        mux_conn_t *conn = pool->conns[i];
+        if (conn != NULL && conn->broken) {
+            continue;
+        }
+        int n = conn != NULL ? conn->nstreams : 0;
+        if (n < load
+            || (n == load && conn != NULL && best != -1 && pool->conns[best] == NULL)) {
+            best = i;
+            load = n;
+        }
+    }
+
+    if (best == -1) {
+        return NULL;
+    }
+    if (pool->conns[best] == NULL) {
+        pool->conns[best] = pool_connect(EV_A_ pool, best);
+    }
+
+    return pool->conns[best];
+}
+
+/** Creates a pool of up to size connections to the servers
+ *
+ *  @param socket_cb
+ *  Creates a non-blocking socket set up for addr, with data passed back
+ */
+mux_pool_t *
+mux_pool_new(crypto_t *crypto, int size, int timeout,
+             struct sockaddr **remote_addr, int remote_num,
+             int (*socket_cb)(void *data, struct sockaddr *addr), void *data)
+{
+    mux_pool_t *pool = ss_malloc(sizeof(mux_pool_t));
+    memset(pool, 0, sizeof(mux_pool_t));
+
+    pool->crypto      = crypto;
+    pool->size        = size;
+    pool->timeout     = timeout;
+    pool->remote_num  = remote_num;
+    pool->remote_addr = remote_addr;
+    pool->socket_cb   = socket_cb;
+    pool->data        = data;
+    pool->conns      = ss_malloc(size * sizeof(mux_conn_t *));
+    memset(pool->conns, 0, size * sizeof(mux_conn_t *));
+
+    return pool;
+}
+
+void
+mux_pool_free(EV_P_ mux_pool_t *pool)
+{
+    for (int i = 0; i < pool->size; i++) {
+        if (pool->conns[i] != NULL) {
+            conn_close(EV_A_ pool->conns[i]);
+        }
+    }
+    ss_free(pool->conns);
+    ss_free(pool);
+}
+
+/** Hands a client socket over to the pool
+ *
+ *  @param header
+ *  The plaintext shadowsocks address header of the destination
+ *
+ *  @param buf
+ *  Client data already read, sent right after the header
+ *
+ *  @return 0 once the pool owns fd, -1 if no connection is available
+ */
+int
+mux_open(EV_P_ mux_pool_t *pool, int fd, buffer_t *header, buffer_t *buf)
+{
+    mux_conn_t *conn = pool_pick(EV_A_ pool);
+    if (conn == NULL) {
+        return -1;
+    }
+
+    uint16_t id = conn->next_id;
+    while (conn->streams[id] != NULL)
+        id = (id + 1) % MUX_MAX_STREAMS;
+    conn->next_id = (id + 1) % MUX_MAX_STREAMS;
+
+    mux_stream_t *stream = new_stream(conn, id, fd);
+
+    char *payload = frame_begin(conn, MUX_OPEN, id);
+    memcpy(payload, header->data, header->len);
+    frame_end(EV_A_ conn, header->len);
+
+    for (size_t offset = 0; offset < buf->len;) {
+        size_t len = min(MUX_FRAME_MAX, buf->len - offset);
+        payload = frame_begin(conn, MUX_DATA, id);
+        memcpy(payload, buf->data + offset, len);
+        frame_end(EV_A_ conn, len);
+        stream->window -= len;
+        offset         += len;
+    }
+
+    stream_resume(EV_A_ stream);
+
+    return 0;
+}
+
+/** Takes over a server connection that opened with MUX_ATYP
+ *
+ *  @param buf
+ *  Everything decrypted so far, starting with the MUX_ATYP byte
+ *
+ *  @return 0 once fd and both cipher contexts belong to the multiplexer,
+ *  -1 if the client speaks an unknown version
+ */
+int
+mux_accept(EV_P_ crypto_t *crypto, int fd, cipher_ctx_t *e_ctx,
+           cipher_ctx_t *d_ctx, buffer_t *buf, int timeout,
+           mux_open_cb open_cb, void (*release_cb)(void *), void *data)
+{
+    if (buf->len < 2 || buf->data[1] != MUX_VERSION) {
+        return -1;
+    }
+
+    mux_conn_t *conn = new_conn(crypto, fd, timeout);
+    conn->e_ctx      = e_ctx;
+    conn->d_ctx      = d_ctx;
+    conn->open_cb    = open_cb;
+    conn->release_cb = release_cb;
+    conn->data       = data;
+
+    brealloc(conn->rbuf, buf->len - 2, SOCKET_BUF_SIZE);
+    memcpy(conn->rbuf->data, buf->data + 2, buf->len - 2);
+    conn->rbuf->len = buf->len - 2;
+
+    ev_io_start(EV_A_ & conn->recv_io);
+    ev_timer_start(EV_A_ & conn->watcher);
+
+    if (conn_parse(EV_A_ conn) == -1) {
+        LOGE("mux: protocol error");
+        conn->broken = 1;
+        ev_io_start(EV_A_ & conn->send_io);
+    }
+
+    return 0;
+}
+
+/*
+ * Binds a socket whose connect() is in progress to a stream opened by the
+ * client. Data the client sent meanwhile is flushed once it connects.
+ */
+void
+mux_stream_attach(EV_P_ mux_stream_t *stream, int fd)
+{
+    stream->fd     = fd;
+    stream->flags |= MUX_CONNECTING;
+    stream->data   = NULL;
+
+    ev_io_set(&stream->recv_io, fd, EV_READ);
+    ev_io_set(&stream->send_io, fd, EV_WRITE);
+    ev_io_start(EV_A_ & stream->send_io);
+}
+
+void
+mux_stream_close(EV_P_ mux_stream_t *stream)
+{
+    stream_shutdown(EV_A_ stream);
+}
+
+void
+mux_stream_set_data(mux_stream_t *stream, void *data)
+{
+    stream->data = data;
+}
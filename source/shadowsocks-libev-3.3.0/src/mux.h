@@ -0,0 +1,87 @@
+/*
+ * mux.h - Define the multiplexed tunnel between the client and the server
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MUX_H
+#define _MUX_H
+
+#include <stddef.h>
+
+#ifdef HAVE_LIBEV_EV_H
+#include <libev/ev.h>
+#else
+#include <ev.h>
+#endif
+
+#include "crypto.h"
+
+/*
+ * A multiplexed connection is an ordinary encrypted shadowsocks stream
+ * whose first request header carries MUX_ATYP instead of an address type,
+ * followed by a version byte. Everything after it is a sequence of frames:
+ *
+ *    +------+-----------+--------+----------+
+ *    | TYPE | STREAM ID | LENGTH | PAYLOAD  |
+ *    +------+-----------+--------+----------+
+ *    |  1   |     2     |   2    | Variable |
+ *    +------+-----------+--------+----------+
+ *
+ * OPEN carries a regular shadowsocks address header and is only sent by
+ * the client, which also allocates the stream ids. DATA carries payload.
+ * CLOSE ends the stream in both directions; an id is reused only once
+ * both ends have sent CLOSE. WINDOW returns 4 bytes of send credit.
+ */
+#define MUX_ATYP        0x0F
+#define MUX_VERSION     1
+
+#define MUX_OPEN        1
+#define MUX_DATA        2
+#define MUX_CLOSE       3
+#define MUX_WINDOW      4
+
+#define MUX_HEADER_LEN  5
+#define MUX_MAX_STREAMS 1024
+
+typedef struct mux_pool mux_pool_t;
+typedef struct mux_stream mux_stream_t;
+
+/*
+ * Called on the server for every OPEN frame. The callback either attaches
+ * a connecting socket to the stream or closes it.
+ */
+typedef void (*mux_open_cb)(EV_P_ mux_stream_t *stream, void *data,
+                            const char *header, size_t header_len);
+
+mux_pool_t *mux_pool_new(crypto_t *crypto, int size, int timeout,
+                         struct sockaddr **remote_addr, int remote_num,
+                         int (*socket_cb)(void *data, struct sockaddr *addr),
+                         void *data);
+void mux_pool_free(EV_P_ mux_pool_t *pool);
+int mux_open(EV_P_ mux_pool_t *pool, int fd, buffer_t *header, buffer_t *buf);
+
+int mux_accept(EV_P_ crypto_t *crypto, int fd, cipher_ctx_t *e_ctx,
+               cipher_ctx_t *d_ctx, buffer_t *buf, int timeout,
+               mux_open_cb open_cb, void (*release_cb)(void *), void *data);
+void mux_stream_attach(EV_P_ mux_stream_t *stream, int fd);
+void mux_stream_close(EV_P_ mux_stream_t *stream);
+void mux_stream_set_data(mux_stream_t *stream, void *data);
+
+#endif // _MUX_H
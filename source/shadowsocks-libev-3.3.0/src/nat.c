@@ -0,0 +1,333 @@
+/*
+ * nat.c - Fixed-size UDP NAT table
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __MINGW32__
+#include <netinet/in.h>
+#endif
+
+#include "crypto.h"
+#include "nat.h"
+#include "utils.h"
+#include "winsock.h"
+
+/*
+ * Entries live in one preallocated array and are addressed through an
+ * open-addressing index with linear probing, kept at most half full.
+ * Every lookup refreshes the entry and moves it to the tail of the LRU
+ * list, so the list is ordered by last activity: the head is both the
+ * eviction victim and the first entry to time out.
+ */
+
+#define NAT_NONE 0
+
+void
+nat_key_init(nat_key_t *key, int af, const struct sockaddr_storage *addr)
+{
+    memset(key, 0, sizeof(nat_key_t));
+    key->af     = af;
+    key->family = addr->ss_family;
+
+    if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+        key->port = sin->sin_port;
+        memcpy(key->addr, &sin->sin_addr, sizeof(struct in_addr));
+    } else if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+        key->port  = sin6->sin6_port;
+        key->scope = sin6->sin6_scope_id;
+        memcpy(key->addr, &sin6->sin6_addr, sizeof(struct in6_addr));
+    }
+}
+
+static inline uint32_t
+nat_hash(const nat_table_t *table, const nat_key_t *key)
+{
+    uint64_t w[3];
+    memcpy(w, key, sizeof(w));
+
+    uint64_t h = (w[0] ^ table->seed) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ w[1] ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ w[2] ^ (h >> 32)) * 0x94D049BB133111EBULL;
+    return (uint32_t)(h ^ (h >> 31));
+}
+
+static uint32_t
+nat_find(const nat_table_t *table, const nat_key_t *key, uint32_t hash)
+{
+    uint32_t pos = hash & table->mask;
+
+    for (;;) {
+        const nat_slot_t *slot = &table->slots[pos];
+        if (slot->idx == NAT_NONE) {
+            return (uint32_t)-1;
+        }
+        if (slot->hash == hash
+            && memcmp(&table->entries[slot->idx - 1].key, key, sizeof(nat_key_t)) == 0) {
+            return pos;
+        }
+        pos = (pos + 1) & table->mask;
+    }
+}
+
+static void
+lru_unlink(nat_table_t *table, uint32_t idx)
+{
+    nat_entry_t *entry = &table->entries[idx - 1];
+
+    if (entry->prev != NAT_NONE) {
+        table->entries[entry->prev - 1].next = entry->next;
+    } else {
+        table->head = entry->next;
+    }
+    if (entry->next != NAT_NONE) {
+        table->entries[entry->next - 1].prev = entry->prev;
+    } else {
+        table->tail = entry->prev;
+    }
+}
+
+static void
+lru_append(nat_table_t *table, uint32_t idx)
+{
+    nat_entry_t *entry = &table->entries[idx - 1];
+
+    entry->prev = table->tail;
+    entry->next = NAT_NONE;
+    if (table->tail != NAT_NONE) {
+        table->entries[table->tail - 1].next = idx;
+    } else {
+        table->head = idx;
+    }
+    table->tail = idx;
+}
+
+/*
+ * Backward-shift deletion: pull later members of the probe run into the
+ * hole as long as that does not move them before their home slot, so the
+ * index never needs tombstones.
+ */
+static void
+slot_erase(nat_table_t *table, uint32_t hole)
+{
+    uint32_t mask = table->mask;
+    uint32_t pos  = hole;
+
+    for (;;) {
+        pos = (pos + 1) & mask;
+        nat_slot_t *slot = &table->slots[pos];
+        if (slot->idx == NAT_NONE) {
+            break;
+        }
+        uint32_t home = slot->hash & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            table->slots[hole] = *slot;
+            hole = pos;
+        }
+    }
+
+    table->slots[hole].idx = NAT_NONE;
+}
+
+static void
+entry_release(nat_table_t *table, uint32_t idx, uint32_t pos)
+{
+    nat_entry_t *entry = &table->entries[idx - 1];
+    void *data         = entry->data;
+
+    if (pos == (uint32_t)-1) {
+        pos = entry->hash & table->mask;
+        while (table->slots[pos].idx != idx)
+            pos = (pos + 1) & table->mask;
+    }
+
+    slot_erase(table, pos);
+    lru_unlink(table, idx);
+
+    entry->data = NULL;
+    entry->next = table->free;
+    table->free = idx;
+    table->count--;
+
+    if (data != NULL && table->free_cb != NULL) {
+        table->free_cb(data);
+    }
+}
+
+/** Creates a new NAT table
+ *
+ *  @param capacity
+ *  The maximum number of associations, the least recently used one is
+ *  evicted when an insert would exceed it
+ *
+ *  @param free_cb
+ *  Called with the payload of every entry leaving the table
+ *
+ *  @return the table, or NULL if capacity is zero
+ */
+nat_table_t *
+nat_create(size_t capacity, void (*free_cb)(void *data))
+{
+    if (capacity == 0 || capacity > UINT32_MAX / 4) {
+        return NULL;
+    }
+
+    size_t slots = 16;
+    while (slots < capacity * 2)
+        slots <<= 1;
+
+    nat_table_t *table = ss_malloc(sizeof(nat_table_t));
+    memset(table, 0, sizeof(nat_table_t));
+
+    table->capacity = capacity;
+    table->mask     = slots - 1;
+    table->free_cb  = free_cb;
+    table->slots    = ss_malloc(slots * sizeof(nat_slot_t));
+    table->entries  = ss_malloc(capacity * sizeof(nat_entry_t));
+    memset(table->slots, 0, slots * sizeof(nat_slot_t));
+    memset(table->entries, 0, capacity * sizeof(nat_entry_t));
+    rand_bytes(&table->seed, sizeof(table->seed));
+
+    for (size_t i = 0; i < capacity; i++)
+        table->entries[i].next = i + 2 <= capacity ? i + 2 : NAT_NONE;
+    table->free = 1;
+
+    return table;
+}
+
+/** Frees a NAT table and every entry still in it */
+void
+nat_delete(nat_table_t *table)
+{
+    if (table == NULL) {
+        return;
+    }
+
+    while (table->head != NAT_NONE)
+        entry_release(table, table->head, (uint32_t)-1);
+
+    ss_free(table->slots);
+    ss_free(table->entries);
+    ss_free(table);
+}
+
+/** Looks up an association and marks it active at now
+ *
+ *  @return the payload, or NULL if the key is not in the table
+ */
+void *
+nat_lookup(nat_table_t *table, const nat_key_t *key, ev_tstamp now)
+{
+    uint32_t pos = nat_find(table, key, nat_hash(table, key));
+    if (pos == (uint32_t)-1) {
+        return NULL;
+    }
+
+    uint32_t idx       = table->slots[pos].idx;
+    nat_entry_t *entry = &table->entries[idx - 1];
+
+    entry->ts = now;
+    if (table->tail != idx) {
+        lru_unlink(table, idx);
+        lru_append(table, idx);
+    }
+
+    return entry->data;
+}
+
+/** Inserts an association, replacing any previous one for the same key
+ *
+ *  @return 0
+ */
+int
+nat_insert(nat_table_t *table, const nat_key_t *key, void *data, ev_tstamp now)
+{
+    uint32_t hash = nat_hash(table, key);
+    uint32_t pos  = nat_find(table, key, hash);
+
+    if (pos != (uint32_t)-1) {
+        entry_release(table, table->slots[pos].idx, pos);
+    }
+    if (table->count == table->capacity) {
+        entry_release(table, table->head, (uint32_t)-1);
+    }
+
+    uint32_t idx       = table->free;
+    nat_entry_t *entry = &table->entries[idx - 1];
+    table->free = entry->next;
+    table->count++;
+
+    entry->key  = *key;
+    entry->data = data;
+    entry->ts   = now;
+    entry->hash = hash;
+    lru_append(table, idx);
+
+    pos = hash & table->mask;
+    while (table->slots[pos].idx != NAT_NONE)
+        pos = (pos + 1) & table->mask;
+    table->slots[pos].hash = hash;
+    table->slots[pos].idx  = idx;
+
+    return 0;
+}
+
+/** Removes an association
+ *
+ *  @return 0 if it was found, ENOENT otherwise
+ */
+int
+nat_remove(nat_table_t *table, const nat_key_t *key)
+{
+    uint32_t pos = nat_find(table, key, nat_hash(table, key));
+    if (pos == (uint32_t)-1) {
+        return ENOENT;
+    }
+
+    entry_release(table, table->slots[pos].idx, pos);
+    return 0;
+}
+
+/** Removes every association not active since before
+ *
+ *  @return the number of entries removed
+ */
+int
+nat_expire(nat_table_t *table, ev_tstamp before)
+{
+    int n = 0;
+
+    while (table->head != NAT_NONE
+           && table->entries[table->head - 1].ts < before) {
+        entry_release(table, table->head, (uint32_t)-1);
+        n++;
+    }
+
+    return n;
+}
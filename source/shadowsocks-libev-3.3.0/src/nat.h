@@ -0,0 +1,92 @@
+/*
+ * nat.h - Define the UDP NAT table interface
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NAT_H
+#define _NAT_H
+
+#include <stddef.h>
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+
+#ifdef HAVE_LIBEV_EV_H
+#include <libev/ev.h>
+#else
+#include <ev.h>
+#endif
+
+#ifndef __MINGW32__
+#include <sys/socket.h>
+#endif
+
+/*
+ * A UDP association is keyed on the family of the outgoing socket plus
+ * the packed source endpoint. IPv4 addresses are stored in the first four
+ * bytes of addr, the rest stays zero so the key can be compared as words.
+ */
+typedef struct nat_key {
+    uint8_t af;
+    uint8_t family;
+    uint16_t port;
+    uint32_t scope;
+    uint8_t addr[16];
+} nat_key_t;
+
+typedef struct nat_entry {
+    nat_key_t key;
+    void *data;
+    ev_tstamp ts;           /* last activity, drives both LRU and expiry */
+    uint32_t hash;
+    uint32_t prev;          /* LRU links, index + 1, 0 terminates */
+    uint32_t next;          /* doubles as the free list link */
+} nat_entry_t;
+
+typedef struct nat_slot {
+    uint32_t hash;
+    uint32_t idx;           /* entry index + 1, 0 marks an empty slot */
+} nat_slot_t;
+
+typedef struct nat_table {
+    size_t capacity;
+    size_t count;
+    uint32_t mask;
+    uint32_t seed;
+    uint32_t head;          /* least recently used */
+    uint32_t tail;          /* most recently used */
+    uint32_t free;
+    nat_slot_t *slots;
+    nat_entry_t *entries;
+    void (*free_cb)(void *data);
+} nat_table_t;
+
+void nat_key_init(nat_key_t *key, int af, const struct sockaddr_storage *addr);
+
+nat_table_t *nat_create(size_t capacity, void (*free_cb)(void *data));
+void nat_delete(nat_table_t *table);
+void *nat_lookup(nat_table_t *table, const nat_key_t *key, ev_tstamp now);
+int nat_insert(nat_table_t *table, const nat_key_t *key, void *data, ev_tstamp now);
+int nat_remove(nat_table_t *table, const nat_key_t *key);
+int nat_expire(nat_table_t *table, ev_tstamp before);
+
+#endif // _NAT_H
@@ -26,11 +26,27 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <stddef.h>
+
 #define MAX_HOSTNAME_LEN 256
 
+/*
+ * Progress of a sniffer over a request that arrives in pieces. The
+ * caller zeroes it once and passes the same, growing buffer on every
+ * call, so bytes already examined are not parsed again.
+ */
+typedef struct sniff {
+    size_t offset;  /* start of the first unfinished line or record */
+    size_t scan;    /* bytes already searched for a line end */
+    size_t count;   /* lines or records consumed */
+    size_t have;    /* handshake bytes received */
+    size_t need;    /* handshake bytes expected, 0 if not known yet */
+} sniff_t;
+
 typedef struct protocol {
     const int default_port;
     int(*const parse_packet) (const char *, size_t, char **);
+    int(*const sniff) (sniff_t *, const char *, size_t, char **);
 } protocol_t;
 
 #endif
@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <limits.h>
+#include <math.h>
 #include <linux/if.h>
 #include <linux/netfilter_ipv4.h>
 #include <linux/netfilter_ipv6/ip6_tables.h>
@@ -91,8 +92,13 @@ static int nofile = 0;
 #endif
        int fast_open = 0;
 static int no_delay  = 0;
+static int warm_pool = 0;
+static int mux_conns = 0;
 static int ret_val   = 0;
 
+#define WARM_POOL_TICK    1.0   // seconds between pool size updates
+#define WARM_IDLE_TIMEOUT 10.0  // seconds a warm connection may sit idle
+
 static struct ev_signal sigint_watcher;
 static struct ev_signal sigterm_watcher;
 static struct ev_signal sigchld_watcher;
@@ -419,6 +425,34 @@ remote_recv_cb(EV_P_ ev_io *w, int revents)
     remote->recv_ctx->connected = 1;
 }
 
+static void
+build_addr_header(buffer_t *abuf, struct sockaddr_storage *destaddr)
+{
+    if (AF_INET6 == destaddr->ss_family) { // IPv6
+        abuf->data[abuf->len++] = 4;       // Type 4 is IPv6 address
+
+        size_t in6_addr_len = sizeof(struct in6_addr);
+        memcpy(abuf->data + abuf->len,
+               &(((struct sockaddr_in6 *)destaddr)->sin6_addr),
+               in6_addr_len);
+        abuf->len += in6_addr_len;
+        memcpy(abuf->data + abuf->len,
+               &(((struct sockaddr_in6 *)destaddr)->sin6_port),
+               2);
+    } else {                             // IPv4
+        abuf->data[abuf->len++] = 1; // Type 1 is IPv4 address
+
+        size_t in_addr_len = sizeof(struct in_addr);
+        memcpy(abuf->data + abuf->len,
+               &((struct sockaddr_in *)destaddr)->sin_addr, in_addr_len);
+        abuf->len += in_addr_len;
+        memcpy(abuf->data + abuf->len,
+               &((struct sockaddr_in *)destaddr)->sin_port, 2);
+    }
+
+    abuf->len += 2;
+}
+
 static void
 remote_send_cb(EV_P_ ev_io *w, int revents)
 {
@@ -447,51 +481,21 @@ remote_send_cb(EV_P_ ev_io *w, int revents)
             buffer_t ss_addr_to_send;
             buffer_t *abuf = &ss_addr_to_send;
             balloc(abuf, SOCKET_BUF_SIZE);
-
-            if (AF_INET6 == server->destaddr.ss_family) { // IPv6
-                abuf->data[abuf->len++] = 4;          // Type 4 is IPv6 address
-
-                size_t in6_addr_len = sizeof(struct in6_addr);
-                memcpy(abuf->data + abuf->len,
-                       &(((struct sockaddr_in6 *)&(server->destaddr))->sin6_addr),
-                       in6_addr_len);
-                abuf->len += in6_addr_len;
-                memcpy(abuf->data + abuf->len,
-                       &(((struct sockaddr_in6 *)&(server->destaddr))->sin6_port),
-                       2);
-            } else {                             // IPv4
-                abuf->data[abuf->len++] = 1; // Type 1 is IPv4 address
-
-                size_t in_addr_len = sizeof(struct in_addr);
-                memcpy(abuf->data + abuf->len,
-                       &((struct sockaddr_in *)&(server->destaddr))->sin_addr, in_addr_len);
-                abuf->len += in_addr_len;
-                memcpy(abuf->data + abuf->len,
-                       &((struct sockaddr_in *)&(server->destaddr))->sin_port, 2);
-            }
-
-            abuf->len += 2;
-
-            int err = crypto->encrypt(abuf, server->e_ctx, SOCKET_BUF_SIZE);
-            if (err) {
-                LOGE("invalid password or cipher");
-                bfree(abuf);
-                close_and_free_remote(EV_A_ remote);
-                close_and_free_server(EV_A_ server);
-                return;
-            }
-
-            err = crypto->encrypt(remote->buf, server->e_ctx, SOCKET_BUF_SIZE);
+            build_addr_header(abuf, &server->destaddr);
+
+            struct iovec iov[2] = {
+                { abuf->data,        abuf->len        },
+                { remote->buf->data, remote->buf->len }
+            };
+            int err = crypto->encrypt_batch(remote->buf, iov, 2,
+                                            server->e_ctx, SOCKET_BUF_SIZE);
+            bfree(abuf);
             if (err) {
                 LOGE("invalid password or cipher");
-                bfree(abuf);
                 close_and_free_remote(EV_A_ remote);
                 close_and_free_server(EV_A_ server);
                 return;
             }
-
-            bprepend(remote->buf, abuf, SOCKET_BUF_SIZE);
-            bfree(abuf);
         } else {
             ERROR("getpeername");
             // not connected
@@ -695,41 +699,14 @@ close_and_free_server(EV_P_ server_t *server)
     }
 }
 
-static void
-accept_cb(EV_P_ ev_io *w, int revents)
+static int
+create_remote_socket(listen_ctx_t *listener, struct sockaddr *remote_addr)
 {
-    listen_ctx_t *listener = (listen_ctx_t *)w;
-    struct sockaddr_storage destaddr;
-    memset(&destaddr, 0, sizeof(struct sockaddr_storage));
-
-    int err;
-
-    int serverfd = accept(listener->fd, NULL, NULL);
-    if (serverfd == -1) {
-        ERROR("accept");
-        return;
-    }
-
-    err = getdestaddr(serverfd, &destaddr);
-    if (err) {
-        ERROR("getdestaddr");
-        return;
-    }
-
-    setnonblocking(serverfd);
-    int opt = 1;
-    setsockopt(serverfd, SOL_TCP, TCP_NODELAY, &opt, sizeof(opt));
-#ifdef SO_NOSIGPIPE
-    setsockopt(serverfd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
-#endif
-
-    int index                    = rand() % listener->remote_num;
-    struct sockaddr *remote_addr = listener->remote_addr[index];
-
+    int opt      = 1;
     int remotefd = socket(remote_addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (remotefd == -1) {
         ERROR("socket");
-        return;
+        return -1;
     }
 
     // Set flags
@@ -777,13 +754,270 @@ accept_cb(EV_P_ ev_io *w, int revents)
         }
     }
 
+    return remotefd;
+}
+
+static int
+mux_socket(void *data, struct sockaddr *addr)
+{
+    return create_remote_socket((listen_ctx_t *)data, addr);
+}
+
+/*
+ * The pool follows the rate of new flows: it keeps enough connections
+ * to cover the flows expected while a replacement is being opened, and
+ * lets them go once traffic stops. Idle ones are dropped long before
+ * ss-server would time them out for not sending a request.
+ */
+static void warm_pool_fill(EV_P_ warm_pool_t *pool);
+
+static void
+free_warm_conn(EV_P_ warm_conn_t *conn)
+{
+    ev_io_stop(EV_A_ & conn->io);
+    ev_timer_stop(EV_A_ & conn->watcher);
+    if (conn->fd != -1)
+        close(conn->fd);
+    ss_free(conn);
+}
+
+static void
+warm_conn_drop(EV_P_ warm_conn_t *conn)
+{
+    warm_pool_t *pool = conn->pool;
+
+    if (conn->connected) {
+        cork_dllist_remove(&conn->entries);
+        pool->idle--;
+    } else {
+        pool->connecting--;
+        pool->failed = 1;
+    }
+    free_warm_conn(EV_A_ conn);
+}
+
+static void
+warm_conn_cb(EV_P_ ev_io *w, int revents)
+{
+    warm_conn_t *conn = cork_container_of(w, warm_conn_t, io);
+    warm_pool_t *pool = conn->pool;
+
+    if (conn->connected) {
+        // an idle connection is readable only when the server gives up on it
+        warm_conn_drop(EV_A_ conn);
+        return;
+    }
+
+    int err       = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        if (verbose)
+            LOGE("warm connection failed: %s", strerror(err ? err : errno));
+        warm_conn_drop(EV_A_ conn);
+        return;
+    }
+
+    ev_tstamp rtt = ev_now(EV_A) - conn->start;
+    pool->rtt = pool->rtt > 0 ? 0.8 * pool->rtt + 0.2 * rtt : rtt;
+
+    conn->connected = 1;
+    pool->connecting--;
+    pool->idle++;
+    cork_dllist_add(&pool->conns, &conn->entries);
+
+    ev_io_stop(EV_A_ & conn->io);
+    ev_io_set(&conn->io, conn->fd, EV_READ);
+    ev_io_start(EV_A_ & conn->io);
+
+    ev_timer_stop(EV_A_ & conn->watcher);
+    ev_timer_set(&conn->watcher,
+                 min(WARM_IDLE_TIMEOUT, pool->listener->timeout / 2.0), 0);
+    ev_timer_start(EV_A_ & conn->watcher);
+}
+
+static void
+warm_conn_timeout_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    warm_conn_t *conn = cork_container_of(watcher, warm_conn_t, watcher);
+
+    warm_conn_drop(EV_A_ conn);
+}
+
+static void
+warm_pool_open(EV_P_ warm_pool_t *pool)
+{
+    listen_ctx_t *listener       = pool->listener;
+    int index                    = rand() % listener->remote_num;
+    struct sockaddr *remote_addr = listener->remote_addr[index];
+
+    int fd = create_remote_socket(listener, remote_addr);
+    if (fd == -1) {
+        pool->failed = 1;
+        return;
+    }
+
+    int r = connect(fd, remote_addr, get_sockaddr_len(remote_addr));
+    if (r == -1 && errno != CONNECT_IN_PROGRESS) {
+        if (verbose)
+            ERROR("warm connect");
+        close(fd);
+        pool->failed = 1;
+        return;
+    }
+
+    warm_conn_t *conn = ss_malloc(sizeof(warm_conn_t));
+    memset(conn, 0, sizeof(warm_conn_t));
+    conn->fd    = fd;
+    conn->pool  = pool;
+    conn->start = ev_now(EV_A);
+
+    ev_io_init(&conn->io, warm_conn_cb, fd, EV_WRITE);
+    ev_timer_init(&conn->watcher, warm_conn_timeout_cb,
+                  min(MAX_CONNECT_TIMEOUT, listener->timeout), 0);
+    ev_io_start(EV_A_ & conn->io);
+    ev_timer_start(EV_A_ & conn->watcher);
+
+    pool->connecting++;
+}
+
+static void
+warm_pool_fill(EV_P_ warm_pool_t *pool)
+{
+    while (!pool->failed && pool->idle + pool->connecting < pool->target)
+        warm_pool_open(EV_A_ pool);
+}
+
+static void
+warm_pool_tick_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    warm_pool_t *pool = cork_container_of(watcher, warm_pool_t, tick);
+
+    pool->rate     = 0.7 * pool->rate + 0.3 * pool->accepts / WARM_POOL_TICK;
+    pool->accepts  = 0;
+    pool->failed   = 0;
+
+    /*
+     * Flows arriving while a replacement connects, twice over, plus a
+     * spare as long as it is likely to be used before it expires.
+     */
+    int target = 0;
+    if (pool->rate * WARM_IDLE_TIMEOUT >= 1.0)
+        target = (int)ceil(2.0 * pool->rate * pool->rtt) + 1;
+    pool->target = min(target, pool->max);
+
+    while (pool->idle > pool->target) {
+        warm_conn_t *conn = cork_container_of(cork_dllist_head(&pool->conns),
+                                              warm_conn_t, entries);
+        warm_conn_drop(EV_A_ conn);
+    }
+
+    warm_pool_fill(EV_A_ pool);
+}
+
+static int
+warm_pool_take(EV_P_ warm_pool_t *pool)
+{
+    struct cork_dllist_item *item = cork_dllist_head(&pool->conns);
+    int fd = -1;
+
+    if (item != NULL) {
+        warm_conn_t *conn = cork_container_of(item, warm_conn_t, entries);
+        cork_dllist_remove(&conn->entries);
+        pool->idle--;
+        fd       = conn->fd;
+        conn->fd = -1;
+        free_warm_conn(EV_A_ conn);
+    }
+
+    // before any rate is known, start with a single spare
+    if (pool->target == 0)
+        pool->target = min(1, pool->max);
+    warm_pool_fill(EV_A_ pool);
+
+    return fd;
+}
+
+static warm_pool_t *
+new_warm_pool(EV_P_ listen_ctx_t *listener, int max)
+{
+    warm_pool_t *pool = ss_malloc(sizeof(warm_pool_t));
+    memset(pool, 0, sizeof(warm_pool_t));
+    pool->listener = listener;
+    pool->max      = max;
+    cork_dllist_init(&pool->conns);
+
+    ev_timer_init(&pool->tick, warm_pool_tick_cb, WARM_POOL_TICK, WARM_POOL_TICK);
+    ev_timer_start(EV_A_ & pool->tick);
+
+    return pool;
+}
+
+static void
+accept_cb(EV_P_ ev_io *w, int revents)
+{
+    listen_ctx_t *listener = (listen_ctx_t *)w;
+    struct sockaddr_storage destaddr;
+    memset(&destaddr, 0, sizeof(struct sockaddr_storage));
+
+    int err;
+
+    int serverfd = accept(listener->fd, NULL, NULL);
+    if (serverfd == -1) {
+        ERROR("accept");
+        return;
+    }
+
+    err = getdestaddr(serverfd, &destaddr);
+    if (err) {
+        ERROR("getdestaddr");
+        return;
+    }
+
+    setnonblocking(serverfd);
+    int opt = 1;
+    setsockopt(serverfd, SOL_TCP, TCP_NODELAY, &opt, sizeof(opt));
+#ifdef SO_NOSIGPIPE
+    setsockopt(serverfd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#endif
+
+    if (listener->mux != NULL) {
+        buffer_t abuf;
+        buffer_t buf = { 0, 0, 0, NULL };
+        balloc(&abuf, SOCKET_BUF_SIZE);
+        build_addr_header(&abuf, &destaddr);
+        err = mux_open(EV_A_ listener->mux, serverfd, &abuf, &buf);
+        bfree(&abuf);
+        if (err == 0)
+            return;
+    }
+
+    int index                    = rand() % listener->remote_num;
+    struct sockaddr *remote_addr = listener->remote_addr[index];
+
+    int remotefd = -1;
+    if (listener->pool != NULL) {
+        listener->pool->accepts++;
+        remotefd = warm_pool_take(EV_A_ listener->pool);
+    }
+
+    int warm = remotefd != -1;
+    if (!warm) {
+        remotefd = create_remote_socket(listener, remote_addr);
+        if (remotefd == -1)
+            return;
+    }
+
     server_t *server = new_server(serverfd);
     remote_t *remote = new_remote(remotefd, listener->timeout);
     server->remote   = remote;
     remote->server   = server;
     server->destaddr = destaddr;
 
-    if (fast_open) {
+    if (warm) {
+        // already connected, send the header as soon as it is writable
+        ev_io_start(EV_A_ & remote->send_ctx->io);
+        ev_timer_start(EV_A_ & remote->send_ctx->watcher);
+    } else if (fast_open) {
         // save remote addr for fast open
         remote->addr = remote_addr;
         ev_timer_start(EV_A_ & server->delayed_connect_watcher);
@@ -867,6 +1101,8 @@ main(int argc, char **argv)
         { "plugin-opts", required_argument, NULL, GETOPT_VAL_PLUGIN_OPTS },
         { "reuse-port",  no_argument,       NULL, GETOPT_VAL_REUSE_PORT  },
         { "no-delay",    no_argument,       NULL, GETOPT_VAL_NODELAY     },
+        { "warm-pool",   required_argument, NULL, GETOPT_VAL_WARM_POOL   },
+        { "mux",         required_argument, NULL, GETOPT_VAL_MUX         },
         { "password",    required_argument, NULL, GETOPT_VAL_PASSWORD    },
         { "key",         required_argument, NULL, GETOPT_VAL_KEY         },
         { "help",        no_argument,       NULL, GETOPT_VAL_HELP        },
@@ -895,6 +1131,12 @@ main(int argc, char **argv)
             no_delay = 1;
             LOGI("enable TCP no-delay");
             break;
+        case GETOPT_VAL_WARM_POOL:
+            warm_pool = atoi(optarg);
+            break;
+        case GETOPT_VAL_MUX:
+            mux_conns = atoi(optarg);
+            break;
         case GETOPT_VAL_PLUGIN:
             plugin = optarg;
             break;
@@ -1033,6 +1275,12 @@ main(int argc, char **argv)
         if (no_delay == 0) {
             no_delay = conf->no_delay;
         }
+        if (warm_pool == 0) {
+            warm_pool = conf->warm_pool;
+        }
+        if (mux_conns == 0) {
+            mux_conns = conf->mux;
+        }
         if (reuse_port == 0) {
             reuse_port = conf->reuse_port;
         }
@@ -1120,6 +1368,14 @@ main(int argc, char **argv)
         LOGI("enable TCP no-delay");
     }
 
+    if (warm_pool > 0) {
+        LOGI("keeping up to %d warm connections", warm_pool);
+    }
+
+    if (mux_conns > 0) {
+        LOGI("multiplex streams over %d connections", mux_conns);
+    }
+
     if (ipv6first) {
         LOGI("resolving hostname to IPv6 address first");
     }
@@ -1211,6 +1467,14 @@ main(int argc, char **argv)
 
             ev_io_init(&listen_ctx_current->io, accept_cb, listenfd, EV_READ);
             ev_io_start(loop, &listen_ctx_current->io);
+
+            if (warm_pool > 0)
+                listen_ctx_current->pool = new_warm_pool(loop, listen_ctx_current, warm_pool);
+            if (mux_conns > 0)
+                listen_ctx_current->mux = mux_pool_new(crypto, mux_conns, listen_ctx_current->timeout,
+                                                       listen_ctx_current->remote_addr,
+                                                       listen_ctx_current->remote_num,
+                                                       mux_socket, listen_ctx_current);
         }
 
         // Setup UDP
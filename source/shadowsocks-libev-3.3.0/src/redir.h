@@ -22,6 +22,8 @@
 #ifndef _REDIR_H
 #define _REDIR_H
 
+#include <libcork/ds.h>
+
 #ifdef HAVE_LIBEV_EV_H
 #include <libev/ev.h>
 #else
@@ -30,6 +32,7 @@
 
 #include "crypto.h"
 #include "jconf.h"
+#include "mux.h"
 
 typedef struct listen_ctx {
     ev_io io;
@@ -39,8 +42,39 @@ typedef struct listen_ctx {
     int mptcp;
     int tos;
     struct sockaddr **remote_addr;
+    struct warm_pool *pool;
+    mux_pool_t *mux;
 } listen_ctx_t;
 
+/*
+ * Connections to the server opened ahead of time, so that a redirected
+ * flow can send its salt and address header without waiting for the
+ * TCP handshake.
+ */
+typedef struct warm_conn {
+    ev_io io;
+    ev_timer watcher;
+    int fd;
+    int connected;
+    ev_tstamp start;
+    struct warm_pool *pool;
+    struct cork_dllist_item entries;
+} warm_conn_t;
+
+typedef struct warm_pool {
+    struct listen_ctx *listener;
+    int max;            /* upper bound set by the user */
+    int target;         /* connections to keep ready */
+    int idle;           /* connected, on the list */
+    int connecting;
+    int failed;         /* a connect failed since the last tick */
+    int accepts;        /* flows accepted since the last tick */
+    double rate;        /* average flows per second */
+    double rtt;         /* average connect time */
+    ev_timer tick;
+    struct cork_dllist conns;   /* oldest first */
+} warm_pool_t;
+
 typedef struct server_ctx {
     ev_io io;
     int connected;
@@ -92,7 +92,8 @@ static void server_send_cb(EV_P_ ev_io *w, int revents);
 static void server_recv_cb(EV_P_ ev_io *w, int revents);
 static void remote_recv_cb(EV_P_ ev_io *w, int revents);
 static void remote_send_cb(EV_P_ ev_io *w, int revents);
-static void server_timeout_cb(EV_P_ ev_timer *watcher, int revents);
+static void server_timeout_cb(EV_P_ wheel_timer_t *watcher);
+static void frame_cb(EV_P_ ev_timer *watcher, int revents);
 
 static remote_t *new_remote(int fd);
 static server_t *new_server(int fd, listen_ctx_t *listener);
@@ -105,6 +106,9 @@ static void free_server(server_t *server);
 static void close_and_free_server(EV_P_ server_t *server);
 static void resolv_cb(struct sockaddr *addr, void *data);
 static void resolv_free_cb(void *data);
+static void open_mux_stream(EV_P_ mux_stream_t *stream, void *data,
+                            const char *buf, size_t len);
+static void mux_release_cb(void *data);
 
 int verbose      = 0;
 int reuse_port   = 0;
@@ -120,6 +124,7 @@ static int mode      = TCP_ONLY;
 static int ipv6first = 0;
        int fast_open = 0;
 static int no_delay  = 0;
+static int mux       = 0;
 static int ret_val   = 0;
 
 #ifdef HAVE_SETRLIMIT
@@ -142,6 +147,8 @@ static struct ev_signal sigint_watcher;
 static struct ev_signal sigterm_watcher;
 #ifndef __MINGW32__
 static struct ev_signal sigchld_watcher;
+static struct ev_signal sighup_watcher;
+static struct ev_signal sigusr2_watcher;
 #else
 static struct plugin_watcher_t {
     ev_io io;
@@ -152,22 +159,15 @@ static struct plugin_watcher_t {
 #endif
 
 static struct cork_dllist connections;
+static wheel_t wheel;
 
 #ifndef __MINGW32__
 static void
-stat_update_cb(EV_P_ ev_timer *watcher, int revents)
+send_to_manager(const char *resp)
 {
     struct sockaddr_un svaddr, claddr;
-    int sfd = -1;
-    size_t msgLen;
-    char resp[SOCKET_BUF_SIZE];
-
-    if (verbose) {
-        LOGI("update traffic stat: tx: %" PRIu64 " rx: %" PRIu64 "", tx, rx);
-    }
-
-    snprintf(resp, SOCKET_BUF_SIZE, "stat: {\"%s\":%" PRIu64 "}", remote_port, tx + rx);
-    msgLen = strlen(resp) + 1;
+    int sfd       = -1;
+    size_t msgLen = strlen(resp) + 1;
 
     ss_addr_t ip_addr = { .host = NULL, .port = NULL };
     parse_addr(manager_addr, &ip_addr);
@@ -230,6 +230,27 @@ stat_update_cb(EV_P_ ev_timer *watcher, int revents)
     close(sfd);
 }
 
+static void
+stat_update_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    char resp[SOCKET_BUF_SIZE];
+
+    if (verbose) {
+        LOGI("update traffic stat: tx: %" PRIu64 " rx: %" PRIu64 "", tx, rx);
+    }
+
+    snprintf(resp, SOCKET_BUF_SIZE, "stat: {\"%s\":%" PRIu64 "}", remote_port, tx + rx);
+    send_to_manager(resp);
+
+    if (trace_enabled) {
+        int len = snprintf(resp, SOCKET_BUF_SIZE, "trace: {\"%s\":", remote_port);
+        if (trace_json(resp + len, SOCKET_BUF_SIZE - len - 1) != -1) {
+            strcat(resp, "}");
+            send_to_manager(resp);
+        }
+    }
+}
+
 #endif
 
 static void
@@ -425,14 +446,10 @@ create_and_bind(const char *host, const char *port, int mptcp)
     return listen_sock;
 }
 
-static remote_t *
-connect_to_remote(EV_P_ struct addrinfo *res,
-                  server_t *server)
+static int
+create_remote_socket(struct addrinfo *res, const char *iface)
 {
     int sockfd;
-#ifdef SET_INTERFACE
-    const char *iface = server->listen_ctx->iface;
-#endif
 
     if (acl) {
         char ipstr[INET6_ADDRSTRLEN];
@@ -449,7 +466,7 @@ connect_to_remote(EV_P_ struct addrinfo *res,
         if (outbound_block_match_host(ipstr) == 1) {
             if (verbose)
                 LOGI("outbound blocked %s", ipstr);
-            return NULL;
+            return -1;
         }
     }
 
@@ -458,7 +475,7 @@ connect_to_remote(EV_P_ struct addrinfo *res,
     if (sockfd == -1) {
         ERROR("socket");
         close(sockfd);
-        return NULL;
+        return -1;
     }
 
     int opt = 1;
@@ -480,7 +497,7 @@ connect_to_remote(EV_P_ struct addrinfo *res,
         if (bind_to_addr(local_addr, sockfd) == -1) {
             ERROR("bind_to_addr");
             close(sockfd);
-            return NULL;
+            return -1;
         }
     }
 
@@ -489,11 +506,25 @@ connect_to_remote(EV_P_ struct addrinfo *res,
         if (setinterface(sockfd, iface) == -1) {
             ERROR("setinterface");
             close(sockfd);
-            return NULL;
+            return -1;
         }
     }
 #endif
 
+    return sockfd;
+}
+
+static remote_t *
+connect_to_remote(EV_P_ struct addrinfo *res,
+                  server_t *server)
+{
+    int sockfd = create_remote_socket(res, server->listen_ctx->iface);
+    if (sockfd == -1) {
+        return NULL;
+    }
+
+    trace_mark(EV_A_ & server->trace.connecting);
+
     remote_t *remote = new_remote(sockfd);
 
     if (fast_open) {
@@ -708,7 +739,7 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
         buf    = remote->buf;
 
         // Only timer the watcher if a valid connection is established
-        ev_timer_again(EV_A_ & server->recv_ctx->watcher);
+        wheel_timer_touch(EV_A_ & server->recv_ctx->watcher);
     }
 
     ssize_t r = recv(server->fd, buf->data, SOCKET_BUF_SIZE, 0);
@@ -736,8 +767,11 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
 
     tx      += r;
     buf->len = r;
+    server->trace.tx += r;
 
-    int err = crypto->decrypt(buf, server->d_ctx, SOCKET_BUF_SIZE);
+    ev_tstamp since = trace_clock();
+    int err         = crypto->decrypt(buf, server->d_ctx, SOCKET_BUF_SIZE);
+    trace_crypto(&server->trace, since);
 
     if (err == CRYPTO_ERROR) {
         report_addr(server->fd, "authentication error");
@@ -789,6 +823,28 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
         int offset     = 0;
         int need_query = 0;
         char atyp      = server->buf->data[offset++];
+
+        // without --mux, MUX_ATYP is rejected like any unknown address type
+        if ((atyp & ADDRTYPE_MASK) == MUX_ATYP && mux) {
+            if (mux_accept(EV_A_ crypto, server->fd, server->e_ctx, server->d_ctx,
+                           server->buf, server->listen_ctx->timeout,
+                           open_mux_stream, mux_release_cb, server->listen_ctx) == -1) {
+                report_addr(server->fd, "unsupported mux version");
+                stop_server(EV_A_ server);
+                return;
+            }
+
+            // the multiplexer owns the socket and both cipher contexts now
+            ev_io_stop(EV_A_ & server_recv_ctx->io);
+            wheel_timer_stop(&server->recv_ctx->watcher);
+            server->e_ctx = NULL;
+            server->d_ctx = NULL;
+            free_server(server);
+            if (verbose) {
+                server_conn--;
+            }
+            return;
+        }
         char host[255] = { 0 };
         uint16_t port  = 0;
         struct addrinfo info;
@@ -950,6 +1006,7 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
             snprintf(query->hostname, MAX_HOSTNAME_LEN, "%s", host);
 
             server->stage = STAGE_RESOLVE;
+            trace_mark(EV_A_ & server->trace.resolving);
             resolv_start(host, port, resolv_cb, resolv_free_cb, query);
         }
 
@@ -1015,7 +1072,22 @@ server_send_cb(EV_P_ ev_io *w, int revents)
 }
 
 static void
-server_timeout_cb(EV_P_ ev_timer *watcher, int revents)
+frame_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    server_t *server = cork_container_of(watcher, server_t, frame.watcher);
+    remote_t *remote = server->remote;
+
+    if (remote == NULL) {
+        LOGE("invalid remote");
+        close_and_free_server(EV_A_ server);
+        return;
+    }
+
+    remote_recv_cb(EV_A_ & remote->recv_ctx->io, revents);
+}
+
+static void
+server_timeout_cb(EV_P_ wheel_timer_t *watcher)
 {
     server_ctx_t *server_ctx
         = cork_container_of(watcher, server_ctx_t, watcher);
@@ -1053,6 +1125,8 @@ resolv_cb(struct sockaddr *addr, void *data)
 
     struct ev_loop *loop = server->listen_ctx->loop;
 
+    trace_mark(EV_A_ & server->trace.resolved);
+
     if (addr == NULL) {
         LOGE("unable to resolve %s", query->hostname);
         close_and_free_server(EV_A_ server);
@@ -1100,6 +1174,170 @@ resolv_cb(struct sockaddr *addr, void *data)
     }
 }
 
+static void
+connect_mux_stream(EV_P_ mux_stream_t *stream, listen_ctx_t *listener,
+                   struct addrinfo *res)
+{
+    int sockfd = create_remote_socket(res, listener->iface);
+    if (sockfd == -1) {
+        mux_stream_close(EV_A_ stream);
+        return;
+    }
+
+    int r = connect(sockfd, res->ai_addr, res->ai_addrlen);
+    if (r == -1 && errno != CONNECT_IN_PROGRESS) {
+        ERROR("connect");
+        close(sockfd);
+        mux_stream_close(EV_A_ stream);
+        return;
+    }
+
+    mux_stream_attach(EV_A_ stream, sockfd);
+}
+
+static void
+mux_release_cb(void *data)
+{
+    mux_query_t *query = (mux_query_t *)data;
+    query->stream = NULL;
+}
+
+static void
+mux_resolv_free_cb(void *data)
+{
+    mux_query_t *query = (mux_query_t *)data;
+
+    if (query->stream != NULL)
+        mux_stream_set_data(query->stream, NULL);
+    ss_free(query);
+}
+
+static void
+mux_resolv_cb(struct sockaddr *addr, void *data)
+{
+    mux_query_t *query   = (mux_query_t *)data;
+    mux_stream_t *stream = query->stream;
+
+    if (stream == NULL)
+        return;
+
+    struct ev_loop *loop = query->listen_ctx->loop;
+
+    mux_stream_set_data(stream, NULL);
+    query->stream = NULL;
+
+    if (addr == NULL) {
+        LOGE("unable to resolve %s", query->hostname);
+        mux_stream_close(EV_A_ stream);
+        return;
+    }
+
+    struct addrinfo info;
+    memset(&info, 0, sizeof(struct addrinfo));
+    info.ai_family   = addr->sa_family;
+    info.ai_socktype = SOCK_STREAM;
+    info.ai_protocol = IPPROTO_TCP;
+    info.ai_addr     = addr;
+    info.ai_addrlen  = get_sockaddr_len(addr);
+
+    connect_mux_stream(EV_A_ stream, query->listen_ctx, &info);
+}
+
+/*
+ * A stream of a multiplexed connection carries the same address header as
+ * a plain connection, only without any payload behind it.
+ */
+static void
+open_mux_stream(EV_P_ mux_stream_t *stream, void *data, const char *buf, size_t len)
+{
+    listen_ctx_t *listener = (listen_ctx_t *)data;
+    int atyp               = buf[0] & ADDRTYPE_MASK;
+    size_t offset          = 1;
+    char host[MAX_HOSTNAME_LEN] = { 0 };
+    uint16_t port;
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof(struct sockaddr_storage));
+
+    if (atyp == 1 && len >= sizeof(struct in_addr) + 3) {
+        struct sockaddr_in *addr = (struct sockaddr_in *)&storage;
+        addr->sin_family = AF_INET;
+        memcpy(&addr->sin_addr, buf + offset, sizeof(struct in_addr));
+        inet_ntop(AF_INET, &addr->sin_addr, host, INET_ADDRSTRLEN);
+        offset += sizeof(struct in_addr);
+    } else if (atyp == 4 && len >= sizeof(struct in6_addr) + 3) {
+        struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&storage;
+        addr->sin6_family = AF_INET6;
+        memcpy(&addr->sin6_addr, buf + offset, sizeof(struct in6_addr));
+        inet_ntop(AF_INET6, &addr->sin6_addr, host, INET6_ADDRSTRLEN);
+        offset += sizeof(struct in6_addr);
+    } else if (atyp == 3 && len >= 2 && len >= (uint8_t)buf[1] + 4U) {
+        uint8_t name_len = buf[offset++];
+        memcpy(host, buf + offset, name_len);
+        offset += name_len;
+
+        if (acl && outbound_block_match_host(host) == 1) {
+            if (verbose)
+                LOGI("outbound blocked %s", host);
+            mux_stream_close(EV_A_ stream);
+            return;
+        }
+
+        struct cork_ip ip;
+        if (cork_ip_init(&ip, host) != -1) {
+            if (ip.version == 4) {
+                struct sockaddr_in *addr = (struct sockaddr_in *)&storage;
+                addr->sin_family = AF_INET;
+                memcpy(&addr->sin_addr, &ip.ip.v4, sizeof(struct in_addr));
+            } else {
+                struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&storage;
+                addr->sin6_family = AF_INET6;
+                memcpy(&addr->sin6_addr, &ip.ip.v6, sizeof(struct in6_addr));
+            }
+        } else if (!validate_hostname(host, name_len)) {
+            LOGE("mux: invalid host name");
+            mux_stream_close(EV_A_ stream);
+            return;
+        }
+    } else {
+        LOGE("mux: invalid address header");
+        mux_stream_close(EV_A_ stream);
+        return;
+    }
+
+    memcpy(&port, buf + offset, sizeof(port));
+
+    if (verbose) {
+        LOGI("[%s] mux connect to %s:%d", remote_port, host, ntohs(port));
+    }
+
+    if (storage.ss_family == AF_UNSPEC) {
+        mux_query_t *query = ss_malloc(sizeof(mux_query_t));
+        memset(query, 0, sizeof(mux_query_t));
+        query->stream     = stream;
+        query->listen_ctx = listener;
+        snprintf(query->hostname, MAX_HOSTNAME_LEN, "%s", host);
+
+        mux_stream_set_data(stream, query);
+        resolv_start(host, port, mux_resolv_cb, mux_resolv_free_cb, query);
+        return;
+    }
+
+    if (storage.ss_family == AF_INET)
+        ((struct sockaddr_in *)&storage)->sin_port = port;
+    else
+        ((struct sockaddr_in6 *)&storage)->sin6_port = port;
+
+    struct addrinfo info;
+    memset(&info, 0, sizeof(struct addrinfo));
+    info.ai_family   = storage.ss_family;
+    info.ai_socktype = SOCK_STREAM;
+    info.ai_protocol = IPPROTO_TCP;
+    info.ai_addr     = (struct sockaddr *)&storage;
+    info.ai_addrlen  = get_sockaddr_len(info.ai_addr);
+
+    connect_mux_stream(EV_A_ stream, listener, &info);
+}
+
 static void
 remote_recv_cb(EV_P_ ev_io *w, int revents)
 {
@@ -1118,35 +1356,50 @@ remote_recv_cb(EV_P_ ev_io *w, int revents)
         return;
     }
 
-    ev_timer_again(EV_A_ & server->recv_ctx->watcher);
+    if (revents != EV_TIMER) {
+        wheel_timer_touch(EV_A_ & server->recv_ctx->watcher);
 
-    ssize_t r = recv(remote->fd, server->buf->data, SOCKET_BUF_SIZE, 0);
+        ssize_t r = recv(remote->fd, server->buf->data + server->buf->len,
+                         SOCKET_BUF_SIZE - server->buf->len, 0);
 
-    if (r == 0) {
-        // connection closed
-        if (verbose) {
-            LOGI("remote_recv close the connection");
-        }
-        close_and_free_remote(EV_A_ remote);
-        close_and_free_server(EV_A_ server);
-        return;
-    } else if (r == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            // no data
-            // continue to wait for recv
-            return;
-        } else {
-            ERROR("remote recv");
+        if (r == 0 && frame_held(&server->frame)) {
+            // send what was held back, the next read sees the EOF again
+            frame_stop(EV_A_ & server->frame);
+        } else if (r == 0) {
+            // connection closed
+            if (verbose) {
+                LOGI("remote_recv close the connection");
+            }
             close_and_free_remote(EV_A_ remote);
             close_and_free_server(EV_A_ server);
             return;
+        } else if (r == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // no data
+                // continue to wait for recv
+                return;
+            } else {
+                ERROR("remote recv");
+                close_and_free_remote(EV_A_ remote);
+                close_and_free_server(EV_A_ server);
+                return;
+            }
+        } else {
+            rx += r;
+            server->trace.rx += r;
+            trace_mark(EV_A_ & server->trace.first_byte);
+
+            server->buf->len += r;
+            if (!no_delay && remote->recv_ctx->connected
+                && frame_hold(EV_A_ & server->frame, r, server->buf->len, SOCKET_BUF_SIZE)) {
+                return;
+            }
         }
     }
 
-    rx += r;
-
-    server->buf->len = r;
-    int err = crypto->encrypt(server->buf, server->e_ctx, SOCKET_BUF_SIZE);
+    ev_tstamp since = trace_clock();
+    int err         = crypto->encrypt(server->buf, server->e_ctx, SOCKET_BUF_SIZE);
+    trace_crypto(&server->trace, since);
 
     if (err) {
         LOGE("invalid password or cipher");
@@ -1177,6 +1430,9 @@ remote_recv_cb(EV_P_ ev_io *w, int revents)
         server->buf->idx  = s;
         ev_io_stop(EV_A_ & remote_recv_ctx->io);
         ev_io_start(EV_A_ & server->send_ctx->io);
+    } else {
+        server->buf->len = 0;
+        server->buf->idx = 0;
     }
 
     // Disable TCP_NODELAY after the first response are sent
@@ -1242,9 +1498,12 @@ remote_send_cb(EV_P_ ev_io *w, int revents)
                 LOGI("remote connected");
             }
             remote_send_ctx->connected = 1;
+            trace_mark(EV_A_ & server->trace.connected);
 
             if (remote->buf->len == 0) {
                 server->stage = STAGE_STREAM;
+                wheel_timer_again(EV_A_ & wheel, &server->recv_ctx->watcher,
+                                  server->listen_ctx->timeout);
                 ev_io_stop(EV_A_ & remote_send_ctx->io);
                 ev_io_start(EV_A_ & server->recv_ctx->io);
                 ev_io_start(EV_A_ & remote->recv_ctx->io);
@@ -1293,6 +1552,8 @@ remote_send_cb(EV_P_ ev_io *w, int revents)
                 ev_io_start(EV_A_ & server->recv_ctx->io);
                 if (server->stage != STAGE_STREAM) {
                     server->stage = STAGE_STREAM;
+                    wheel_timer_again(EV_A_ & wheel, &server->recv_ctx->watcher,
+                                      server->listen_ctx->timeout);
                     ev_io_start(EV_A_ & remote->recv_ctx->io);
                 }
             } else {
@@ -1403,8 +1664,9 @@ new_server(int fd, listen_ctx_t *listener)
 
     ev_io_init(&server->recv_ctx->io, server_recv_cb, fd, EV_READ);
     ev_io_init(&server->send_ctx->io, server_send_cb, fd, EV_WRITE);
-    ev_timer_init(&server->recv_ctx->watcher, server_timeout_cb,
-                  request_timeout, listener->timeout);
+    wheel_timer_init(&server->recv_ctx->watcher, server_timeout_cb,
+                     request_timeout);
+    frame_init(&server->frame, frame_cb);
 
     cork_dllist_add(&connections, &server->entries);
 
@@ -1452,13 +1714,15 @@ static void
 close_and_free_server(EV_P_ server_t *server)
 {
     if (server != NULL) {
+        trace_end(EV_A_ & server->trace);
         if (server->query != NULL) {
             server->query->server = NULL;
             server->query         = NULL;
         }
         ev_io_stop(EV_A_ & server->send_ctx->io);
         ev_io_stop(EV_A_ & server->recv_ctx->io);
-        ev_timer_stop(EV_A_ & server->recv_ctx->watcher);
+        wheel_timer_stop(&server->recv_ctx->watcher);
+        frame_stop(EV_A_ & server->frame);
         close(server->fd);
         free_server(server);
         if (verbose) {
@@ -1474,6 +1738,15 @@ signal_cb(EV_P_ ev_signal *w, int revents)
     if (revents & EV_SIGNAL) {
         switch (w->signum) {
 #ifndef __MINGW32__
+        case SIGHUP:
+            if (acl) {
+                LOGI("reloading acl...");
+                reload_acl();
+            }
+            return;
+        case SIGUSR2:
+            trace_dump();
+            return;
         case SIGCHLD:
             if (!is_plugin_running()) {
                 LOGE("plugin service exit unexpectedly");
@@ -1487,6 +1760,8 @@ signal_cb(EV_P_ ev_signal *w, int revents)
             ev_signal_stop(EV_DEFAULT, &sigterm_watcher);
 #ifndef __MINGW32__
             ev_signal_stop(EV_DEFAULT, &sigchld_watcher);
+            ev_signal_stop(EV_DEFAULT, &sighup_watcher);
+            ev_signal_stop(EV_DEFAULT, &sigusr2_watcher);
 #else
             ev_io_stop(EV_DEFAULT, &plugin_watcher.io);
 #endif
@@ -1550,8 +1825,9 @@ accept_cb(EV_P_ ev_io *w, int revents)
     }
 
     server_t *server = new_server(serverfd, listener);
+    trace_start(EV_A_ & server->trace);
     ev_io_start(EV_A_ & server->recv_ctx->io);
-    ev_timer_start(EV_A_ & server->recv_ctx->watcher);
+    wheel_timer_start(EV_A_ & wheel, &server->recv_ctx->watcher);
 }
 
 int
@@ -1576,6 +1852,7 @@ main(int argc, char **argv)
     char *plugin_port = NULL;
     char tmp_port[8];
     char *nameservers = NULL;
+    char *trace_file  = NULL;
 
     int server_num = 0;
     ss_addr_t server_addr[MAX_REMOTE_NUM];
@@ -1594,6 +1871,8 @@ main(int argc, char **argv)
         { "plugin-opts",     required_argument, NULL, GETOPT_VAL_PLUGIN_OPTS },
         { "password",        required_argument, NULL, GETOPT_VAL_PASSWORD    },
         { "key",             required_argument, NULL, GETOPT_VAL_KEY         },
+        { "trace",           required_argument, NULL, GETOPT_VAL_TRACE       },
+        { "mux",             no_argument,       NULL, GETOPT_VAL_MUX         },
 #ifdef __linux__
         { "mptcp",           no_argument,       NULL, GETOPT_VAL_MPTCP       },
 #endif
@@ -1621,6 +1900,12 @@ main(int argc, char **argv)
         case GETOPT_VAL_MANAGER_ADDRESS:
             manager_addr = optarg;
             break;
+        case GETOPT_VAL_TRACE:
+            trace_file = optarg;
+            break;
+        case GETOPT_VAL_MUX:
+            mux = 1;
+            break;
         case GETOPT_VAL_MTU:
             mtu = atoi(optarg);
             LOGI("set MTU to %d", mtu);
@@ -1771,6 +2056,9 @@ main(int argc, char **argv)
         if (fast_open == 0) {
             fast_open = conf->fast_open;
         }
+        if (mux == 0) {
+            mux = conf->mux > 0;
+        }
         if (is_bind_local_addr == 0) {
             if (parse_local_addr(&local_addr_v4, &local_addr_v6, conf->local_addr) == 0)
                 is_bind_local_addr = 1;
@@ -1794,6 +2082,14 @@ main(int argc, char **argv)
             LOGI("initializing acl...");
             acl = !init_acl(conf->acl);
         }
+        if (trace_file == NULL) {
+            trace_file = conf->trace;
+        }
+    }
+
+    if (trace_file != NULL) {
+        LOGI("tracing connections to %s", trace_file);
+        trace_init(trace_file);
     }
 
     if (server_num == 0) {
@@ -1891,6 +2187,10 @@ main(int argc, char **argv)
         LOGI("enable TCP no-delay");
     }
 
+    if (mux) {
+        LOGI("accept multiplexed connections");
+    }
+
 #ifndef __MINGW32__
     // ignore SIGPIPE
     signal(SIGPIPE, SIG_IGN);
@@ -1904,6 +2204,10 @@ main(int argc, char **argv)
 #ifndef __MINGW32__
     ev_signal_init(&sigchld_watcher, signal_cb, SIGCHLD);
     ev_signal_start(EV_DEFAULT, &sigchld_watcher);
+    ev_signal_init(&sighup_watcher, signal_cb, SIGHUP);
+    ev_signal_start(EV_DEFAULT, &sighup_watcher);
+    ev_signal_init(&sigusr2_watcher, signal_cb, SIGUSR2);
+    ev_signal_start(EV_DEFAULT, &sigusr2_watcher);
 #endif
 
     // setup keys
@@ -2076,6 +2380,7 @@ main(int argc, char **argv)
 
     // Init connections
     cork_dllist_init(&connections);
+    wheel_init(EV_A_ & wheel);
 
     // start ev loop
     ev_run(loop, 0);
@@ -2084,6 +2389,9 @@ main(int argc, char **argv)
         LOGI("closed gracefully");
     }
 
+    wheel_stop(EV_A_ & wheel);
+    trace_dump();
+
 #ifndef __MINGW32__
     if (manager_addr != NULL) {
         ev_timer_stop(EV_DEFAULT, &stat_update_watcher);
@@ -40,6 +40,10 @@
 #include "jconf.h"
 #include "resolv.h"
 #include "netutils.h"
+#include "mux.h"
+#include "wheel.h"
+#include "frame.h"
+#include "trace.h"
 
 #include "common.h"
 
@@ -53,7 +57,7 @@ typedef struct listen_ctx {
 
 typedef struct server_ctx {
     ev_io io;
-    ev_timer watcher;
+    wheel_timer_t watcher;
     int connected;
     struct server *server;
 } server_ctx_t;
@@ -90,6 +94,9 @@ typedef struct server {
 
     struct query *query;
 
+    frame_t frame;
+    trace_t trace;
+
     struct cork_dllist_item entries;
 #ifdef USE_NFCONNTRACK_TOS
     struct dscptracker *tracker;
@@ -101,6 +108,12 @@ typedef struct query {
     char hostname[MAX_HOSTNAME_LEN];
 } query_t;
 
+typedef struct mux_query {
+    mux_stream_t *stream;
+    listen_ctx_t *listen_ctx;
+    char hostname[MAX_HOSTNAME_LEN];
+} mux_query_t;
+
 typedef struct remote_ctx {
     ev_io io;
     int connected;
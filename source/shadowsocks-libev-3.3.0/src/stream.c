@@ -378,8 +378,15 @@ stream_encrypt_all(buffer_t *plaintext, cipher_t *cipher, size_t capacity)
     return CRYPTO_OK;
 }
 
+/*
+ * The salsa20 family keeps its keystream position in the counter, so the
+ * whole batch is gathered behind the partial block it resumes and xored
+ * in a single pass. mbed TLS keeps its own position and simply takes one
+ * update per iovec.
+ */
 int
-stream_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
+stream_encrypt_batch(buffer_t *out, const struct iovec *iov, int iovcnt,
+                     cipher_ctx_t *cipher_ctx, size_t capacity)
 {
     if (cipher_ctx == NULL)
         return CRYPTO_ERROR;
@@ -388,15 +395,19 @@ stream_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
 
     static buffer_t tmp = { 0, 0, 0, NULL };
 
-    int err          = CRYPTO_OK;
     size_t nonce_len = 0;
+    size_t len       = iov_length(iov, iovcnt);
+    size_t padding   = 0;
     if (!cipher_ctx->init) {
         nonce_len = cipher_ctx->cipher->nonce_len;
     }
+    if (cipher->method >= SALSA20) {
+        padding = cipher_ctx->counter % SODIUM_BLOCK_SIZE;
+    }
 
-    brealloc(&tmp, nonce_len + plaintext->len, capacity);
+    brealloc(&tmp, nonce_len + padding + len, capacity);
     buffer_t *ciphertext = &tmp;
-    ciphertext->len = plaintext->len;
+    ciphertext->len = nonce_len + len;
 
     if (!cipher_ctx->init) {
         cipher_ctx_set_nonce(cipher_ctx, cipher_ctx->nonce, nonce_len, 1);
@@ -409,47 +420,54 @@ stream_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
 #endif
     }
 
+    uint8_t *c = (uint8_t *)ciphertext->data + nonce_len;
     if (cipher->method >= SALSA20) {
-        int padding = cipher_ctx->counter % SODIUM_BLOCK_SIZE;
-        brealloc(ciphertext, nonce_len + (padding + ciphertext->len) * 2, capacity);
-        if (padding) {
-            brealloc(plaintext, plaintext->len + padding, capacity);
-            memmove(plaintext->data + padding, plaintext->data, plaintext->len);
-            sodium_memzero(plaintext->data, padding);
+        size_t off = padding;
+        sodium_memzero(c, padding);
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(c + off, iov[i].iov_base, iov[i].iov_len);
+            off += iov[i].iov_len;
         }
-        crypto_stream_xor_ic((uint8_t *)(ciphertext->data + nonce_len),
-                             (const uint8_t *)plaintext->data,
-                             (uint64_t)(plaintext->len + padding),
+        crypto_stream_xor_ic(c, c, (uint64_t)(len + padding),
                              (const uint8_t *)cipher_ctx->nonce,
                              cipher_ctx->counter / SODIUM_BLOCK_SIZE, cipher->key,
                              cipher->method);
-        cipher_ctx->counter += plaintext->len;
+        cipher_ctx->counter += len;
         if (padding) {
-            memmove(ciphertext->data + nonce_len,
-                    ciphertext->data + nonce_len + padding, ciphertext->len);
+            memmove(c, c + padding, len);
         }
     } else {
-        err = cipher_ctx_update(cipher_ctx,
-                                (uint8_t *)(ciphertext->data + nonce_len),
-                                &ciphertext->len, (const uint8_t *)plaintext->data,
-                                plaintext->len);
-        if (err) {
-            return CRYPTO_ERROR;
+        size_t off = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            size_t olen = 0;
+            int err     = cipher_ctx_update(cipher_ctx, c + off, &olen,
+                                            (const uint8_t *)iov[i].iov_base,
+                                            iov[i].iov_len);
+            if (err) {
+                return CRYPTO_ERROR;
+            }
+            off += olen;
         }
     }
 
 #ifdef SS_DEBUG
-    dump("PLAIN", plaintext->data, plaintext->len);
-    dump("CIPHER", ciphertext->data + nonce_len, ciphertext->len);
+    dump("CIPHER", (char *)c, len);
 #endif
 
-    brealloc(plaintext, nonce_len + ciphertext->len, capacity);
-    memcpy(plaintext->data, ciphertext->data, nonce_len + ciphertext->len);
-    plaintext->len = nonce_len + ciphertext->len;
+    brealloc(out, ciphertext->len, capacity);
+    memcpy(out->data, ciphertext->data, ciphertext->len);
+    out->len = ciphertext->len;
 
     return CRYPTO_OK;
 }
 
+int
+stream_encrypt(buffer_t *plaintext, cipher_ctx_t *cipher_ctx, size_t capacity)
+{
+    struct iovec iov = { plaintext->data, plaintext->len };
+    return stream_encrypt_batch(plaintext, &iov, 1, cipher_ctx, capacity);
+}
+
 int
 stream_decrypt_all(buffer_t *ciphertext, cipher_t *cipher, size_t capacity)
 {
@@ -510,7 +528,8 @@ stream_decrypt_all(buffer_t *ciphertext, cipher_t *cipher, size_t capacity)
 }
 
 int
-stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
+stream_decrypt_batch(buffer_t *out, const struct iovec *iov, int iovcnt,
+                     cipher_ctx_t *cipher_ctx, size_t capacity)
 {
     if (cipher_ctx == NULL)
         return CRYPTO_ERROR;
@@ -519,11 +538,9 @@ stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
 
     static buffer_t tmp = { 0, 0, 0, NULL };
 
-    int err = CRYPTO_OK;
-
-    brealloc(&tmp, ciphertext->len, capacity);
-    buffer_t *plaintext = &tmp;
-    plaintext->len = ciphertext->len;
+    size_t len  = iov_length(iov, iovcnt);
+    size_t skip = 0; // bytes of iov[i] taken by the nonce
+    int i       = 0;
 
     if (!cipher_ctx->init) {
         if (cipher_ctx->chunk == NULL) {
@@ -532,15 +549,18 @@ stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
             balloc(cipher_ctx->chunk, cipher->nonce_len);
         }
 
-        size_t left_len = min(cipher->nonce_len - cipher_ctx->chunk->len,
-                              ciphertext->len);
-
-        if (left_len > 0) {
-            memcpy(cipher_ctx->chunk->data + cipher_ctx->chunk->len, ciphertext->data, left_len);
-            memmove(ciphertext->data, ciphertext->data + left_len,
-                    ciphertext->len - left_len);
+        while (cipher_ctx->chunk->len < cipher->nonce_len && i < iovcnt) {
+            size_t left_len = min(cipher->nonce_len - cipher_ctx->chunk->len,
+                                  iov[i].iov_len - skip);
+            memcpy(cipher_ctx->chunk->data + cipher_ctx->chunk->len,
+                   (uint8_t *)iov[i].iov_base + skip, left_len);
             cipher_ctx->chunk->len += left_len;
-            ciphertext->len        -= left_len;
+            len                    -= left_len;
+            skip                   += left_len;
+            if (skip == iov[i].iov_len) {
+                skip = 0;
+                i++;
+            }
         }
 
         if (cipher_ctx->chunk->len < cipher->nonce_len)
@@ -548,7 +568,6 @@ stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
 
         uint8_t *nonce   = cipher_ctx->nonce;
         size_t nonce_len = cipher->nonce_len;
-        plaintext->len -= left_len;
 
         memcpy(nonce, cipher_ctx->chunk->data, nonce_len);
         cipher_ctx_set_nonce(cipher_ctx, nonce, nonce_len, 0);
@@ -563,41 +582,53 @@ stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
         }
     }
 
-    if (ciphertext->len <= 0)
+    if (len == 0)
         return CRYPTO_NEED_MORE;
 
+    size_t padding = 0;
     if (cipher->method >= SALSA20) {
-        int padding = cipher_ctx->counter % SODIUM_BLOCK_SIZE;
-        brealloc(plaintext, (plaintext->len + padding) * 2, capacity);
+        padding = cipher_ctx->counter % SODIUM_BLOCK_SIZE;
+    }
 
-        if (padding) {
-            brealloc(ciphertext, ciphertext->len + padding, capacity);
-            memmove(ciphertext->data + padding, ciphertext->data,
-                    ciphertext->len);
-            sodium_memzero(ciphertext->data, padding);
+    brealloc(&tmp, padding + len, capacity);
+    buffer_t *plaintext = &tmp;
+    plaintext->len = len;
+
+    uint8_t *p = (uint8_t *)plaintext->data;
+    if (cipher->method >= SALSA20) {
+        size_t off = padding;
+        sodium_memzero(p, padding);
+        for (; i < iovcnt; i++) {
+            memcpy(p + off, (uint8_t *)iov[i].iov_base + skip,
+                   iov[i].iov_len - skip);
+            off += iov[i].iov_len - skip;
+            skip = 0;
         }
-        crypto_stream_xor_ic((uint8_t *)plaintext->data,
-                             (const uint8_t *)(ciphertext->data),
-                             (uint64_t)(ciphertext->len + padding),
+        crypto_stream_xor_ic(p, p, (uint64_t)(len + padding),
                              (const uint8_t *)cipher_ctx->nonce,
                              cipher_ctx->counter / SODIUM_BLOCK_SIZE, cipher->key,
                              cipher->method);
-        cipher_ctx->counter += ciphertext->len;
+        cipher_ctx->counter += len;
         if (padding) {
-            memmove(plaintext->data, plaintext->data + padding, plaintext->len);
+            memmove(p, p + padding, len);
         }
     } else {
-        err = cipher_ctx_update(cipher_ctx, (uint8_t *)plaintext->data, &plaintext->len,
-                                (const uint8_t *)(ciphertext->data),
-                                ciphertext->len);
+        size_t off = 0;
+        for (; i < iovcnt; i++) {
+            size_t olen = 0;
+            int err     = cipher_ctx_update(cipher_ctx, p + off, &olen,
+                                            (const uint8_t *)iov[i].iov_base + skip,
+                                            iov[i].iov_len - skip);
+            if (err) {
+                return CRYPTO_ERROR;
+            }
+            off += olen;
+            skip = 0;
+        }
     }
 
-    if (err)
-        return CRYPTO_ERROR;
-
 #ifdef SS_DEBUG
     dump("PLAIN", plaintext->data, plaintext->len);
-    dump("CIPHER", ciphertext->data, ciphertext->len);
 #endif
 
     // Add to bloom filter
@@ -612,13 +643,20 @@ stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
         }
     }
 
-    brealloc(ciphertext, plaintext->len, capacity);
-    memcpy(ciphertext->data, plaintext->data, plaintext->len);
-    ciphertext->len = plaintext->len;
+    brealloc(out, plaintext->len, capacity);
+    memcpy(out->data, plaintext->data, plaintext->len);
+    out->len = plaintext->len;
 
     return CRYPTO_OK;
 }
 
+int
+stream_decrypt(buffer_t *ciphertext, cipher_ctx_t *cipher_ctx, size_t capacity)
+{
+    struct iovec iov = { ciphertext->data, ciphertext->len };
+    return stream_decrypt_batch(ciphertext, &iov, 1, cipher_ctx, capacity);
+}
+
 void
 stream_ctx_init(cipher_t *cipher, cipher_ctx_t *cipher_ctx, int enc)
 {
@@ -695,3 +733,19 @@ stream_init(const char *pass, const char *key, const char *method)
     }
     return stream_key_init(m, pass, key);
 }
+
+const cipher_engine_t stream_engine = {
+    .methods    = supported_stream_ciphers,
+    .method_num = STREAM_CIPHER_NUM,
+    .init       = &stream_init,
+    .ops        = {
+        .encrypt_all   = &stream_encrypt_all,
+        .decrypt_all   = &stream_decrypt_all,
+        .encrypt       = &stream_encrypt,
+        .decrypt       = &stream_decrypt,
+        .encrypt_batch = &stream_encrypt_batch,
+        .decrypt_batch = &stream_decrypt_batch,
+        .ctx_init      = &stream_ctx_init,
+        .ctx_release   = &stream_ctx_release,
+    },
+};
@@ -45,10 +45,16 @@ int stream_encrypt_all(buffer_t *, cipher_t *, size_t);
 int stream_decrypt_all(buffer_t *, cipher_t *, size_t);
 int stream_encrypt(buffer_t *, cipher_ctx_t *, size_t);
 int stream_decrypt(buffer_t *, cipher_ctx_t *, size_t);
+int stream_encrypt_batch(buffer_t *, const struct iovec *, int,
+                         cipher_ctx_t *, size_t);
+int stream_decrypt_batch(buffer_t *, const struct iovec *, int,
+                         cipher_ctx_t *, size_t);
 
 void stream_ctx_init(cipher_t *, cipher_ctx_t *, int);
 void stream_ctx_release(cipher_ctx_t *);
 
 cipher_t *stream_init(const char *pass, const char *key, const char *method);
 
+extern const cipher_engine_t stream_engine;
+
 #endif // _STREAM_H
@@ -55,12 +55,15 @@
 extern int verbose;
 
 static int parse_tls_header(const char *, size_t, char **);
+static int sniff_tls_header(sniff_t *, const char *, size_t, char **);
+static int parse_client_hello(const char *, size_t, char **);
 static int parse_extensions(const char *, size_t, char **);
 static int parse_server_name_extension(const char *, size_t, char **);
 
 static const protocol_t tls_protocol_st = {
     .default_port =               443,
     .parse_packet = &parse_tls_header,
+    .sniff        = &sniff_tls_header,
 };
 const protocol_t *const tls_protocol = &tls_protocol_st;
 
@@ -79,70 +82,135 @@ const protocol_t *const tls_protocol = &tls_protocol_st;
  */
 static int
 parse_tls_header(const char *data, size_t data_len, char **hostname)
+{
+    sniff_t st = { 0 };
+
+    return sniff_tls_header(&st, data, data_len, hostname);
+}
+
+/*
+ * Copy the first len bytes of the handshake carried by the records at
+ * the start of data. The records have been checked by the caller.
+ */
+static void
+gather_handshake(const char *data, char *out, size_t len)
+{
+    size_t pos = 0, n;
+
+    while (len > 0) {
+        n = ((unsigned char)data[pos + 3] << 8) +
+            (unsigned char)data[pos + 4];
+        n = MIN(n, len);
+        memcpy(out, data + pos + TLS_HEADER_LEN, n);
+        out += n;
+        len -= n;
+        pos += TLS_HEADER_LEN + n;
+    }
+}
+
+/*
+ * Same as parse_tls_header(), but a client hello may span several
+ * records, and the records already counted by an earlier call are
+ * not walked again.
+ */
+static int
+sniff_tls_header(sniff_t *st, const char *data, size_t data_len,
+                 char **hostname)
 {
     char tls_content_type;
     char tls_version_major;
     char tls_version_minor;
-    size_t pos = TLS_HEADER_LEN;
+    unsigned char hs[4];
     size_t len;
 
     if (hostname == NULL)
         return -3;
 
-    /* Check that our TCP payload is at least large enough for a TLS header */
-    if (data_len < TLS_HEADER_LEN)
-        return -1;
+    while (st->need == 0 || st->have < st->need) {
+        const char *record = data + st->offset;
+
+        /* Check that our TCP payload is at least large enough for a TLS header */
+        if (data_len < st->offset + TLS_HEADER_LEN)
+            return -1;
+
+        if (st->count == 0) {
+            /* SSL 2.0 compatible Client Hello
+             *
+             * High bit of first byte (length) and content type is Client Hello
+             *
+             * See RFC5246 Appendix E.2
+             */
+            if (record[0] & 0x80 && record[2] == 1) {
+                if (verbose)
+                    LOGI("Received SSL 2.0 Client Hello which can not support SNI.");
+                return -2;
+            }
 
-    /* SSL 2.0 compatible Client Hello
-     *
-     * High bit of first byte (length) and content type is Client Hello
-     *
-     * See RFC5246 Appendix E.2
-     */
-    if (data[0] & 0x80 && data[2] == 1) {
-        if (verbose)
-            LOGI("Received SSL 2.0 Client Hello which can not support SNI.");
-        return -2;
-    }
+            tls_version_major = record[1];
+            tls_version_minor = record[2];
+            if (record[0] == TLS_HANDSHAKE_CONTENT_TYPE && tls_version_major < 3) {
+                if (verbose)
+                    LOGI("Received SSL %d.%d handshake which can not support SNI.",
+                         tls_version_major, tls_version_minor);
 
-    tls_content_type = data[0];
-    if (tls_content_type != TLS_HANDSHAKE_CONTENT_TYPE) {
-        if (verbose)
-            LOGI("Request did not begin with TLS handshake.");
-        return -5;
-    }
+                return -2;
+            }
+        }
 
-    tls_version_major = data[1];
-    tls_version_minor = data[2];
-    if (tls_version_major < 3) {
-        if (verbose)
-            LOGI("Received SSL %d.%d handshake which can not support SNI.",
-                 tls_version_major, tls_version_minor);
+        tls_content_type = record[0];
+        if (tls_content_type != TLS_HANDSHAKE_CONTENT_TYPE) {
+            if (verbose)
+                LOGI("Request did not begin with TLS handshake.");
+            return -5;
+        }
 
-        return -2;
-    }
+        /* TLS record length */
+        len = ((unsigned char)record[3] << 8) + (unsigned char)record[4];
+        if (len == 0)
+            return -5;
 
-    /* TLS record length */
-    len = ((unsigned char)data[3] << 8) +
-          (unsigned char)data[4] + TLS_HEADER_LEN;
-    data_len = MIN(data_len, len);
+        /* Check we received entire TLS record length */
+        if (data_len < st->offset + TLS_HEADER_LEN + len)
+            return -1;
 
-    /* Check we received entire TLS record length */
-    if (data_len < len)
-        return -1;
+        st->offset += TLS_HEADER_LEN + len;
+        st->have   += len;
+        st->count++;
 
-    /*
-     * Handshake
-     */
-    if (pos + 1 > data_len) {
-        return -5;
+        /* Handshake type and length, which may straddle two records */
+        if (st->need == 0 && st->have >= sizeof(hs)) {
+            gather_handshake(data, (char *)hs, sizeof(hs));
+            if (hs[0] != TLS_HANDSHAKE_TYPE_CLIENT_HELLO) {
+                if (verbose)
+                    LOGI("Not a client hello");
+
+                return -5;
+            }
+            st->need = sizeof(hs) + ((size_t)hs[1] << 16) + (hs[2] << 8) + hs[3];
+        }
     }
-    if (data[pos] != TLS_HANDSHAKE_TYPE_CLIENT_HELLO) {
-        if (verbose)
-            LOGI("Not a client hello");
 
-        return -5;
+    if (st->count == 1)
+        return parse_client_hello(data + TLS_HEADER_LEN, st->need, hostname);
+
+    /* Only a client hello in several records needs to be reassembled */
+    char *hello = malloc(st->need);
+    if (hello == NULL) {
+        ERROR("malloc() failure");
+        return -4;
     }
+    gather_handshake(data, hello, st->need);
+    int ret = parse_client_hello(hello, st->need, hostname);
+    free(hello);
+
+    return ret;
+}
+
+static int
+parse_client_hello(const char *data, size_t data_len, char **hostname)
+{
+    size_t pos = 0;
+    size_t len;
 
     /* Skip past fixed length records:
      * 1	Handshake Type
@@ -171,9 +239,9 @@ parse_tls_header(const char *data, size_t data_len, char **hostname)
     len  = (unsigned char)data[pos];
     pos += 1 + len;
 
-    if (pos == data_len && tls_version_major == 3 && tls_version_minor == 0) {
+    if (pos == data_len) {
         if (verbose)
-            LOGI("Received SSL 3.0 handshake without extensions");
+            LOGI("Received client hello without extensions");
         return -2;
     }
 
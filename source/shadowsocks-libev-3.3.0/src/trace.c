@@ -0,0 +1,225 @@
+/*
+ * trace.c - Per-connection latency and throughput tracing
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "utils.h"
+#include "trace.h"
+
+/*
+ * Finished connections go into a fixed ring of records, overwriting the
+ * oldest, and into log2 histograms: bucket 0 counts zeros, bucket i the
+ * values in [2^(i-1), 2^i). Latencies are in microseconds. Everything
+ * runs on the event loop thread, so nothing here needs a lock.
+ */
+
+#define HIST_DNS     0
+#define HIST_CONNECT 1
+#define HIST_TTFB    2
+#define HIST_CRYPTO  3
+#define HIST_BYTES   4
+#define HIST_NUM     5
+
+typedef struct trace_record {
+    ev_tstamp start;
+    int64_t dns;            /* -1 if the phase was never reached */
+    int64_t connect;
+    int64_t ttfb;
+    int64_t crypto;
+    int64_t duration;
+    uint64_t tx;
+    uint64_t rx;
+} trace_record_t;
+
+typedef struct trace_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t bucket[TRACE_BUCKETS];
+} trace_hist_t;
+
+int trace_enabled = 0;
+
+static char *trace_path;
+static uint64_t flows;
+static trace_record_t ring[TRACE_RING_SIZE];
+static trace_hist_t hists[HIST_NUM];
+static const char *hist_names[HIST_NUM] = {
+    "dns", "connect", "ttfb", "crypto", "bytes"
+};
+
+static int64_t
+elapsed(ev_tstamp from, ev_tstamp to)
+{
+    if (from == 0 || to == 0) {
+        return -1;
+    }
+    return to > from ? (int64_t)((to - from) * 1e6) : 0;
+}
+
+static void
+hist_add(trace_hist_t *hist, int64_t value)
+{
+    int i = 0;
+
+    if (value < 0) {
+        return;
+    }
+
+    for (uint64_t v = value; v != 0 && i < TRACE_BUCKETS - 1; v >>= 1)
+        i++;
+
+    hist->count++;
+    hist->sum += value;
+    hist->bucket[i]++;
+}
+
+void
+trace_init(const char *path)
+{
+    trace_enabled = 1;
+    trace_path    = path != NULL ? strdup(path) : NULL;
+}
+
+void
+trace_end(EV_P_ trace_t *trace)
+{
+    if (!trace_enabled || trace->start == 0) {
+        return;
+    }
+
+    trace_record_t *rec = &ring[flows++ % TRACE_RING_SIZE];
+
+    rec->start    = trace->start;
+    rec->dns      = elapsed(trace->resolving, trace->resolved);
+    rec->connect  = elapsed(trace->connecting, trace->connected);
+    rec->ttfb     = elapsed(trace->start, trace->first_byte);
+    rec->crypto   = (int64_t)(trace->crypto * 1e6);
+    rec->duration = elapsed(trace->start, ev_now(EV_A));
+    rec->tx       = trace->tx;
+    rec->rx       = trace->rx;
+
+    hist_add(&hists[HIST_DNS], rec->dns);
+    hist_add(&hists[HIST_CONNECT], rec->connect);
+    hist_add(&hists[HIST_TTFB], rec->ttfb);
+    hist_add(&hists[HIST_CRYPTO], rec->crypto);
+    hist_add(&hists[HIST_BYTES], rec->tx + rec->rx);
+
+    trace->start = 0;
+}
+
+/*
+ * Rewrites the dump file with the histograms followed by the most recent
+ * connections, oldest first.
+ */
+int
+trace_dump(void)
+{
+    if (!trace_enabled || trace_path == NULL) {
+        return -1;
+    }
+
+    FILE *f = fopen(trace_path, "w");
+    if (f == NULL) {
+        ERROR("trace_dump");
+        return -1;
+    }
+
+    fprintf(f, "# flows %" PRIu64 "\n", flows);
+    fprintf(f, "# hist <name> <count> <sum> <buckets...>\n");
+    for (int i = 0; i < HIST_NUM; i++) {
+        fprintf(f, "hist %s %" PRIu64 " %" PRIu64, hist_names[i],
+                hists[i].count, hists[i].sum);
+        for (int j = 0; j < TRACE_BUCKETS; j++)
+            fprintf(f, " %" PRIu64, hists[i].bucket[j]);
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "# flow <start> <dns> <connect> <ttfb> <crypto> <duration> <tx> <rx>\n");
+    uint64_t first = flows > TRACE_RING_SIZE ? flows - TRACE_RING_SIZE : 0;
+    for (uint64_t n = first; n < flows; n++) {
+        trace_record_t *rec = &ring[n % TRACE_RING_SIZE];
+        fprintf(f, "flow %.6f %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64
+                " %" PRId64 " %" PRIu64 " %" PRIu64 "\n",
+                rec->start, rec->dns, rec->connect, rec->ttfb, rec->crypto,
+                rec->duration, rec->tx, rec->rx);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Formats the histograms as a JSON object for the manager, with trailing
+ * empty buckets left out. Returns the length, or -1 if buf is too small.
+ */
+int
+trace_json(char *buf, size_t size)
+{
+    size_t pos = 0;
+    int n;
+
+    n = snprintf(buf, size, "{\"flows\":%" PRIu64, flows);
+    if (n < 0 || (size_t)n >= size) {
+        return -1;
+    }
+    pos += n;
+
+    for (int i = 0; i < HIST_NUM; i++) {
+        int last = TRACE_BUCKETS - 1;
+        while (last > 0 && hists[i].bucket[last] == 0)
+            last--;
+
+        n = snprintf(buf + pos, size - pos, ",\"%s\":[", hist_names[i]);
+        if (n < 0 || (size_t)n >= size - pos) {
+            return -1;
+        }
+        pos += n;
+
+        for (int j = 0; j <= last; j++) {
+            n = snprintf(buf + pos, size - pos, j ? ",%" PRIu64 : "%" PRIu64,
+                         hists[i].bucket[j]);
+            if (n < 0 || (size_t)n >= size - pos) {
+                return -1;
+            }
+            pos += n;
+        }
+
+        if (pos + 1 >= size) {
+            return -1;
+        }
+        buf[pos++] = ']';
+    }
+
+    if (pos + 1 >= size) {
+        return -1;
+    }
+    buf[pos++] = '}';
+    buf[pos]   = '\0';
+    return pos;
+}
@@ -0,0 +1,89 @@
+/*
+ * trace.h - Define the per-connection tracing facility
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef HAVE_LIBEV_EV_H
+#include <libev/ev.h>
+#else
+#include <ev.h>
+#endif
+
+#define TRACE_RING_SIZE 4096
+#define TRACE_BUCKETS   32
+
+/*
+ * Phase timestamps of one connection. Phases a connection never goes
+ * through stay at zero and are left out of the histograms. The byte
+ * counters are always kept, everything else only while tracing is on.
+ */
+typedef struct trace {
+    ev_tstamp start;
+    ev_tstamp resolving;
+    ev_tstamp resolved;
+    ev_tstamp connecting;
+    ev_tstamp connected;
+    ev_tstamp first_byte;
+    ev_tstamp crypto;       /* seconds spent in encrypt/decrypt */
+    uint64_t tx;            /* bytes from the client */
+    uint64_t rx;            /* bytes to the client */
+} trace_t;
+
+extern int trace_enabled;
+
+void trace_init(const char *path);
+void trace_end(EV_P_ trace_t *trace);
+int trace_dump(void);
+int trace_json(char *buf, size_t size);
+
+static inline void
+trace_start(EV_P_ trace_t *trace)
+{
+    if (trace_enabled)
+        trace->start = ev_now(EV_A);
+}
+
+static inline void
+trace_mark(EV_P_ ev_tstamp *phase)
+{
+    if (trace_enabled && *phase == 0)
+        *phase = ev_now(EV_A);
+}
+
+static inline ev_tstamp
+trace_clock(void)
+{
+    return trace_enabled ? ev_time() : 0;
+}
+
+static inline void
+trace_crypto(trace_t *trace, ev_tstamp since)
+{
+    if (trace_enabled)
+        trace->crypto += ev_time() - since;
+}
+
+#endif // _TRACE_H
@@ -50,7 +50,7 @@
 
 #include "utils.h"
 #include "netutils.h"
-#include "cache.h"
+#include "nat.h"
 #include "udprelay.h"
 #include "winsock.h"
 
@@ -60,6 +60,9 @@
 #define MAX_UDP_CONN_NUM 256
 #endif
 
+// Granularity of idle expiry of the UDP associations
+#define UDP_EXPIRE_INTERVAL 1.0
+
 #ifdef MODULE_REMOTE
 #ifdef MODULE_
 #error "MODULE_REMOTE and MODULE_LOCAL should not be both defined"
@@ -76,9 +79,8 @@
 
 static void server_recv_cb(EV_P_ ev_io *w, int revents);
 static void remote_recv_cb(EV_P_ ev_io *w, int revents);
-static void remote_timeout_cb(EV_P_ ev_timer *watcher, int revents);
+static void server_timeout_cb(EV_P_ ev_timer *watcher, int revents);
 
-static char *hash_key(const int af, const struct sockaddr_storage *addr);
 #ifdef MODULE_REMOTE
 static void resolv_free_cb(void *data);
 static void resolv_cb(struct sockaddr *addr, void *data);
@@ -188,20 +190,6 @@ get_dstaddr(struct msghdr *msg, struct sockaddr_storage *dstaddr)
 
 #endif
 
-#define HASH_KEY_LEN sizeof(struct sockaddr_storage) + sizeof(int)
-static char *
-hash_key(const int af, const struct sockaddr_storage *addr)
-{
-    size_t addr_len = sizeof(struct sockaddr_storage);
-    static char key[HASH_KEY_LEN];
-
-    memset(key, 0, HASH_KEY_LEN);
-    memcpy(key, &af, sizeof(int));
-    memcpy(key + sizeof(int), (const uint8_t *)addr, addr_len);
-
-    return key;
-}
-
 #if defined(MODULE_REDIR) || defined(MODULE_REMOTE)
 
 static int
@@ -539,8 +527,6 @@ new_remote(int fd, server_ctx_t *server_ctx)
     ctx->af         = AF_UNSPEC;
 
     ev_io_init(&ctx->io, remote_recv_cb, fd, EV_READ);
-    ev_timer_init(&ctx->watcher, remote_timeout_cb, server_ctx->timeout,
-                  server_ctx->timeout);
 
     return ctx;
 }
@@ -554,6 +540,8 @@ new_server_ctx(int fd)
     ctx->fd = fd;
 
     ev_io_init(&ctx->io, server_recv_cb, fd, EV_READ);
+    ev_timer_init(&ctx->watcher, server_timeout_cb,
+                  UDP_EXPIRE_INTERVAL, UDP_EXPIRE_INTERVAL);
 
     return ctx;
 }
@@ -589,7 +577,6 @@ void
 close_and_free_remote(EV_P_ remote_ctx_t *ctx)
 {
     if (ctx != NULL) {
-        ev_timer_stop(EV_A_ & ctx->watcher);
         ev_io_stop(EV_A_ & ctx->io);
         close(ctx->fd);
         ss_free(ctx);
@@ -597,17 +584,17 @@ close_and_free_remote(EV_P_ remote_ctx_t *ctx)
 }
 
 static void
-remote_timeout_cb(EV_P_ ev_timer *watcher, int revents)
+server_timeout_cb(EV_P_ ev_timer *watcher, int revents)
 {
-    remote_ctx_t *remote_ctx
-        = cork_container_of(watcher, remote_ctx_t, watcher);
+    server_ctx_t *server_ctx
+        = cork_container_of(watcher, server_ctx_t, watcher);
 
-    if (verbose) {
-        LOGI("[udp] connection timeout");
-    }
+    int n = nat_expire(server_ctx->conn_cache,
+                       ev_now(EV_A) - server_ctx->timeout);
 
-    char *key = hash_key(remote_ctx->af, &remote_ctx->src_addr);
-    cache_remove(remote_ctx->server_ctx->conn_cache, key, HASH_KEY_LEN);
+    if (verbose && n > 0) {
+        LOGI("[udp] %d connection(s) timeout", n);
+    }
 }
 
 #ifdef MODULE_REMOTE
@@ -636,8 +623,9 @@ resolv_cb(struct sockaddr *addr, void *data)
 
         // Lookup in the conn cache
         if (remote_ctx == NULL) {
-            char *key = hash_key(AF_UNSPEC, &query_ctx->src_addr);
-            cache_lookup(query_ctx->server_ctx->conn_cache, key, HASH_KEY_LEN, (void *)&remote_ctx);
+            nat_key_t key;
+            nat_key_init(&key, AF_UNSPEC, &query_ctx->src_addr);
+            remote_ctx = nat_lookup(query_ctx->server_ctx->conn_cache, &key, ev_now(EV_A));
         }
 
         if (remote_ctx == NULL) {
@@ -690,10 +678,10 @@ resolv_cb(struct sockaddr *addr, void *data)
             } else {
                 if (!cache_hit) {
                     // Add to conn cache
-                    char *key = hash_key(AF_UNSPEC, &remote_ctx->src_addr);
-                    cache_insert(query_ctx->server_ctx->conn_cache, key, HASH_KEY_LEN, (void *)remote_ctx);
+                    nat_key_init(&remote_ctx->key, AF_UNSPEC, &remote_ctx->src_addr);
+                    nat_insert(query_ctx->server_ctx->conn_cache, &remote_ctx->key,
+                               remote_ctx, ev_now(EV_A));
                     ev_io_start(EV_A_ & remote_ctx->io);
-                    ev_timer_start(EV_A_ & remote_ctx->watcher);
                 }
             }
         }
@@ -871,8 +859,8 @@ remote_recv_cb(EV_P_ ev_io *w, int revents)
 #endif
 
     // handle the UDP packet successfully,
-    // triger the timer
-    ev_timer_again(EV_A_ & remote_ctx->watcher);
+    // mark the association as active
+    nat_lookup(server_ctx->conn_cache, &remote_ctx->key, ev_now(EV_A));
 
 CLEAN_UP:
 
@@ -1097,27 +1085,17 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
 
 #endif
 
+    nat_key_t key;
 #ifdef MODULE_LOCAL
-    char *key = hash_key(server_ctx->remote_addr->sa_family, &src_addr);
+    nat_key_init(&key, server_ctx->remote_addr->sa_family, &src_addr);
 #else
-    char *key = hash_key(dst_addr.ss_family, &src_addr);
+    nat_key_init(&key, dst_addr.ss_family, &src_addr);
 #endif
 
-    struct cache *conn_cache = server_ctx->conn_cache;
-
-    remote_ctx_t *remote_ctx = NULL;
-    cache_lookup(conn_cache, key, HASH_KEY_LEN, (void *)&remote_ctx);
-
-    if (remote_ctx != NULL) {
-        if (sockaddr_cmp(&src_addr, &remote_ctx->src_addr, sizeof(src_addr))) {
-            remote_ctx = NULL;
-        }
-    }
+    struct nat_table *conn_cache = server_ctx->conn_cache;
 
-    // reset the timer
-    if (remote_ctx != NULL) {
-        ev_timer_again(EV_A_ & remote_ctx->watcher);
-    }
+    // Lookup also marks the association as active
+    remote_ctx_t *remote_ctx = nat_lookup(conn_cache, &key, ev_now(EV_A));
 
     if (remote_ctx == NULL) {
         if (verbose) {
@@ -1197,13 +1175,13 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
         remote_ctx           = new_remote(remotefd, server_ctx);
         remote_ctx->src_addr = src_addr;
         remote_ctx->af       = remote_addr->sa_family;
+        remote_ctx->key      = key;
 
         // Add to conn cache
-        cache_insert(conn_cache, key, HASH_KEY_LEN, (void *)remote_ctx);
+        nat_insert(conn_cache, &key, remote_ctx, ev_now(EV_A));
 
         // Start remote io
         ev_io_start(EV_A_ & remote_ctx->io);
-        ev_timer_start(EV_A_ & remote_ctx->watcher);
     }
 
     if (offset > 0) {
@@ -1297,12 +1275,11 @@ server_recv_cb(EV_P_ ev_io *w, int revents)
         } else {
             if (!cache_hit) {
                 // Add to conn cache
-                remote_ctx->af = dst_addr.ss_family;
-                char *key = hash_key(remote_ctx->af, &remote_ctx->src_addr);
-                cache_insert(server_ctx->conn_cache, key, HASH_KEY_LEN, (void *)remote_ctx);
+                remote_ctx->af  = dst_addr.ss_family;
+                remote_ctx->key = key;
+                nat_insert(conn_cache, &key, remote_ctx, ev_now(EV_A));
 
                 ev_io_start(EV_A_ & remote_ctx->io);
-                ev_timer_start(EV_A_ & remote_ctx->watcher);
             }
         }
     } else {
@@ -1333,7 +1310,7 @@ CLEAN_UP:
 }
 
 void
-free_cb(void *key, void *element)
+free_cb(void *element)
 {
     remote_ctx_t *remote_ctx = (remote_ctx_t *)element;
 
@@ -1375,8 +1352,7 @@ init_udprelay(const char *server_host, const char *server_port,
     setnonblocking(serverfd);
 
     // Initialize cache
-    struct cache *conn_cache;
-    cache_create(&conn_cache, MAX_UDP_CONN_NUM, free_cb);
+    struct nat_table *conn_cache = nat_create(MAX_UDP_CONN_NUM, free_cb);
 
     server_ctx_t *server_ctx = new_server_ctx(serverfd);
 #ifdef MODULE_REMOTE
@@ -1395,6 +1371,7 @@ init_udprelay(const char *server_host, const char *server_port,
 #endif
 
     ev_io_start(loop, &server_ctx->io);
+    ev_timer_start(loop, &server_ctx->watcher);
 
     server_ctx_list[server_num++] = server_ctx;
 
@@ -1408,8 +1385,9 @@ free_udprelay()
     while (server_num > 0) {
         server_ctx_t *server_ctx = server_ctx_list[--server_num];
         ev_io_stop(loop, &server_ctx->io);
+        ev_timer_stop(loop, &server_ctx->watcher);
         close(server_ctx->fd);
-        cache_delete(server_ctx->conn_cache, 0);
+        nat_delete(server_ctx->conn_cache);
         ss_free(server_ctx);
         server_ctx_list[server_num] = NULL;
     }
@@ -38,7 +38,7 @@
 #include "resolv.h"
 #endif
 
-#include "cache.h"
+#include "nat.h"
 
 #include "common.h"
 
@@ -50,11 +50,12 @@
 
 typedef struct server_ctx {
     ev_io io;
+    ev_timer watcher;
     int fd;
     crypto_t *crypto;
     int timeout;
     const char *iface;
-    struct cache *conn_cache;
+    struct nat_table *conn_cache;
 #ifdef MODULE_LOCAL
     const struct sockaddr *remote_addr;
     int remote_addr_len;
@@ -80,9 +81,9 @@ typedef struct query_ctx {
 
 typedef struct remote_ctx {
     ev_io io;
-    ev_timer watcher;
     int af;
     int fd;
+    nat_key_t key;
     struct sockaddr_storage src_addr;
 #ifdef MODULE_REMOTE
     struct sockaddr_storage dst_addr;
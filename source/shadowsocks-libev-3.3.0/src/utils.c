@@ -406,8 +406,34 @@ usage()
 #ifndef MODULE_MANAGER
     printf(
         "       [--no-delay]               Enable TCP_NODELAY.\n");
+#ifdef MODULE_REDIR
+    printf(
+        "       [--warm-pool <number>]     Max number of connections to the server\n");
+    printf(
+        "                                  opened ahead of new flows.\n");
+#endif
+#if defined(MODULE_LOCAL) || defined(MODULE_REDIR)
+    printf(
+        "       [--mux <number>]           Multiplex connections over this many\n");
+    printf(
+        "                                  connections to the server.\n");
+#endif
+#ifdef MODULE_REMOTE
+    printf(
+        "       [--mux]                    Accept multiplexed connections.\n");
+#endif
     printf(
         "       [--key <key_in_base64>]    Key of your remote server.\n");
+#endif
+#if defined(MODULE_REMOTE) || defined(MODULE_LOCAL)
+    printf(
+        "       [--trace <file>]           Trace connection latencies, dumped to\n");
+    printf(
+        "                                  the file on SIGUSR2 and at exit.\n");
+#endif
+#ifdef MODULE_MANAGER
+    printf(
+        "       [--trace]                  Enable tracing in every ss-server.\n");
 #endif
     printf(
         "       [--plugin <name>]          Enable SIP003 plugin. (Experimental)\n");
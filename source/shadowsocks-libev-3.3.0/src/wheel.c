@@ -0,0 +1,178 @@
+/*
+ * wheel.c - Timer wheel used for connection timeouts
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <libcork/core.h>
+
+#include "wheel.h"
+
+#define WHEEL_L0_MASK (WHEEL_L0_SIZE - 1)
+#define WHEEL_L1_MASK (WHEEL_L1_SIZE - 1)
+
+static uint32_t
+wheel_deadline(wheel_t *wheel, wheel_timer_t *timer)
+{
+    double ticks = ceil((timer->last + timer->timeout - wheel->base) / WHEEL_TICK);
+    return ticks > 0 ? (uint32_t)ticks : 0;
+}
+
+static void
+wheel_file(wheel_t *wheel, wheel_timer_t *timer, uint32_t expires)
+{
+    uint32_t now = wheel->now;
+    struct cork_dllist *slot;
+
+    // anything already due goes into the next slot
+    if ((int32_t)(expires - now) <= 0)
+        expires = now + 1;
+    timer->expires = expires;
+
+    if (expires - now < WHEEL_L0_SIZE) {
+        slot = &wheel->slots[expires & WHEEL_L0_MASK];
+    } else {
+        uint32_t block = expires >> WHEEL_L0_BITS;
+        uint32_t first = now >> WHEEL_L0_BITS;
+        // beyond the second level, park in its last slot and look again
+        if (block - first >= WHEEL_L1_SIZE)
+            block = first + WHEEL_L1_SIZE - 1;
+        slot = &wheel->slots[WHEEL_L0_SIZE + (block & WHEEL_L1_MASK)];
+    }
+
+    cork_dllist_add(slot, &timer->entries);
+}
+
+static void
+wheel_tick(EV_P_ wheel_t *wheel)
+{
+    struct cork_dllist *slot;
+    struct cork_dllist_item *item;
+    uint32_t now = ++wheel->now;
+
+    if ((now & WHEEL_L0_MASK) == 0) {
+        slot = &wheel->slots[WHEEL_L0_SIZE + ((now >> WHEEL_L0_BITS) & WHEEL_L1_MASK)];
+        while ((item = cork_dllist_head(slot)) != NULL) {
+            wheel_timer_t *timer = cork_container_of(item, wheel_timer_t, entries);
+            cork_dllist_remove(item);
+            wheel_file(wheel, timer, timer->expires);
+        }
+    }
+
+    slot = &wheel->slots[now & WHEEL_L0_MASK];
+    while ((item = cork_dllist_head(slot)) != NULL) {
+        wheel_timer_t *timer = cork_container_of(item, wheel_timer_t, entries);
+        uint32_t deadline    = wheel_deadline(wheel, timer);
+
+        cork_dllist_remove(item);
+        if ((int32_t)(deadline - now) > 0) {
+            wheel_file(wheel, timer, deadline);
+        } else {
+            timer->active = 0;
+            timer->cb(EV_A_ timer);
+        }
+    }
+}
+
+static void
+wheel_cb(EV_P_ ev_timer *watcher, int revents)
+{
+    wheel_t *wheel = cork_container_of(watcher, wheel_t, watcher);
+    uint32_t now   = (uint32_t)((ev_now(EV_A) - wheel->base) / WHEEL_TICK);
+
+    // catch up on ticks missed while the loop was busy
+    while ((int32_t)(now - wheel->now) > 0)
+        wheel_tick(EV_A_ wheel);
+}
+
+void
+wheel_init(EV_P_ wheel_t *wheel)
+{
+    memset(wheel, 0, sizeof(wheel_t));
+    wheel->base = ev_now(EV_A);
+    for (uint32_t i = 0; i < WHEEL_L0_SIZE + WHEEL_L1_SIZE; i++)
+        cork_dllist_init(&wheel->slots[i]);
+
+    ev_timer_init(&wheel->watcher, wheel_cb, WHEEL_TICK, WHEEL_TICK);
+    ev_timer_start(EV_A_ & wheel->watcher);
+}
+
+void
+wheel_stop(EV_P_ wheel_t *wheel)
+{
+    ev_timer_stop(EV_A_ & wheel->watcher);
+}
+
+void
+wheel_timer_init(wheel_timer_t *timer,
+                 void (*cb)(EV_P_ wheel_timer_t *timer),
+                 ev_tstamp timeout)
+{
+    memset(timer, 0, sizeof(wheel_timer_t));
+    timer->cb      = cb;
+    timer->timeout = timeout;
+}
+
+void
+wheel_timer_start(EV_P_ wheel_t *wheel, wheel_timer_t *timer)
+{
+    wheel_timer_stop(timer);
+    timer->last   = ev_now(EV_A);
+    timer->active = 1;
+    wheel_file(wheel, timer, wheel_deadline(wheel, timer));
+}
+
+/*
+ * Restarts the timer with a new timeout. Only a deadline that moves
+ * earlier has to be filed again, a later one is found on expiry.
+ */
+void
+wheel_timer_again(EV_P_ wheel_t *wheel, wheel_timer_t *timer,
+                  ev_tstamp timeout)
+{
+    timer->last    = ev_now(EV_A);
+    timer->timeout = timeout;
+
+    if (!timer->active) {
+        wheel_timer_start(EV_A_ wheel, timer);
+        return;
+    }
+
+    uint32_t deadline = wheel_deadline(wheel, timer);
+    if ((int32_t)(deadline - timer->expires) < 0) {
+        cork_dllist_remove(&timer->entries);
+        wheel_file(wheel, timer, deadline);
+    }
+}
+
+void
+wheel_timer_stop(wheel_timer_t *timer)
+{
+    if (timer->active) {
+        cork_dllist_remove(&timer->entries);
+        timer->active = 0;
+    }
+}
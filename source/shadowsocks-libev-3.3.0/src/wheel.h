@@ -0,0 +1,87 @@
+/*
+ * wheel.h - Define the timer wheel used for connection timeouts
+ *
+ * Copyright (C) 2013 - 2019, Max Lv <max.c.lv@gmail.com>
+ *
+ * This file is part of the shadowsocks-libev.
+ *
+ * shadowsocks-libev is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * shadowsocks-libev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with shadowsocks-libev; see the file COPYING. If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WHEEL_H
+#define _WHEEL_H
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#elif HAVE_INTTYPES_H
+#include <inttypes.h>
+#endif
+
+#ifdef HAVE_LIBEV_EV_H
+#include <libev/ev.h>
+#else
+#include <ev.h>
+#endif
+
+#include <libcork/ds.h>
+
+#define WHEEL_TICK      1.0 /* seconds per slot */
+#define WHEEL_L0_BITS   8
+#define WHEEL_L1_BITS   6
+#define WHEEL_L0_SIZE   (1U << WHEEL_L0_BITS)
+#define WHEEL_L1_SIZE   (1U << WHEEL_L1_BITS)
+
+/*
+ * Two-level timer wheel: 256 one-second slots, then 64 slots of 256
+ * seconds that cascade into the first level as it wraps. Timers are
+ * filed under the deadline they had when started. Activity only records
+ * the time in last; a timer whose slot comes up is checked against it and
+ * filed again if it was touched meanwhile. Timers fire up to one tick
+ * late, never early.
+ */
+typedef struct wheel_timer {
+    struct cork_dllist_item entries;
+    ev_tstamp last;         /* last activity */
+    ev_tstamp timeout;
+    uint32_t expires;       /* tick the timer is filed under */
+    int active;
+    void (*cb)(EV_P_ struct wheel_timer *timer);
+} wheel_timer_t;
+
+typedef struct wheel {
+    ev_timer watcher;
+    ev_tstamp base;
+    uint32_t now;           /* last tick processed */
+    struct cork_dllist slots[WHEEL_L0_SIZE + WHEEL_L1_SIZE];
+} wheel_t;
+
+void wheel_init(EV_P_ wheel_t *wheel);
+void wheel_stop(EV_P_ wheel_t *wheel);
+
+void wheel_timer_init(wheel_timer_t *timer,
+                      void (*cb)(EV_P_ wheel_timer_t *timer),
+                      ev_tstamp timeout);
+void wheel_timer_start(EV_P_ wheel_t *wheel, wheel_timer_t *timer);
+void wheel_timer_again(EV_P_ wheel_t *wheel, wheel_timer_t *timer,
+                       ev_tstamp timeout);
+void wheel_timer_stop(wheel_timer_t *timer);
+
+static inline void
+wheel_timer_touch(EV_P_ wheel_timer_t *timer)
+{
+    timer->last = ev_now(EV_A);
+}
+
+#endif // _WHEEL_H